@@ -18,6 +18,8 @@
 #include <QStringList>
 #include <QUrl>
 #include <QFile>
+#include <QScopedPointer>
+#include <QRegExp>
 #include <qdebug.h>
 
 #include "account.h"
@@ -27,6 +29,9 @@
 #include "simplesslerrorhandler.h"
 #include "syncengine.h"
 #include "syncjournaldb.h"
+#include "synctrace.h"
+#include "syncmetrics.h"
+#include "filesystem.h"
 #include "config.h"
 
 #include "cmd.h"
@@ -34,6 +39,8 @@
 #include "theme.h"
 #include "netrcparser.h"
 
+#include "json.h"
+
 #include "version.h"
 #include "config.h"
 
@@ -45,20 +52,6 @@
 
 using namespace OCC;
 
-struct CmdOptions {
-    QString source_dir;
-    QString target_url;
-    QString config_directory;
-    QString user;
-    QString password;
-    QString proxy;
-    bool silent;
-    bool trustSSL;
-    bool useNetrc;
-    bool interactive;
-    QString exclude;
-    QString unsyncedfolders;
-};
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
 // So we have to use a global variable
@@ -98,6 +91,40 @@ private:
 #endif
 };
 
+MetricsDumper::MetricsDumper(const QString &fileName, int intervalSecs)
+    : QObject(), _fileName(fileName)
+{
+    connect(&_timer, SIGNAL(timeout()), SLOT(dump()));
+    _timer.start(qMax(1, intervalSecs) * 1000);
+}
+
+MetricsDumper::~MetricsDumper()
+{
+    dump();
+}
+
+void MetricsDumper::dump()
+{
+    QByteArray json = SyncMetrics::toJson();
+    if (_fileName == QLatin1String("-")) {
+        std::cout << json.constData() << std::endl;
+        return;
+    }
+
+    // Replace the file in one step, so that a scraper never sees half of it
+    QFile tmp(_fileName + QLatin1String(".tmp"));
+    if (!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Could not write metrics to" << tmp.fileName() << tmp.errorString();
+        return;
+    }
+    tmp.write(json + '\n');
+    tmp.close();
+    QString error;
+    if (!FileSystem::renameReplace(tmp.fileName(), _fileName, &error)) {
+        qDebug() << "Could not write metrics to" << _fileName << error;
+    }
+}
+
 QString queryPassword(const QString &user)
 {
     EchoDisabler disabler;
@@ -140,6 +167,7 @@ void help()
     std::cout << binaryName << " - command line " APPLICATION_NAME " client tool" << std::endl;
     std::cout << "" << std::endl;
     std::cout << "Usage: " << binaryName << " [OPTION] <source_dir> <server_url>" << std::endl;
+    std::cout << "       " << binaryName << " [OPTION] --manifest <file>" << std::endl;
     std::cout << "" << std::endl;
     std::cout << "A proxy can either be set manually using --httpproxy." << std::endl;
     std::cout << "Otherwise, the setting from a configured sync client will be used." << std::endl;
@@ -155,6 +183,21 @@ void help()
     std::cout << "  --password, -p [pass]  Use [pass] as password" << std::endl;
     std::cout << "  -n                     Use netrc (5) for login" << std::endl;
     std::cout << "  --non-interactive      Do not block execution with interaction" << std::endl;
+    std::cout << "  --trace                Write a Chrome trace of each sync run into" << std::endl;
+    std::cout << "                         <source_dir>/.swissdisksync.log.trace-*.json" << std::endl;
+    std::cout << "                         Not possible with more than one folder" << std::endl;
+    std::cout << "  --metrics [file]       Periodically write the sync metrics as JSON into [file]," << std::endl;
+    std::cout << "                         or to stdout for -" << std::endl;
+    std::cout << "  --metrics-interval [s] Write the metrics every [s] seconds (default 10)" << std::endl;
+    std::cout << "  --manifest [file]      Sync all folder pairs listed in [file], one" << std::endl;
+    std::cout << "                         \"<source_dir> <server_url>\" per line, concurrently." << std::endl;
+    std::cout << "                         All urls must be on the same server" << std::endl;
+    std::cout << "  --max-parallel [n]     Run at most [n] transfers at a time per folder" << std::endl;
+    std::cout << "  --max-discovery-parallel [n]" << std::endl;
+    std::cout << "                         Discover at most [n] folders at a time (default 1)" << std::endl;
+    std::cout << "  --dry-run              Only discover and reconcile, print what would be done" << std::endl;
+    std::cout << "  --stats-json [file]    Write per folder statistics as JSON into [file]," << std::endl;
+    std::cout << "                         or to stdout for -" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "" << std::endl;
     exit(1);
@@ -167,13 +210,32 @@ void showVersion() {
     exit(1);
 }
 
+QString normalizeTargetUrl(QString url)
+{
+    // check if the remote.php/webdav tail was added and append if not.
+    if(!url.endsWith("/")) {
+        url.append("/");
+    }
+    if (url.startsWith("http"))
+        url.replace(0, 4, "owncloud");
+    return url;
+}
+
 void parseOptions( const QStringList& app_args, CmdOptions *options )
 {
     QStringList args(app_args);
 
+    // With a manifest, the folder pairs are not given on the command line
+    int manifestIndex = args.indexOf("--manifest");
+    if (manifestIndex > 0 && manifestIndex + 1 < args.count()) {
+        options->manifest = args.at(manifestIndex + 1);
+        args.removeAt(manifestIndex + 1);
+        args.removeAt(manifestIndex);
+    }
+
     int argCount = args.count();
 
-    if( argCount < 3 ) {
+    if( options->manifest.isEmpty() && argCount < 3 ) {
         if (argCount >= 2) {
             const QString option = args.at(1);
             if (option == "-v" || option == "--version") {
@@ -183,17 +245,13 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
         help();
     }
 
-    options->target_url = args.takeLast();
-    // check if the remote.php/webdav tail was added and append if not.
-    if(!options->target_url.endsWith("/")) {
-        options->target_url.append("/");
-    }
-    if (options->target_url.startsWith("http"))
-        options->target_url.replace(0, 4, "owncloud");
-    options->source_dir = args.takeLast();
-    if( !QFile::exists( options->source_dir )) {
-        std::cerr << "Source dir '" << qPrintable(options->source_dir) << "' does not exist." << std::endl;
-        exit(1);
+    if (options->manifest.isEmpty()) {
+        options->target_url = normalizeTargetUrl(args.takeLast());
+        options->source_dir = args.takeLast();
+        if( !QFile::exists( options->source_dir )) {
+            std::cerr << "Source dir '" << qPrintable(options->source_dir) << "' does not exist." << std::endl;
+            exit(1);
+        }
     }
 
     QStringListIterator it(args);
@@ -213,6 +271,20 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
             options->useNetrc = true;
         } else if( option == "--non-interactive") {
             options->interactive = false;
+        } else if( option == "--trace") {
+            options->trace = true;
+        } else if( option == "--dry-run") {
+            options->dryRun = true;
+        } else if( option == "--metrics" && it.hasNext() && (it.peekNext() == "-" || !it.peekNext().startsWith("-")) ) {
+            options->metricsFile = it.next();
+        } else if( option == "--metrics-interval" && it.hasNext() && !it.peekNext().startsWith("-") ) {
+            options->metricsInterval = it.next().toInt();
+        } else if( option == "--stats-json" && it.hasNext() && (it.peekNext() == "-" || !it.peekNext().startsWith("-")) ) {
+            options->statsJson = it.next();
+        } else if( option == "--max-parallel" && it.hasNext() && !it.peekNext().startsWith("-") ) {
+            options->maxParallel = it.next().toInt();
+        } else if( option == "--max-discovery-parallel" && it.hasNext() && !it.peekNext().startsWith("-") ) {
+            options->maxDiscoveryParallel = it.next().toInt();
         } else if( (option == "-u" || option == "--user") && !it.peekNext().startsWith("-") ) {
                 options->user = it.next();
         } else if( (option == "-p" || option == "--password") && !it.peekNext().startsWith("-") ) {
@@ -226,7 +298,7 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
         }
     }
 
-    if( options->target_url.isEmpty() || options->source_dir.isEmpty() ) {
+    if( options->manifest.isEmpty() && (options->target_url.isEmpty() || options->source_dir.isEmpty()) ) {
         help();
     }
 }
@@ -280,6 +352,376 @@ void selectiveSyncFixup(OCC::SyncJournalDb *journal, const QStringList &newList)
 }
 
 
+static void loadSelectiveSyncList(const QString &fileName, QStringList *list)
+{
+    QFile f(fileName);
+    if (!f.open(QFile::ReadOnly)) {
+        qCritical() << "Could not open file containing the list of unsynced folders: " << fileName;
+        return;
+    }
+    *list = QString::fromUtf8(f.readAll()).split('\n');
+    for (int i = 0; i < list->count(); ++i) {
+        if (!list->at(i).endsWith(QLatin1Char('/'))) {
+            (*list)[i].append(QLatin1Char('/'));
+        }
+    }
+}
+
+static QString instructionName(csync_instructions_e instruction)
+{
+    switch (instruction) {
+    case CSYNC_INSTRUCTION_NONE: return QLatin1String("NONE");
+    case CSYNC_INSTRUCTION_EVAL: return QLatin1String("EVAL");
+    case CSYNC_INSTRUCTION_REMOVE: return QLatin1String("REMOVE");
+    case CSYNC_INSTRUCTION_RENAME: return QLatin1String("RENAME");
+    case CSYNC_INSTRUCTION_EVAL_RENAME: return QLatin1String("EVAL_RENAME");
+    case CSYNC_INSTRUCTION_NEW: return QLatin1String("NEW");
+    case CSYNC_INSTRUCTION_CONFLICT: return QLatin1String("CONFLICT");
+    case CSYNC_INSTRUCTION_IGNORE: return QLatin1String("IGNORE");
+    case CSYNC_INSTRUCTION_SYNC: return QLatin1String("SYNC");
+    case CSYNC_INSTRUCTION_STAT_ERROR: return QLatin1String("STAT_ERROR");
+    case CSYNC_INSTRUCTION_ERROR: return QLatin1String("ERROR");
+    }
+    return QLatin1String("UNKNOWN");
+}
+
+// Files that keep changing must not make the folder sync forever
+static const int maxRuns = 3;
+
+FolderSync::FolderSync(AccountPtr account, const QString &sourceDir, const QString &targetUrl,
+                       const CmdOptions &options, const QStringList &selectiveSyncList)
+    : QObject()
+    , _account(account)
+    , _sourceDir(sourceDir)
+    , _targetUrl(targetUrl)
+    , _options(options)
+    , _selectiveSyncList(selectiveSyncList)
+    , _csyncCtx(0)
+    , _discovering(false)
+    , _needsRestart(false)
+    , _runs(0)
+    , _msecs(0)
+    , _completedItems(0)
+{
+    // Find the folder, like the account url is found in main()
+    QStringList splitted = QUrl::fromUserInput(_targetUrl).path().split(_account->davPath());
+    _remoteFolder = splitted.value(1);
+}
+
+FolderSync::~FolderSync()
+{
+    _engine.reset();
+    _journal.reset();
+    if (_csyncCtx) {
+        csync_destroy(_csyncCtx);
+    }
+}
+
+bool FolderSync::createContext()
+{
+    if( csync_create( &_csyncCtx, _sourceDir.toUtf8(), _targetUrl.toUtf8().constData()) < 0 ) {
+        _errors.append(QLatin1String("Unable to create csync-context!"));
+        _csyncCtx = 0;
+        return false;
+    }
+
+    csync_set_log_level(_options.silent ? 1 : 11);
+
+    _account->credentials()->syncContextPreInit(_csyncCtx);
+
+    if( csync_init( _csyncCtx ) < 0 ) {
+        _errors.append(QLatin1String("Could not initialize csync!"));
+        return false;
+    }
+
+    csync_set_module_property(_csyncCtx, "csync_context", _csyncCtx);
+    if( !_options.proxy.isNull() ) {
+        QString host;
+        int port = 0;
+        bool ok;
+
+        // Set as default and let overwrite later
+        csync_set_module_property(_csyncCtx, "proxy_type", (void*) "NoProxy");
+
+        QStringList pList = _options.proxy.split(':');
+        if(pList.count() == 3) {
+            // http: //192.168.178.23 : 8080
+            //  0            1            2
+            host = pList.at(1);
+            if( host.startsWith("//") ) host.remove(0, 2);
+
+            port = pList.at(2).toInt(&ok);
+
+            if( !host.isNull() ) {
+                csync_set_module_property(_csyncCtx, "proxy_type", (void*) "HttpProxy");
+                csync_set_module_property(_csyncCtx, "proxy_host", host.toUtf8().data());
+                if( ok && port ) {
+                    csync_set_module_property(_csyncCtx, "proxy_port", (void*) &port);
+                }
+            }
+        }
+    } else {
+        _clientProxy.setupQtProxyFromConfig();
+        QString url( _targetUrl );
+        if( url.startsWith("owncloud")) {
+            url.remove(0, 8);
+            url = QString("http%1").arg(url);
+        }
+        _clientProxy.setCSyncProxy(QUrl(url), _csyncCtx);
+    }
+
+    // Exclude lists
+    QString systemExcludeListFn = ConfigFile::excludeFileFromSystem();
+    int loadedSystemExcludeList = false;
+    if (!systemExcludeListFn.isEmpty()) {
+        loadedSystemExcludeList = csync_add_exclude_list(_csyncCtx, systemExcludeListFn.toLocal8Bit());
+    }
+
+    int loadedUserExcludeList = false;
+    if (!_options.exclude.isEmpty()) {
+        loadedUserExcludeList = csync_add_exclude_list(_csyncCtx, _options.exclude.toLocal8Bit());
+    }
+
+    if (loadedSystemExcludeList != 0 && loadedUserExcludeList != 0) {
+        // Always make sure at least one list had been loaded
+        _errors.append(QLatin1String("Cannot load system exclude list or list supplied via --exclude"));
+        return false;
+    }
+
+    _account->credentials()->syncContextPreStart(_csyncCtx);
+    return true;
+}
+
+void FolderSync::start()
+{
+    if (!_timer.isValid()) {
+        _timer.start();
+    }
+    _runs++;
+    _needsRestart = false;
+
+    // The statistics are those of the last run, only the completed items add up
+    _instructionCounts.clear();
+    _plannedItems.clear();
+    _plannedBytes.clear();
+    _errors.clear();
+    _discovering = true;
+
+    if (!createContext()) {
+        QMetaObject::invokeMethod(this, "slotCleanup", Qt::QueuedConnection);
+        return;
+    }
+
+    _journal.reset(new SyncJournalDb(_sourceDir));
+    selectiveSyncFixup(_journal.data(), _selectiveSyncList);
+
+    _engine.reset(new SyncEngine(_account, _csyncCtx, _sourceDir, QUrl(_targetUrl).path(), _remoteFolder, _journal.data()));
+    _engine->setSelectiveSyncBlackList(_selectiveSyncList);
+    _engine->setDryRun(_options.dryRun);
+    connect(_engine.data(), SIGNAL(aboutToPropagate(SyncFileItemVector&)), SLOT(slotAboutToPropagate(SyncFileItemVector&)));
+    connect(_engine.data(), SIGNAL(jobCompleted(SyncFileItem)), SLOT(slotJobCompleted(SyncFileItem)));
+    connect(_engine.data(), SIGNAL(csyncError(QString)), SLOT(slotCsyncError(QString)));
+    connect(_engine.data(), SIGNAL(finished()), SLOT(slotEngineFinished()));
+
+    // Have to be done async, else, an error before exec() does not terminate the event loop.
+    QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
+}
+
+void FolderSync::reportDiscoveryFinished()
+{
+    if (_discovering) {
+        _discovering = false;
+        emit discoveryFinished();
+    }
+}
+
+void FolderSync::slotAboutToPropagate(SyncFileItemVector &items)
+{
+    foreach (const SyncFileItem &item, items) {
+        if (item._instruction == CSYNC_INSTRUCTION_NONE) {
+            continue;
+        }
+        _instructionCounts[instructionName(item._instruction)]++;
+        if (item._isDirectory || item._direction == SyncFileItem::None) {
+            continue;
+        }
+        _plannedItems[item._direction]++;
+        if (item._instruction == CSYNC_INSTRUCTION_NEW || item._instruction == CSYNC_INSTRUCTION_SYNC
+                || item._instruction == CSYNC_INSTRUCTION_CONFLICT) {
+            _plannedBytes[item._direction] += item._size;
+        }
+    }
+    reportDiscoveryFinished();
+}
+
+void FolderSync::slotJobCompleted(const SyncFileItem &item)
+{
+    if (item._status == SyncFileItem::Success) {
+        _completedItems++;
+    } else if (item._status != SyncFileItem::NoStatus && item._status != SyncFileItem::FileIgnored) {
+        _errors.append(item._file + QLatin1String(": ") + item._errorString);
+    }
+}
+
+void FolderSync::slotCsyncError(const QString &error)
+{
+    _errors.append(error);
+}
+
+void FolderSync::slotEngineFinished()
+{
+    // The engine is still emitting, delete it later
+    QMetaObject::invokeMethod(this, "slotCleanup", Qt::QueuedConnection);
+}
+
+void FolderSync::slotCleanup()
+{
+    if (_engine) {
+        _needsRestart = !_options.dryRun && _runs < maxRuns
+                && (_engine->isAnotherSyncNeeded() || !_engine->pathsToRetry().isEmpty());
+    }
+    _engine.reset();
+    _journal.reset();
+    if (_csyncCtx) {
+        csync_destroy(_csyncCtx);
+        _csyncCtx = 0;
+    }
+    _msecs = _timer.elapsed();
+
+    if (_needsRestart) {
+        qDebug() << "Restarting Sync, because another sync is needed" << _sourceDir;
+    }
+    reportDiscoveryFinished();
+    emit finished();
+}
+
+QString FolderSync::summary() const
+{
+    QStringList instructions;
+    for (QMap<QString, int>::const_iterator it = _instructionCounts.constBegin(); it != _instructionCounts.constEnd(); ++it) {
+        instructions.append(QString::fromLatin1("%1 %2").arg(it.key()).arg(it.value()));
+    }
+    return QString::fromLatin1("%1: %2; up %3 items %4 bytes, down %5 items %6 bytes, %7 errors")
+            .arg(_sourceDir, instructions.isEmpty() ? QString::fromLatin1("no changes") : instructions.join(QLatin1String(", ")))
+            .arg(plannedItems(SyncFileItem::Up)).arg(plannedBytes(SyncFileItem::Up))
+            .arg(plannedItems(SyncFileItem::Down)).arg(plannedBytes(SyncFileItem::Down))
+            .arg(_errors.count());
+}
+
+QVariantMap FolderSync::stats() const
+{
+    QVariantMap instructions;
+    for (QMap<QString, int>::const_iterator it = _instructionCounts.constBegin(); it != _instructionCounts.constEnd(); ++it) {
+        instructions.insert(it.key(), it.value());
+    }
+    QVariantMap up;
+    up.insert("items", plannedItems(SyncFileItem::Up));
+    up.insert("bytes", plannedBytes(SyncFileItem::Up));
+    QVariantMap down;
+    down.insert("items", plannedItems(SyncFileItem::Down));
+    down.insert("bytes", plannedBytes(SyncFileItem::Down));
+
+    QVariantMap map;
+    map.insert("source", _sourceDir);
+    map.insert("remoteFolder", _remoteFolder);
+    map.insert("dryRun", _options.dryRun);
+    map.insert("runs", _runs);
+    map.insert("seconds", _msecs / 1000.0);
+    map.insert("instructions", instructions);
+    map.insert("up", up);
+    map.insert("down", down);
+    map.insert("completed", _completedItems);
+    map.insert("errors", _errors);
+    return map;
+}
+
+FolderSyncScheduler::FolderSyncScheduler(int maxDiscoveryParallel)
+    : QObject()
+    , _maxDiscoveryParallel(qMax(1, maxDiscoveryParallel))
+    , _discovering(0)
+    , _running(0)
+{
+}
+
+void FolderSyncScheduler::add(FolderSync *sync)
+{
+    connect(sync, SIGNAL(discoveryFinished()), SLOT(slotDiscoveryFinished()));
+    connect(sync, SIGNAL(finished()), SLOT(slotFinished()));
+    _queue.append(sync);
+    _running++;
+}
+
+void FolderSyncScheduler::start()
+{
+    if (_running == 0) {
+        emit allFinished();
+        return;
+    }
+    startNext();
+}
+
+void FolderSyncScheduler::startNext()
+{
+    while (_discovering < _maxDiscoveryParallel && !_queue.isEmpty()) {
+        _discovering++;
+        _queue.takeFirst()->start();
+    }
+}
+
+void FolderSyncScheduler::slotDiscoveryFinished()
+{
+    _discovering--;
+    startNext();
+}
+
+void FolderSyncScheduler::slotFinished()
+{
+    FolderSync *sync = qobject_cast<FolderSync*>(sender());
+    if (sync && sync->needsRestart()) {
+        _queue.append(sync);
+        startNext();
+        return;
+    }
+    if (--_running == 0) {
+        emit allFinished();
+    }
+}
+
+// Lines are "<source_dir> <server_url>", the url being the last word.
+// Empty lines and lines starting with # are ignored.
+static bool loadManifest(const QString &fileName, QList<QPair<QString, QString> > *pairs)
+{
+    QFile f(fileName);
+    if (!f.open(QFile::ReadOnly)) {
+        std::cerr << "Could not open manifest '" << qPrintable(fileName) << "'." << std::endl;
+        return false;
+    }
+    int lineNumber = 0;
+    while (!f.atEnd()) {
+        lineNumber++;
+        QString line = QString::fromUtf8(f.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#'))) {
+            continue;
+        }
+        int separator = line.lastIndexOf(QRegExp(QLatin1String("\\s")));
+        if (separator < 0) {
+            std::cerr << qPrintable(fileName) << ":" << lineNumber << ": expected <source_dir> <server_url>" << std::endl;
+            return false;
+        }
+        QString sourceDir = line.left(separator).trimmed();
+        if (!QFile::exists(sourceDir)) {
+            std::cerr << "Source dir '" << qPrintable(sourceDir) << "' does not exist." << std::endl;
+            return false;
+        }
+        pairs->append(qMakePair(sourceDir, normalizeTargetUrl(line.mid(separator + 1))));
+    }
+    if (pairs->isEmpty()) {
+        std::cerr << "The manifest '" << qPrintable(fileName) << "' contains no folder." << std::endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     QCoreApplication app(argc, argv);
 
@@ -288,12 +730,55 @@ int main(int argc, char **argv) {
     options.trustSSL = false;
     options.useNetrc = false;
     options.interactive = true;
-    ClientProxy clientProxy;
+    options.trace = false;
+    options.metricsInterval = 10;
+    options.maxParallel = 0;
+    options.maxDiscoveryParallel = 1;
+    options.dryRun = false;
 
     parseOptions( app.arguments(), &options );
 
+    QList<QPair<QString, QString> > folderPairs;
+    if (!options.manifest.isEmpty()) {
+        if (!loadManifest(options.manifest, &folderPairs)) {
+            return EXIT_FAILURE;
+        }
+        options.target_url = folderPairs.first().second;
+    } else {
+        folderPairs.append(qMakePair(options.source_dir, options.target_url));
+    }
+
+    if (options.trace) {
+        // There is one trace per process, the runs of several folders would mix
+        if (folderPairs.count() > 1) {
+            std::cerr << "--trace can not be used with more than one folder." << std::endl;
+            return EXIT_FAILURE;
+        }
+        SyncTrace::setEnabled(true);
+    }
+
+    if (options.maxParallel > 0) {
+        // read by OwncloudPropagator::maximumActiveJob()
+        qputenv("OWNCLOUD_MAX_PARALLEL", QByteArray::number(options.maxParallel));
+    }
+
+    QScopedPointer<MetricsDumper> metricsDumper;
+    if (!options.metricsFile.isEmpty()) {
+        metricsDumper.reset(new MetricsDumper(options.metricsFile, options.metricsInterval));
+    }
+
     QUrl url = QUrl::fromUserInput(options.target_url);
 
+    // All folders share one account, so they must be on the same server
+    for (int i = 1; i < folderPairs.count(); ++i) {
+        QUrl other = QUrl::fromUserInput(folderPairs.at(i).second);
+        if (other.scheme() != url.scheme() || other.host() != url.host() || other.port() != url.port()) {
+            std::cerr << "All folders of the manifest must be on the same server: "
+                      << qPrintable(folderPairs.at(i).second) << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
     // Order of retrieval attempt (later attempts override earlier ones):
     // 1. From URL
     // 2. From options
@@ -340,17 +825,13 @@ int main(int argc, char **argv) {
         url.setPassword(password);
     }
 
-    // take the unmodified url to pass to csync_create()
-    QByteArray remUrl = options.target_url.toUtf8();
-
     AccountPtr account = Account::create();
 
-    // Find the folder and the original owncloud url
+    // Find the original owncloud url
     QStringList splitted = url.path().split(account->davPath());
     url.setPath(splitted.value(0));
 
     url.setScheme(url.scheme().replace("owncloud", "http"));
-    QString folder = splitted.value(1);
 
     SimpleSslErrorHandler *sslErrorHandler = new SimpleSslErrorHandler;
 
@@ -365,120 +846,55 @@ int main(int argc, char **argv) {
 
     AccountManager::instance()->setAccount(account);
 
-restart_sync:
-
-    CSYNC *_csync_ctx;
-
-    if( csync_create( &_csync_ctx, options.source_dir.toUtf8(),
-                      remUrl.constData()) < 0 ) {
-        qFatal("Unable to create csync-context!");
-        return EXIT_FAILURE;
-    }
-
-    csync_set_log_level(options.silent ? 1 : 11);
-
     opts = &options;
-    cred->syncContextPreInit(_csync_ctx);
 
-    if( csync_init( _csync_ctx ) < 0 ) {
-        qFatal("Could not initialize csync!");
-        return EXIT_FAILURE;
+    QStringList selectiveSyncList;
+    if (!options.unsyncedfolders.isEmpty()) {
+        loadSelectiveSyncList(options.unsyncedfolders, &selectiveSyncList);
     }
 
-    csync_set_module_property(_csync_ctx, "csync_context", _csync_ctx);
-    if( !options.proxy.isNull() ) {
-        QString host;
-        int port = 0;
-        bool ok;
-
-        // Set as default and let overwrite later
-        csync_set_module_property(_csync_ctx, "proxy_type", (void*) "NoProxy");
-
-        QStringList pList = options.proxy.split(':');
-        if(pList.count() == 3) {
-            // http: //192.168.178.23 : 8080
-            //  0            1            2
-            host = pList.at(1);
-            if( host.startsWith("//") ) host.remove(0, 2);
-
-            port = pList.at(2).toInt(&ok);
-
-            if( !host.isNull() ) {
-                csync_set_module_property(_csync_ctx, "proxy_type", (void*) "HttpProxy");
-                csync_set_module_property(_csync_ctx, "proxy_host", host.toUtf8().data());
-                if( ok && port ) {
-                    csync_set_module_property(_csync_ctx, "proxy_port", (void*) &port);
-                }
-            }
-        }
-    } else {
-        clientProxy.setupQtProxyFromConfig();
-        QString url( options.target_url );
-        if( url.startsWith("owncloud")) {
-            url.remove(0, 8);
-            url = QString("http%1").arg(url);
-        }
-        clientProxy.setCSyncProxy(QUrl(url), _csync_ctx);
+    // All folders use the QNAM of the account, and with it its connection pool
+    QList<FolderSync*> folders;
+    FolderSyncScheduler scheduler(options.maxDiscoveryParallel);
+    for (int i = 0; i < folderPairs.count(); ++i) {
+        FolderSync *folder = new FolderSync(account, folderPairs.at(i).first, folderPairs.at(i).second,
+                                            options, selectiveSyncList);
+        folders.append(folder);
+        scheduler.add(folder);
     }
+    QObject::connect(&scheduler, SIGNAL(allFinished()), &app, SLOT(quit()));
+    QMetaObject::invokeMethod(&scheduler, "start", Qt::QueuedConnection);
 
-    // Exclude lists
-    QString systemExcludeListFn = ConfigFile::excludeFileFromSystem();
-    int loadedSystemExcludeList = false;
-    if (!systemExcludeListFn.isEmpty()) {
-        loadedSystemExcludeList = csync_add_exclude_list(_csync_ctx, systemExcludeListFn.toLocal8Bit());
-    }
+    app.exec();
 
-    int loadedUserExcludeList = false;
-    if (!options.exclude.isEmpty()) {
-        loadedUserExcludeList = csync_add_exclude_list(_csync_ctx, options.exclude.toLocal8Bit());
+    QVariantList folderStats;
+    int errors = 0;
+    foreach (FolderSync *folder, folders) {
+        if (options.dryRun || folders.count() > 1) {
+            std::cout << qPrintable(folder->summary()) << std::endl;
+        }
+        folderStats.append(folder->stats());
+        errors += folder->errorCount();
     }
 
-    QStringList selectiveSyncList;
-    if (!options.unsyncedfolders.isEmpty()) {
-        QFile f(options.unsyncedfolders);
-        if (!f.open(QFile::ReadOnly)) {
-            qCritical() << "Could not open file containing the list of unsynced folders: " << options.unsyncedfolders;
+    if (!options.statsJson.isEmpty()) {
+        QVariantMap stats;
+        stats.insert("dryRun", options.dryRun);
+        stats.insert("folders", folderStats);
+        stats.insert("errors", errors);
+        QByteArray json = QtJson::serialize(stats);
+        if (options.statsJson == QLatin1String("-")) {
+            std::cout << json.constData() << std::endl;
         } else {
-            selectiveSyncList = QString::fromUtf8(f.readAll()).split('\n');
-            for (int i = 0; i < selectiveSyncList.count(); ++i) {
-                if (!selectiveSyncList.at(i).endsWith(QLatin1Char('/'))) {
-                    selectiveSyncList[i].append(QLatin1Char('/'));
-                }
+            QFile f(options.statsJson);
+            if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                f.write(json + '\n');
+            } else {
+                std::cerr << "Could not write " << qPrintable(options.statsJson) << std::endl;
             }
         }
     }
 
-
-    if (loadedSystemExcludeList != 0 && loadedUserExcludeList != 0) {
-        // Always make sure at least one list had been loaded
-        qFatal("Cannot load system exclude list or list supplied via --exclude");
-        return EXIT_FAILURE;
-    }
-
-    cred->syncContextPreStart(_csync_ctx);
-
-    Cmd cmd;
-    SyncJournalDb db(options.source_dir);
-    selectiveSyncFixup(&db, selectiveSyncList);
-
-    SyncEngine engine(account, _csync_ctx, options.source_dir, QUrl(options.target_url).path(), folder, &db);
-    QObject::connect(&engine, SIGNAL(finished()), &app, SLOT(quit()));
-    QObject::connect(&engine, SIGNAL(transmissionProgress(Progress::Info)), &cmd, SLOT(transmissionProgressSlot()));
-
-    engine.setSelectiveSyncBlackList(selectiveSyncList);
-
-    // Have to be done async, else, an error before exec() does not terminate the event loop.
-    QMetaObject::invokeMethod(&engine, "startSync", Qt::QueuedConnection);
-
-    app.exec();
-
-    csync_destroy(_csync_ctx);
-
-    if (engine.isAnotherSyncNeeded()) {
-        qDebug() << "Restarting Sync, because another sync is needed";
-        goto restart_sync;
-    }
-
+    qDeleteAll(folders);
     return 0;
 }
-
@@ -17,15 +17,165 @@
 #define CMD_H
 
 #include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QScopedPointer>
+#include <QVariantMap>
 
+#include "accountfwd.h"
+#include "clientproxy.h"
+#include "syncfileitem.h"
 
-class Cmd : public QObject {
+
+struct CmdOptions {
+    QString source_dir;
+    QString target_url;
+    QString config_directory;
+    QString user;
+    QString password;
+    QString proxy;
+    bool silent;
+    bool trustSSL;
+    bool useNetrc;
+    bool interactive;
+    QString exclude;
+    QString unsyncedfolders;
+    bool trace;
+    QString metricsFile;
+    int metricsInterval;
+    QString manifest;
+    int maxParallel;
+    int maxDiscoveryParallel;
+    bool dryRun;
+    QString statsJson;
+};
+
+/**
+ * Writes the sync metrics as one line of JSON into a file, or to stdout
+ * for "-", periodically and once more when it is destroyed.
+ */
+class MetricsDumper : public QObject {
+    Q_OBJECT
+public:
+    MetricsDumper(const QString &fileName, int intervalSecs);
+    ~MetricsDumper();
+public slots:
+    void dump();
+private:
+    QString _fileName;
+    QTimer _timer;
+};
+
+namespace OCC {
+
+class SyncEngine;
+class SyncJournalDb;
+
+/**
+ * Syncs one <source_dir> <server_url> pair, or only discovers what would be
+ * done with --dry-run, and collects statistics about it.
+ *
+ * discoveryFinished() is emitted once discovery and reconcile are over, so
+ * that the next folder may start its discovery. finished() is emitted at the
+ * end of the run, needsRestart() then tells whether another run is needed.
+ * The statistics are those of the last run.
+ */
+class FolderSync : public QObject {
+    Q_OBJECT
+public:
+    FolderSync(AccountPtr account, const QString &sourceDir, const QString &targetUrl,
+               const CmdOptions &options, const QStringList &selectiveSyncList);
+    ~FolderSync();
+
+    QString sourceDir() const { return _sourceDir; }
+    QString targetUrl() const { return _targetUrl; }
+    bool needsRestart() const { return _needsRestart; }
+    int errorCount() const { return _errors.count(); }
+
+    /** Items and bytes that were (or with --dry-run, would be) transferred */
+    qint64 plannedItems(SyncFileItem::Direction direction) const { return _plannedItems.value(direction); }
+    qint64 plannedBytes(SyncFileItem::Direction direction) const { return _plannedBytes.value(direction); }
+
+    /** Human readable one line summary */
+    QString summary() const;
+    /** The statistics, as expected by QtJson::serialize() */
+    QVariantMap stats() const;
+
+public slots:
+    void start();
+
+signals:
+    void discoveryFinished();
+    void finished();
+
+private slots:
+    void slotAboutToPropagate(SyncFileItemVector &items);
+    void slotJobCompleted(const SyncFileItem &item);
+    void slotCsyncError(const QString &error);
+    void slotEngineFinished();
+    void slotCleanup();
+
+private:
+    bool createContext();
+    void reportDiscoveryFinished();
+
+    AccountPtr _account;
+    QString _sourceDir;
+    QString _targetUrl;
+    QString _remoteFolder;
+    const CmdOptions &_options;
+    QStringList _selectiveSyncList;
+    ClientProxy _clientProxy;
+
+    CSYNC *_csyncCtx;
+    QScopedPointer<SyncJournalDb> _journal;
+    QScopedPointer<SyncEngine> _engine;
+    bool _discovering;
+    bool _needsRestart;
+
+    int _runs;
+    QElapsedTimer _timer;
+    qint64 _msecs;
+    QMap<QString, int> _instructionCounts;
+    QMap<int, qint64> _plannedItems; // by SyncFileItem::Direction
+    QMap<int, qint64> _plannedBytes;
+    int _completedItems; // of all runs
+    QStringList _errors;
+};
+
+/**
+ * Runs the FolderSyncs of a manifest. All of them propagate at the same
+ * time, but at most maxDiscoveryParallel are in the discovery phase at once.
+ */
+class FolderSyncScheduler : public QObject {
     Q_OBJECT
 public:
-    Cmd() : QObject() { }
+    FolderSyncScheduler(int maxDiscoveryParallel);
+
+    void add(FolderSync *sync);
+
 public slots:
-    void transmissionProgressSlot() {
-    }
+    void start();
+
+signals:
+    void allFinished();
+
+private slots:
+    void slotDiscoveryFinished();
+    void slotFinished();
+
+private:
+    void startNext();
+
+    int _maxDiscoveryParallel;
+    int _discovering;
+    int _running;
+    QList<FolderSync*> _queue;
 };
 
+}
+
 #endif
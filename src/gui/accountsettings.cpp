@@ -595,6 +595,19 @@ QString AccountSettings::shortenFilename( const QString& folder, const QString&
     return shortFile;
 }
 
+void AccountSettings::slotItemCompleted(const QString& folder, const SyncFileItem& syncItem)
+{
+    if (!isVisible() || !Progress::isWarningKind(syncItem._status)) {
+        return;
+    }
+    QStandardItem *item = itemForFolder( folder );
+    if( !item ) return;
+
+    int warnCount = item->data(FolderStatusDelegate::WarningCount).toInt();
+    warnCount++;
+    item->setData( QVariant(warnCount), FolderStatusDelegate::WarningCount );
+}
+
 void AccountSettings::slotSetProgress(const QString& folder, const Progress::Info &progress )
 {
     if (!isVisible()) {
@@ -611,13 +624,6 @@ void AccountSettings::slotSetProgress(const QString& folder, const Progress::Inf
         return;
     }
 
-    if(!progress._lastCompletedItem.isEmpty()
-            && Progress::isWarningKind(progress._lastCompletedItem._status)) {
-        int warnCount = item->data(FolderStatusDelegate::WarningCount).toInt();
-        warnCount++;
-        item->setData( QVariant(warnCount), FolderStatusDelegate::WarningCount );
-    }
-
     // find the single item to display:  This is going to be the bigger item, or the last completed
     // item if no items are in progress.
     SyncFileItem curItem = progress._lastCompletedItem;
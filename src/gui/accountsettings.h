@@ -62,6 +62,7 @@ public slots:
     void slotUpdateFolderState( Folder* );
     void slotDoubleClicked( const QModelIndex& );
     void slotSetProgress(const QString& folder, const Progress::Info& progress);
+    void slotItemCompleted(const QString& folder, const SyncFileItem& item);
     void slotButtonsSetEnabled();
 
     void slotUpdateQuota( qint64,qint64 );
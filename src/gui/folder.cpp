@@ -37,6 +37,7 @@
 #include <QTimer>
 #include <QUrl>
 #include <QDir>
+#include <QThread>
 
 #include <QMessageBox>
 #include <QPushButton>
@@ -51,6 +52,8 @@ static void csyncLogCatcher(int /*verbosity*/,
     Logger::instance()->csyncLog( QString::fromUtf8(buffer) );
 }
 
+// With more changed files than this, the full discovery is cheaper
+static const int maxTargetedSyncPaths = 100;
 
 Folder::Folder(AccountState* accountState,
                const QString& alias,
@@ -69,14 +72,18 @@ Folder::Folder(AccountState* accountState,
       , _proxyDirty(true)
       , _lastSyncDuration(0)
       , _forceSyncOnPollTimeout(false)
+      , _fullSyncNeeded(true)
+      , _fullSyncRunning(false)
       , _consecutiveFailingSyncs(0)
       , _consecutiveFollowUpSyncs(0)
       , _journal(path)
+      , _journalOpenThread(0)
       , _csync_ctx(0)
 {
     qsrand(QTime::currentTime().msec());
     _timeSinceLastSyncStart.start();
     _timeSinceLastSyncDone.start();
+    _timeSinceLastFullSyncDone.start();
 
     _syncResult.setStatus( SyncResult::NotYetStarted );
 
@@ -130,6 +137,9 @@ bool Folder::init()
 
 Folder::~Folder()
 {
+    if (_journalOpenThread) {
+        _journalOpenThread->wait();
+    }
     if( _engine ) {
         _engine->abort();
         _engine.reset(0);
@@ -241,6 +251,50 @@ SyncResult Folder::syncResult() const
   return _syncResult;
 }
 
+namespace {
+class JournalOpenThread : public QThread
+{
+public:
+    JournalOpenThread(SyncJournalDb *journal, QObject *parent)
+        : QThread(parent), _journal(journal), _ok(false) {}
+
+    bool ok() const { return _ok; }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        // Creates the database and upgrades its schema if needed
+        _ok = _journal->isConnected();
+    }
+
+private:
+    SyncJournalDb *_journal;
+    bool _ok;
+};
+}
+
+void Folder::openJournal()
+{
+    if (_journalOpenThread) {
+        return;
+    }
+    _journalOpenThread = new JournalOpenThread(&_journal, this);
+    connect(_journalOpenThread, SIGNAL(finished()), SLOT(slotJournalOpenFinished()), Qt::QueuedConnection);
+    _journalOpenThread->start();
+}
+
+void Folder::slotJournalOpenFinished()
+{
+    bool ok = static_cast<JournalOpenThread *>(_journalOpenThread)->ok();
+    _journalOpenThread->deleteLater();
+    _journalOpenThread = 0;
+
+    if (!ok) {
+        qDebug() << "Could not open the sync journal of" << alias();
+    }
+    emit journalOpened(ok);
+}
+
 void Folder::prepareToSync()
 {
     _syncResult.setStatus( SyncResult::NotYetStarted );
@@ -252,9 +306,7 @@ void Folder::slotRunEtagJob()
     qDebug() << "* Trying to check" << alias() << "for changes via ETag check. (time since last sync:" << (_timeSinceLastSyncDone.elapsed() / 1000) << "s)";
 
 
-    AccountPtr account = _accountState->account();
-
-    if (!_requestEtagJob.isNull()) {
+    if (FolderMan::instance()->etagCheckScheduled(alias())) {
         qDebug() << Q_FUNC_INFO << alias() << "has ETag job queued, not trying to sync";
         return;
     }
@@ -264,8 +316,9 @@ void Folder::slotRunEtagJob()
         return;
     }
 
+    // Targeted syncs do not count, only a full one sees all the changes
     bool forceSyncIntervalExpired =
-            quint64(_timeSinceLastSyncDone.elapsed()) > ConfigFile().forceSyncInterval();
+            quint64(_timeSinceLastFullSyncDone.elapsed()) > ConfigFile().forceSyncInterval();
     bool syncAgainAfterFail = _consecutiveFailingSyncs > 0 && _consecutiveFailingSyncs < 3;
 
     // There are several conditions under which we trigger a full-discovery sync:
@@ -280,8 +333,8 @@ void Folder::slotRunEtagJob()
             || syncAgainAfterFail) {
 
         if (forceSyncIntervalExpired) {
-            qDebug() << "** Force Sync, because it has been " << _timeSinceLastSyncDone.elapsed() << "ms "
-                     << "since the last sync";
+            qDebug() << "** Force Sync, because it has been " << _timeSinceLastFullSyncDone.elapsed() << "ms "
+                     << "since the last full sync";
         }
         if (_forceSyncOnPollTimeout) {
             qDebug() << "** Force Sync, because it was requested";
@@ -298,11 +351,9 @@ void Folder::slotRunEtagJob()
         // Do the ordinary etag check for the root folder and only schedule a real
         // sync if it's different.
 
-        _requestEtagJob = new RequestEtagJob(account, remotePath(), this);
-        // check if the etag is different
-        QObject::connect(_requestEtagJob, SIGNAL(etagRetreived(QString)), this, SLOT(etagRetreived(QString)));
-        FolderMan::instance()->slotScheduleETagJob(alias(), _requestEtagJob);
-        // The _requestEtagJob is auto deleting itself on finish. Our guard pointer _requestEtagJob will then be null.
+        // The FolderMan batches the checks of all folders and calls etagRetreived()
+        // with the result.
+        FolderMan::instance()->slotScheduleETagCheck(alias());
     }
 }
 
@@ -344,7 +395,8 @@ void Folder::bubbleUpSyncResult()
 
     SyncRunFileLog syncFileLog;
 
-    syncFileLog.start(path(), _engine ? _engine->stopWatch() : Utility::StopWatch() );
+    syncFileLog.start(path(), _engine ? _engine->stopWatch() : Utility::StopWatch(),
+                      _engine ? _engine->discoveryPeakMemory() : 0);
 
     QElapsedTimer timer;
     timer.start();
@@ -509,9 +561,8 @@ int Folder::slotDiscardDownloadProgress()
 {
     // Delete from journal and from filesystem.
     QDir folderpath(_path);
-    QSet<QString> keep_nothing;
     const QVector<SyncJournalDb::DownloadInfo> deleted_infos =
-            _journal.getAndDeleteStaleDownloadInfos(keep_nothing);
+            _journal.getAndDeleteAllDownloadInfos();
     foreach (const SyncJournalDb::DownloadInfo & deleted_info, deleted_infos) {
         const QString tmppath = folderpath.filePath(deleted_info._tmpfile);
         qDebug() << "Deleting temporary file: " << tmppath;
@@ -540,7 +591,7 @@ void Folder::slotWatchedPathChanged(const QString& path)
     // When no sync is running or it's in the prepare phase, we can
     // always schedule a new sync.
     if (! _engine || _syncResult.status() == SyncResult::SyncPrepare) {
-        emit scheduleToSync(alias());
+        addTargetedSyncPath(path);
         return;
     }
 
@@ -562,10 +613,28 @@ void Folder::slotWatchedPathChanged(const QString& path)
 #endif
 
     if (! ownChange) {
-        emit scheduleToSync(alias());
+        addTargetedSyncPath(path);
     }
 }
 
+void Folder::addTargetedSyncPath(const QString &path)
+{
+    if (!path.startsWith(this->path())) {
+        _fullSyncNeeded = true;
+    } else {
+        QString relativePath = path.mid(this->path().length());
+        if (!_targetedSyncPaths.contains(relativePath)) {
+            _targetedSyncPaths.append(relativePath);
+        }
+    }
+    emit scheduleTargetedSync(alias());
+}
+
+void Folder::slotScheduleTargetedSync()
+{
+    emit scheduleTargetedSync(alias());
+}
+
 void Folder::setConfigFile( const QString& file )
 {
     _configFile = file;
@@ -809,6 +878,23 @@ void Folder::startSync(const QStringList &pathList)
 
     setDirtyNetworkLimits();
     _engine->setSelectiveSyncBlackList(selectiveSyncBlackList());
+    foreach (const QString &path, _prioritizedPaths) {
+        _engine->prioritizePath(path);
+    }
+    _prioritizedPaths.clear();
+
+    // Changed files are synced alone, the full discovery runs when it was asked
+    // for, and at least every forceSyncInterval
+    QStringList targetedPaths = pathList + _targetedSyncPaths;
+    _fullSyncRunning = _fullSyncNeeded || targetedPaths.isEmpty()
+            || targetedPaths.count() > maxTargetedSyncPaths
+            || quint64(_timeSinceLastFullSyncDone.elapsed()) > ConfigFile().forceSyncInterval();
+    if (!_fullSyncRunning) {
+        qDebug() << "*** Syncing only" << targetedPaths;
+        _engine->setTargetedPaths(targetedPaths);
+    }
+    _fullSyncNeeded = false;
+    _targetedSyncPaths.clear();
 
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
 
@@ -817,6 +903,15 @@ void Folder::startSync(const QStringList &pathList)
     emit syncStarted();
 }
 
+void Folder::prioritizePath(const QString &relativePath)
+{
+    if (_engine) {
+        _engine->prioritizePath(relativePath);
+    } else if (!_prioritizedPaths.contains(relativePath)) {
+        _prioritizedPaths.append(relativePath);
+    }
+}
+
 void Folder::setDirtyNetworkLimits()
 {
     if (_engine) {
@@ -877,8 +972,10 @@ void Folder::slotSyncFinished()
     bubbleUpSyncResult();
 
     bool anotherSyncNeeded = false;
+    QStringList pathsToRetry;
     if (_engine) {
         anotherSyncNeeded = _engine->isAnotherSyncNeeded();
+        pathsToRetry = _engine->pathsToRetry();
         _engine.reset(0);
     }
     // _watcher->setEventsEnabledDelayed(2000);
@@ -929,9 +1026,12 @@ void Folder::slotSyncFinished()
 
     _lastSyncDuration = _timeSinceLastSyncStart.elapsed();
     _timeSinceLastSyncDone.restart();
+    if (_fullSyncRunning) {
+        _timeSinceLastFullSyncDone.restart();
+    }
 
     // Increment the follow-up sync counter if necessary.
-    if (anotherSyncNeeded) {
+    if (anotherSyncNeeded || !pathsToRetry.isEmpty()) {
         _consecutiveFollowUpSyncs++;
         qDebug() << "another sync was requested by the finished sync, this has"
                  << "happened" << _consecutiveFollowUpSyncs << "times";
@@ -947,6 +1047,15 @@ void Folder::slotSyncFinished()
         // delay 1s, 4s, 9s
         int c = _consecutiveFollowUpSyncs;
         QTimer::singleShot(c*c * 1000, this, SLOT(slotRunEtagJob() ));
+    } else if (!pathsToRetry.isEmpty() && _consecutiveFollowUpSyncs <= 3) {
+        // Files that were still changing, no need for a full discovery
+        foreach (const QString &path, pathsToRetry) {
+            if (!_targetedSyncPaths.contains(path)) {
+                _targetedSyncPaths.append(path);
+            }
+        }
+        int c = _consecutiveFollowUpSyncs;
+        QTimer::singleShot(c*c * 1000, this, SLOT(slotScheduleTargetedSync()));
     }
 }
 
@@ -126,12 +126,29 @@ public:
      // Used by the Socket API
      SyncJournalDb *journalDb() { return &_journal; }
 
+     /**
+      * Opens the sync journal in a thread of its own, journalOpened() is
+      * emitted when it is done.
+      */
+     void openJournal();
+
      QStringList selectiveSyncBlackList() { return _selectiveSyncBlackList; }
      void setSelectiveSyncBlackList(const QStringList &blackList);
 
      bool estimateState(QString fn, csync_ftw_type_e t, SyncFileStatus* s);
 
-     RequestEtagJob *etagJob() { return _requestEtagJob; }
+     /**
+      * Sync the file or directory at \a relativePath before everything else.
+      * Applies to the running sync, or to the next one if none is running.
+      */
+     void prioritizePath(const QString &relativePath);
+
+     /**
+      * Makes the next scheduled sync run the full discovery. Without it, a
+      * sync that was scheduled for changed files only syncs these files.
+      */
+     void requestFullSync() { _fullSyncNeeded = true; }
+
      qint64 msecSinceLastSync() const { return _timeSinceLastSyncDone.elapsed(); }
      qint64 msecLastSyncDuration() const { return _lastSyncDuration; }
      int consecutiveFollowUpSyncs() const { return _consecutiveFollowUpSyncs; }
@@ -141,6 +158,9 @@ signals:
     void syncStarted();
     void syncFinished(const SyncResult &result);
     void scheduleToSync( const QString& );
+    // Only the files in _targetedSyncPaths need to be synced
+    void scheduleTargetedSync( const QString& );
+    void journalOpened(bool ok);
 
 public slots:
 
@@ -174,6 +194,12 @@ public slots:
        */
       void slotWatchedPathChanged(const QString& path);
 
+      /**
+       * Called by the FolderMan with the result of the remote ETag check.
+       * Schedules a sync if the ETag differs from the last known one.
+       */
+      void etagRetreived(const QString &);
+
 private slots:
     void slotSyncStarted();
     void slotSyncError(const QString& );
@@ -186,7 +212,6 @@ private slots:
     void slotSyncItemDiscovered(const SyncFileItem & item);
 
     void slotRunEtagJob();
-    void etagRetreived(const QString &);
     void etagRetreivedFromSyncEngine(const QString &);
 
     void slotAboutToPropagate(SyncFileItemVector& );
@@ -196,9 +221,15 @@ private slots:
 
     void watcherSlot(QString);
 
+    void slotJournalOpenFinished();
+
+    void slotScheduleTargetedSync();
+
 private:
     bool init();
 
+    void addTargetedSyncPath(const QString &path);
+
     bool setIgnoredFiles();
 
     void bubbleUpSyncResult();
@@ -218,17 +249,22 @@ private:
     QScopedPointer<SyncEngine> _engine;
     QStringList  _errors;
     QStringList _selectiveSyncBlackList;
+    QStringList _prioritizedPaths; // for the next sync, see prioritizePath()
     bool         _csyncError;
     bool         _csyncUnavail;
     bool         _wipeDb;
     bool         _proxyDirty;
-    QPointer<RequestEtagJob> _requestEtagJob;
     QString       _lastEtag;
     QElapsedTimer _timeSinceLastSyncDone;
+    QElapsedTimer _timeSinceLastFullSyncDone;
     QElapsedTimer _timeSinceLastSyncStart;
     qint64        _lastSyncDuration;
     bool          _forceSyncOnPollTimeout;
 
+    QStringList   _targetedSyncPaths; // changed files for the next targeted sync
+    bool          _fullSyncNeeded; // the next sync must not be a targeted one
+    bool          _fullSyncRunning;
+
     /// The number of syncs that failed in a row.
     /// Reset when a sync is successful.
     int           _consecutiveFailingSyncs;
@@ -243,6 +279,7 @@ private:
     QSet<QString>   _stateTaintedFolders;
 
     SyncJournalDb _journal;
+    QThread      *_journalOpenThread;
 
     ClientProxy   _clientProxy;
 
@@ -20,6 +20,8 @@
 #include "socketapi.h"
 #include "account.h"
 #include "accountstate.h"
+#include "batchetagchecker.h"
+#include "syncmetrics.h"
 
 #ifdef Q_OS_MAC
 #include <CoreServices/CoreServices.h>
@@ -47,9 +49,20 @@ FolderMan* FolderMan::_instance = 0;
  */
 static qint64 msBetweenRequestAndSync = 2000;
 
+/*
+ * The connections for a scheduled sync are opened this long before it starts.
+ * Earlier, the server might close them again for being idle.
+ */
+static qint64 msWarmUpBeforeSync = 2000;
+
 FolderMan::FolderMan(QObject *parent) :
     QObject(parent),
-    _syncEnabled( true )
+    _syncEnabled( true ),
+    _runningEtagCheckers(0),
+    _etagPollRequestCount(0),
+    _startupSetupMsec(0),
+    _startupJournalsMsec(0),
+    _startupWatchersMsec(0)
 {
     _folderChangeSignalMapper = new QSignalMapper(this);
     connect(_folderChangeSignalMapper, SIGNAL(mapped(const QString &)),
@@ -107,6 +120,8 @@ void FolderMan::unloadFolder( const QString& alias )
         if( _folderWatchers.contains(alias)) {
             _folderWatchers.remove(alias);
         }
+        _startupJournalsPending.remove(alias);
+        _startupWatchersPending.remove(alias);
         _folderMap.remove( alias );
         delete f;
     }
@@ -152,6 +167,9 @@ void FolderMan::registerFolderMonitor( Folder *folder )
 
         // This is at the moment only for the behaviour of the SocketApi.
         connect(fw, SIGNAL(pathChanged(QString)), folder, SLOT(watcherSlot(QString)));
+
+        connect(fw, SIGNAL(registrationProgress(int)), SLOT(slotWatcherRegistrationProgress(int)));
+        connect(fw, SIGNAL(ready()), SLOT(slotWatcherReady()));
     }
 
     // register the folder with the socket API
@@ -182,11 +200,20 @@ void FolderMan::removeMonitorPath( const QString& alias, const QString& path )
     }
 }
 
+/*
+ * The folders are set up in phases: reading the configuration happens right
+ * here, the journals are opened and the watchers register the directories in
+ * other threads. A folder is scheduled to sync as soon as its journal is open.
+ * The duration of each phase is logged once all folders are done.
+ */
 int FolderMan::setupFolders()
 {
   qDebug() << "* Setup folders from " << _folderConfigPath;
 
   unloadAllFolders();
+  _startupTimer.start();
+  _startupJournalsMsec = 0;
+  _startupWatchersMsec = 0;
 
   ConfigFile cfg;
   QDir storageDir(cfg.configPath());
@@ -201,10 +228,15 @@ int FolderMan::setupFolders()
   foreach ( const QString& alias, list ) {
     Folder *f = setupFolderFromConfigFile( alias );
     if( f ) {
-        slotScheduleSync(alias);
+        _startupJournalsPending.insert(f->alias());
+        _startupWatchersPending.insert(f->alias());
+        connect(f, SIGNAL(journalOpened(bool)), SLOT(slotFolderJournalOpened(bool)));
+        f->openJournal();
         emit( folderSyncStateChange( f->alias() ) );
     }
   }
+  _startupSetupMsec = _startupTimer.elapsed();
+  qDebug() << "* Set up" << _folderMap.count() << "folders in" << _startupSetupMsec << "msec";
 
   emit folderListLoaded(_folderMap);
 
@@ -360,6 +392,7 @@ Folder* FolderMan::setupFolderFromConfigFile(const QString &file) {
 
     /* Use a signal mapper to connect the signals to the alias */
     connect(folder, SIGNAL(scheduleToSync(const QString&)), SLOT(slotScheduleSync(const QString&)));
+    connect(folder, SIGNAL(scheduleTargetedSync(const QString&)), SLOT(slotScheduleTargetedSync(const QString&)));
     connect(folder, SIGNAL(syncStateChange()), _folderChangeSignalMapper, SLOT(map()));
     connect(folder, SIGNAL(syncStarted()), SLOT(slotFolderSyncStarted()));
     connect(folder, SIGNAL(syncFinished(SyncResult)), SLOT(slotFolderSyncFinished(SyncResult)));
@@ -436,6 +469,14 @@ void FolderMan::slotScheduleAllFolders()
   * to the queue. The slot to actually start a sync is called afterwards.
   */
 void FolderMan::slotScheduleSync( const QString& alias )
+{
+    if (Folder *f = folder(alias)) {
+        f->requestFullSync();
+    }
+    slotScheduleTargetedSync(alias);
+}
+
+void FolderMan::slotScheduleTargetedSync( const QString& alias )
 {
     Folder* f = folder(alias);
     if( !f ) {
@@ -470,39 +511,96 @@ void FolderMan::slotScheduleSync( const QString& alias )
     startScheduledSyncSoon();
 }
 
-void FolderMan::slotScheduleETagJob(const QString &/*alias*/, RequestEtagJob *job)
+void FolderMan::slotScheduleETagCheck(const QString &alias)
 {
-    QObject::connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(slotEtagJobDestroyed(QObject*)));
-    QMetaObject::invokeMethod(this, "slotRunOneEtagJob", Qt::QueuedConnection);
-    // maybe: add to queue
+    _etagCheckQueue.insert(alias);
+    QMetaObject::invokeMethod(this, "slotRunEtagChecks", Qt::QueuedConnection);
 }
 
-void FolderMan::slotEtagJobDestroyed(QObject* /*o*/)
+bool FolderMan::etagCheckScheduled(const QString &alias) const
 {
-    // _currentEtagJob is automatically cleared
-    // maybe: remove from queue
-    QMetaObject::invokeMethod(this, "slotRunOneEtagJob", Qt::QueuedConnection);
+    return _etagCheckQueue.contains(alias) || _etagCheckRunning.contains(alias);
 }
 
-void FolderMan::slotRunOneEtagJob()
+void FolderMan::slotRunEtagChecks()
 {
-    if (_currentEtagJob.isNull()) {
-        QString alias;
-        foreach(Folder *f, _folderMap) {
-            if (f->etagJob()) {
-                // Caveat: always grabs the first folder with a job, but we think this is Ok for now and avoids us having a seperate queue.
-                _currentEtagJob = f->etagJob();
-                alias = f->alias();
-                break;
-            }
+    if (_runningEtagCheckers > 0) {
+        // the current cycle continues the queue via slotEtagCheckerFinished
+        return;
+    }
+    if (_etagCheckQueue.isEmpty()) {
+        qDebug() << "No more remote ETag check jobs to schedule.";
+        return;
+    }
+
+    // One checker per account, it batches the folders sharing a parent
+    // directory into a single request and runs the rest in parallel.
+    QHash<AccountState*, BatchEtagChecker*> checkers;
+    foreach (const QString &alias, _etagCheckQueue) {
+        Folder *f = _folderMap.value(alias);
+        if (!f || !f->accountState()) {
+            continue;
         }
-        if (_currentEtagJob.isNull()) {
-            qDebug() << "No more remote ETag check jobs to schedule.";
-        } else {
-            qDebug() << "Scheduling" << alias << "to check remote ETag";
-            _currentEtagJob->start(); // on destroy/end it will continue the queue via slotEtagJobDestroyed
+        BatchEtagChecker *checker = checkers.value(f->accountState());
+        if (!checker) {
+            checker = new BatchEtagChecker(f->accountState()->account(), this);
+            connect(checker, SIGNAL(etagRetreived(QString,QString)),
+                    SLOT(slotEtagCheckerRetreived(QString,QString)));
+            connect(checker, SIGNAL(finished()), SLOT(slotEtagCheckerFinished()));
+            checkers.insert(f->accountState(), checker);
         }
+        checker->addPath(f->remotePath());
+        _etagCheckRunning.insert(alias);
+    }
+    _etagCheckQueue.clear();
+
+    if (checkers.isEmpty()) {
+        return;
+    }
+
+    qDebug() << "Scheduling" << _etagCheckRunning << "to check remote ETag";
+    _runningEtagCheckers = checkers.count();
+    _etagPollRequestCount = 0;
+    _etagPollCycleTimer.start();
+    foreach (BatchEtagChecker *checker, checkers) {
+        checker->start(); // on finish it will continue the queue via slotEtagCheckerFinished
+    }
+}
+
+void FolderMan::slotEtagCheckerRetreived(const QString &remotePath, const QString &etag)
+{
+    BatchEtagChecker *checker = qobject_cast<BatchEtagChecker*>(sender());
+    if (!checker) {
+        return;
+    }
+    QString path = BatchEtagChecker::normalizePath(remotePath);
+    foreach (const QString &alias, _etagCheckRunning) {
+        Folder *f = _folderMap.value(alias);
+        if (f && f->accountState() && f->accountState()->account() == checker->account()
+                && BatchEtagChecker::normalizePath(f->remotePath()) == path) {
+            f->etagRetreived(etag);
+        }
+    }
+}
+
+void FolderMan::slotEtagCheckerFinished()
+{
+    BatchEtagChecker *checker = qobject_cast<BatchEtagChecker*>(sender());
+    if (checker) {
+        _etagPollRequestCount += checker->requestCount();
     }
+    if (--_runningEtagCheckers > 0) {
+        return;
+    }
+
+    const qint64 msec = _etagPollCycleTimer.elapsed();
+    qDebug() << "Remote ETag check of" << _etagCheckRunning.count() << "folders took"
+             << msec << "msec with" << _etagPollRequestCount << "requests";
+    SyncMetrics::recordValue("etag_poll.cycle_requests", _etagPollRequestCount);
+    SyncMetrics::recordValue("etag_poll.cycle_msec", msec);
+    _etagCheckRunning.clear();
+
+    QMetaObject::invokeMethod(this, "slotRunEtagChecks", Qt::QueuedConnection);
 }
 
 // only enable or disable foldermans will to schedule and do syncs.
@@ -568,6 +666,18 @@ void FolderMan::startScheduledSyncSoon(qint64 msMinimumDelay)
 
     qDebug() << "Scheduling a sync in" << (msDelay/1000) << "seconds";
     _startScheduledSyncTimer.start(msDelay);
+    QTimer::singleShot(qMax(0ll, msDelay - msWarmUpBeforeSync), this, SLOT(slotWarmUpConnections()));
+}
+
+void FolderMan::slotWarmUpConnections()
+{
+    if (_scheduleQueue.isEmpty() || !_startScheduledSyncTimer.isActive()) {
+        return;
+    }
+    Folder *f = folder(_scheduleQueue.head());
+    if (f && f->accountState()) {
+        f->accountState()->account()->warmUpConnections();
+    }
 }
 
 /*
@@ -638,7 +748,7 @@ void FolderMan::slotEtagPollTimerTimeout()
             i.remove();
             continue;
         }
-        if (f && (f->etagJob() || f->isBusy() || f->syncPaused())) {
+        if (f && (etagCheckScheduled(alias) || f->isBusy() || f->syncPaused())) {
             i.remove();
             continue;
         }
@@ -660,6 +770,54 @@ void FolderMan::slotEtagPollTimerTimeout()
     }
 }
 
+void FolderMan::slotFolderJournalOpened(bool ok)
+{
+    Folder *f = qobject_cast<Folder *>(sender());
+    if (!f) {
+        return;
+    }
+    disconnect(f, SIGNAL(journalOpened(bool)), this, SLOT(slotFolderJournalOpened(bool)));
+    if (!_startupJournalsPending.remove(f->alias())) {
+        return;
+    }
+    qint64 msec = _startupTimer.elapsed();
+    _startupJournalsMsec = qMax(_startupJournalsMsec, msec);
+    qDebug() << "* Journal of" << f->alias() << (ok ? "opened" : "failed to open") << "after" << msec << "msec";
+
+    // The first sync of this folder does not need to wait for the others
+    slotScheduleSync(f->alias());
+    checkStartupFinished();
+}
+
+void FolderMan::slotWatcherRegistrationProgress(int directories)
+{
+    FolderWatcher *fw = qobject_cast<FolderWatcher *>(sender());
+    if (fw) {
+        qDebug() << "* Watcher of" << _folderWatchers.key(fw) << "watches" << directories << "directories";
+    }
+}
+
+void FolderMan::slotWatcherReady()
+{
+    FolderWatcher *fw = qobject_cast<FolderWatcher *>(sender());
+    if (!fw || !_startupWatchersPending.remove(_folderWatchers.key(fw))) {
+        return;
+    }
+    _startupWatchersMsec = qMax(_startupWatchersMsec, _startupTimer.elapsed());
+    checkStartupFinished();
+}
+
+void FolderMan::checkStartupFinished()
+{
+    if (!_startupJournalsPending.isEmpty() || !_startupWatchersPending.isEmpty()) {
+        return;
+    }
+    qDebug() << "* Startup of" << _folderMap.count() << "folders finished after" << _startupTimer.elapsed() << "msec:"
+             << "configuration" << _startupSetupMsec << "msec,"
+             << "journals" << _startupJournalsMsec << "msec,"
+             << "watchers" << _startupWatchersMsec << "msec";
+}
+
 void FolderMan::slotRemoveFoldersForAccount(AccountState* accountState)
 {
     QStringList foldersToRemove;
@@ -20,6 +20,8 @@
 #include <QQueue>
 #include <QList>
 #include <QPointer>
+#include <QSet>
+#include <QElapsedTimer>
 
 #include "folder.h"
 #include "folderwatcher.h"
@@ -96,6 +98,9 @@ public:
 
     SocketApi *socketApi();
 
+    /** Whether a remote ETag check is queued or running for the folder */
+    bool etagCheckScheduled( const QString &alias ) const;
+
 signals:
     /**
       * signal to indicate a folder named by alias has changed its sync state.
@@ -137,18 +142,28 @@ public slots:
 
     // slot to add a folder to the syncing queue
     void slotScheduleSync( const QString & );
-    // slot to scheule an ETag job
-    void slotScheduleETagJob ( const QString &alias, RequestEtagJob *job);
-    void slotEtagJobDestroyed (QObject*);
-    void slotRunOneEtagJob();
+    // same, but the sync may be limited to the files the folder knows changed
+    void slotScheduleTargetedSync( const QString & );
+    // slot to schedule a remote ETag check for a folder
+    void slotScheduleETagCheck( const QString &alias );
+    void slotRunEtagChecks();
 
 private slots:
 
     // slot to take the next folder from queue and start syncing.
     void slotStartScheduledFolderSync();
+    // open the connections for the next scheduled sync
+    void slotWarmUpConnections();
     void slotEtagPollTimerTimeout();
+    void slotEtagCheckerRetreived(const QString &remotePath, const QString &etag);
+    void slotEtagCheckerFinished();
     void slotRemoveFoldersForAccount(AccountState* accountState);
 
+    // startup of the folders created by setupFolders()
+    void slotFolderJournalOpened(bool ok);
+    void slotWatcherRegistrationProgress(int directories);
+    void slotWatcherReady();
+
 private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon(qint64 msMinimumDelay = 0);
@@ -162,6 +177,8 @@ private:
 
     void removeFolder( const QString& );
 
+    void checkStartupFinished();
+
     QSet<Folder*>  _disabledFolders;
     Folder::Map    _folderMap;
     QString        _folderConfigPath;
@@ -170,7 +187,19 @@ private:
     QString        _lastSyncFolder;
     bool           _syncEnabled;
     QTimer         _etagPollTimer;
-    QPointer<RequestEtagJob>        _currentEtagJob; // alias of Folder running the current RequestEtagJob
+    QSet<QString>  _etagCheckQueue;   // aliases of folders waiting for an ETag check
+    QSet<QString>  _etagCheckRunning; // aliases of folders in the current poll cycle
+    int            _runningEtagCheckers;
+    int            _etagPollRequestCount;
+    QElapsedTimer  _etagPollCycleTimer;
+
+    /** Measures the startup phases, see setupFolders() */
+    QElapsedTimer  _startupTimer;
+    qint64         _startupSetupMsec;
+    qint64         _startupJournalsMsec;
+    qint64         _startupWatchersMsec;
+    QSet<QString>  _startupJournalsPending;
+    QSet<QString>  _startupWatchersPending;
 
     QMap<QString, FolderWatcher*> _folderWatchers;
     QPointer<SocketApi> _socketApi;
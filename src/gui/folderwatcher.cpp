@@ -41,6 +41,11 @@ FolderWatcher::FolderWatcher(const QString &root, QObject *parent)
     _d.reset(new FolderWatcherPrivate(this, root));
 
     _timer.start();
+
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+    // These backends watch the whole tree right away
+    QTimer::singleShot(0, this, SIGNAL(ready()));
+#endif
 }
 
 FolderWatcher::~FolderWatcher()
@@ -81,6 +81,12 @@ signals:
     /** Emitted if an error occurs */
     void error(const QString& error);
 
+    /** Emitted while the directories are added, with the number watched so far */
+    void registrationProgress(int directories);
+
+    /** Emitted once the whole tree is watched */
+    void ready();
+
 protected slots:
     // called from the implementations to indicate a change in path
     void changeDetected( const QString& path);
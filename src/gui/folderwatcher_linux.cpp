@@ -39,13 +39,71 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path
         qDebug() << Q_FUNC_INFO << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
-
+    // Queued, the ignore list is not loaded yet
+    QMetaObject::invokeMethod(this, "slotStartScan", Qt::QueuedConnection);
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
 {
+    if (_scanner) {
+        _scanner->abort();
+        _scanner->wait();
+    }
+}
+
+void DirectoryScannerThread::run()
+{
+    // Directories are reported in batches of this size
+    static const int batchSize = 500;
+
+    QStringList batch;
+    QStringList queue(_path);
+    while (!queue.isEmpty() && !_abort.fetchAndAddRelaxed(0)) {
+        QDir dir(queue.takeFirst());
+        const QStringList names = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        foreach (const QString &name, names) {
+            const QString fullPath = dir.path() + QLatin1Char('/') + name;
+            queue.append(fullPath);
+            batch.append(fullPath);
+        }
+        if (batch.count() >= batchSize) {
+            emit directoriesFound(batch);
+            batch.clear();
+        }
+    }
+    if (!batch.isEmpty()) {
+        emit directoriesFound(batch);
+    }
+}
+
+void FolderWatcherPrivate::slotStartScan()
+{
+    _scanTimer.start();
+    inotifyRegisterPath(QDir(_folder).absolutePath());
+
+    _scanner.reset(new DirectoryScannerThread(_folder));
+    connect(_scanner.data(), SIGNAL(directoriesFound(QStringList)),
+            SLOT(slotDirectoriesFound(QStringList)), Qt::QueuedConnection);
+    connect(_scanner.data(), SIGNAL(finished()), SLOT(slotScanFinished()), Qt::QueuedConnection);
+    _scanner->start(QThread::LowPriority);
+}
 
+void FolderWatcherPrivate::slotDirectoriesFound(const QStringList &paths)
+{
+    foreach (const QString &path, paths) {
+        if (_parent->pathIsIgnored(path)) {
+            continue;
+        }
+        inotifyRegisterPath(path);
+    }
+    emit _parent->registrationProgress(_watches.count());
+}
+
+void FolderWatcherPrivate::slotScanFinished()
+{
+    qDebug() << "(+) Watcher:" << _folder << "watches" << _watches.count()
+             << "directories after" << _scanTimer.elapsed() << "msec";
+    emit _parent->ready();
 }
 
 // attention: result list passed by reference!
@@ -19,11 +19,39 @@
 #include <QSocketNotifier>
 #include <QHash>
 #include <QDir>
+#include <QThread>
+#include <QElapsedTimer>
 
 #include "folderwatcher.h"
 
 namespace OCC
 {
+
+/**
+ * @brief Lists all directories below a path in a thread of its own
+ *
+ * The directories are reported in batches, the FolderWatcherPrivate adds
+ * the watches for them in its own thread.
+ */
+class DirectoryScannerThread : public QThread {
+    Q_OBJECT
+public:
+    explicit DirectoryScannerThread(const QString &path)
+        : QThread(), _path(path), _abort(0) {}
+
+    void abort() { _abort.fetchAndStoreRelaxed(1); }
+
+signals:
+    void directoriesFound(const QStringList &paths);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    QString _path;
+    QAtomicInt _abort;
+};
+
 class FolderWatcherPrivate : public QObject
 {
     Q_OBJECT
@@ -38,6 +66,9 @@ public:
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotStartScan();
+    void slotDirectoriesFound(const QStringList &paths);
+    void slotScanFinished();
 
 protected:
     bool findFoldersBelow( const QDir& dir, QStringList& fullList );
@@ -49,6 +80,8 @@ private:
     QString _folder;
     QHash <int, QString> _watches;
     QScopedPointer<QSocketNotifier> _socket;
+    QScopedPointer<DirectoryScannerThread> _scanner;
+    QElapsedTimer _scanTimer;
     int _fd;
 };
 
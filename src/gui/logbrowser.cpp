@@ -30,9 +30,11 @@
 #include <QDebug>
 #include <QSettings>
 #include <QAction>
+#include <QCheckBox>
 
 #include "configfile.h"
 #include "logger.h"
+#include "synctrace.h"
 
 namespace OCC {
 
@@ -80,6 +82,14 @@ LogBrowser::LogBrowser(QWidget *parent) :
     connect( findBtn, SIGNAL(clicked()), this, SLOT(slotFind()));
     toolLayout->addWidget( findBtn );
 
+    // sync tracing
+    _traceCheckBox = new QCheckBox(tr("&Trace sync runs"));
+    _traceCheckBox->setToolTip(tr("Record where the time of each sync run goes. The trace is saved "
+                                  "in the synced folder and can be opened with chrome://tracing."));
+    _traceCheckBox->setChecked(SyncTrace::isEnabled());
+    connect(_traceCheckBox, SIGNAL(toggled(bool)), this, SLOT(slotTraceToggled(bool)));
+    toolLayout->addWidget( _traceCheckBox );
+
     // stretch
     toolLayout->addStretch(1);
     _statusLabel = new QLabel;
@@ -145,6 +155,12 @@ void LogBrowser::slotNewLog( const QString& msg )
 }
 
 
+void LogBrowser::slotTraceToggled(bool enabled)
+{
+    // takes effect with the next sync run
+    SyncTrace::setEnabled(enabled);
+}
+
 void LogBrowser::slotFind()
 {
     QString searchText = _findTermEdit->text();
@@ -25,6 +25,7 @@
 #include <QLineEdit>
 #include <QPushButton>
 #include <QLabel>
+#include <QCheckBox>
 
 namespace OCC {
 
@@ -56,6 +57,7 @@ protected slots:
     void search( const QString& );
     void slotSave();
     void slotClearLog();
+    void slotTraceToggled(bool enabled);
 
 private:
     LogWidget *_logWidget;
@@ -63,6 +65,7 @@ private:
     QPushButton *_saveBtn;
     QPushButton *_clearBtn;
     QLabel      *_statusLabel;
+    QCheckBox   *_traceCheckBox;
 
 };
 
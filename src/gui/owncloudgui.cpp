@@ -81,6 +81,8 @@ ownCloudGui::ownCloudGui(Application *parent) :
     ProgressDispatcher *pd = ProgressDispatcher::instance();
     connect( pd, SIGNAL(progressInfo(QString,Progress::Info)), this,
              SLOT(slotUpdateProgress(QString,Progress::Info)) );
+    connect( pd, SIGNAL(jobCompleted(QString,SyncFileItem)), this,
+             SLOT(slotItemCompleted(QString,SyncFileItem)) );
 
     FolderMan *folderMan = FolderMan::instance();
     connect( folderMan, SIGNAL(folderSyncStateChange(QString)),
@@ -494,21 +496,30 @@ void ownCloudGui::slotUpdateProgress(const QString &folder, const Progress::Info
 
     _actionRecent->setIcon( QIcon() ); // Fixme: Set a "in-progress"-item eventually.
 
-    if (!progress._lastCompletedItem.isEmpty() && !Progress::isIgnoredKind(progress._lastCompletedItem._status)) {
+    if (progress._completedFileCount != ULLONG_MAX
+            && progress._completedFileCount >= progress._totalFileCount
+            && progress._currentDiscoveredFolder.isEmpty()) {
+        QTimer::singleShot(2000, this, SLOT(slotDisplayIdle()));
+    }
+}
+
+void ownCloudGui::slotItemCompleted(const QString &folder, const SyncFileItem &item)
+{
+    if (!Progress::isIgnoredKind(item._status)) {
 
-        if (Progress::isWarningKind(progress._lastCompletedItem._status)) {
+        if (Progress::isWarningKind(item._status)) {
             // display a warn icon if warnings happend.
             QIcon warnIcon(":/client/resources/warning");
             _actionRecent->setIcon(warnIcon);
         }
 
-        QString kindStr = Progress::asResultString(progress._lastCompletedItem);
+        QString kindStr = Progress::asResultString(item);
         QString timeStr = QTime::currentTime().toString("hh:mm");
-        QString actionText = tr("%1 (%2, %3)").arg(progress._lastCompletedItem._file, kindStr, timeStr);
+        QString actionText = tr("%1 (%2, %3)").arg(item._file, kindStr, timeStr);
         QAction *action = new QAction(actionText, this);
         Folder *f = FolderMan::instance()->folder(folder);
         if (f) {
-            QString fullPath = f->path() + '/' + progress._lastCompletedItem._file;
+            QString fullPath = f->path() + '/' + item._file;
             if (QFile(fullPath).exists()) {
                 _recentItemsMapper->setMapping(action, fullPath);
                 connect(action, SIGNAL(triggered()), _recentItemsMapper, SLOT(map()));
@@ -523,12 +534,6 @@ void ownCloudGui::slotUpdateProgress(const QString &folder, const Progress::Info
 
         slotRebuildRecentMenus();
     }
-
-    if (progress._completedFileCount != ULLONG_MAX
-            && progress._completedFileCount >= progress._totalFileCount
-            && progress._currentDiscoveredFolder.isEmpty()) {
-        QTimer::singleShot(2000, this, SLOT(slotDisplayIdle()));
-    }
 }
 
 void ownCloudGui::slotDisplayIdle()
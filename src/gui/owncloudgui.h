@@ -57,6 +57,7 @@ public slots:
     void slotRefreshQuotaDisplay( qint64 total, qint64 used );
     void slotRebuildRecentMenus();
     void slotUpdateProgress(const QString &folder, const Progress::Info& progress);
+    void slotItemCompleted(const QString &folder, const SyncFileItem& item);
     void slotShowGuiMessage(const QString &title, const QString &message);
     void slotFoldersChanged();
     void slotShowSettings();
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "protocolmodel.h"
+#include "progressdispatcher.h"
+#include "syncresult.h"
+#include "theme.h"
+#include "utility.h"
+
+#include <QDateTime>
+#include <QIcon>
+#include <QLocale>
+
+namespace OCC {
+
+// New rows are inserted at most this often, a view does not need more.
+static const int flushIntervalMsec = 250;
+
+ProtocolModel::ProtocolModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , _entries(maximumEntries())
+{
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(flushIntervalMsec);
+    connect(&_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+int ProtocolModel::maximumEntries()
+{
+    return 2000;
+}
+
+int ProtocolModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : _entries.count();
+}
+
+int ProtocolModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+const ProtocolModel::Entry &ProtocolModel::entry(int row) const
+{
+    // the newest entry is in the first row
+    return _entries.at(_entries.lastIndex() - row);
+}
+
+QString ProtocolModel::timeString(qint64 timestamp, bool longFormat) const
+{
+    QLocale loc = QLocale::system();
+    QDateTime dt = QDateTime::fromMSecsSinceEpoch(timestamp);
+
+    if (longFormat) {
+        return loc.toString(dt, QLocale::LongFormat);
+    }
+    if (dt.date().day() == QDate::currentDate().day()) {
+        return loc.toString(dt.time(), QLocale::NarrowFormat);
+    }
+    return loc.toString(dt, QLocale::NarrowFormat);
+}
+
+QString ProtocolModel::message(const Entry &entry) const
+{
+    // if the error string is set, it's prefered because it is a usefull user message.
+    // at least should be...
+    if (!entry._errorString.isEmpty() || Progress::isWarningKind(entry._status)) {
+        return entry._errorString;
+    }
+    SyncFileItem item;
+    item._instruction = entry._instruction;
+    item._direction = entry._direction;
+    item._renameTarget = entry._renameTarget;
+    return Progress::asResultString(item);
+}
+
+QVariant ProtocolModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= _entries.count()) {
+        return QVariant();
+    }
+    const Entry &e = entry(index.row());
+
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(e._timestamp, false);
+        case FileColumn:
+            if (Utility::isMac()) {
+                QString name = e._file;
+                return name.replace(QChar(':'), QChar('/'));
+            }
+            return e._file;
+        case FolderColumn:
+            return e._folder;
+        case ActionColumn:
+            return message(e);
+        case SizeColumn:
+            if (!Progress::isWarningKind(e._status) && Progress::isSizeDependent(e._instruction)) {
+                return Utility::octetsToString(e._size);
+            }
+            return QVariant();
+        }
+        break;
+    case Qt::DecorationRole:
+        if (index.column() == TimeColumn && Progress::isWarningKind(e._status)) {
+            if (e._status == SyncFileItem::NormalError || e._status == SyncFileItem::FatalError) {
+                return Theme::instance()->syncStateIcon(SyncResult::Error);
+            }
+            return Theme::instance()->syncStateIcon(SyncResult::Problem);
+        }
+        break;
+    case Qt::ToolTipRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return timeString(e._timestamp, true);
+        case FileColumn:
+            return e._file;
+        case ActionColumn:
+            return message(e);
+        }
+        break;
+    case IgnoredIndicatorRole:
+        // Tell that we want to remove it on the next sync.
+        return e._status == SyncFileItem::FileIgnored;
+    }
+    return QVariant();
+}
+
+QVariant ProtocolModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    switch (section) {
+    case TimeColumn:
+        return tr("Time");
+    case FileColumn:
+        return tr("File");
+    case FolderColumn:
+        return tr("Folder");
+    case ActionColumn:
+        return tr("Action");
+    case SizeColumn:
+        return tr("Size");
+    }
+    return QVariant();
+}
+
+void ProtocolModel::addItem(const QString &folder, const SyncFileItem &item)
+{
+    Entry e;
+    e._file = item._file;
+    e._folder = folder;
+    e._renameTarget = item._renameTarget;
+    e._errorString = item._errorString;
+    e._size = item._size;
+    e._timestamp = QDateTime::currentMSecsSinceEpoch();
+    e._status = item._status;
+    e._direction = item._direction;
+    e._instruction = item._instruction;
+    _pending.append(e);
+
+    if (!_flushTimer.isActive()) {
+        _flushTimer.start();
+    }
+}
+
+void ProtocolModel::flush()
+{
+    _flushTimer.stop();
+    if (_pending.isEmpty()) {
+        return;
+    }
+
+    // Items that would be dropped right away are not inserted at all
+    const int capacity = _entries.capacity();
+    const int first = qMax(0, _pending.count() - capacity);
+    const int added = _pending.count() - first;
+
+    const int overflow = _entries.count() + added - capacity;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), _entries.count() - overflow, _entries.count() - 1);
+        for (int i = 0; i < overflow; ++i) {
+            _entries.removeFirst();
+        }
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), 0, added - 1);
+    for (int i = first; i < _pending.count(); ++i) {
+        _entries.append(_pending.at(i));
+    }
+    if (!_entries.areIndexesValid()) {
+        _entries.normalizeIndexes();
+    }
+    endInsertRows();
+
+    _pending.clear();
+}
+
+void ProtocolModel::removeIgnoredItems(const QString &folder)
+{
+    flush();
+
+    beginResetModel();
+    QContiguousCache<Entry> kept(_entries.capacity());
+    for (int i = _entries.firstIndex(); i <= _entries.lastIndex(); ++i) {
+        const Entry &e = _entries.at(i);
+        if (e._status != SyncFileItem::FileIgnored || e._folder != folder) {
+            kept.append(e);
+        }
+    }
+    _entries = kept;
+    endResetModel();
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PROTOCOLMODEL_H
+#define PROTOCOLMODEL_H
+
+#include <QAbstractTableModel>
+#include <QContiguousCache>
+#include <QTimer>
+#include <QVector>
+
+#include "syncfileitem.h"
+
+namespace OCC {
+
+/**
+ * @brief The list of completed items shown in the ProtocolWidget
+ *
+ * Only the newest maximumEntries() items are kept, as small records that are
+ * formatted when the view asks for them. The complete history of every sync
+ * run is in the sync log that SyncRunFileLog writes into each folder.
+ *
+ * The newest item is in the first row. New items are inserted in batches.
+ */
+class ProtocolModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column { TimeColumn, FileColumn, FolderColumn, ActionColumn, SizeColumn, ColumnCount };
+    enum Role { IgnoredIndicatorRole = Qt::UserRole + 1 };
+
+    explicit ProtocolModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role) const Q_DECL_OVERRIDE;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const Q_DECL_OVERRIDE;
+
+    /** Adds an item, it shows up with the next batch */
+    void addItem(const QString &folder, const SyncFileItem &item);
+
+    /** Removes the ignored items of \a folder, they are reported again by the next sync */
+    void removeIgnoredItems(const QString &folder);
+
+    static int maximumEntries();
+
+public slots:
+    /** Inserts the pending items now */
+    void flush();
+
+private:
+    struct Entry {
+        QString _file;
+        QString _folder;
+        QString _renameTarget;
+        QString _errorString;
+        quint64 _size;
+        qint64 _timestamp; // msecs since epoch
+        SyncFileItem::Status _status;
+        SyncFileItem::Direction _direction;
+        csync_instructions_e _instruction;
+    };
+
+    const Entry &entry(int row) const;
+    QString message(const Entry &entry) const;
+    QString timeString(qint64 timestamp, bool longFormat) const;
+
+    QContiguousCache<Entry> _entries; // oldest first
+    QVector<Entry> _pending;
+    QTimer _flushTimer;
+};
+
+}
+
+#endif // PROTOCOLMODEL_H
@@ -17,6 +17,7 @@
 #endif
 
 #include "protocolwidget.h"
+#include "protocolmodel.h"
 #include "configfile.h"
 #include "syncresult.h"
 #include "logger.h"
@@ -35,32 +36,24 @@ namespace OCC {
 
 ProtocolWidget::ProtocolWidget(QWidget *parent) :
     QWidget(parent),
-    IgnoredIndicatorRole( Qt::UserRole +1 ),
-    _ui(new Ui::ProtocolWidget)
+    _ui(new Ui::ProtocolWidget),
+    _model(new ProtocolModel(this))
 {
     _ui->setupUi(this);
 
     connect(ProgressDispatcher::instance(), SIGNAL(progressInfo(QString,Progress::Info)),
             this, SLOT(slotProgressInfo(QString,Progress::Info)));
+    connect(ProgressDispatcher::instance(), SIGNAL(jobCompleted(QString,SyncFileItem)),
+            this, SLOT(slotItemCompleted(QString,SyncFileItem)));
 
-    connect(_ui->_treeWidget, SIGNAL(itemActivated(QTreeWidgetItem*,int)), SLOT(slotOpenFile(QTreeWidgetItem*,int)));
-
-    // Adjust copyToClipboard() when making changes here!
-    QStringList header;
-    header << tr("Time");
-    header << tr("File");
-    header << tr("Folder");
-    header << tr("Action");
-    header << tr("Size");
-
-    _ui->_treeWidget->setHeaderLabels( header );
-    _ui->_treeWidget->setColumnWidth(1, 180);
-    _ui->_treeWidget->setColumnCount(5);
-    _ui->_treeWidget->setRootIsDecorated(false);
-    _ui->_treeWidget->setTextElideMode(Qt::ElideMiddle);
-    _ui->_treeWidget->header()->setObjectName("ActivityListHeader");
+    _ui->_treeView->setModel(_model);
+    connect(_ui->_treeView, SIGNAL(activated(QModelIndex)), SLOT(slotOpenFile(QModelIndex)));
+
+    _ui->_treeView->setColumnWidth(ProtocolModel::FileColumn, 180);
+    _ui->_treeView->setTextElideMode(Qt::ElideMiddle);
+    _ui->_treeView->header()->setObjectName("ActivityListHeader");
 #if defined(Q_OS_MAC)
-    _ui->_treeWidget->setMinimumWidth(400);
+    _ui->_treeView->setMinimumWidth(400);
 #endif
 
     connect(this, SIGNAL(guiLog(QString,QString)), Logger::instance(), SIGNAL(guiLog(QString,QString)));
@@ -75,13 +68,13 @@ ProtocolWidget::ProtocolWidget(QWidget *parent) :
     connect(_copyBtn, SIGNAL(clicked()), SLOT(copyToClipboard()));
 
     ConfigFile cfg;
-    cfg.restoreGeometryHeader(_ui->_treeWidget->header());
+    cfg.restoreGeometryHeader(_ui->_treeView->header());
 }
 
 ProtocolWidget::~ProtocolWidget()
 {
     ConfigFile cfg;
-    cfg.saveGeometryHeader(_ui->_treeWidget->header() );
+    cfg.saveGeometryHeader(_ui->_treeView->header() );
 
     delete _ui;
 }
@@ -91,27 +84,19 @@ void ProtocolWidget::copyToClipboard()
     QString text;
     QTextStream ts(&text);
 
-    int topLevelItems = _ui->_treeWidget->topLevelItemCount();
-    for (int i = 0; i < topLevelItems; i++) {
-        QTreeWidgetItem *child = _ui->_treeWidget->topLevelItem(i);
-        ts << left
-                // time stamp
-            << qSetFieldWidth(10)
-            << child->data(0,Qt::DisplayRole).toString()
-                // file name
-            << qSetFieldWidth(64)
-            << child->data(1,Qt::DisplayRole).toString()
-                // folder
-            << qSetFieldWidth(15)
-            << child->data(2, Qt::DisplayRole).toString()
-                // action
-            << qSetFieldWidth(15)
-            << child->data(3, Qt::DisplayRole).toString()
-                // size
-            << qSetFieldWidth(10)
-            << child->data(4, Qt::DisplayRole).toString()
-            << qSetFieldWidth(0)
-            << endl;
+    _model->flush();
+    // the field widths of the columns, in the order of ProtocolModel::Column
+    static const int widths[ProtocolModel::ColumnCount] = { 10, 64, 15, 15, 10 };
+
+    int rows = _model->rowCount();
+    for (int i = 0; i < rows; i++) {
+        ts << left;
+        for (int column = 0; column < ProtocolModel::ColumnCount; ++column) {
+            ts << qSetFieldWidth(widths[column])
+               << _model->data(_model->index(i, column), Qt::DisplayRole).toString();
+        }
+        ts << qSetFieldWidth(0)
+           << endl;
     }
 
     QApplication::clipboard()->setText(text);
@@ -137,48 +122,10 @@ void ProtocolWidget::slotRetrySync()
     folderMan->slotScheduleAllFolders();
 }
 
-void ProtocolWidget::cleanIgnoreItems(const QString& folder)
-{
-    int itemCnt = _ui->_treeWidget->topLevelItemCount();
-
-    // Limit the number of items
-    while(itemCnt > 2000) {
-        delete _ui->_treeWidget->takeTopLevelItem(itemCnt - 1);
-        itemCnt--;
-    }
-
-    for( int cnt = itemCnt-1; cnt >=0 ; cnt-- ) {
-        QTreeWidgetItem *item = _ui->_treeWidget->topLevelItem(cnt);
-        bool isErrorItem = item->data(0, IgnoredIndicatorRole).toBool();
-        QString itemFolder = item->data(2, Qt::DisplayRole).toString();
-        if( isErrorItem && itemFolder == folder ) {
-            delete item;
-        }
-    }
-}
-
-QString ProtocolWidget::timeString(QDateTime dt, QLocale::FormatType format) const
+void ProtocolWidget::slotOpenFile( const QModelIndex& index )
 {
-    QLocale loc = QLocale::system();
-    QString timeStr;
-    QDate today = QDate::currentDate();
-
-    if( format == QLocale::NarrowFormat ) {
-        if( dt.date().day() == today.day() ) {
-            timeStr = loc.toString(dt.time(), QLocale::NarrowFormat);
-        } else {
-            timeStr = loc.toString(dt, QLocale::NarrowFormat);
-        }
-    } else {
-        timeStr = loc.toString(dt, format);
-    }
-    return timeStr;
-}
-
-void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
-{
-    QString folderName = item->text(2);
-    QString fileName = item->text(1);
+    QString folderName = index.sibling(index.row(), ProtocolModel::FolderColumn).data().toString();
+    QString fileName = index.sibling(index.row(), ProtocolModel::FileColumn).data().toString();
 
     Folder *folder = FolderMan::instance()->folder(folderName);
     if (folder) {
@@ -190,63 +137,6 @@ void ProtocolWidget::slotOpenFile( QTreeWidgetItem *item, int )
     }
 }
 
-QString ProtocolWidget::fixupFilename( const QString& name )
-{
-    if( Utility::isMac() ) {
-        QString n(name);
-        return n.replace(QChar(':'), QChar('/'));
-    }
-    return name;
-}
-
-QTreeWidgetItem* ProtocolWidget::createCompletedTreewidgetItem(const QString& folder, const SyncFileItem& item)
-{
-    QStringList columns;
-    QDateTime timestamp = QDateTime::currentDateTime();
-    const QString timeStr = timeString(timestamp);
-    const QString longTimeStr = timeString(timestamp, QLocale::LongFormat);
-    QIcon icon;
-    QString message;
-
-    columns << timeStr;
-    columns << fixupFilename(item._file);
-    columns << folder;
-    if (Progress::isWarningKind(item._status)) {
-        message= item._errorString;
-        columns << message;
-        if (item._status == SyncFileItem::NormalError || item._status == SyncFileItem::FatalError) {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Error);
-        } else {
-            icon = Theme::instance()->syncStateIcon(SyncResult::Problem);
-        }
-
-    } else {
-        // if the error string is set, it's prefered because it is a usefull user message.
-        // at least should be...
-        if(item._errorString.isEmpty()) {
-            message = Progress::asResultString(item);
-        } else {
-            message = item._errorString;
-        }
-        columns << message;
-        if (Progress::isSizeDependent(item._instruction)) {
-            columns <<  Utility::octetsToString( item._size );
-        }
-    }
-
-    QTreeWidgetItem *twitem = new QTreeWidgetItem(columns);
-    if (item._status == SyncFileItem::FileIgnored) {
-        // Tell that we want to remove it on the next sync.
-        twitem->setData(0, IgnoredIndicatorRole, true);
-    }
-
-    twitem->setIcon(0, icon);
-    twitem->setToolTip(0, longTimeStr);
-    twitem->setToolTip(1, item._file);
-    twitem->setToolTip(3, message );
-    return twitem;
-}
-
 void ProtocolWidget::computeResyncButtonEnabled()
 {
     FolderMan *folderMan = FolderMan::instance();
@@ -276,21 +166,19 @@ void ProtocolWidget::slotProgressInfo( const QString& folder, const Progress::In
 {
     if( progress._completedFileCount == ULLONG_MAX ) {
         // The sync is restarting, clean the old items
-        cleanIgnoreItems(folder);
+        _model->removeIgnoredItems(folder);
         computeResyncButtonEnabled();
     } else if (progress._completedFileCount >= progress._totalFileCount) {
         //Sync completed
         computeResyncButtonEnabled();
     }
-    SyncFileItem last = progress._lastCompletedItem;
-    if (last.isEmpty()) return;
-
-    QTreeWidgetItem *item = createCompletedTreewidgetItem(folder, last);
-    if(item) {
-        _ui->_treeWidget->insertTopLevelItem(0, item);
-        if (!_copyBtn->isEnabled()) {
-            _copyBtn->setEnabled(true);
-        }
+}
+
+void ProtocolWidget::slotItemCompleted( const QString& folder, const SyncFileItem& item )
+{
+    _model->addItem(folder, item);
+    if (!_copyBtn->isEnabled()) {
+        _copyBtn->setEnabled(true);
     }
 }
 
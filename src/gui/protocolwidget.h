@@ -15,8 +15,6 @@
 #define PROTOCOLWIDGET_H
 
 #include <QDialog>
-#include <QDateTime>
-#include <QLocale>
 
 #include "progressdispatcher.h"
 
@@ -26,6 +24,7 @@ class QPushButton;
 
 namespace OCC {
 class SyncResult;
+class ProtocolModel;
 
 namespace Ui {
   class ProtocolWidget;
@@ -43,7 +42,8 @@ signals:
 
 public slots:
     void slotProgressInfo( const QString& folder, const Progress::Info& progress );
-    void slotOpenFile( QTreeWidgetItem* item, int );
+    void slotItemCompleted( const QString& folder, const SyncFileItem& item );
+    void slotOpenFile( const QModelIndex& index );
 
 protected slots:
     void copyToClipboard();
@@ -54,17 +54,10 @@ signals:
 
 private:
     void setSyncResultStatus(const SyncResult& result );
-    void cleanIgnoreItems( const QString& folder );
     void computeResyncButtonEnabled();
-    QString fixupFilename( const QString& name );
 
-
-    QTreeWidgetItem* createCompletedTreewidgetItem(const QString &folder, const SyncFileItem &item );
-
-    QString timeString(QDateTime dt, QLocale::FormatType format = QLocale::NarrowFormat) const;
-
-    const int IgnoredIndicatorRole;
     Ui::ProtocolWidget *_ui;
+    ProtocolModel *_model;
     QPushButton *_retrySyncBtn;
     QPushButton *_copyBtn;
 };
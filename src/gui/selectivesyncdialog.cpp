@@ -27,9 +27,27 @@
 #include <QSettings>
 #include <QScopedValueRollback>
 #include <QLabel>
+#include <QSet>
 
 namespace OCC {
 
+namespace {
+// Set on the items whose subfolders were requested
+const int LoadedRole = Qt::UserRole + 1;
+
+const char directoryPropertyC[] = "owncloud_selective_sync_directory";
+
+struct DirectoryListing {
+    QStringList subfolders; // as reported by the LsColJob
+    QHash<QString, qint64> sizes;
+};
+
+// The listings are kept while the client runs: a dialog that is opened
+// again shows them right away and updates them when the server replies.
+typedef QHash<QString, DirectoryListing> ListingCache;
+Q_GLOBAL_STATIC(ListingCache, listingCache)
+}
+
 SelectiveSyncTreeView::SelectiveSyncTreeView(AccountPtr account, QWidget* parent)
     : QTreeWidget(parent), _inserting(false), _account(account)
 {
@@ -55,15 +73,11 @@ QSize SelectiveSyncTreeView::sizeHint() const
 
 void SelectiveSyncTreeView::refreshFolders()
 {
-    LsColJob *job = new LsColJob(_account, _folderPath, this);
-    connect(job, SIGNAL(directoryListingSubfolders(QStringList)),
-            this, SLOT(slotUpdateDirectories(QStringList)));
-    connect(job, SIGNAL(finishedWithError(QNetworkReply*)),
-            this, SLOT(slotLscolFinishedWithError(QNetworkReply*)));
-    job->start();
     clear();
+    _itemsByPath.clear();
     _loading->show();
     _loading->move(10,header()->height() + 10);
+    loadDirectory(QString());
 }
 
 void SelectiveSyncTreeView::setFolderInfo(const QString& folderPath, const QString& rootName, const QStringList& oldBlackList)
@@ -78,62 +92,56 @@ void SelectiveSyncTreeView::setFolderInfo(const QString& folderPath, const QStri
     refreshFolders();
 }
 
-static QTreeWidgetItem* findFirstChild(QTreeWidgetItem *parent, const QString& text)
+QString SelectiveSyncTreeView::listingKey(const QString &path) const
 {
-    for (int i = 0; i < parent->childCount(); ++i) {
-        QTreeWidgetItem *child = parent->child(i);
-        if (child->text(0) == text) {
-            return child;
-        }
-    }
-    return 0;
+    return Account::concatUrlPath(_account->davUrl(), path).toString();
 }
 
-void SelectiveSyncTreeView::recursiveInsert(QTreeWidgetItem* parent, QStringList pathTrail, QString path, qint64 size)
+void SelectiveSyncTreeView::loadDirectory(const QString &dir)
 {
-    QFileIconProvider prov;
-    QIcon folderIcon = prov.icon(QFileIconProvider::Folder);
-    if (pathTrail.size() == 0) {
-        if (path.endsWith('/')) {
-            path.chop(1);
-        }
-        parent->setToolTip(0, path);
-        parent->setData(0, Qt::UserRole, path);
-    } else {
-        QTreeWidgetItem *item = findFirstChild(parent, pathTrail.first());
-        if (!item) {
-            item = new QTreeWidgetItem(parent);
-            if (parent->checkState(0) == Qt::Checked
-                    || parent->checkState(0) == Qt::PartiallyChecked) {
-                item->setCheckState(0, Qt::Checked);
-                foreach(const QString &str , _oldBlackList) {
-                    if (str == path || str == QLatin1String("/")) {
-                        item->setCheckState(0, Qt::Unchecked);
-                        break;
-                    } else if (str.startsWith(path)) {
-                        item->setCheckState(0, Qt::PartiallyChecked);
-                    }
-                }
-            } else if (parent->checkState(0) == Qt::Unchecked) {
-                item->setCheckState(0, Qt::Unchecked);
-            }
-            item->setIcon(0, folderIcon);
-            item->setText(0, pathTrail.first());
-            item->setText(1, Utility::octetsToString(size));
-            item->setData(1, Qt::UserRole, size);
-//            item->setData(0, Qt::UserRole, pathTrail.first());
-            item->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+    QString path = _folderPath;
+    if (!dir.isEmpty()) {
+        if (!path.isEmpty()) {
+            path += QLatin1Char('/');
         }
+        path += dir;
+    }
 
-        pathTrail.removeFirst();
-        recursiveInsert(item, pathTrail, path, size);
+    // Show the listing of the last time right away, the reply updates it
+    ListingCache::const_iterator cached = listingCache()->constFind(listingKey(path));
+    if (cached != listingCache()->constEnd()) {
+        insertListing(dir, cached->subfolders, cached->sizes);
     }
+
+    LsColJob *job = new LsColJob(_account, path, this);
+    job->setProperties(QList<QByteArray>() << "resourcetype" << "quota-used-bytes");
+    job->setProperty(directoryPropertyC, dir);
+    connect(job, SIGNAL(directoryListingSubfolders(QStringList)),
+            this, SLOT(slotUpdateDirectories(QStringList)));
+    if (dir.isEmpty()) {
+        connect(job, SIGNAL(finishedWithError(QNetworkReply*)),
+                this, SLOT(slotLscolFinishedWithError(QNetworkReply*)));
+    }
+    job->start();
 }
 
 void SelectiveSyncTreeView::slotUpdateDirectories(const QStringList&list)
 {
     auto job = qobject_cast<LsColJob *>(sender());
+    if (!job) {
+        return;
+    }
+
+    DirectoryListing listing;
+    listing.subfolders = list;
+    listing.sizes = job->_sizes;
+    listingCache()->insert(listingKey(job->path()), listing);
 
+    insertListing(job->property(directoryPropertyC).toString(), list, job->_sizes);
+}
+
+void SelectiveSyncTreeView::insertListing(const QString &dir, const QStringList &list, const QHash<QString, qint64> &sizes)
+{
     QScopedValueRollback<bool> isInserting(_inserting);
     _inserting = true;
 
@@ -157,6 +165,13 @@ void SelectiveSyncTreeView::slotUpdateDirectories(const QStringList&list)
         } else {
             root->setCheckState(0, Qt::PartiallyChecked);
         }
+        _itemsByPath.insert(QString(), root);
+    }
+
+    QTreeWidgetItem *parent = _itemsByPath.value(dir);
+    if (!parent) {
+        // the tree was refreshed since the listing was requested
+        return;
     }
 
     QUrl url = _account->davUrl();
@@ -168,24 +183,89 @@ void SelectiveSyncTreeView::slotUpdateDirectories(const QStringList&list)
     if (!_folderPath.isEmpty())
         pathToRemove.append('/');
 
+    QFileIconProvider prov;
+    QIcon folderIcon = prov.icon(QFileIconProvider::Folder);
+
+    // Sorting after each insertion would be slow
+    setSortingEnabled(false);
+
+    QSet<QString> listed;
     foreach (QString path, list) {
-        auto size = job ? job->_sizes.value(path) : 0;
+        auto size = sizes.value(path);
         path.remove(pathToRemove);
-        QStringList paths = path.split('/');
-        if (paths.last().isEmpty()) paths.removeLast();
-        if (paths.isEmpty())
+        if (path.endsWith('/')) {
+            path.chop(1);
+        }
+        if (path.isEmpty() || path == dir) {
+            // the listed directory itself
             continue;
-        if (!path.endsWith('/')) {
-            path.append('/');
         }
-        recursiveInsert(root, paths, path, size);
+        listed.insert(path);
+
+        QTreeWidgetItem *item = _itemsByPath.value(path);
+        if (!item) {
+            item = new QTreeWidgetItem(parent);
+            if (parent->checkState(0) == Qt::Checked
+                    || parent->checkState(0) == Qt::PartiallyChecked) {
+                item->setCheckState(0, Qt::Checked);
+                const QString blackListPath = path + QLatin1Char('/');
+                foreach(const QString &str , _oldBlackList) {
+                    if (str == blackListPath || str == QLatin1String("/")) {
+                        item->setCheckState(0, Qt::Unchecked);
+                        break;
+                    } else if (str.startsWith(blackListPath)) {
+                        item->setCheckState(0, Qt::PartiallyChecked);
+                    }
+                }
+            } else if (parent->checkState(0) == Qt::Unchecked) {
+                item->setCheckState(0, Qt::Unchecked);
+            }
+            item->setIcon(0, folderIcon);
+            item->setText(0, path.section(QLatin1Char('/'), -1));
+            item->setToolTip(0, path);
+            item->setData(0, Qt::UserRole, path);
+            item->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+            _itemsByPath.insert(path, item);
+        }
+        item->setText(1, Utility::octetsToString(size));
+        item->setData(1, Qt::UserRole, size);
+    }
+
+    // Remove the folders that are gone from the server
+    for (int i = parent->childCount() - 1; i >= 0; --i) {
+        QTreeWidgetItem *child = parent->child(i);
+        if (!listed.contains(child->data(0, Qt::UserRole).toString())) {
+            removeItem(child);
+        }
+    }
+    if (parent != root && parent->childCount() == 0) {
+        parent->setChildIndicatorPolicy(QTreeWidgetItem::DontShowIndicator);
     }
 
+    setSortingEnabled(true);
     root->setExpanded(true);
 }
 
+void SelectiveSyncTreeView::removeItem(QTreeWidgetItem *item)
+{
+    QList<QTreeWidgetItem *> items;
+    items.append(item);
+    while (!items.isEmpty()) {
+        QTreeWidgetItem *it = items.takeLast();
+        _itemsByPath.remove(it->data(0, Qt::UserRole).toString());
+        for (int i = 0; i < it->childCount(); ++i) {
+            items.append(it->child(i));
+        }
+    }
+    delete item;
+}
+
 void SelectiveSyncTreeView::slotLscolFinishedWithError(QNetworkReply *r)
 {
+    if (topLevelItem(0)) {
+        // a listing from the last time is shown
+        return;
+    }
     if (r->error() == QNetworkReply::ContentNotFoundError) {
         _loading->setText(tr("No subfolders currently on the server."));
     } else {
@@ -197,15 +277,15 @@ void SelectiveSyncTreeView::slotLscolFinishedWithError(QNetworkReply *r)
 void SelectiveSyncTreeView::slotItemExpanded(QTreeWidgetItem *item)
 {
     QString dir = item->data(0, Qt::UserRole).toString();
-    if (dir.isEmpty()) return;
-    QString prefix;
-    if (!_folderPath.isEmpty()) {
-        prefix = _folderPath + QLatin1Char('/');
+    if (dir.isEmpty() || item->data(0, LoadedRole).toBool()) return;
+
+    // Each level is loaded once, when it is expanded for the first time
+    {
+        QScopedValueRollback<bool> isInserting(_inserting);
+        _inserting = true;
+        item->setData(0, LoadedRole, true);
     }
-    LsColJob *job = new LsColJob(_account, prefix + dir, this);
-    connect(job, SIGNAL(directoryListingSubfolders(QStringList)),
-            SLOT(slotUpdateDirectories(QStringList)));
-    job->start();
+    loadDirectory(dir);
 }
 
 void SelectiveSyncTreeView::slotItemChanged(QTreeWidgetItem *item, int col)
@@ -15,6 +15,7 @@
 #pragma once
 #include <QDialog>
 #include <QTreeWidget>
+#include <QHash>
 #include "accountfwd.h"
 
 class QTreeWidgetItem;
@@ -48,11 +49,17 @@ private slots:
     void slotItemChanged(QTreeWidgetItem*,int);
     void slotLscolFinishedWithError(QNetworkReply*);
 private:
-    void recursiveInsert(QTreeWidgetItem* parent, QStringList pathTrail, QString path, qint64 size);
+    /// Lists the subfolders of dir, which is relative to the folder path
+    void loadDirectory(const QString &dir);
+    void insertListing(const QString &dir, const QStringList &list, const QHash<QString, qint64> &sizes);
+    void removeItem(QTreeWidgetItem *item);
+    QString listingKey(const QString &path) const;
+
     QString _folderPath;
     QString _rootName;
     QStringList _oldBlackList;
     bool _inserting; // set to true when we are inserting new items on the list
+    QHash<QString, QTreeWidgetItem*> _itemsByPath; // keyed by the path relative to the folder path
     AccountPtr _account;
     QLabel *_loading;
 };
@@ -111,6 +111,8 @@ SettingsDialog::SettingsDialog(ownCloudGui *gui, QWidget *parent) :
 
     connect( ProgressDispatcher::instance(), SIGNAL(progressInfo(QString, Progress::Info)),
              _accountSettings, SLOT(slotSetProgress(QString, Progress::Info)) );
+    connect( ProgressDispatcher::instance(), SIGNAL(jobCompleted(QString,SyncFileItem)),
+             _accountSettings, SLOT(slotItemCompleted(QString,SyncFileItem)) );
 
 
     // default to Account
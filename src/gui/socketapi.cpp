@@ -24,6 +24,7 @@
 #include "syncfileitem.h"
 #include "filesystem.h"
 #include "version.h"
+#include "syncmetrics.h"
 
 #include <QDebug>
 #include <QUrl>
@@ -423,11 +424,46 @@ void SocketApi::command_SHARE(const QString& localFile, SocketType* socket)
     }
 }
 
+void SocketApi::command_SYNC_NOW(const QString& localFile, SocketType* socket)
+{
+    if (!socket) {
+        qDebug() << Q_FUNC_INFO << "No valid socket object.";
+        return;
+    }
+
+    qDebug() << Q_FUNC_INFO << localFile;
+
+    Folder *folder = FolderMan::instance()->folderForPath(localFile);
+    if (!folder) {
+        // files that are not within a sync folder are not synced.
+        sendMessage(socket, QLatin1String("SYNC_NOW:NOP:") + QDir::toNativeSeparators(localFile));
+        return;
+    }
+
+    const QString folderPath = QDir::cleanPath(folder->path());
+    QString relativePath = QDir::cleanPath(localFile).mid(folderPath.length());
+    while (relativePath.startsWith(QLatin1Char('/'))) {
+        relativePath.remove(0, 1);
+    }
+
+    folder->prioritizePath(relativePath);
+    if (!folder->isBusy()) {
+        FolderMan::instance()->slotScheduleSync(folder->alias());
+    }
+    sendMessage(socket, QLatin1String("SYNC_NOW:OK:") + QDir::toNativeSeparators(localFile));
+}
+
 void SocketApi::command_VERSION(const QString&, SocketType* socket)
 {
     sendMessage(socket, QLatin1String("VERSION:" MIRALL_VERSION_STRING ":" MIRALL_SOCKET_API_VERSION));
 }
 
+void SocketApi::command_METRICS(const QString&, SocketType* socket)
+{
+    // The JSON is on one line, so that it fits into the line based protocol
+    sendMessage(socket, QLatin1String("METRICS:") + QString::fromUtf8(SyncMetrics::toJson()));
+}
+
 void SocketApi::command_SHARE_MENU_TITLE(const QString &, SocketType* socket)
 {
     sendMessage(socket, QLatin1String("SHARE_MENU_TITLE:") + tr("Share with %1", "parameter is ownCloud").arg(Theme::instance()->appNameGUI()));
@@ -79,8 +79,10 @@ private:
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString& argument, SocketType* socket);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString& argument, SocketType* socket);
     Q_INVOKABLE void command_SHARE(const QString& localFile, SocketType* socket);
+    Q_INVOKABLE void command_SYNC_NOW(const QString& localFile, SocketType* socket);
 
     Q_INVOKABLE void command_VERSION(const QString& argument, SocketType* socket);
+    Q_INVOKABLE void command_METRICS(const QString& argument, SocketType* socket);
 
     Q_INVOKABLE void command_SHARE_MENU_TITLE(const QString& argument, SocketType* socket);
 
@@ -84,7 +84,7 @@ QString SyncRunFileLog::instructionToStr( csync_instructions_e inst )
 }
 
 
-void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch &stopWatch )
+void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch &stopWatch, qint64 discoveryPeakMemory )
 {
     const qint64 logfileMaxSize = 1024*1024; // 1MiB
 
@@ -120,7 +120,11 @@ void SyncRunFileLog::start(const QString &folderPath,  const Utility::StopWatch
 
 
     _out << "#=#=#=# Syncrun started " << dateTimeStr(dt) << " until " << dateTimeStr(de) << " ("
-            << stopWatch.durationOfLap(QLatin1String("Sync Finished")) << " msec)" << endl;
+            << stopWatch.durationOfLap(QLatin1String("Sync Finished")) << " msec)";
+    if (discoveryPeakMemory > 0) {
+        _out << " discovery peak memory " << discoveryPeakMemory << " bytes";
+    }
+    _out << endl;
 }
 
 void SyncRunFileLog::logItem( const SyncFileItem& item )
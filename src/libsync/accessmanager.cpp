@@ -32,6 +32,7 @@ namespace OCC
 
 AccessManager::AccessManager(QObject* parent)
     : QNetworkAccessManager (parent)
+    , _activeRequests(0)
 {
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0) && defined(Q_OS_MAC)
     // FIXME Workaround http://stackoverflow.com/a/15707366/2941 https://bugreports.qt-project.org/browse/QTBUG-30434
@@ -44,7 +45,8 @@ AccessManager::AccessManager(QObject* parent)
             this, SLOT(slotProxyAuthenticationRequired(QNetworkProxy,QAuthenticator*)));
     connect(this, SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)),
             this, SLOT(slotAuthenticationRequired(QNetworkReply*,QAuthenticator*)));
-
+    connect(this, SIGNAL(finished(QNetworkReply*)),
+            this, SLOT(slotRequestFinished()));
 }
 
 void AccessManager::setRawCookie(const QByteArray &rawCookie, const  QUrl &url)
@@ -75,9 +77,15 @@ QNetworkReply* AccessManager::createRequest(QNetworkAccessManager::Operation op,
     if (verb == "PROPFIND") {
         newRequest.setHeader( QNetworkRequest::ContentTypeHeader, QLatin1String("text/xml; charset=utf-8"));
     }
+    _activeRequests++;
     return QNetworkAccessManager::createRequest(op, newRequest, outgoingData);
 }
 
+void AccessManager::slotRequestFinished()
+{
+    _activeRequests--;
+}
+
 void AccessManager::slotProxyAuthenticationRequired(const QNetworkProxy &proxy, QAuthenticator *authenticator)
 {
     Q_UNUSED(authenticator);
@@ -32,12 +32,18 @@ public:
 
     void setRawCookie(const  QByteArray &rawCookie, const  QUrl &url);
 
+    /** The number of requests that did not finish yet */
+    int activeRequests() const { return _activeRequests; }
+
 protected:
     QNetworkReply* createRequest(QNetworkAccessManager::Operation op, const QNetworkRequest& request, QIODevice* outgoingData = 0) Q_DECL_OVERRIDE;
 protected slots:
     void slotProxyAuthenticationRequired(const QNetworkProxy &proxy, QAuthenticator *authenticator);
     void slotAuthenticationRequired(QNetworkReply *reply, QAuthenticator *authenticator);
-
+private slots:
+    void slotRequestFinished();
+private:
+    int _activeRequests;
 };
 
 } // namespace OCC
@@ -18,6 +18,7 @@
 #include "configfile.h"
 #include "accessmanager.h"
 #include "owncloudtheme.h"
+#include "syncmetrics.h"
 #include "creds/abstractcredentials.h"
 #include "creds/credentialsfactory.h"
 #include "../3rdparty/certificates/p12topem.h"
@@ -39,6 +40,11 @@ static const char urlC[] = "url";
 static const char authTypeC[] = "authType";
 static const char userC[] = "user";
 static const char caCertsKeyC[] = "CaCertificates";
+// Where earlier versions stored TLS session tickets, they are removed on start
+static const char sslSessionGroupC[] = "SslSessions";
+
+// A network access manager opens at most this many connections to a host
+static const int connectionsPerManager = 6;
 
 AccountManager *AccountManager::_instance = 0;
 
@@ -70,6 +76,10 @@ Account::Account(QObject *parent)
     : QObject(parent)
     , _url(Theme::instance()->overrideServerUrl())
     , _am(0)
+    , _discoveryAm(0)
+    , _parallelTransfers(0)
+    , _uploadFeaturesKnown(false)
+    , _maxBundledFiles(0)
     , _credentials(0)
     , _treatSslErrorsAsFailure(false)
     , _davPath("/")
@@ -88,6 +98,8 @@ Account::~Account()
 {
     delete _credentials;
     delete _am;
+    delete _discoveryAm;
+    qDeleteAll(_transferAms);
 }
 
 void Account::setSharedThis(AccountPtr sharedThis)
@@ -159,6 +171,12 @@ AccountPtr Account::restore()
     // now the cert, it is in the general group
     settings->beginGroup(QLatin1String("General"));
     acc->setApprovedCerts(QSslCertificate::fromData(settings->value(caCertsKeyC).toByteArray()));
+    settings->endGroup();
+    settings->endGroup();
+
+    // A session ticket is as good as a key to the session, it is only kept in memory
+    QScopedPointer<QSettings> sslSessions(settingsWithGroup(QLatin1String(sslSessionGroupC)));
+    sslSessions->remove(QString());
 
     return acc;
 }
@@ -199,25 +217,58 @@ void Account::setCredentials(AbstractCredentials *cred)
     if (_am) {
         jar = _am->cookieJar();
         jar->setParent(0);
-
-        _am->deleteLater();
     }
+    foreach (QNetworkAccessManager *am, networkAccessManagers()) {
+        am->deleteLater();
+    }
+    _am = 0;
+    _discoveryAm = 0;
+    _transferAms.clear();
 
     if (_credentials) {
         credentials()->deleteLater();
     }
     cred->setAccount(this);
     _credentials = cred;
-    _am = _credentials->getQNAM();
+    _am = createNetworkAccessManager();
     if (jar) {
         _am->setCookieJar(jar);
     }
-    connect(_am, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),
-            SLOT(slotHandleErrors(QNetworkReply*,QList<QSslError>)));
+    // The lanes share the cookie jar, it belongs to the account
+    _am->cookieJar()->setParent(this);
     connect(_credentials, SIGNAL(fetched()),
             SLOT(slotCredentialsFetched()));
 }
 
+QNetworkAccessManager *Account::createNetworkAccessManager()
+{
+    QNetworkAccessManager *am = _credentials->getQNAM();
+    if (_am) {
+        QNetworkCookieJar *jar = _am->cookieJar();
+        am->setCookieJar(jar);
+        jar->setParent(this);
+    }
+    connect(am, SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),
+            SLOT(slotHandleErrors(QNetworkReply*,QList<QSslError>)));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+    connect(am, SIGNAL(encrypted(QNetworkReply*)),
+            SLOT(slotEncrypted(QNetworkReply*)));
+#endif
+    return am;
+}
+
+QList<QNetworkAccessManager *> Account::networkAccessManagers() const
+{
+    QList<QNetworkAccessManager *> ams = _transferAms;
+    if (_am) {
+        ams.prepend(_am);
+    }
+    if (_discoveryAm) {
+        ams.prepend(_discoveryAm);
+    }
+    return ams;
+}
+
 QUrl Account::davUrl() const
 {
     return concatUrlPath(url(), davPath());
@@ -230,47 +281,132 @@ QList<QNetworkCookie> Account::lastAuthCookies() const
 
 void Account::clearCookieJar()
 {
-    _am->setCookieJar(new CookieJar);
+    QNetworkCookieJar *oldJar = _am->cookieJar();
+    QNetworkCookieJar *jar = new CookieJar;
+    foreach (QNetworkAccessManager *am, networkAccessManagers()) {
+        am->setCookieJar(jar);
+    }
+    jar->setParent(this);
+    oldJar->deleteLater();
 }
 
-QNetworkAccessManager *Account::networkAccessManager()
+QNetworkAccessManager *Account::networkAccessManager(NetworkLane lane)
 {
+    if (!_credentials) {
+        return _am;
+    }
+    switch (lane) {
+    case DiscoveryLane:
+        if (!_discoveryAm) {
+            _discoveryAm = createNetworkAccessManager();
+        }
+        return _discoveryAm;
+    case TransferLane:
+        return transferNetworkAccessManager();
+    case MetadataLane:
+        break;
+    }
     return _am;
 }
 
-QNetworkReply *Account::headRequest(const QString &relPath)
+QNetworkAccessManager *Account::transferNetworkAccessManager()
+{
+    int wanted = qMax(1, (_parallelTransfers + connectionsPerManager - 1) / connectionsPerManager);
+    while (_transferAms.count() < wanted) {
+        _transferAms.append(createNetworkAccessManager());
+    }
+
+    // Use the one with the fewest running requests
+    QNetworkAccessManager *best = 0;
+    int bestActive = 0;
+    foreach (QNetworkAccessManager *am, _transferAms) {
+        AccessManager *accessManager = qobject_cast<AccessManager *>(am);
+        int active = accessManager ? accessManager->activeRequests() : 0;
+        if (!best || active < bestActive) {
+            best = am;
+            bestActive = active;
+        }
+    }
+    return best;
+}
+
+void Account::setParallelTransfers(int count)
+{
+    _parallelTransfers = count;
+}
+
+void Account::warmUpConnections()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
+    if (!_credentials || _url.host().isEmpty()) {
+        return;
+    }
+    QList<QNetworkAccessManager *> ams;
+    ams << networkAccessManager(DiscoveryLane)
+        << networkAccessManager(MetadataLane)
+        << networkAccessManager(TransferLane);
+    foreach (QNetworkAccessManager *am, ams) {
+        if (_url.scheme() == QLatin1String("https")) {
+            am->connectToHostEncrypted(_url.host(), _url.port(443), createSslConfig());
+        } else {
+            am->connectToHost(_url.host(), _url.port(80));
+        }
+    }
+    SyncMetrics::addToCounter("network.warmups");
+#endif
+}
+
+void Account::slotEncrypted(QNetworkReply *reply)
+{
+    // Qt does not tell whether the session was resumed, so this counts both
+    SyncMetrics::addToCounter("network.tls_sessions");
+#if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
+    // Keep the session so that the connections of the other lanes, and new
+    // connections later on, can resume it instead of doing a full handshake
+    QByteArray ticket = reply->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        _sslSessionTicket = ticket;
+    }
+#else
+    Q_UNUSED(reply)
+#endif
+}
+
+QNetworkReply *Account::headRequest(const QString &relPath, NetworkLane lane)
 {
-    return headRequest(concatUrlPath(url(), relPath));
+    return headRequest(concatUrlPath(url(), relPath), lane);
 }
 
-QNetworkReply *Account::headRequest(const QUrl &url)
+QNetworkReply *Account::headRequest(const QUrl &url, NetworkLane lane)
 {
     QNetworkRequest request(url);
-    return _am->head(request);
+    return networkAccessManager(lane)->head(request);
 }
 
-QNetworkReply *Account::getRequest(const QString &relPath)
+QNetworkReply *Account::getRequest(const QString &relPath, NetworkLane lane)
 {
-    return getRequest(concatUrlPath(url(), relPath));
+    return getRequest(concatUrlPath(url(), relPath), lane);
 }
 
-QNetworkReply *Account::getRequest(const QUrl &url)
+QNetworkReply *Account::getRequest(const QUrl &url, NetworkLane lane)
 {
     QNetworkRequest request(url);
     request.setSslConfiguration(this->createSslConfig());
-    return _am->get(request);
+    return networkAccessManager(lane)->get(request);
 }
 
-QNetworkReply *Account::davRequest(const QByteArray &verb, const QString &relPath, QNetworkRequest req, QIODevice *data)
+QNetworkReply *Account::davRequest(const QByteArray &verb, const QString &relPath, QNetworkRequest req, QIODevice *data,
+                                   NetworkLane lane)
 {
-    return davRequest(verb, concatUrlPath(davUrl(), relPath), req, data);
+    return davRequest(verb, concatUrlPath(davUrl(), relPath), req, data, lane);
 }
 
-QNetworkReply *Account::davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data)
+QNetworkReply *Account::davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data,
+                                   NetworkLane lane)
 {
     req.setUrl(url);
     req.setSslConfiguration(this->createSslConfig());
-    return _am->sendCustomRequest(req, verb, data);
+    return networkAccessManager(lane)->sendCustomRequest(req, verb, data);
 }
 
 void Account::setCertificate(const QByteArray certficate, const QString privateKey)
@@ -319,6 +455,17 @@ QSslConfiguration Account::createSslConfig()
         qDebug() << "Added SSL client certificate to the query";
     }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
+    // Allow the session to be resumed by the other connections
+    if (sslConfig.isNull()) {
+        sslConfig = QSslConfiguration::defaultConfiguration();
+    }
+    sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    if (!_sslSessionTicket.isEmpty()) {
+        sslConfig.setSessionTicket(_sslSessionTicket);
+    }
+#endif
+
     return sslConfig;
 }
 
@@ -340,6 +487,15 @@ void Account::setSslErrorHandler(AbstractSslErrorHandler *handler)
 void Account::setUrl(const QUrl &url)
 {
     _url = url;
+    // A different server might not support the same
+    _uploadFeaturesKnown = false;
+}
+
+void Account::setUploadFeatures(int maxBundledFiles, const QByteArray &acceptEncoding)
+{
+    _uploadFeaturesKnown = true;
+    _maxBundledFiles = maxBundledFiles;
+    _uploadAcceptEncoding = acceptEncoding;
 }
 
 void Account::setUser(const QString &user)
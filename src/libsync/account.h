@@ -71,6 +71,17 @@ public:
 class OWNCLOUDSYNC_EXPORT Account : public QObject {
     Q_OBJECT
 public:
+    /**
+     * The requests are spread over several network access managers, each
+     * with connections of its own, so that file transfers don't hold up
+     * the discovery or the small requests.
+     */
+    enum NetworkLane {
+        MetadataLane,  ///< MKCOL, MOVE, DELETE and all other short requests
+        DiscoveryLane, ///< The PROPFINDs of the remote discovery
+        TransferLane   ///< GET and PUT of file contents
+    };
+
     QString davPath() const { return _davPath; }
     void setDavPath(const QString&s) { _davPath = s; }
 
@@ -114,12 +125,14 @@ public:
 
     QList<QNetworkCookie> lastAuthCookies() const;
 
-    QNetworkReply* headRequest(const QString &relPath);
-    QNetworkReply* headRequest(const QUrl &url);
-    QNetworkReply* getRequest(const QString &relPath);
-    QNetworkReply* getRequest(const QUrl &url);
-    QNetworkReply* davRequest(const QByteArray &verb, const QString &relPath, QNetworkRequest req, QIODevice *data = 0);
-    QNetworkReply* davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data = 0);
+    QNetworkReply* headRequest(const QString &relPath, NetworkLane lane = MetadataLane);
+    QNetworkReply* headRequest(const QUrl &url, NetworkLane lane = MetadataLane);
+    QNetworkReply* getRequest(const QString &relPath, NetworkLane lane = MetadataLane);
+    QNetworkReply* getRequest(const QUrl &url, NetworkLane lane = MetadataLane);
+    QNetworkReply* davRequest(const QByteArray &verb, const QString &relPath, QNetworkRequest req, QIODevice *data = 0,
+                              NetworkLane lane = MetadataLane);
+    QNetworkReply* davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data = 0,
+                              NetworkLane lane = MetadataLane);
 
     /** The ssl configuration during the first connection */
     QSslConfiguration createSslConfig();
@@ -149,7 +162,29 @@ public:
 
     void clearCookieJar();
 
-    QNetworkAccessManager* networkAccessManager();
+    QNetworkAccessManager* networkAccessManager(NetworkLane lane = MetadataLane);
+
+    /**
+     * The number of transfers that may run in parallel. A network access
+     * manager opens at most six connections to a host, so the transfer lane
+     * uses as many of them as needed.
+     */
+    void setParallelTransfers(int count);
+
+    /**
+     * Opens a connection in every lane ahead of the requests, called when a
+     * sync is scheduled so that the handshakes are done when it starts.
+     */
+    void warmUpConnections();
+
+    /**
+     * What the server announced for uploads in its OPTIONS reply, see
+     * CheckUploadFeaturesJob. Kept so that it is only asked once per server.
+     */
+    bool uploadFeaturesKnown() const { return _uploadFeaturesKnown; }
+    int maxBundledFiles() const { return _maxBundledFiles; }
+    QByteArray uploadAcceptEncoding() const { return _uploadAcceptEncoding; }
+    void setUploadFeatures(int maxBundledFiles, const QByteArray &acceptEncoding);
 
     /// Called by network jobs on credential errors.
     void handleInvalidCredentials();
@@ -162,9 +197,13 @@ signals:
 protected Q_SLOTS:
     void slotHandleErrors(QNetworkReply*,QList<QSslError>);
     void slotCredentialsFetched();
+    void slotEncrypted(QNetworkReply *reply);
 
 private:
     Account(QObject *parent = 0);
+    QNetworkAccessManager *createNetworkAccessManager();
+    QNetworkAccessManager *transferNetworkAccessManager();
+    QList<QNetworkAccessManager *> networkAccessManagers() const;
 
     QWeakPointer<Account> _sharedThis;
     QMap<QString, QVariant> _settingsMap;
@@ -174,7 +213,14 @@ private:
     QSslConfiguration _sslConfiguration;
     QScopedPointer<AbstractSslErrorHandler> _sslErrorHandler;
     QuotaInfo *_quotaInfo;
-    QNetworkAccessManager *_am;
+    QNetworkAccessManager *_am; // the metadata lane
+    QNetworkAccessManager *_discoveryAm;
+    QList<QNetworkAccessManager *> _transferAms;
+    int _parallelTransfers;
+    bool _uploadFeaturesKnown;
+    int _maxBundledFiles;
+    QByteArray _uploadAcceptEncoding;
+    QByteArray _sslSessionTicket; // resumes the TLS session, never written to the config
     AbstractCredentials* _credentials;
     bool _treatSslErrorsAsFailure;
     int _state;
@@ -16,6 +16,7 @@
 #include "propagatedownload.h"
 #include "propagateupload.h"
 #include "propagatorjobs.h"
+#include "syncmetrics.h"
 #include "utility.h"
 
 #ifdef Q_OS_WIN
@@ -25,6 +26,7 @@
 
 #include <QTimer>
 #include <QObject>
+#include <QDebug>
 
 namespace OCC {
 
@@ -34,380 +36,386 @@ namespace OCC {
 static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000*2;
 // See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
 
+// Waiting consumers are woken up at least that often.
+static const qint64 wakeUpIntervalMsec = 50;
+// The bucket holds at most that much time worth of tokens.
+static const qint64 burstMsec = 100;
+// Don't hand out less than that (unless less is wanted), to avoid tiny reads.
+static const qint64 minimumGrant = 1024;
+
 // FIXME At some point:
 //  * Register device only after the QNR received its metaDataChanged() signal
 //  * Incorporate Qt buffer fill state (it's a negative absolute delta).
 //  * Incorporate SSL overhead (percentage)
-//  * For relative limiting, do less measuring and more delaying+giving quota
 //  * For relative limiting, smoothen measurements
 
-BandwidthManager::BandwidthManager(OwncloudPropagator *p) : QObject(),
-    _propagator(p),
-    _relativeLimitCurrentMeasuredDevice(0),
-    _relativeUploadLimitProgressAtMeasuringRestart(0),
-    _currentUploadLimit(0),
-    _relativeLimitCurrentMeasuredJob(0),
-    _currentDownloadLimit(0)
+BandwidthBucket::BandwidthBucket(QObject *parent)
+    : QObject(parent),
+      _limit(0),
+      _rate(0),
+      _tokens(0),
+      _burst(0),
+      _totalTaken(0),
+      _relativeMeasuring(false),
+      _relativeTakenAtPhaseStart(0)
 {
-    _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-
-    QObject::connect(&_switchingTimer, SIGNAL(timeout()), this, SLOT(switchingTimerExpired()));
-    _switchingTimer.setInterval(10*1000);
-    _switchingTimer.start();
-    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
-
-    // absolute uploads/downloads
-    QObject::connect(&_absoluteLimitTimer, SIGNAL(timeout()), this, SLOT(absoluteLimitTimerExpired()));
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
-
-    // Relative uploads
-    QObject::connect(&_relativeUploadMeasuringTimer,SIGNAL(timeout()),
-                     this, SLOT(relativeUploadMeasuringTimerExpired()));
-    _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
-    _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeUploadDelayTimer, SIGNAL(timeout()),
-                     this, SLOT(relativeUploadDelayTimerExpired()));
-    _relativeUploadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
-
-    // Relative downloads
-    QObject::connect(&_relativeDownloadMeasuringTimer,SIGNAL(timeout()),
-                     this, SLOT(relativeDownloadMeasuringTimerExpired()));
-    _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
-    _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeDownloadDelayTimer, SIGNAL(timeout()),
-                     this, SLOT(relativeDownloadDelayTimerExpired()));
-    _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+    _wakeUpTimer.setSingleShot(true);
+    connect(&_wakeUpTimer, SIGNAL(timeout()), SLOT(slotWakeUp()));
+    _relativePhaseTimer.setSingleShot(true);
+    connect(&_relativePhaseTimer, SIGNAL(timeout()), SLOT(slotRelativePhaseExpired()));
 }
 
-BandwidthManager::~BandwidthManager()
+void BandwidthBucket::setLimit(qint64 limit)
 {
-    qDebug() << Q_FUNC_INFO;
+    _limit = limit;
+    if (limit < 0) {
+        // restart with a measuring phase
+        _relativePhaseTimer.stop();
+        updateRelativePhaseTimer();
+    } else {
+        _relativePhaseTimer.stop();
+        setRate(limit);
+    }
 }
 
-void BandwidthManager::registerUploadDevice(UploadDevice *p)
+void BandwidthBucket::setRate(qint64 rate)
 {
-    qDebug() << Q_FUNC_INFO << p;
-    _absoluteUploadDeviceList.append(p);
-    _relativeUploadDeviceList.append(p);
-    QObject::connect(p, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterUploadDevice(QObject*)));
-
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
-    } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
-    } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
+    refill();
+    if (_rate == 0 || !_lastRefill.isValid()) {
+        _lastRefill.start();
+    }
+    _rate = rate;
+    _burst = qMax(rate * burstMsec / 1000, minimumGrant);
+    _tokens = qMin(_tokens, _burst);
+
+    if (_rate == 0) {
+        // not throttling any more, everybody may continue
+        _tokens = 0;
+        _credit.clear();
+        QList<QObject*> waiting = _waiting;
+        _waiting.clear();
+        _wakeUpTimer.stop();
+        foreach (QObject *consumer, waiting) {
+            emit consumerReady(consumer);
+        }
     }
 }
 
-void BandwidthManager::unregisterUploadDevice(QObject *o)
+void BandwidthBucket::refill()
 {
-    UploadDevice *p = qobject_cast<UploadDevice*>(o);
-    if (p) {
-        unregisterUploadDevice(p);
+    if (_rate <= 0) {
+        return;
+    }
+    qint64 newTokens = qint64(double(_rate) * _lastRefill.nsecsElapsed() / 1e9);
+    if (newTokens > 0) {
+        // only restart when it was worth it, so that no fractions of bytes get lost
+        _lastRefill.start();
+        _tokens = qMin(_burst, _tokens + newTokens);
     }
 }
 
-void BandwidthManager::unregisterUploadDevice(UploadDevice* p)
+void BandwidthBucket::addConsumer(QObject *consumer)
 {
-    qDebug() << Q_FUNC_INFO << p;
-    _absoluteUploadDeviceList.removeAll(p);
-    _relativeUploadDeviceList.removeAll(p);
-    if (p == _relativeLimitCurrentMeasuredDevice) {
-        _relativeLimitCurrentMeasuredDevice = 0;
-        _relativeUploadLimitProgressAtMeasuringRestart = 0;
+    if (!_consumers.contains(consumer)) {
+        _consumers.append(consumer);
     }
+    updateRelativePhaseTimer();
 }
 
-void BandwidthManager::registerDownloadJob(GETFileJob* j)
+void BandwidthBucket::removeConsumer(QObject *consumer)
 {
-    qDebug() << Q_FUNC_INFO << j;
-    _downloadJobList.append(j);
-    QObject::connect(j, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterDownloadJob(QObject*)));
-
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
-    } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
-    } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
-    }
+    _consumers.removeAll(consumer);
+    _waiting.removeAll(consumer);
+    // give back what it did not use to the others
+    qint64 credit = _credit.take(consumer);
+    _tokens = qMin(_burst, _tokens + credit);
+    updateRelativePhaseTimer();
 }
 
-void BandwidthManager::unregisterDownloadJob(GETFileJob* j)
+qint64 BandwidthBucket::take(QObject *consumer, qint64 wanted)
 {
-    _downloadJobList.removeAll(j);
-    if (_relativeLimitCurrentMeasuredJob == j) {
-        _relativeLimitCurrentMeasuredJob = 0;
-        _relativeDownloadLimitProgressAtMeasuringRestart = 0;
+    if (wanted <= 0) {
+        return 0;
+    }
+    if (_rate == 0) {
+        // unlimited or measuring
+        _totalTaken += wanted;
+        return wanted;
+    }
+
+    qint64 granted = 0;
+    QHash<QObject*, qint64>::iterator it = _credit.find(consumer);
+    if (it != _credit.end()) {
+        granted = qMin(wanted, it.value());
+        it.value() -= granted;
+        if (it.value() == 0) {
+            _credit.erase(it);
+        }
     }
+
+    if (granted < wanted && !_waiting.contains(consumer)) {
+        refill();
+        if (_tokens >= qMin(wanted - granted, minimumGrant)) {
+            // fair share, so that a single consumer does not drain what the others need
+            qint64 share = qMax(_tokens / qMax(1, _consumers.count()), qMin(_tokens, minimumGrant));
+            share = qMin(share, wanted - granted);
+            _tokens -= share;
+            granted += share;
+        }
+    }
+
+    if (granted == 0) {
+        if (!_waiting.contains(consumer)) {
+            _waiting.append(consumer);
+        }
+        scheduleWakeUp();
+    }
+
+    _totalTaken += granted;
+    return granted;
 }
 
-void BandwidthManager::unregisterDownloadJob(QObject* o)
+void BandwidthBucket::scheduleWakeUp()
 {
-    GETFileJob *p = qobject_cast<GETFileJob*>(o);
-    if (p) {
-        unregisterDownloadJob(p);
+    if (_wakeUpTimer.isActive() || _rate <= 0) {
+        return;
     }
+    qint64 needed = qMin(_burst, minimumGrant * _waiting.count()) - _tokens;
+    qint64 msec = needed * 1000 / _rate + 1;
+    _wakeUpTimer.start(int(qBound(qint64(1), msec, wakeUpIntervalMsec)));
 }
 
-void BandwidthManager::relativeUploadMeasuringTimerExpired()
+void BandwidthBucket::slotWakeUp()
 {
-    if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
+    if (_waiting.isEmpty()) {
         return;
     }
-    if (_relativeLimitCurrentMeasuredDevice == 0) {
-        qDebug() << Q_FUNC_INFO << "No device set, just waiting 1 sec";
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
+    refill();
+    if (_tokens < minimumGrant) {
+        scheduleWakeUp();
         return;
     }
 
-    qDebug() << Q_FUNC_INFO << _relativeUploadDeviceList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                            + _relativeLimitCurrentMeasuredDevice->_read) / 2;
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
-    qDebug() << Q_FUNC_INFO << _relativeUploadLimitProgressAtMeasuringRestart
-             << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec*1000.0) / 1024.0;
-    qDebug() << Q_FUNC_INFO << relativeLimitProgressDifference/1024 <<"kB =>" << speedkBPerSec << "kB/sec on full speed ("
-             << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
-             << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                     - _relativeLimitCurrentMeasuredDevice->_read) << ")";
+    // Split what we have evenly among the waiting consumers, in the order they came
+    int count = qMin(_waiting.count(), int(qMax(qint64(1), _tokens / minimumGrant)));
+    qint64 share = _tokens / count;
+    QList<QObject*> ready = _waiting.mid(0, count);
+    _waiting = _waiting.mid(count);
+    foreach (QObject *consumer, ready) {
+        _credit[consumer] += share;
+        _tokens -= share;
+    }
+    foreach (QObject *consumer, ready) {
+        emit consumerReady(consumer);
+    }
 
-    qint64 uploadLimitPercent = -_currentUploadLimit;
-    // don't use too extreme values
-    uploadLimitPercent = qMin(uploadLimitPercent, qint64(90));
-    uploadLimitPercent = qMax(qint64(10), uploadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / uploadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qDebug() << Q_FUNC_INFO << waitTimeMsec << " - "<< realWaitTimeMsec <<
-                " msec for " << uploadLimitPercent << "%";
-    qDebug() << Q_FUNC_INFO << "XXXX" << uploadLimitPercent << relativeLimitMeasuringTimerIntervalMsec;
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeUploadDelayTimer.start();
-
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
-    qDebug() << Q_FUNC_INFO << "YYYY" << relativeLimitProgressDifference << uploadLimitPercent << deviceCount;
-    Q_FOREACH(UploadDevice *ud, _relativeUploadDeviceList) {
-        ud->setBandwidthLimited(true);
-        ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qDebug() << Q_FUNC_INFO << "Gave" << quotaPerDevice/1024.0 << "kB to" << ud;
+    if (!_waiting.isEmpty()) {
+        scheduleWakeUp();
     }
-    _relativeLimitCurrentMeasuredDevice = 0;
 }
 
-void BandwidthManager::relativeUploadDelayTimerExpired()
+void BandwidthBucket::updateRelativePhaseTimer()
 {
-    // Switch to measuring state
-    _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
+    if (_limit >= 0 || _consumers.isEmpty()) {
+        _relativePhaseTimer.stop();
+        return;
+    }
+    if (!_relativePhaseTimer.isActive()) {
+        _relativeMeasuring = true;
+        _relativeTakenAtPhaseStart = _totalTaken;
+        setRate(0);
+        _relativePhaseTimer.start(int(relativeLimitMeasuringTimerIntervalMsec));
+    }
+}
 
-    if (!usingRelativeUploadLimit()) {
-        return; // oh, not actually needed
+void BandwidthBucket::slotRelativePhaseExpired()
+{
+    if (_limit >= 0) {
+        return;
     }
 
-    if (_relativeUploadDeviceList.isEmpty()) {
+    // don't use too extreme values
+    qint64 percent = qBound(qint64(10), -_limit, qint64(90));
+
+    if (!_relativeMeasuring) {
+        _relativeMeasuring = true;
+        _relativeTakenAtPhaseStart = _totalTaken;
+        setRate(0);
+        _relativePhaseTimer.start(int(relativeLimitMeasuringTimerIntervalMsec));
         return;
     }
 
-    qDebug() << Q_FUNC_INFO << _relativeUploadDeviceList.count() << "Starting measuring";
+    // We measured the full speed R for the time W. To get an average of p*R we
+    // then limit to p*p*R for the time W/p: (R*W + p*p*R*W/p) / (W + W/p) = p*R
+    qint64 measured = (_totalTaken - _relativeTakenAtPhaseStart) * 1000 / relativeLimitMeasuringTimerIntervalMsec;
+    qint64 rate = qMax(minimumGrant, measured * percent * percent / 10000);
+    qDebug() << Q_FUNC_INFO << measured / 1024 << "kB/sec on full speed, limiting to"
+             << rate / 1024 << "kB/sec for" << percent << "%";
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
-    _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
+    _relativeMeasuring = false;
+    setRate(rate);
+    _relativePhaseTimer.start(int(relativeLimitMeasuringTimerIntervalMsec * 100 / percent));
+}
 
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                      + _relativeLimitCurrentMeasuredDevice->_read) / 2;
-    _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredDevice->setChoked(false);
+/*********************************************************************************************/
 
-    // choke all other UploadDevices
-    Q_FOREACH(UploadDevice *ud, _relativeUploadDeviceList) {
-        if (ud != _relativeLimitCurrentMeasuredDevice) {
-            ud->setBandwidthLimited(true);
-            ud->setChoked(true);
-        }
-    }
+BandwidthManager::BandwidthManager(OwncloudPropagator *p) : QObject(),
+    _propagator(p),
+    _currentUploadLimit(0),
+    _uploadMeter("bandwidth.uploaded_bytes", "bandwidth.upload_bytes_per_sec"),
+    _currentDownloadLimit(0),
+    _downloadMeter("bandwidth.downloaded_bytes", "bandwidth.download_bytes_per_sec")
+{
+    connect(&_uploadBucket, SIGNAL(consumerReady(QObject*)), SLOT(slotUploadDeviceReady(QObject*)));
+    connect(&_downloadBucket, SIGNAL(consumerReady(QObject*)), SLOT(slotDownloadJobReady(QObject*)));
+    slotLimitsChanged();
+}
+
+BandwidthManager::~BandwidthManager()
+{
+    qDebug() << Q_FUNC_INFO;
+    SyncMetrics::setGauge("bandwidth.active_uploads", 0);
+    SyncMetrics::setGauge("bandwidth.active_downloads", 0);
+}
 
-    // now we're in measuring state
+qint64 BandwidthManager::takeUploadQuota(UploadDevice *device, qint64 wanted)
+{
+    return _uploadBucket.take(device, wanted);
 }
 
-// for downloads:
-void BandwidthManager::relativeDownloadMeasuringTimerExpired()
+qint64 BandwidthManager::takeDownloadQuota(GETFileJob *job, qint64 wanted)
 {
-    if (!usingRelativeDownloadLimit() || _downloadJobList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
+    return _downloadBucket.take(job, wanted);
+}
+
+BandwidthManager::ThroughputMeter::~ThroughputMeter()
+{
+    publish();
+    SyncMetrics::setGauge(_gaugeName, 0);
+}
+
+void BandwidthManager::ThroughputMeter::record(qint64 bytes)
+{
+    if (!_window.isValid()) {
+        _window.start();
     }
-    if (_relativeLimitCurrentMeasuredJob == 0) {
-        qDebug() << Q_FUNC_INFO << "No job set, just waiting 1 sec";
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
+    _windowBytes += bytes;
+    if (_window.elapsed() >= 1000) {
+        publish();
+    }
+}
+
+void BandwidthManager::ThroughputMeter::publish()
+{
+    if (!_window.isValid()) {
         return;
     }
+    // The metrics are behind a global lock, so they are only touched once per window
+    qint64 elapsed = _window.elapsed();
+    SyncMetrics::addToCounter(_counterName, _windowBytes);
+    if (elapsed > 0) {
+        SyncMetrics::setGauge(_gaugeName, _windowBytes * 1000 / elapsed);
+    }
+    _windowBytes = 0;
+    _window.restart();
+}
 
-    qDebug() << Q_FUNC_INFO << _downloadJobList.count() << "Starting Delay";
+void BandwidthManager::recordUploaded(qint64 bytes)
+{
+    _uploadMeter.record(bytes);
+}
 
-    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeDownloadLimitProgressAtMeasuringRestart;
-    qDebug() << Q_FUNC_INFO << _relativeDownloadLimitProgressAtMeasuringRestart
-             << relativeLimitProgressMeasured << relativeLimitProgressDifference;
+void BandwidthManager::recordDownloaded(qint64 bytes)
+{
+    _downloadMeter.record(bytes);
+}
 
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec*1000.0) / 1024.0;
-    qDebug() << Q_FUNC_INFO << relativeLimitProgressDifference/1024 <<"kB =>" << speedkBPerSec << "kB/sec on full speed ("
-             << _relativeLimitCurrentMeasuredJob->currentDownloadPosition() ;
+void BandwidthManager::registerUploadDevice(UploadDevice *p)
+{
+    qDebug() << Q_FUNC_INFO << p;
+    _uploadDeviceList.append(p);
+    _uploadBucket.addConsumer(p);
+    SyncMetrics::setGauge("bandwidth.active_uploads", _uploadDeviceList.count());
+    QObject::connect(p, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterUploadDevice(QObject*)));
 
-    qint64 downloadLimitPercent = -_currentDownloadLimit;
-    // don't use too extreme values
-    downloadLimitPercent = qMin(downloadLimitPercent, qint64(90));
-    downloadLimitPercent = qMax(qint64(10), downloadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / downloadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qDebug() << Q_FUNC_INFO << waitTimeMsec << " - "<< realWaitTimeMsec <<
-                " msec for " << downloadLimitPercent << "%";
-    qDebug() << Q_FUNC_INFO << "XXXX" << downloadLimitPercent << relativeLimitMeasuringTimerIntervalMsec;
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeDownloadDelayTimer.start();
-
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
-//    if (quota > 20*1024) {
-//        qDebug() << "======== ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20*1024;
-//        quota -= 20*1024;
-//    }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
-    qDebug() << Q_FUNC_INFO << "YYYY" << relativeLimitProgressDifference << downloadLimitPercent << jobCount;
-    Q_FOREACH(GETFileJob *gfj, _downloadJobList) {
-        gfj->setBandwidthLimited(true);
-        gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qDebug() << Q_FUNC_INFO << "Gave" << quotaPerJob/1024.0 << "kB to" << gfj;
-    }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    p->setBandwidthLimited(_uploadBucket.isLimited());
 }
 
-void BandwidthManager::relativeDownloadDelayTimerExpired()
+void BandwidthManager::unregisterUploadDevice(QObject *o)
 {
-    // Switch to measuring state
-    _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeDownloadLimit()) {
-        return; // oh, not actually needed
-    }
+    // o is being destroyed, qobject_cast would not work any more.
+    // We only need the pointer value.
+    _uploadDeviceList.removeAll(static_cast<UploadDevice*>(o));
+    _uploadBucket.removeConsumer(o);
+    SyncMetrics::setGauge("bandwidth.active_uploads", _uploadDeviceList.count());
+}
 
-    if (_downloadJobList.isEmpty()) {
-        //qDebug() << Q_FUNC_INFO << _downloadJobList.count() << "No jobs?";
-        return;
-    }
+void BandwidthManager::unregisterUploadDevice(UploadDevice* p)
+{
+    qDebug() << Q_FUNC_INFO << p;
+    _uploadDeviceList.removeAll(p);
+    _uploadBucket.removeConsumer(p);
+    SyncMetrics::setGauge("bandwidth.active_uploads", _uploadDeviceList.count());
+}
 
-    qDebug() << Q_FUNC_INFO << _downloadJobList.count() << "Starting measuring";
+void BandwidthManager::registerDownloadJob(GETFileJob* j)
+{
+    qDebug() << Q_FUNC_INFO << j;
+    _downloadJobList.append(j);
+    _downloadBucket.addConsumer(j);
+    SyncMetrics::setGauge("bandwidth.active_downloads", _downloadJobList.count());
+    QObject::connect(j, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterDownloadJob(QObject*)));
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
-    _downloadJobList.append(_relativeLimitCurrentMeasuredJob);
+    j->setBandwidthLimited(_downloadBucket.isLimited());
+}
 
-    _relativeDownloadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    _relativeLimitCurrentMeasuredJob->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredJob->setChoked(false);
+void BandwidthManager::unregisterDownloadJob(GETFileJob* j)
+{
+    _downloadJobList.removeAll(j);
+    _downloadBucket.removeConsumer(j);
+    SyncMetrics::setGauge("bandwidth.active_downloads", _downloadJobList.count());
+}
 
-    // choke all other UploadDevices
-    Q_FOREACH(GETFileJob *gfj, _downloadJobList) {
-        if (gfj != _relativeLimitCurrentMeasuredJob) {
-            gfj->setBandwidthLimited(true);
-            gfj->setChoked(true);
-        }
-    }
+void BandwidthManager::unregisterDownloadJob(QObject* o)
+{
+    // o is being destroyed, qobject_cast would not work any more.
+    _downloadJobList.removeAll(static_cast<GETFileJob*>(o));
+    _downloadBucket.removeConsumer(o);
+    SyncMetrics::setGauge("bandwidth.active_downloads", _downloadJobList.count());
+}
 
-    // now we're in measuring state
+void BandwidthManager::slotUploadDeviceReady(QObject *o)
+{
+    QMetaObject::invokeMethod(o, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
 }
 
-// end downloads
+void BandwidthManager::slotDownloadJobReady(QObject *o)
+{
+    QMetaObject::invokeMethod(o, "slotReadyRead", Qt::QueuedConnection);
+}
 
-void BandwidthManager::switchingTimerExpired() {
+void BandwidthManager::slotLimitsChanged()
+{
     qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
     if (newUploadLimit != _currentUploadLimit) {
         qDebug() << Q_FUNC_INFO << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
         _currentUploadLimit = newUploadLimit;
-        Q_FOREACH(UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
+        _uploadBucket.setLimit(newUploadLimit);
+        Q_FOREACH(UploadDevice *ud, _uploadDeviceList) {
+            ud->setBandwidthLimited(_uploadBucket.isLimited());
         }
     }
     qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
     if (newDownloadLimit != _currentDownloadLimit) {
         qDebug() << Q_FUNC_INFO << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
         _currentDownloadLimit = newDownloadLimit;
+        _downloadBucket.setLimit(newDownloadLimit);
         Q_FOREACH(GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
-        }
-    }
-}
-
-void BandwidthManager::absoluteLimitTimerExpired()
-{
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qDebug() << Q_FUNC_INFO << quotaPerDevice <<  _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH(UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qDebug() << Q_FUNC_INFO << "Gave " << quotaPerDevice/1024.0 << " kB to" << device;
-        }
-    }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qDebug() << Q_FUNC_INFO << quotaPerJob <<  _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH(GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qDebug() << Q_FUNC_INFO << "Gave " << quotaPerJob/1024.0 << " kB to" << j;
+            j->setBandwidthLimited(_downloadBucket.isLimited());
         }
     }
+    SyncMetrics::setGauge("bandwidth.upload_limit", _currentUploadLimit);
+    SyncMetrics::setGauge("bandwidth.download_limit", _currentDownloadLimit);
 }
 
-
 }
@@ -15,9 +15,14 @@
 #ifndef BANDWIDTHMANAGER_H
 #define BANDWIDTHMANAGER_H
 
+#include "owncloudlib.h"
+
 #include <QObject>
 #include <QLinkedList>
+#include <QList>
+#include <QHash>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QIODevice>
 
 namespace OCC {
@@ -26,6 +31,86 @@ class UploadDevice;
 class GETFileJob;
 class OwncloudPropagator;
 
+/**
+ * @brief Token bucket shared by all transfers of one direction
+ *
+ * The limit has the same meaning as the configured network limits:
+ * 0 is unlimited, a positive value is an absolute limit in bytes per second and
+ * a negative value is a percentage of the measured link capacity.
+ *
+ * Tokens (bytes) are refilled from the elapsed time whenever a consumer asks
+ * for some with take(), so there is no periodic timer. A consumer never gets
+ * more than its fair share of the bucket, and tokens are only handed out on
+ * demand: quota that an idle transfer does not ask for stays in the bucket for
+ * the others. When the bucket runs dry the consumer is put on a wait list and
+ * consumerReady() is emitted once it got its share of the next refill.
+ *
+ * For relative limits the bucket alternates between a short measuring phase
+ * without limit and a longer limited phase, such that the average is the
+ * requested percentage of the measured rate.
+ */
+class OWNCLOUDSYNC_EXPORT BandwidthBucket : public QObject {
+    Q_OBJECT
+public:
+    explicit BandwidthBucket(QObject *parent = 0);
+
+    void setLimit(qint64 limit);
+    qint64 limit() const { return _limit; }
+    bool isLimited() const { return _limit != 0; }
+
+    /** The current refill rate in bytes per second, 0 while not throttling */
+    qint64 rate() const { return _rate; }
+
+    void addConsumer(QObject *consumer);
+    void removeConsumer(QObject *consumer);
+    int consumerCount() const { return _consumers.count(); }
+
+    /**
+     * Returns how many of the wanted bytes the consumer may transfer now.
+     * If that is 0, consumerReady() will be emitted later.
+     */
+    qint64 take(QObject *consumer, qint64 wanted);
+
+    /** Total number of bytes handed out since the bucket was created */
+    qint64 totalTaken() const { return _totalTaken; }
+
+signals:
+    void consumerReady(QObject *consumer);
+
+private slots:
+    void slotWakeUp();
+    void slotRelativePhaseExpired();
+
+private:
+    void setRate(qint64 rate);
+    void refill();
+    void scheduleWakeUp();
+    void updateRelativePhaseTimer();
+
+    qint64 _limit;
+    qint64 _rate;
+    qint64 _tokens;
+    qint64 _burst;
+    qint64 _totalTaken;
+    QElapsedTimer _lastRefill;
+    QTimer _wakeUpTimer;
+
+    QList<QObject*> _consumers;
+    QList<QObject*> _waiting;
+    QHash<QObject*, qint64> _credit; // shares granted on wake up, not yet taken
+
+    QTimer _relativePhaseTimer;
+    bool _relativeMeasuring;
+    qint64 _relativeTakenAtPhaseStart;
+};
+
+/**
+ * @brief Distributes the configured bandwidth among the transfers of a propagator
+ *
+ * Each direction has its own BandwidthBucket. UploadDevices and GETFileJobs
+ * only ask for quota while a limit is set, without a limit the manager runs
+ * no timers at all.
+ */
 class BandwidthManager : public QObject {
     Q_OBJECT
 public:
@@ -37,6 +122,12 @@ public:
     bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
     bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
 
+    qint64 takeUploadQuota(UploadDevice *device, qint64 wanted);
+    qint64 takeDownloadQuota(GETFileJob *job, qint64 wanted);
+
+    /** Accounts transferred bytes for the throughput metrics, limited or not */
+    void recordUploaded(qint64 bytes);
+    void recordDownloaded(qint64 bytes);
 
 public slots:
     void registerUploadDevice(UploadDevice*);
@@ -47,36 +138,39 @@ public slots:
     void unregisterDownloadJob(GETFileJob*);
     void unregisterDownloadJob(QObject*);
 
-    void absoluteLimitTimerExpired();
-    void switchingTimerExpired();
-
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
+    /** Re-reads the limits from the propagator */
+    void slotLimitsChanged();
 
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
+private slots:
+    void slotUploadDeviceReady(QObject*);
+    void slotDownloadJobReady(QObject*);
 
 private:
-    QTimer _switchingTimer; // for switching between absolute and relative bw limiting
-    OwncloudPropagator *_propagator; // FIXME this timer and this variable should be replaced
-    // by the propagator emitting the changed limit values to us as signal
-
-    QTimer _absoluteLimitTimer; // for absolute up/down bw limiting
-
-    QLinkedList<UploadDevice*> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice*> _relativeUploadDeviceList; // FIXME merge with list above ^^
-    QTimer _relativeUploadMeasuringTimer;
-    QTimer _relativeUploadDelayTimer; // for relative bw limiting, we need to wait this amount before measuring again
-    UploadDevice *_relativeLimitCurrentMeasuredDevice; // the device measured
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart; // for measuring how much progress we made at start
+    // bytes per second over windows of at least one second
+    // the byte counter is published with the rate, not for every block
+    struct ThroughputMeter {
+        ThroughputMeter(const char *counterName, const char *gaugeName)
+            : _counterName(counterName), _gaugeName(gaugeName), _windowBytes(0) {}
+        ~ThroughputMeter();
+        void record(qint64 bytes);
+        void publish();
+        const char *_counterName;
+        const char *_gaugeName;
+        QElapsedTimer _window;
+        qint64 _windowBytes;
+    };
+
+    OwncloudPropagator *_propagator; // FIXME the propagator should rather emit the changed limit values to us
+
+    QLinkedList<UploadDevice*> _uploadDeviceList;
+    BandwidthBucket _uploadBucket;
     qint64 _currentUploadLimit;
+    ThroughputMeter _uploadMeter;
 
     QLinkedList<GETFileJob*> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
-    QTimer _relativeDownloadDelayTimer; // for relative bw limiting, we need to wait this amount before measuring again
-    GETFileJob *_relativeLimitCurrentMeasuredJob; // the device measured
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart; // for measuring how much progress we made at start
+    BandwidthBucket _downloadBucket;
     qint64 _currentDownloadLimit;
+    ThroughputMeter _downloadMeter;
 };
 
 }
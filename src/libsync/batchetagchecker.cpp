@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "batchetagchecker.h"
+#include "networkjobs.h"
+#include "account.h"
+
+#include <QNetworkReply>
+#include <QDebug>
+
+namespace OCC {
+
+static const char membersPropertyC[] = "owncloud_etag_members";
+static const char parentPropertyC[] = "owncloud_etag_parent";
+
+static QString parentPath(const QString &normalizedPath)
+{
+    int slash = normalizedPath.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QString() : normalizedPath.left(slash);
+}
+
+BatchEtagChecker::BatchEtagChecker(AccountPtr account, QObject *parent)
+    : QObject(parent)
+    , _account(account)
+    , _requestCount(0)
+    , _runningJobs(0)
+    , _duration(0)
+{
+}
+
+QString BatchEtagChecker::normalizePath(const QString &remotePath)
+{
+    QString path = remotePath;
+    while (path.startsWith(QLatin1Char('/'))) {
+        path.remove(0, 1);
+    }
+    while (path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+    }
+    return path;
+}
+
+void BatchEtagChecker::addPath(const QString &remotePath)
+{
+    _paths.insert(normalizePath(remotePath), remotePath);
+}
+
+void BatchEtagChecker::start()
+{
+    _timer.start();
+
+    // group by parent directory. The root folder is its own group since
+    // a Depth:1 listing of the root also contains the root itself.
+    QMap<QString, QStringList> groups;
+    foreach (const QString &path, _paths.keys()) {
+        groups[parentPath(path)].append(path);
+    }
+
+    // A checked folder that is the parent of other checked folders can get its
+    // etag from the listing of its children instead of a request of its own.
+    foreach (const QString &path, _paths.keys()) {
+        if (path.isEmpty() || !groups.contains(path)) {
+            continue;
+        }
+        QString parent = parentPath(path);
+        if (groups.value(parent).count() == 1) {
+            groups.remove(parent);
+            groups[path].append(path);
+        }
+    }
+
+    QMapIterator<QString, QStringList> it(groups);
+    while (it.hasNext()) {
+        it.next();
+        startGroup(it.key(), it.value());
+    }
+
+    qDebug() << Q_FUNC_INFO << "Checking" << _paths.count() << "folders with" << _requestCount << "requests";
+
+    if (_runningJobs == 0) {
+        emit finished();
+        deleteLater();
+    }
+}
+
+void BatchEtagChecker::startGroup(const QString &parent, const QStringList &members)
+{
+    if (members.count() == 1) {
+        RequestEtagJob *job = new RequestEtagJob(_account, _paths.value(members.first()), this);
+        job->setNetworkLane(Account::DiscoveryLane);
+        job->setProperty(parentPropertyC, members.first());
+        connect(job, SIGNAL(etagRetreived(QString)), SLOT(slotSingleEtagRetreived(QString)));
+        connect(job, SIGNAL(destroyed()), SLOT(slotJobDestroyed()));
+        _requestCount++;
+        _runningJobs++;
+        job->start();
+        return;
+    }
+
+    LsColJob *job = new LsColJob(_account, QLatin1Char('/') + parent, this);
+    job->setNetworkLane(Account::DiscoveryLane);
+    job->setProperties(QList<QByteArray>() << "getetag");
+    job->setProperty(parentPropertyC, parent);
+    job->setProperty(membersPropertyC, members);
+    connect(job, SIGNAL(directoryListingIterated(QString,QMap<QString,QString>)),
+            SLOT(slotListingIterated(QString,QMap<QString,QString>)));
+    connect(job, SIGNAL(finishedWithError(QNetworkReply*)), SLOT(slotListingFailed(QNetworkReply*)));
+    connect(job, SIGNAL(destroyed()), SLOT(slotJobDestroyed()));
+    _requestCount++;
+    _runningJobs++;
+    job->start();
+}
+
+void BatchEtagChecker::slotSingleEtagRetreived(const QString &etag)
+{
+    QString path = sender()->property(parentPropertyC).toString();
+    emit etagRetreived(_paths.value(path), etag);
+}
+
+void BatchEtagChecker::slotListingIterated(const QString &href, const QMap<QString, QString> &properties)
+{
+    LsColJob *job = qobject_cast<LsColJob*>(sender());
+    if (!job || !job->reply() || !properties.contains(QLatin1String("getetag"))) {
+        return;
+    }
+
+    // Remove /remote.php/webdav/parent/ from /remote.php/webdav/parent/child
+    QString relative = href.mid(job->reply()->request().url().path().length());
+    relative = normalizePath(relative);
+    QString parent = job->property(parentPropertyC).toString();
+    QString path = parent;
+    if (!relative.isEmpty()) {
+        path = parent.isEmpty() ? relative : parent + QLatin1Char('/') + relative;
+    }
+
+    if (_paths.contains(path)) {
+        emit etagRetreived(_paths.value(path), properties.value(QLatin1String("getetag")));
+    }
+}
+
+void BatchEtagChecker::slotListingFailed(QNetworkReply *reply)
+{
+    qDebug() << Q_FUNC_INFO << "Listing failed, checking folders one by one:" << reply->errorString();
+    QStringList members = sender()->property(membersPropertyC).toStringList();
+    foreach (const QString &member, members) {
+        startGroup(member, QStringList() << member);
+    }
+}
+
+void BatchEtagChecker::slotJobDestroyed()
+{
+    _runningJobs--;
+    if (_runningJobs == 0) {
+        _duration = _timer.elapsed();
+        emit finished();
+        deleteLater();
+    }
+}
+
+}
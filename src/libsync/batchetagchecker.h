@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef BATCHETAGCHECKER_H
+#define BATCHETAGCHECKER_H
+
+#include "owncloudlib.h"
+#include "accountfwd.h"
+
+#include <QObject>
+#include <QMap>
+#include <QStringList>
+#include <QElapsedTimer>
+
+class QNetworkReply;
+
+namespace OCC {
+
+/**
+ * @brief Checks the remote ETags of several folders of one account at once
+ *
+ * The remote paths are grouped by their parent directory. Every group with
+ * more than one member is served by a single Depth:1 PROPFIND on the common
+ * parent, the remaining paths get an ordinary Depth:0 RequestEtagJob. All
+ * requests run in parallel.
+ *
+ * etagRetreived() is emitted once for every path that got an answer, with the
+ * path exactly as it was passed to addPath(). finished() is emitted once all
+ * requests are done, after which the object deletes itself.
+ */
+class OWNCLOUDSYNC_EXPORT BatchEtagChecker : public QObject {
+    Q_OBJECT
+public:
+    explicit BatchEtagChecker(AccountPtr account, QObject *parent = 0);
+
+    AccountPtr account() const { return _account; }
+
+    void addPath(const QString &remotePath);
+    QStringList paths() const { return _paths.values(); }
+
+    void start();
+
+    /** Number of network requests issued by start() */
+    int requestCount() const { return _requestCount; }
+
+    /** Time from start() until the last request finished, in msec */
+    qint64 duration() const { return _duration; }
+
+    /** Strips leading and trailing slashes, "/" becomes the empty string */
+    static QString normalizePath(const QString &remotePath);
+
+signals:
+    void etagRetreived(const QString &remotePath, const QString &etag);
+    void finished();
+
+private slots:
+    void slotSingleEtagRetreived(const QString &etag);
+    void slotListingIterated(const QString &href, const QMap<QString, QString> &properties);
+    void slotListingFailed(QNetworkReply *reply);
+    void slotJobDestroyed();
+
+private:
+    void startGroup(const QString &parent, const QStringList &members);
+
+    AccountPtr _account;
+    QMap<QString, QString> _paths; // normalized path -> path as passed to addPath()
+    int _requestCount;
+    int _runningJobs;
+    QElapsedTimer _timer;
+    qint64 _duration;
+};
+
+}
+
+#endif // BATCHETAGCHECKER_H
@@ -18,6 +18,8 @@
 
 #include <QUrl>
 #include "account.h"
+#include "synctrace.h"
+#include "syncmetrics.h"
 #include <QFileInfo>
 
 namespace OCC {
@@ -65,6 +67,8 @@ void DiscoveryJob::update_job_update_callback (bool local,
 {
     DiscoveryJob *updateJob = static_cast<DiscoveryJob*>(userdata);
     if (updateJob) {
+        SyncMetrics::addToCounter(local ? "discovery.local_directories" : "discovery.remote_directories");
+
         // Don't wanna overload the UI
         if (!updateJob->lastUpdateProgressCallbackCall.isValid()) {
             updateJob->lastUpdateProgressCallbackCall.restart(); // first call
@@ -162,10 +166,19 @@ DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(AccountPtr account, con
 {
 }
 
+DiscoverySingleDirectoryJob::~DiscoverySingleDirectoryJob()
+{
+    // Only set if the listing failed or was not handed over
+    foreach (csync_vio_file_stat_t *stat, _results) {
+        csync_vio_file_stat_destroy(stat);
+    }
+}
+
 void DiscoverySingleDirectoryJob::start()
 {
     // Start the actual HTTP job
     LsColJob *lsColJob = new LsColJob(_account, _subPath, this);
+    lsColJob->setNetworkLane(Account::DiscoveryLane);
     QObject::connect(lsColJob, SIGNAL(directoryListingIterated(QString,QMap<QString,QString>)),
                      this, SLOT(directoryListingIteratedSlot(QString,QMap<QString,QString>)));
     QObject::connect(lsColJob, SIGNAL(finishedWithError(QNetworkReply*)), this, SLOT(lsJobFinishedWithErrorSlot(QNetworkReply*)));
@@ -233,6 +246,17 @@ static csync_vio_file_stat_t* propertyMapToFileStat(QMap<QString,QString> map)
     return file_stat;
 }
 
+// An estimate of the heap memory of a listing entry
+static qint64 fileStatSize(const csync_vio_file_stat_t *stat)
+{
+    qint64 size = sizeof(csync_vio_file_stat_t);
+    if (stat->name) size += strlen(stat->name) + 1;
+    if (stat->etag) size += strlen(stat->etag) + 1;
+    if (stat->directDownloadUrl) size += strlen(stat->directDownloadUrl) + 1;
+    if (stat->directDownloadCookies) size += strlen(stat->directDownloadCookies) + 1;
+    return size;
+}
+
 void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file,QMap<QString,QString> map)
 {
     //qDebug() << Q_FUNC_INFO << _subPath << file << map.count() << map.keys() << _account->davPath() << _lsColJob->reply()->request().url().path();
@@ -269,6 +293,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file,QMap
 void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
 {
     emit finishedWithResult(_results);
+    _results.clear(); // owned by the receiver now
     deleteLater();
 }
 
@@ -316,6 +341,14 @@ void DiscoveryMainThread::doOpendirSlot(QString subPath, DiscoveryDirectoryResul
     }
     qDebug() << Q_FUNC_INFO << _pathPrefix << subPath << fullPath;
 
+    QString listedDirectory = subPath;
+    while (listedDirectory.startsWith('/')) {
+        listedDirectory.remove(0, 1);
+    }
+    while (listedDirectory.endsWith('/')) {
+        listedDirectory.chop(1);
+    }
+    _listedDirectories.insert(listedDirectory);
 
     // Result gets written in there
     _currentDiscoveryDirectoryResult = r;
@@ -338,16 +371,17 @@ void DiscoveryMainThread::doOpendirSlot(QString subPath, DiscoveryDirectoryResul
 void DiscoveryMainThread::singleDirectoryJobResultSlot(QLinkedList<csync_vio_file_stat_t *> result)
 {
     if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+        // possibly aborted
+        foreach (csync_vio_file_stat_t *stat, result) {
+            csync_vio_file_stat_destroy(stat);
+        }
+        return;
     }
     qDebug() << Q_FUNC_INFO << "Have" << result.count() << "results for " << _currentDiscoveryDirectoryResult->path;
 
-
-    _directoryContents.insert(_currentDiscoveryDirectoryResult->path, result);
-
+    // The sync thread gives the entries to csync one by one, which frees them
     _currentDiscoveryDirectoryResult->list = result;
     _currentDiscoveryDirectoryResult->code = 0;
-    _currentDiscoveryDirectoryResult->iterator = _currentDiscoveryDirectoryResult->list.begin();
      _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
 
     _discoveryJob->_vioMutex.lock();
@@ -404,7 +438,10 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
 {
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
+        TraceSpan span("discovery", QString::fromUtf8(url));
         qDebug() << Q_FUNC_INFO << discoveryJob << url << "Calling into main thread...";
+        QElapsedTimer timer;
+        timer.start();
 
         DiscoveryDirectoryResult *directoryResult = new DiscoveryDirectoryResult();
         directoryResult->code = EIO;
@@ -416,13 +453,22 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
         discoveryJob->_vioMutex.unlock();
 
         qDebug() << Q_FUNC_INFO << discoveryJob << url << "...Returned from main thread";
+        SyncMetrics::recordValue("discovery.listing_msec", timer.elapsed());
 
-        // Upon awakening from the _vioWaitCondition, iterator should be a valid iterator.
+        // Upon awakening from the _vioWaitCondition, the list holds the entries.
         if (directoryResult->code != 0) {
             qDebug() << Q_FUNC_INFO << directoryResult->code << "when opening" << url;
+            SyncMetrics::addToCounter("discovery.listing_errors");
             errno = directoryResult->code;
+            delete directoryResult;
             return NULL;
         }
+        SyncMetrics::addToCounter("discovery.remote_entries", directoryResult->list.count());
+
+        foreach (const csync_vio_file_stat_t *stat, directoryResult->list) {
+            discoveryJob->_listingBytes += fileStatSize(stat);
+        }
+        discoveryJob->_peakListingBytes = qMax(discoveryJob->_peakListingBytes, discoveryJob->_listingBytes);
 
         return (csync_vio_handle_t*) directoryResult;
     }
@@ -436,11 +482,11 @@ csync_vio_file_stat_t* DiscoveryJob::remote_vio_readdir_hook (csync_vio_handle_t
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
         DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*>(dhandle);
-        if (directoryResult->iterator != directoryResult->list.end()) {
-            csync_vio_file_stat_t *file_stat = *(directoryResult->iterator);
-            directoryResult->iterator++;
-            // Make a copy, csync_update will delete the copy
-            return csync_vio_file_stat_copy(file_stat);
+        if (!directoryResult->list.isEmpty()) {
+            // No copy, csync_update deletes the entry when it is done with it
+            csync_vio_file_stat_t *file_stat = directoryResult->list.takeFirst();
+            discoveryJob->releaseListingEntry(file_stat);
+            return file_stat;
         }
     }
     return NULL;
@@ -452,10 +498,20 @@ void DiscoveryJob::remote_vio_closedir_hook (csync_vio_handle_t *dhandle,  void
     if (discoveryJob) {
         qDebug() << Q_FUNC_INFO << discoveryJob;
         DiscoveryDirectoryResult *directoryResult = static_cast<DiscoveryDirectoryResult*> (dhandle);
-        delete directoryResult; // just deletes the struct and the iterator, the data itself is owned by the SyncEngine/DiscoveryMainThread
+        // csync may stop reading early, the rest of the listing is not needed anymore
+        foreach (csync_vio_file_stat_t *stat, directoryResult->list) {
+            discoveryJob->releaseListingEntry(stat);
+            csync_vio_file_stat_destroy(stat);
+        }
+        delete directoryResult;
     }
 }
 
+void DiscoveryJob::releaseListingEntry(const csync_vio_file_stat_t *stat)
+{
+    _listingBytes -= fileStatSize(stat);
+}
+
 void DiscoveryJob::start() {
     _selectiveSyncBlackList.sort();
     _csync_ctx->checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallBack;
@@ -473,7 +529,13 @@ void DiscoveryJob::start() {
     csync_set_log_level(_log_level);
     csync_set_log_userdata(_log_userdata);
     lastUpdateProgressCallbackCall.invalidate();
-    int ret = csync_update(_csync_ctx);
+    int ret;
+    SyncMetrics::setGauge("discovery.running", 1);
+    {
+        TraceSpan span("csync", QLatin1String("csync_update"));
+        ret = csync_update(_csync_ctx);
+    }
+    SyncMetrics::setGauge("discovery.running", 0);
 
     _csync_ctx->checkSelectiveSyncBlackListHook = 0;
     _csync_ctx->checkSelectiveSyncBlackListData = 0;
@@ -481,6 +543,9 @@ void DiscoveryJob::start() {
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
 
+    qDebug() << "Peak memory of the remote listings:" << _peakListingBytes << "bytes";
+    SyncMetrics::setGauge("discovery.peak_listing_bytes", _peakListingBytes);
+    emit peakListingMemory(_peakListingBytes);
     emit finished(ret);
     deleteLater();
 }
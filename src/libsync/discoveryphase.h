@@ -23,6 +23,7 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QSet>
 
 namespace OCC {
 
@@ -38,8 +39,7 @@ struct DiscoveryDirectoryResult {
     QString path;
     QString msg;
     int code;
-    QLinkedList<csync_vio_file_stat_t*>::iterator iterator;
-    QLinkedList<csync_vio_file_stat_t *> list;
+    QLinkedList<csync_vio_file_stat_t *> list; // the entries not yet given to csync
 };
 
 // Run in the main thread, reporting to the DiscoveryJobMainThread object
@@ -47,12 +47,14 @@ class DiscoverySingleDirectoryJob : public QObject {
     Q_OBJECT
 public:
     explicit DiscoverySingleDirectoryJob(AccountPtr account, const QString &path, QObject *parent = 0);
+    ~DiscoverySingleDirectoryJob();
     void start();
     void abort();
     // This is not actually a network job, it is just a job
 signals:
     void firstDirectoryPermissions(const QString &);
     void firstDirectoryEtag(const QString &);
+    // The receiver owns the entries
     void finishedWithResult(QLinkedList<csync_vio_file_stat_t*>);
     void finishedWithError(int csyncErrnoCode, QString msg);
 private slots:
@@ -72,30 +74,22 @@ class DiscoveryJob;
 class DiscoveryMainThread : public QObject {
     Q_OBJECT
 
-    // For non-recursive and recursive
-    // If it is not in this map it needs to be requested
-    QMap<QString, QLinkedList<csync_vio_file_stat_t*> > _directoryContents;
-
-
     QPointer<DiscoveryJob> _discoveryJob;
     QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
     QString _pathPrefix;
     AccountPtr _account;
     DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
+    QSet<QString> _listedDirectories;
 
 public:
     DiscoveryMainThread(AccountPtr account) : QObject(), _account(account), _currentDiscoveryDirectoryResult(0) {
 
-    }
-    ~DiscoveryMainThread() {
-        foreach (const QLinkedList<csync_vio_file_stat_t*> & list, _directoryContents) {
-            foreach (csync_vio_file_stat_t* stat, list) {
-                csync_vio_file_stat_destroy(stat);
-            }
-        }
     }
     void abort();
 
+    /** The remote directories that were listed, relative to the sync root, "" for the root */
+    QSet<QString> listedDirectories() const { return _listedDirectories; }
+
 
 public slots:
     // From DiscoveryJob:
@@ -145,10 +139,15 @@ class DiscoveryJob : public QObject {
     QMutex _vioMutex;
     QWaitCondition _vioWaitCondition;
 
+    // Memory of the listings that csync did not consume yet, only used in the discovery thread
+    qint64 _listingBytes;
+    qint64 _peakListingBytes;
+    void releaseListingEntry(const csync_vio_file_stat_t *stat);
+
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject* parent = 0)
-            : QObject(parent), _csync_ctx(ctx) {
+            : QObject(parent), _csync_ctx(ctx), _listingBytes(0), _peakListingBytes(0) {
         // We need to forward the log property as csync uses thread local
         // and updates run in another thread
         _log_callback = csync_get_log_callback();
@@ -160,6 +159,8 @@ public:
     Q_INVOKABLE void start();
 signals:
     void finished(int result);
+    // Emitted just before finished(), the most memory the remote listings used at once
+    void peakListingMemory(qint64 bytes);
     void folderDiscovered(bool local, QString folderUrl);
 
     // After the discovery job has been woken up again (_vioWaitCondition)
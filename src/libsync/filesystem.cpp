@@ -28,6 +28,12 @@
 #include <fcntl.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
 // We use some internals of csync:
 extern "C" int c_utimes(const char *, const struct timeval *);
 extern "C" void csync_win32_set_file_hidden( const char *file, bool h );
@@ -93,6 +99,20 @@ time_t FileSystem::getModTime(const QString &filename)
     return result;
 }
 
+quint64 FileSystem::getInode(const QString &filename)
+{
+    csync_vio_file_stat_t* stat = csync_vio_file_stat_new();
+    quint64 result = 0;
+    if (csync_vio_local_stat(filename.toUtf8().data(), stat) != -1
+            && (stat->fields & CSYNC_VIO_FILE_STAT_FIELDS_INODE)) {
+        result = stat->inode;
+    } else {
+        qDebug() << "Could not get the inode for" << filename;
+    }
+    csync_vio_file_stat_destroy(stat);
+    return result;
+}
+
 bool FileSystem::setModTime(const QString& filename, time_t modTime)
 {
     struct timeval times[2];
@@ -214,6 +234,27 @@ bool FileSystem::openFileSharedRead(QFile* file, QString* error)
     return ok;
 }
 
+bool FileSystem::preallocate(QFile *file, qint64 size)
+{
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+    if (size <= 0 || file->handle() < 0) {
+        return false;
+    }
+    // FALLOC_FL_KEEP_SIZE: the reported size stays the same, which matters
+    // because the size of a partial download is used for resuming.
+    if (fallocate(file->handle(), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        qDebug() << Q_FUNC_INFO << "Could not preallocate" << size << "bytes for" << file->fileName()
+                 << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
 qint64 FileSystem::getSize(const QString& filename)
 {
 #ifdef Q_OS_WIN
@@ -41,7 +41,7 @@ void OWNCLOUDSYNC_EXPORT setFileHidden(const QString& filename, bool hidden);
  */
 time_t OWNCLOUDSYNC_EXPORT getModTime(const QString &filename);
 
-bool setModTime(const QString &filename, time_t modTime);
+bool OWNCLOUDSYNC_EXPORT setModTime(const QString &filename, time_t modTime);
 
 /** Get the size for a file.
  *
@@ -50,11 +50,14 @@ bool setModTime(const QString &filename, time_t modTime);
  */
 qint64 OWNCLOUDSYNC_EXPORT getSize(const QString& filename);
 
+/** Get the inode for a file, the file index on Windows. Returns 0 on failure. */
+quint64 OWNCLOUDSYNC_EXPORT getInode(const QString& filename);
+
 /**
  * Rename the file \a originFileName to \a destinationFileName, and overwrite the destination if it
  * already exists
  */
-bool renameReplace(const QString &originFileName, const QString &destinationFileName,
+bool OWNCLOUDSYNC_EXPORT renameReplace(const QString &originFileName, const QString &destinationFileName,
                    QString *errorString);
 
 /**
@@ -66,6 +69,14 @@ bool renameReplace(const QString &originFileName, const QString &destinationFile
  */
 bool openFileSharedRead(QFile* file, QString* error);
 
+/**
+ * Reserves disk space for \a size bytes of the opened \a file without changing
+ * its size, so that it can be written to without fragmenting.
+ *
+ * Only implemented on Linux (fallocate), returns false where it is not supported.
+ */
+bool OWNCLOUDSYNC_EXPORT preallocate(QFile *file, qint64 size);
+
 #ifdef Q_OS_WIN
 /**
  * Returns the file system used at the given path.
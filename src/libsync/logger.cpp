@@ -17,9 +17,111 @@
 #include <QDir>
 #include <QStringList>
 #include <QThread>
+#include <QWaitCondition>
+
+#include <algorithm>
 
 namespace OCC {
 
+// Lines a thread may have pending before further lines are dropped, a power of 2.
+static const uint ringSize = 8192;
+// How often the writer thread looks for new lines when nobody wakes it up.
+static const int writerIntervalMsec = 50;
+
+struct LogEntry {
+    qint64 msecs; // since the epoch, formatted by the writer thread
+    Qt::HANDLE thread;
+    QString message;
+    bool raw;
+};
+
+static bool entryLessThan(const LogEntry &a, const LogEntry &b)
+{
+    return a.msecs < b.msecs;
+}
+
+/**
+ * Single producer, single consumer queue of the lines of one thread.
+ * Only the owning thread pushes, only drain() (under _drainMutex) pops.
+ */
+class LogRing {
+public:
+    LogRing() : _entries(new LogEntry[ringSize]), _head(0), _tail(0), _dropped(0), _orphaned(0) {}
+    ~LogRing() { delete[] _entries; }
+
+    /** Returns false if the ring is full and the entry was dropped */
+    bool push(const LogEntry &entry) {
+        uint head = _head.fetchAndAddRelaxed(0);
+        uint tail = _tail.fetchAndAddAcquire(0);
+        if (head - tail >= ringSize) {
+            _dropped.fetchAndAddRelaxed(1);
+            return false;
+        }
+        _entries[head % ringSize] = entry;
+        _head.fetchAndStoreRelease(int(head + 1));
+        return head - tail >= ringSize / 2;
+    }
+
+    void drain(QVector<LogEntry> *out) {
+        uint tail = _tail.fetchAndAddRelaxed(0);
+        uint head = _head.fetchAndAddAcquire(0);
+        for (; tail != head; ++tail) {
+            LogEntry &entry = _entries[tail % ringSize];
+            out->append(entry);
+            entry.message = QString();
+        }
+        _tail.fetchAndStoreRelease(int(tail));
+    }
+
+    bool isEmpty() { return _head.fetchAndAddAcquire(0) == _tail.fetchAndAddAcquire(0); }
+    int takeDropped() { return _dropped.fetchAndStoreRelaxed(0); }
+
+    LogEntry *_entries;
+    QAtomicInt _head;
+    QAtomicInt _tail;
+    QAtomicInt _dropped;
+    QAtomicInt _orphaned; // the thread has exited, delete once drained
+};
+
+// Owned by QThreadStorage, tells the writer when the thread is gone.
+class LogRingHolder {
+public:
+    explicit LogRingHolder(LogRing *ring) : _ring(ring) {}
+    ~LogRingHolder() { _ring->_orphaned.fetchAndStoreRelease(1); }
+    LogRing *_ring;
+};
+
+class LogWriterThread : public QThread {
+public:
+    LogWriterThread() : _stop(0) {}
+
+    void stop() {
+        _stop.fetchAndStoreOrdered(1);
+        wakeUp();
+        wait();
+    }
+
+    void wakeUp() {
+        QMutexLocker lock(&_mutex);
+        _wakeUp.wakeOne();
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE {
+        while (!_stop.fetchAndAddAcquire(0)) {
+            if (!Logger::instance()->drain()) {
+                QMutexLocker lock(&_mutex);
+                _wakeUp.wait(&_mutex, writerIntervalMsec);
+            }
+        }
+    }
+
+private:
+    QAtomicInt _stop;
+    QMutex _mutex;
+    QWaitCondition _wakeUp;
+};
+
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 // logging handler.
 static void mirallLogCatcher(QtMsgType type, const char *msg)
@@ -32,15 +134,22 @@ static void qInstallMessageHandler(QtMsgHandler h) {
     qInstallMsgHandler(h);
 }
 #elif QT_VERSION < QT_VERSION_CHECK(5, 4, 0)
-static void mirallLogCatcher(QtMsgType, const QMessageLogContext &ctx, const QString &message) {
+static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message) {
     QByteArray file = ctx.file;
     file = file.mid(file.lastIndexOf('/') + 1);
     Logger::instance()->mirallLog( QString::fromLocal8Bit(file) + QLatin1Char(':') + QString::number(ctx.line)
                                     + QLatin1Char(' ')  + message) ;
+    if (type == QtFatalMsg) {
+        Logger::instance()->flush();
+    }
 }
 #else
 static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message) {
-    Logger::instance()->doLog( qFormatLogMessage(type, ctx, message) ) ;
+    // timestamp and thread are added by the writer thread
+    Logger::instance()->mirallLog( qFormatLogMessage(type, ctx, message) ) ;
+    if (type == QtFatalMsg) {
+        Logger::instance()->flush();
+    }
 }
 #endif
 
@@ -51,11 +160,13 @@ Logger *Logger::instance()
 }
 
 Logger::Logger( QObject* parent) : QObject(parent),
-  _showTime(true), _doLogging(false), _doFileFlush(false), _logExpire(0)
+  _showTime(true), _doLogging(false), _doFileFlush(false), _logExpire(0),
+  _writer(new LogWriterThread), _formattedSecond(-1)
 {
+    _writer->start(QThread::LowPriority);
 #ifndef NO_MSG_HANDLER
 #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
-    qSetMessagePattern("%{time MM-dd hh:mm:ss:zzz} %{threadid} %{function}: %{message}");
+    qSetMessagePattern("%{function}: %{message}");
 #endif
     qInstallMessageHandler(mirallLogCatcher);
 #else
@@ -67,6 +178,10 @@ Logger::~Logger() {
 #ifndef NO_MSG_HANDLER
     qInstallMessageHandler(0);
 #endif
+    _writer->stop();
+    delete _writer;
+    drain();
+    // The rings are not deleted, threads may still hold them until they exit.
 }
 
 
@@ -87,54 +202,115 @@ void Logger::postGuiMessage(const QString &title, const QString &message)
 
 void Logger::log(Log log)
 {
-    QString msg;
-    if( _showTime ) {
-        msg = log.timeStamp.toString(QLatin1String("MM-dd hh:mm:ss:zzz")) + QLatin1Char(' ');
+    enqueue(log.timeStamp.toMSecsSinceEpoch(), log.message, false);
+}
+
+void Logger::doLog(const QString& msg)
+{
+    enqueue(QDateTime::currentMSecsSinceEpoch(), msg, true);
+}
+
+void Logger::enqueue(qint64 msecs, const QString &message, bool raw)
+{
+    LogRingHolder *holder = _threadRing.localData();
+    if (!holder) {
+        holder = new LogRingHolder(new LogRing);
+        _threadRing.setLocalData(holder);
+        QMutexLocker lock(&_ringsMutex);
+        _rings.append(holder->_ring);
     }
 
-    if( log.source == Log::CSync ) {
-        // msg += "csync - ";
-    } else {
-        // msg += "ownCloud - ";
+    LogEntry entry;
+    entry.msecs = msecs;
+    entry.thread = QThread::currentThreadId();
+    entry.message = message;
+    entry.raw = raw;
+    if (holder->_ring->push(entry)) {
+        // more than half full, don't wait for the next interval
+        _writer->wakeUp();
     }
-    msg += QString().sprintf("%p ", (void*)QThread::currentThread());
-    msg += log.message;
-    // _logs.append(log);
-    // std::cout << qPrintable(log.message) << std::endl;
+}
 
-    doLog(msg);
+void Logger::flush()
+{
+    drain();
 }
 
-void Logger::doLog(const QString& msg)
+bool Logger::drain()
 {
+    QMutexLocker drainLock(&_drainMutex);
+
+    QVector<LogEntry> entries;
+    int dropped = 0;
+    {
+        QMutexLocker lock(&_ringsMutex);
+        for (int i = 0; i < _rings.count(); ) {
+            LogRing *ring = _rings.at(i);
+            bool orphaned = ring->_orphaned.fetchAndAddAcquire(0);
+            ring->drain(&entries);
+            dropped += ring->takeDropped();
+            if (orphaned && ring->isEmpty()) {
+                delete _rings.takeAt(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+    if (entries.isEmpty() && dropped == 0) {
+        return false;
+    }
+
+    // the lines of different threads are collected one ring after the other
+    std::stable_sort(entries.begin(), entries.end(), entryLessThan);
+
+    QStringList lines;
+    lines.reserve(entries.count() + 1);
+    foreach (const LogEntry &entry, entries) {
+        if (entry.raw || !_showTime) {
+            lines.append(entry.message);
+            continue;
+        }
+        qint64 second = entry.msecs / 1000;
+        if (second != _formattedSecond) {
+            _formattedSecond = second;
+            _formattedPrefix = QDateTime::fromMSecsSinceEpoch(second * 1000).toString(QLatin1String("MM-dd hh:mm:ss:"));
+        }
+        lines.append(_formattedPrefix
+                     + QString::number(entry.msecs % 1000).rightJustified(3, QLatin1Char('0'))
+                     + QLatin1String(" 0x") + QString::number(quintptr(entry.thread), 16)
+                     + QLatin1Char(' ') + entry.message);
+    }
+    if (dropped > 0) {
+        _droppedCount.fetchAndAddRelaxed(dropped);
+        lines.append(QString::fromLatin1("%1 log lines were dropped, logging could not keep up").arg(dropped));
+    }
+    _writtenCount.fetchAndAddRelaxed(lines.count());
+
     {
         QMutexLocker lock(&_mutex);
         if( _logstream ) {
-            (*_logstream) << msg << endl;
-            if( _doFileFlush ) _logstream->flush();
+            foreach (const QString &line, lines) {
+                (*_logstream) << line << QLatin1Char('\n');
+            }
+            _logstream->flush();
+            if( _doFileFlush ) _logFile.flush();
         }
     }
-    emit newLog(msg);
+
+    if (receivers(SIGNAL(newLog(QString))) > 0) {
+        emit newLog(lines.join(QLatin1String("\n")));
+    }
+    return true;
 }
 
 void Logger::csyncLog( const QString& message )
 {
-    Log log;
-    log.source = Log::CSync;
-    log.timeStamp = QDateTime::currentDateTime();
-    log.message = message;
-
-    Logger::instance()->log(log);
+    Logger::instance()->enqueue(QDateTime::currentMSecsSinceEpoch(), message, false);
 }
 
 void Logger::mirallLog( const QString& message )
 {
-    Log log_;
-    log_.source = Log::Occ;
-    log_.timeStamp = QDateTime::currentDateTime();
-    log_.message = message;
-
-    Logger::instance()->log( log_ );
+    Logger::instance()->enqueue(QDateTime::currentMSecsSinceEpoch(), message, false);
 }
 
 void Logger::setLogFile(const QString & name)
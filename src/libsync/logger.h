@@ -20,6 +20,7 @@
 #include <QDateTime>
 #include <QFile>
 #include <QTextStream>
+#include <QThreadStorage>
 #include <qmutex.h>
 
 #include "utility.h"
@@ -37,14 +38,38 @@ struct Log{
   QString message;
 };
 
+class LogRing;
+class LogRingHolder;
+class LogWriterThread;
+
+/**
+ * @brief The application log
+ *
+ * Logging a line only appends it to a ring buffer of the calling thread,
+ * without taking a lock. A background thread collects the lines of all
+ * threads, formats the timestamps, writes them to the log file and emits
+ * newLog() once per batch.
+ *
+ * If a thread logs faster than the writer keeps up, new lines are dropped
+ * and the number of dropped lines is written to the log instead.
+ */
 class OWNCLOUDSYNC_EXPORT Logger : public QObject
 {
   Q_OBJECT
 public:
 
   void log(Log log);
+  /** Logs \a log as it is, without timestamp and thread */
   void doLog(const QString &log);
 
+  /** Writes all pending lines, returns once they are written */
+  void flush();
+
+  /** Number of lines dropped because the ring buffer of their thread was full */
+  int droppedCount() const { return _droppedCount.fetchAndAddRelaxed(0); }
+  /** Number of lines written so far */
+  int writtenCount() const { return _writtenCount.fetchAndAddRelaxed(0); }
+
   static void csyncLog( const QString& message );
   static void mirallLog( const QString& message );
 
@@ -62,6 +87,7 @@ public:
   void setLogFlush( bool flush );
 
 signals:
+  /** New lines in the log. Batches of several lines are separated by '\n' */
   void newLog(const QString&);
   void guiLog(const QString&, const QString&);
   void guiMessage(const QString&, const QString&);
@@ -73,6 +99,12 @@ public slots:
 private:
   Logger(QObject* parent=0);
   ~Logger();
+
+  void enqueue(qint64 msecs, const QString &message, bool raw);
+  /** Writes what is in the ring buffers, returns false if there was nothing */
+  bool drain();
+  friend class LogWriterThread;
+
   QList<Log> _logs;
   bool       _showTime;
   bool       _doLogging;
@@ -83,6 +115,16 @@ private:
   QMutex      _mutex;
   QString     _logDirectory;
 
+  QThreadStorage<LogRingHolder*> _threadRing;
+  QList<LogRing*> _rings;
+  QMutex      _ringsMutex; // only taken when a thread logs for the first time, and by drain()
+  QMutex      _drainMutex;
+  LogWriterThread *_writer;
+  mutable QAtomicInt _droppedCount;
+  mutable QAtomicInt _writtenCount;
+  qint64      _formattedSecond; // the second _formattedPrefix is for
+  QString     _formattedPrefix;
+
 };
 
 } // namespace OCC
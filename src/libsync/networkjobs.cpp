@@ -32,6 +32,8 @@
 #include "networkjobs.h"
 #include "account.h"
 #include "owncloudpropagator.h"
+#include "synctrace.h"
+#include "syncmetrics.h"
 
 #include "creds/credentialsfactory.h"
 #include "creds/abstractcredentials.h"
@@ -44,9 +46,12 @@ namespace OCC {
 AbstractNetworkJob::AbstractNetworkJob(AccountPtr account, const QString &path, QObject *parent)
     : QObject(parent)
     , _duration(0)
+    , _traceStartUsec(0)
     , _timedout(false)
     , _followRedirects(false)
     , _ignoreCredentialFailure(false)
+    , _firstByteReceived(false)
+    , _lane(Account::MetadataLane)
     , _reply(0)
     , _account(account)
     , _path(path)
@@ -108,6 +113,7 @@ void AbstractNetworkJob::setupConnections(QNetworkReply *reply)
     connect(reply->manager(), SIGNAL(proxyAuthenticationRequired(QNetworkProxy,QAuthenticator*)), SIGNAL(networkActivity()));
     connect(reply, SIGNAL(sslErrors(QList<QSslError>)), SIGNAL(networkActivity()));
     connect(reply, SIGNAL(metaDataChanged()), SIGNAL(networkActivity()));
+    connect(reply, SIGNAL(metaDataChanged()), SLOT(slotMetaDataChanged()));
     connect(reply, SIGNAL(downloadProgress(qint64,qint64)), SIGNAL(networkActivity()));
     connect(reply, SIGNAL(uploadProgress(qint64,qint64)), SIGNAL(networkActivity()));
 }
@@ -121,32 +127,32 @@ QNetworkReply* AbstractNetworkJob::addTimer(QNetworkReply *reply)
 QNetworkReply* AbstractNetworkJob::davRequest(const QByteArray &verb, const QString &relPath,
                                               QNetworkRequest req, QIODevice *data)
 {
-    return addTimer(_account->davRequest(verb, relPath, req, data));
+    return addTimer(_account->davRequest(verb, relPath, req, data, _lane));
 }
 
 QNetworkReply *AbstractNetworkJob::davRequest(const QByteArray &verb, const QUrl &url, QNetworkRequest req, QIODevice *data)
 {
-    return addTimer(_account->davRequest(verb, url, req, data));
+    return addTimer(_account->davRequest(verb, url, req, data, _lane));
 }
 
 QNetworkReply* AbstractNetworkJob::getRequest(const QString &relPath)
 {
-    return addTimer(_account->getRequest(relPath));
+    return addTimer(_account->getRequest(relPath, _lane));
 }
 
 QNetworkReply *AbstractNetworkJob::getRequest(const QUrl &url)
 {
-    return addTimer(_account->getRequest(url));
+    return addTimer(_account->getRequest(url, _lane));
 }
 
 QNetworkReply *AbstractNetworkJob::headRequest(const QString &relPath)
 {
-    return addTimer(_account->headRequest(relPath));
+    return addTimer(_account->headRequest(relPath, _lane));
 }
 
 QNetworkReply *AbstractNetworkJob::headRequest(const QUrl &url)
 {
-    return addTimer(_account->headRequest(url));
+    return addTimer(_account->headRequest(url, _lane));
 }
 
 void AbstractNetworkJob::slotFinished()
@@ -169,6 +175,14 @@ void AbstractNetworkJob::slotFinished()
     _responseTimestamp = QString::fromAscii(_reply->rawHeader("Date"));
     _duration = _durationTimer.elapsed();
 
+    if (SyncTrace::isRecording()) {
+        QVariantMap args;
+        args.insert(QLatin1String("url"), _reply->request().url().toString());
+        args.insert(QLatin1String("status"), _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+        SyncTrace::addAsyncSpan("network", QLatin1String(metaObject()->className()) + QLatin1Char(' ') + path(),
+                                _traceStartUsec, SyncTrace::nowUsec() - _traceStartUsec, args);
+    }
+
     if (_followRedirects) {
         // ### the qWarnings here should be exported via displayErrors() so they
         // ### can be presented to the user if the job executor has a GUI
@@ -201,6 +215,22 @@ void AbstractNetworkJob::slotFinished()
     }
 }
 
+void AbstractNetworkJob::slotMetaDataChanged()
+{
+    if (_firstByteReceived) {
+        return;
+    }
+    _firstByteReceived = true;
+
+    const char *name = "network.metadata.first_byte_msec";
+    if (_lane == Account::DiscoveryLane) {
+        name = "network.discovery.first_byte_msec";
+    } else if (_lane == Account::TransferLane) {
+        name = "network.transfer.first_byte_msec";
+    }
+    SyncMetrics::recordValue(name, _durationTimer.elapsed());
+}
+
 quint64 AbstractNetworkJob::duration()
 {
     return _duration;
@@ -222,7 +252,9 @@ void AbstractNetworkJob::start()
 {
     _timer.start();
     _durationTimer.start();
+    _firstByteReceived = false;
     _duration = 0;
+    _traceStartUsec = SyncTrace::nowUsec();
 
     qDebug() << "!!!" << metaObject()->className() << "created for" << account()->url() << "querying" << path();
 }
@@ -333,8 +365,27 @@ void LsColJob::start()
 {
     QNetworkRequest req;
     req.setRawHeader("Depth", "1");
-    // FIXME The results are delivered without namespace, if this is ever a problem we need to check it..
-    QByteArray xml("<?xml version=\"1.0\" encoding=\"utf-8\" ?><propfind xmlns=\"DAV:\"><allprop/></propfind>\n");
+    QByteArray xml;
+    if (_properties.isEmpty()) {
+        // FIXME The results are delivered without namespace, if this is ever a problem we need to check it..
+        xml = "<?xml version=\"1.0\" encoding=\"utf-8\" ?><propfind xmlns=\"DAV:\"><allprop/></propfind>\n";
+    } else {
+        QByteArray propStr;
+        foreach (const QByteArray &prop, _properties) {
+            if (prop.contains(':')) {
+                int colIdx = prop.lastIndexOf(":");
+                propStr += "    <" + prop.mid(colIdx+1) + " xmlns=\"" + prop.left(colIdx) + "\" />\n";
+            } else {
+                propStr += "    <d:" + prop + " />\n";
+            }
+        }
+        xml = "<?xml version=\"1.0\" ?>\n"
+              "<d:propfind xmlns:d=\"DAV:\">\n"
+              "  <d:prop>\n"
+              + propStr +
+              "  </d:prop>\n"
+              "</d:propfind>\n";
+    }
     QBuffer *buf = new QBuffer(this);
     buf->setData(xml);
     buf->open(QIODevice::ReadOnly);
@@ -345,6 +396,16 @@ void LsColJob::start()
     AbstractNetworkJob::start();
 }
 
+void LsColJob::setProperties(QList<QByteArray> properties)
+{
+    _properties = properties;
+}
+
+QList<QByteArray> LsColJob::properties() const
+{
+    return _properties;
+}
+
 // supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
 static QString readContentsAsString(QXmlStreamReader &reader) {
     QString result;
@@ -24,7 +24,7 @@
 #include <QElapsedTimer>
 #include <QDateTime>
 #include <QTimer>
-#include "accountfwd.h"
+#include "account.h"
 
 class QUrl;
 
@@ -66,6 +66,10 @@ public:
     void setIgnoreCredentialFailure(bool ignore);
     bool ignoreCredentialFailure() const { return _ignoreCredentialFailure; }
 
+    /** The lane the requests are sent in, must be set before start() */
+    void setNetworkLane(Account::NetworkLane lane) { _lane = lane; }
+    Account::NetworkLane networkLane() const { return _lane; }
+
     QString responseTimestamp();
     quint64 duration();
 
@@ -93,16 +97,20 @@ protected:
     QString       _responseTimestamp;
     QElapsedTimer _durationTimer;
     quint64       _duration;
+    qint64        _traceStartUsec;
     bool          _timedout;  // set to true when the timeout slot is recieved
     bool          _followRedirects;
 
 private slots:
     void slotFinished();
+    void slotMetaDataChanged();
     virtual void slotTimeout();
 
 private:
     QNetworkReply* addTimer(QNetworkReply *reply);
     bool _ignoreCredentialFailure;
+    bool _firstByteReceived;
+    Account::NetworkLane _lane;
     QPointer<QNetworkReply> _reply; // (QPointer because the NetworkManager may be destroyed before the jobs at exit)
     AccountPtr _account;
     QString _path;
@@ -136,6 +144,13 @@ public:
     void start() Q_DECL_OVERRIDE;
     QHash<QString, qint64> _sizes;
 
+    /**
+     * Restrict the listing to the given properties instead of allprop.
+     * Same format as PropfindJob::setProperties().
+     */
+    void setProperties(QList<QByteArray> properties);
+    QList<QByteArray> properties() const;
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString name, QMap<QString,QString> properties);
@@ -144,6 +159,9 @@ signals:
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+
+private:
+    QList<QByteArray> _properties;
 };
 
 /**
@@ -18,10 +18,12 @@
 #include "syncjournalfilerecord.h"
 #include "propagatedownload.h"
 #include "propagateupload.h"
+#include "propagateuploadbundle.h"
 #include "propagateremotedelete.h"
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
 #include "propagatorjobs.h"
+#include "syncmetrics.h"
 #ifdef USE_NEON
 #include "propagator_legacy.h"
 #endif
@@ -41,6 +43,10 @@
 #include <QObject>
 #include <QTimerEvent>
 
+#include <algorithm>
+#include <limits>
+#include <ctime>
+
 namespace OCC {
 
 /* The maximum number of active job in parallel  */
@@ -53,6 +59,30 @@ int OwncloudPropagator::maximumActiveJob()
     return max;
 }
 
+int OwncloudPropagator::maximumActiveMkdirJobs()
+{
+    // QNAM opens at most six connections per host, more would only queue up
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_MKDIR").toUInt();
+    if (!max) {
+        max = 6; //default
+    }
+    return max;
+}
+
+qint64 OwncloudPropagator::freeSpaceLimit()
+{
+    // 0 turns the limit off, only a missing or invalid value means the default
+    static qint64 limit = -1;
+    if (limit < 0) {
+        bool ok = false;
+        limit = qgetenv("OWNCLOUD_FREE_SPACE_LIMIT").toLongLong(&ok);
+        if (!ok || limit < 0) {
+            limit = 250 * 1000 * 1000; //default
+        }
+    }
+    return limit;
+}
+
 /** Updates or creates a blacklist entry for the given item.
  *
  * Returns whether the file is in the blacklist now.
@@ -63,9 +93,9 @@ static bool blacklist(SyncJournalDb* journal, const SyncFileItem& item)
     SyncJournalErrorBlacklistRecord newEntry = SyncJournalErrorBlacklistRecord::update(oldEntry, item);
 
     if (newEntry.isValid()) {
-        journal->updateErrorBlacklistEntry(newEntry);
+        journal->updateErrorBlacklistEntryAsync(newEntry);
     } else if (oldEntry.isValid()) {
-        journal->wipeErrorBlacklistEntry(item._file);
+        journal->wipeErrorBlacklistEntryAsync(item._file);
     }
 
     return newEntry.isValid();
@@ -92,6 +122,15 @@ void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorStr
         status = SyncFileItem::SoftError;
     }
 
+    if (SyncTrace::isRecording()) {
+        QVariantMap args;
+        args.insert(QLatin1String("job"), QLatin1String(metaObject()->className()));
+        args.insert(QLatin1String("status"), int(status));
+        args.insert(QLatin1String("size"), qint64(_item._size));
+        SyncTrace::addAsyncSpan("propagation", _item._file, _traceStartUsec,
+                                SyncTrace::nowUsec() - _traceStartUsec, args);
+    }
+
     switch( status ) {
     case SyncFileItem::SoftError:
     case SyncFileItem::FatalError:
@@ -108,10 +147,10 @@ void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorStr
     case SyncFileItem::Restoration:
         if( _item._hasBlacklistEntry ) {
             // wipe blacklist entry.
-            _propagator->_journal->wipeErrorBlacklistEntry(_item._file);
+            _propagator->_journal->wipeErrorBlacklistEntryAsync(_item._file);
             // remove a blacklist entry in case the file was moved.
             if( _item._originalFile != _item._file ) {
-                _propagator->_journal->wipeErrorBlacklistEntry(_item._originalFile);
+                _propagator->_journal->wipeErrorBlacklistEntryAsync(_item._originalFile);
             }
         }
         break;
@@ -259,11 +298,17 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter adirectory, we can create the directory job and push it on the stack. */
 
+    _mkdirQueue.clear();
     _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory* /* job */> > directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob*> directoriesToRemove;
     QString removedDirectory;
+    int jobCount = 0;
+    // the bundle being filled with the small uploads of each directory
+    QHash<PropagateDirectory*, PropagateUploadBundle*> bundles;
+    const bool bundleUploads = !useLegacyJobs();
+    bool hasUploads = false;
     foreach(const SyncFileItem &item, items) {
 
         if (!removedDirectory.isEmpty() && item._file.startsWith(removedDirectory)) {
@@ -299,6 +344,7 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
         }
 
         if (item._isDirectory) {
+            jobCount++;
             PropagateDirectory *dir = new PropagateDirectory(this, item);
             dir->_firstJob.reset(createJob(item));
             if (item._instruction == CSYNC_INSTRUCTION_REMOVE) {
@@ -319,7 +365,21 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                 currentDirJob->append(dir);
             }
             directories.push(qMakePair(item.destination() + "/" , dir));
+        } else if (bundleUploads && PropagateUploadBundle::isBundleCandidate(item)) {
+            hasUploads = true;
+            jobCount++;
+            PropagateDirectory *dir = directories.top().second;
+            PropagateUploadBundle *&bundle = bundles[dir];
+            if (!bundle || bundle->isFull()) {
+                bundle = new PropagateUploadBundle(this, directories.top().first);
+                dir->append(bundle);
+            }
+            bundle->append(item);
         } else if (PropagateItemJob* current = createJob(item)) {
+            jobCount++;
+            hasUploads = hasUploads || (item._direction == SyncFileItem::Up
+                                        && (item._instruction == CSYNC_INSTRUCTION_NEW
+                                            || item._instruction == CSYNC_INSTRUCTION_SYNC));
             directories.top().second->append(current);
         }
     }
@@ -329,15 +389,146 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
     }
 
     connect(_rootJob.data(), SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
+    connect(_rootJob.data(), SIGNAL(completed(SyncFileItem)), this, SLOT(slotItemCompleted(SyncFileItem)));
     connect(_rootJob.data(), SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
     connect(_rootJob.data(), SIGNAL(finished(SyncFileItem::Status)), this, SLOT(emitFinished()));
     connect(_rootJob.data(), SIGNAL(ready()), this, SLOT(scheduleNextJob()), Qt::QueuedConnection);
 
     qDebug() << (useLegacyJobs() ? "Using legacy libneon/HTTP sequential code path" : "Using QNAM/HTTP parallel code path");
 
+    _completionTimes.clear();
+    _propagationTimer.start();
+    SyncMetrics::setGauge("propagator.pending_items", jobCount);
+    SyncMetrics::setGauge("propagator.active_jobs", 0);
+    _account->setParallelTransfers(maximumActiveJob());
+    _maxBundledFiles = 0;
+    _uploadEncoding = TransferCompression::Identity;
+    _uploadFeaturesPending = false;
+    _compressedFileBytes = 0;
+    _compressedWireBytes = 0;
+    if (hasUploads && !useLegacyJobs()) {
+        if (_account->uploadFeaturesKnown()) {
+            _maxBundledFiles = _account->maxBundledFiles();
+            _uploadEncoding = TransferCompression::uploadEncoding(_account->uploadAcceptEncoding());
+        } else {
+            // Whether bundles and compression are used must be known before the
+            // uploads start, the other jobs don't wait for it
+            _uploadFeaturesPending = true;
+            CheckUploadFeaturesJob *job = new CheckUploadFeaturesJob(_account, _remoteFolder, this);
+            connect(job, SIGNAL(uploadFeaturesChecked(int,QByteArray)),
+                    this, SLOT(slotUploadFeaturesChecked(int,QByteArray)));
+            job->start();
+        }
+    }
     QTimer::singleShot(0, this, SLOT(scheduleNextJob()));
 }
 
+void OwncloudPropagator::slotUploadFeaturesChecked(int maxBundledFiles, const QByteArray &acceptEncoding)
+{
+    _maxBundledFiles = maxBundledFiles;
+    _uploadEncoding = TransferCompression::uploadEncoding(acceptEncoding);
+    _uploadFeaturesPending = false;
+
+    QList<QPointer<PropagateItemJob> > waiting;
+    waiting.swap(_jobsWaitingForUploadFeatures);
+    foreach (const QPointer<PropagateItemJob> &job, waiting) {
+        if (job) {
+            QMetaObject::invokeMethod(job, "start", Qt::QueuedConnection);
+        }
+    }
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::waitForUploadFeatures(PropagateItemJob *job)
+{
+    _jobsWaitingForUploadFeatures.append(job);
+}
+
+void OwncloudPropagator::recordCompression(bool upload, qint64 fileBytes, qint64 wireBytes)
+{
+    _compressedFileBytes += fileBytes;
+    _compressedWireBytes += wireBytes;
+    if (upload) {
+        SyncMetrics::addToCounter("compression.upload_file_bytes", fileBytes);
+        SyncMetrics::addToCounter("compression.upload_wire_bytes", wireBytes);
+    } else {
+        SyncMetrics::addToCounter("compression.download_file_bytes", fileBytes);
+        SyncMetrics::addToCounter("compression.download_wire_bytes", wireBytes);
+    }
+}
+
+// Files changed locally this recently are probably what the user is working on.
+static const qint64 recentlyModifiedSecs = 10 * 60;
+
+quint64 OwncloudPropagator::itemPriority(const SyncFileItem &item) const
+{
+    static const int bandShift = 56;
+    static const quint64 maxSize = (Q_UINT64_C(1) << bandShift) - 1;
+
+    quint64 band = 2;
+    foreach (const QString &path, _prioritizedPaths) {
+        if (item._file == path || item._file.startsWith(path + QLatin1Char('/'))) {
+            band = 0;
+            break;
+        }
+    }
+    if (band != 0 && item._direction == SyncFileItem::Up && !item._isDirectory
+            && qint64(time(0)) - qint64(item._modtime) < recentlyModifiedSecs) {
+        band = 1;
+    }
+    return (band << bandShift) | qMin(quint64(item._size), maxSize);
+}
+
+void OwncloudPropagator::prioritizePath(const QString &path)
+{
+    QString cleanPath = QDir::cleanPath(path);
+    if (cleanPath == QLatin1String(".")) {
+        cleanPath.clear();
+    }
+    if (_prioritizedPaths.contains(cleanPath)) {
+        return;
+    }
+    qDebug() << Q_FUNC_INFO << cleanPath;
+    _prioritizedPaths.append(cleanPath);
+    _priorityGeneration++;
+    if (_rootJob) {
+        QMetaObject::invokeMethod(this, "scheduleNextJob", Qt::QueuedConnection);
+    }
+}
+
+void OwncloudPropagator::slotItemCompleted(const SyncFileItem &item)
+{
+    SyncMetrics::addToGauge("propagator.pending_items", -1);
+    SyncMetrics::setGauge("propagator.active_jobs", _activeJobs);
+    if (item._status == SyncFileItem::Success) {
+        SyncMetrics::addToCounter("propagator.items_succeeded");
+    } else if (item._status != SyncFileItem::NoStatus && item._status != SyncFileItem::FileIgnored) {
+        SyncMetrics::addToCounter("propagator.items_failed");
+    }
+    if (item._requestDuration > 0) {
+        SyncMetrics::recordValue("propagator.request_msec", item._requestDuration);
+    }
+
+    if (item._isDirectory || item._status != SyncFileItem::Success) {
+        return;
+    }
+    _completionTimes.append(_propagationTimer.elapsed());
+}
+
+qint64 OwncloudPropagator::firstCompletionMsec() const
+{
+    return _completionTimes.isEmpty() ? -1 : _completionTimes.first();
+}
+
+qint64 OwncloudPropagator::medianCompletionMsec() const
+{
+    if (_completionTimes.isEmpty()) {
+        return -1;
+    }
+    // completion times are appended in order, so they are sorted already
+    return _completionTimes.at(_completionTimes.count() / 2);
+}
+
 bool OwncloudPropagator::isInSharedDirectory(const QString& file)
 {
     bool re = false;
@@ -472,11 +663,77 @@ QString OwncloudPropagator::getFilePath(const QString& tmp_file_name) const
 
 void OwncloudPropagator::scheduleNextJob()
 {
+    SyncMetrics::setGauge("propagator.active_jobs", _activeJobs);
     if (this->_activeJobs < maximumActiveJob()) {
         if (_rootJob->scheduleNextJob()) {
             QTimer::singleShot(100, this, SLOT(scheduleNextJob()));
         }
     }
+
+    // The directories are created in their own lane, so that the uploads into
+    // them can start as early as possible. A finished MKCOL calls us again.
+    while (_activeMkdirJobs < maximumActiveMkdirJobs() && !_mkdirQueue.isEmpty()) {
+        QPair<PropagateDirectory *, PropagateDirectory *> next = _mkdirQueue.dequeue();
+        next.first->startQueuedMkdir(next.second);
+    }
+}
+
+bool OwncloudPropagator::reserveDiskSpace(qint64 bytes)
+{
+    if (bytes <= 0) {
+        return true;
+    }
+
+    bool ok = true;
+    const qint64 freeBytes = Utility::freeDiskSpace(_localDir, &ok);
+    if (!ok) {
+        // Can't tell, let the download fail when the disk is full
+        return true;
+    }
+    // The allocated part of the reservations is already missing from the free space
+    if (freeBytes - (_reservedDiskBytes - _allocatedDiskBytes) - freeSpaceLimit() < bytes) {
+        qDebug() << "Not enough disk space for" << bytes << "bytes, free:" << freeBytes
+                 << "reserved:" << _reservedDiskBytes << "allocated:" << _allocatedDiskBytes;
+        return false;
+    }
+
+    _reservedDiskBytes += bytes;
+    SyncMetrics::setGauge("disk.reserved_bytes", _reservedDiskBytes);
+    return true;
+}
+
+void OwncloudPropagator::allocateDiskSpace(qint64 bytes)
+{
+    if (bytes > 0) {
+        _allocatedDiskBytes += bytes;
+    }
+}
+
+void OwncloudPropagator::releaseDiskSpace(qint64 bytes, bool allocated)
+{
+    if (bytes <= 0) {
+        return;
+    }
+    _reservedDiskBytes -= bytes;
+    if (allocated) {
+        _allocatedDiskBytes -= bytes;
+    }
+    SyncMetrics::setGauge("disk.reserved_bytes", _reservedDiskBytes);
+
+    // Give the waiting downloads another chance, those that still don't fit wait again
+    QList<QPointer<PropagateItemJob> > waiting;
+    waiting.swap(_jobsWaitingForDiskSpace);
+    foreach (const QPointer<PropagateItemJob> &job, waiting) {
+        if (job) {
+            QMetaObject::invokeMethod(job, "start", Qt::QueuedConnection);
+        }
+    }
+}
+
+void OwncloudPropagator::waitForDiskSpace(PropagateItemJob *job)
+{
+    SyncMetrics::addToCounter("disk.deferred_downloads");
+    _jobsWaitingForDiskSpace.append(job);
 }
 
 void OwncloudPropagator::addTouchedFile(const QString& fn)
@@ -507,6 +764,11 @@ AccountPtr OwncloudPropagator::account() const
 
 // ================================================================================
 
+quint64 PropagateItemJob::priority()
+{
+    return _propagator->itemPriority(_item);
+}
+
 PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 {
     // If any of the non-finished sub jobs is not parallel, we have to wait
@@ -528,6 +790,56 @@ PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 }
 
 
+quint64 PropagateDirectory::priority()
+{
+    updateSchedulingOrder();
+    return _priority;
+}
+
+void PropagateDirectory::updateSchedulingOrder()
+{
+    if (_priorityGeneration == _propagator->_priorityGeneration
+            && _schedulingOrder.count() == _subJobs.count()) {
+        return;
+    }
+    _priorityGeneration = _propagator->_priorityGeneration;
+    _priority = _firstJob ? _firstJob->priority() : std::numeric_limits<quint64>::max();
+
+    QVector<QPair<quint64, PropagatorJob *> > keyed;
+    keyed.reserve(_subJobs.count());
+    foreach (PropagatorJob *job, _subJobs) {
+        quint64 p = job->priority();
+        _priority = qMin(_priority, p);
+        keyed.append(qMakePair(p, job));
+    }
+
+    _schedulingOrder.resize(0);
+    int segmentStart = 0;
+    for (int i = 0; i <= keyed.count(); ++i) {
+        bool barrier = i == keyed.count() || keyed.at(i).second->parallelism() != FullParallelism;
+        if (!barrier) {
+            if (PropagateDirectory *dir = qobject_cast<PropagateDirectory *>(keyed.at(i).second)) {
+                barrier = dir->_item._instruction == CSYNC_INSTRUCTION_REMOVE;
+            }
+        }
+        if (!barrier) {
+            continue;
+        }
+        // the pair compares the pointers for equal priorities, keep the sync order instead
+        std::stable_sort(keyed.begin() + segmentStart, keyed.begin() + i,
+                         [](const QPair<quint64, PropagatorJob *> &a, const QPair<quint64, PropagatorJob *> &b) {
+                             return a.first < b.first;
+                         });
+        for (int j = segmentStart; j < i; ++j) {
+            _schedulingOrder.append(keyed.at(j).second);
+        }
+        if (i < keyed.count()) {
+            _schedulingOrder.append(keyed.at(i).second);
+        }
+        segmentStart = i + 1;
+    }
+}
+
 bool PropagateDirectory::scheduleNextJob()
 {
     if (_state == Finished) {
@@ -541,9 +853,17 @@ bool PropagateDirectory::scheduleNextJob()
             finalize();
             return true;
         }
+        if (!_firstJob) {
+            queueSubDirectoryMkdirs();
+        }
     }
 
     if (_firstJob && _firstJob->_state == NotYetStarted) {
+        if (hasPendingMkdir() && _propagator->_activeMkdirJobs >= OwncloudPropagator::maximumActiveMkdirJobs()) {
+            // OwncloudPropagator::scheduleNextJob() starts it once a MKCOL finished
+            queueMkdir(0);
+            return false;
+        }
         return possiblyRunNextJob(_firstJob.data());
     }
 
@@ -551,24 +871,27 @@ bool PropagateDirectory::scheduleNextJob()
         return false;
     }
 
+    updateSchedulingOrder();
+
     bool stopAtDirectory = false;
     // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
-        if (_subJobs.at(i)->_state == Finished) {
+    for (int i = 0; i < _schedulingOrder.count(); ++i) {
+        PropagatorJob *job = _schedulingOrder.at(i);
+        if (job->_state == Finished) {
             continue;
         }
 
-        if (stopAtDirectory && qobject_cast<PropagateDirectory*>(_subJobs.at(i))) {
+        if (stopAtDirectory && qobject_cast<PropagateDirectory*>(job)) {
             return false;
         }
 
-        if (possiblyRunNextJob(_subJobs.at(i))) {
+        if (possiblyRunNextJob(job)) {
             return true;
         }
 
-        Q_ASSERT(_subJobs.at(i)->_state == Running);
+        Q_ASSERT(job->_state == Running);
 
-        auto paral = _subJobs.at(i)->parallelism();
+        auto paral = job->parallelism();
         if (paral == WaitForFinished) {
             return false;
         }
@@ -579,6 +902,65 @@ bool PropagateDirectory::scheduleNextJob()
     return false;
 }
 
+bool PropagateDirectory::hasPendingMkdir() const
+{
+    return _firstJob && _firstJob->_state == NotYetStarted
+            && qobject_cast<PropagateRemoteMkdir *>(_firstJob.data());
+}
+
+void PropagateDirectory::queueMkdir(PropagateDirectory *parent)
+{
+    if (!_mkdirQueued) {
+        _mkdirQueued = true;
+        _propagator->_mkdirQueue.enqueue(qMakePair(this, parent));
+    }
+}
+
+void PropagateDirectory::queueSubDirectoryMkdirs()
+{
+    updateSchedulingOrder();
+
+    // The same ordering constraints as in scheduleNextJob(), but stricter:
+    // nothing is created ahead of a move or removal that did not finish.
+    // The directories behind it are started by scheduleNextJob() later.
+    for (int i = 0; i < _schedulingOrder.count(); ++i) {
+        PropagatorJob *job = _schedulingOrder.at(i);
+        if (job->_state == Finished) {
+            continue;
+        }
+        if (job->parallelism() != FullParallelism) {
+            break;
+        }
+        PropagateDirectory *dir = qobject_cast<PropagateDirectory *>(job);
+        if (!dir) {
+            continue;
+        }
+        if (dir->_item._instruction == CSYNC_INSTRUCTION_REMOVE) {
+            break;
+        }
+        if (dir->_state == NotYetStarted && dir->hasPendingMkdir()) {
+            dir->queueMkdir(this);
+        }
+    }
+}
+
+bool PropagateDirectory::startQueuedMkdir(PropagateDirectory *parent)
+{
+    _mkdirQueued = false;
+    if (!hasPendingMkdir()) {
+        return false;
+    }
+    if (_state == Running) {
+        // scheduleNextJob() got here first, but the lane was full
+        return possiblyRunNextJob(_firstJob.data());
+    }
+    if (_state == NotYetStarted && parent && parent->_state == Running) {
+        // starting the directory job starts its MKCOL
+        return parent->possiblyRunNextJob(this);
+    }
+    return false;
+}
+
 void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
 {
     if (status == SyncFileItem::FatalError ||
@@ -592,6 +974,11 @@ void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
     }
     _runningNow--;
 
+    if (sender() == _firstJob.data()) {
+        // The directory exists on the server now
+        queueSubDirectoryMkdirs();
+    }
+
     int total = _subJobs.count();
     if (!_firstJob) {
         total--;
@@ -624,44 +1011,69 @@ void PropagateDirectory::finalize()
                 }
             }
             SyncJournalFileRecord record(_item,  _propagator->_localDir + _item._file);
-            _propagator->_journal->setFileRecord(record);
+            _propagator->_journal->setFileRecordAsync(record);
         }
     }
     _state = Finished;
     emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
 }
 
+int CleanupPollsJob::maximumActivePolls()
+{
+    // QNAM opens at most six connections per host, more would only queue up
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_POLLS").toUInt();
+    if (!max) {
+        max = 6; //default
+    }
+    return max;
+}
+
+int CleanupPollsJob::pollDeadlineMsec()
+{
+    return 60 * 1000;
+}
+
 void CleanupPollsJob::start()
 {
-    if (_pollInfos.empty()) {
+    if (_pollInfos.empty() && _activeJobs == 0) {
         emit finished();
         deleteLater();
         return;
     }
 
-    auto info = _pollInfos.first();
-    _pollInfos.pop_front();
-    SyncFileItem item;
-    item._file = info._file;
-    item._modtime = info._modtime;
-    PollJob *job = new PollJob(_account, info._url, item, _journal, _localPath, this);
-    connect(job, SIGNAL(finishedSignal()), SLOT(slotPollFinished()));
-    job->start();
+    while (_activeJobs < maximumActivePolls() && !_pollInfos.empty()) {
+        auto info = _pollInfos.first();
+        _pollInfos.pop_front();
+        SyncFileItem item;
+        item._file = info._file;
+        item._modtime = info._modtime;
+        PollJob *job = new PollJob(_account, info._url, item, _journal, _localPath, this);
+        job->setDeadline(pollDeadlineMsec());
+        connect(job, SIGNAL(finishedSignal()), SLOT(slotPollFinished()));
+        _activeJobs++;
+        job->start();
+    }
 }
 
 void CleanupPollsJob::slotPollFinished()
 {
     PollJob *job = qobject_cast<PollJob *>(sender());
     Q_ASSERT(job);
+    _activeJobs--;
     if (job->_item._status == SyncFileItem::FatalError) {
         emit aborted(job->_item._errorString);
+        // The polls that still run are deleted with us and must not report anything
+        _pollInfos.clear();
+        disconnect();
+        deleteLater();
         return;
     } else if (job->_item._status != SyncFileItem::Success) {
         qDebug() << "There was an error with file " << job->_item._file << job->_item._errorString;
     } else {
-        _journal->setFileRecord(SyncJournalFileRecord(job->_item, _localPath + job->_item._file));
+        _journal->setFileRecordAsync(SyncJournalFileRecord(job->_item, _localPath + job->_item._file));
+        emit pollSucceeded(job->_item._file);
     }
-    // Continue with the next entry, or finish
+    // Continue with the next entries, or finish
     start();
 }
 
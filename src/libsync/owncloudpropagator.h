@@ -24,11 +24,14 @@
 #include <QPointer>
 #include <QIODevice>
 #include <QMutex>
+#include <QQueue>
 
 #include "syncfileitem.h"
 #include "syncjournaldb.h"
 #include "bandwidthmanager.h"
 #include "accountfwd.h"
+#include "synctrace.h"
+#include "transfercompression.h"
 
 struct hbf_transfer_s;
 struct ne_session_s;
@@ -80,6 +83,11 @@ public:
 
     virtual JobParallelism parallelism() { return FullParallelism; }
 
+    /**
+     * Jobs with lower values are started first, see OwncloudPropagator::itemPriority()
+     */
+    virtual quint64 priority() { return 0; }
+
 public slots:
     virtual void abort() {}
 
@@ -135,22 +143,28 @@ protected:
 protected slots:
     void slotRestoreJobCompleted(const SyncFileItem& );
 
+protected:
+    qint64 _traceStartUsec;
+
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
 
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItem &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _traceStartUsec(0), _item(item) {}
 
     bool scheduleNextJob() Q_DECL_OVERRIDE {
         if (_state != NotYetStarted) {
             return false;
         }
         _state = Running;
+        _traceStartUsec = SyncTrace::nowUsec();
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
 
+    quint64 priority() Q_DECL_OVERRIDE;
+
     SyncFileItem  _item;
 
 public slots:
@@ -179,6 +193,7 @@ public:
     explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItem &item = SyncFileItem())
         : PropagatorJob(propagator)
         , _firstJob(0), _item(item),  _current(-1), _runningNow(0), _hasError(SyncFileItem::NoStatus)
+        , _priorityGeneration(-1), _priority(0), _mkdirQueued(false)
     { }
 
     virtual ~PropagateDirectory() {
@@ -190,7 +205,18 @@ public:
     }
 
     virtual bool scheduleNextJob() Q_DECL_OVERRIDE;
+
+    /**
+     * Starts the MKCOL of this directory, which was queued in
+     * OwncloudPropagator::_mkdirQueue, ahead of the file jobs. \a parent is
+     * the directory job this one is a sub job of.
+     * Returns false if that is not possible (anymore).
+     */
+    bool startQueuedMkdir(PropagateDirectory *parent);
+
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
+    /** The priority of the most urgent job in this directory */
+    virtual quint64 priority() Q_DECL_OVERRIDE;
     virtual void abort() Q_DECL_OVERRIDE {
         if (_firstJob)
             _firstJob->abort();
@@ -204,6 +230,26 @@ public:
 
     void finalize();
 
+private:
+    /**
+     * Sorts the sub jobs by priority into _schedulingOrder.
+     * Jobs that are not fully parallel, and removed directories, keep their
+     * position so that the ordering constraints of the sync are respected.
+     */
+    void updateSchedulingOrder();
+
+    /** Whether _firstJob creates the directory on the server and did not start yet */
+    bool hasPendingMkdir() const;
+    /** Adds this directory to OwncloudPropagator::_mkdirQueue, unless it is in there */
+    void queueMkdir(PropagateDirectory *parent);
+    /** Queues the MKCOLs of the sub directories, once this directory exists on the server */
+    void queueSubDirectoryMkdirs();
+
+    QVector<PropagatorJob *> _schedulingOrder;
+    int _priorityGeneration; // OwncloudPropagator::_priorityGeneration _schedulingOrder is for
+    quint64 _priority;
+    bool _mkdirQueued;
+
 private slots:
     bool possiblyRunNextJob(PropagatorJob *next) {
         if (next->_state == NotYetStarted) {
@@ -266,7 +312,16 @@ public:
             , _finishedEmited(false)
             , _bandwidthManager(this)
             , _activeJobs(0)
+            , _activeMkdirJobs(0)
             , _anotherSyncNeeded(false)
+            , _priorityGeneration(0)
+            , _maxBundledFiles(0)
+            , _uploadEncoding(TransferCompression::Identity)
+            , _uploadFeaturesPending(false)
+            , _compressedFileBytes(0)
+            , _compressedWireBytes(0)
+            , _reservedDiskBytes(0)
+            , _allocatedDiskBytes(0)
             , _account(account)
     { }
 
@@ -284,9 +339,104 @@ public:
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
+    /** Files that were skipped because they were still changing, a targeted sync can pick them up */
+    QStringList _pathsToRetry;
+
     /* The maximum number of active job in parallel  */
     int maximumActiveJob();
 
+    /**
+     * The number of running PropagateRemoteMkdir jobs. They don't count in
+     * _activeJobs, new directories are created in a lane of their own.
+     */
+    int _activeMkdirJobs;
+
+    /**
+     * The directories whose MKCOL can start as soon as the lane has room,
+     * with their parent directory job. A directory is queued once its parent
+     * exists on the server, so a new tree is created breadth-first and ahead
+     * of the file jobs.
+     */
+    QQueue<QPair<PropagateDirectory *, PropagateDirectory *> > _mkdirQueue;
+
+    /* The maximum number of PropagateRemoteMkdir jobs in parallel */
+    static int maximumActiveMkdirJobs();
+
+    /**
+     * The scheduling priority of an item, lower values are started first.
+     *
+     * Paths requested with prioritizePath() come first, then files that were
+     * modified locally during the last minutes, then everything else. Within
+     * each of these, smaller files go first.
+     */
+    quint64 itemPriority(const SyncFileItem &item) const;
+
+    /**
+     * Let the item at \a path, or everything below it if it is a directory,
+     * jump the queue. Jobs that already run are not affected.
+     */
+    void prioritizePath(const QString &path);
+
+    /** Bumped when the priorities changed, so the directory jobs re-sort their sub jobs */
+    int _priorityGeneration;
+
+    /** How many files the server accepts in one PropagateUploadBundle, 0 if it does not support them */
+    int _maxBundledFiles;
+
+    /** How uploads may be compressed, Identity if the server does not accept compressed uploads */
+    TransferCompression::Encoding _uploadEncoding;
+
+    /**
+     * Whether _maxBundledFiles and _uploadEncoding are set. Until the OPTIONS
+     * reply is there, uploads wait with waitForUploadFeatures() while the
+     * other jobs run. The job is restarted once the features are known.
+     */
+    bool uploadFeaturesKnown() const { return !_uploadFeaturesPending; }
+    void waitForUploadFeatures(PropagateItemJob *job);
+
+    /**
+     * Called once a compressed upload or download is done, with the size of
+     * the file and the number of bytes that went over the wire for it.
+     */
+    void recordCompression(bool upload, qint64 fileBytes, qint64 wireBytes);
+    /** How many bytes compression saved during this propagation */
+    qint64 compressionSavedBytes() const { return _compressedFileBytes - _compressedWireBytes; }
+    /** The size of the files that were transferred compressed during this propagation */
+    qint64 compressedFileBytes() const { return _compressedFileBytes; }
+
+    /** Time from start() until the first file was done, -1 if none was */
+    qint64 firstCompletionMsec() const;
+    /** Median time from start() until a file was done, -1 if none was */
+    qint64 medianCompletionMsec() const;
+
+    /**
+     * Reserves \a bytes of local disk space for a download.
+     *
+     * Returns false if the free space minus the space reserved by the other
+     * downloads would drop below freeSpaceLimit(). Every successful
+     * reservation must be given back with releaseDiskSpace() once the
+     * download is done.
+     */
+    bool reserveDiskSpace(qint64 bytes);
+    /**
+     * The reserved \a bytes were allocated on the disk, so the free space
+     * already lacks them. They stay reserved until they are released with
+     * \a allocated set.
+     */
+    void allocateDiskSpace(qint64 bytes);
+    void releaseDiskSpace(qint64 bytes, bool allocated = false);
+    /** The space reserved by the running downloads */
+    qint64 reservedDiskSpace() const { return _reservedDiskBytes; }
+
+    /**
+     * Restarts \a job once another download released its reservation.
+     * The job stays Running meanwhile, but does not count in _activeJobs.
+     */
+    void waitForDiskSpace(PropagateItemJob *job);
+
+    /** The free space that downloads leave on the local disk, in bytes, 0 for no limit */
+    static qint64 freeSpaceLimit();
+
     bool isInSharedDirectory(const QString& file);
     bool localFileNameClash(const QString& relfile);
     QString getFilePath(const QString& tmp_file_name) const;
@@ -328,6 +478,9 @@ private slots:
 
     void scheduleNextJob();
 
+    void slotItemCompleted(const SyncFileItem &item);
+    void slotUploadFeaturesChecked(int maxBundledFiles, const QByteArray &acceptEncoding);
+
 signals:
     void completed(const SyncFileItem &);
     void progress(const SyncFileItem&, quint64 bytes);
@@ -340,8 +493,23 @@ signals:
 
 private:
 
+    qint64 _compressedFileBytes;
+    qint64 _compressedWireBytes;
+
+    qint64 _reservedDiskBytes;
+    qint64 _allocatedDiskBytes; // the part of _reservedDiskBytes that is no longer free
+    QList<QPointer<PropagateItemJob> > _jobsWaitingForDiskSpace;
+
+    bool _uploadFeaturesPending;
+    QList<QPointer<PropagateItemJob> > _jobsWaitingForUploadFeatures;
+
     AccountPtr _account;
 
+    QStringList _prioritizedPaths;
+
+    QElapsedTimer _propagationTimer;
+    QVector<qint64> _completionTimes; // msec since start() for each propagated file
+
     /** Stores the time since a job touched a file. */
     QHash<QString, QElapsedTimer> _touchedFiles;
     mutable QMutex _touchedFilesMutex;
@@ -354,15 +522,26 @@ class CleanupPollsJob : public QObject {
     AccountPtr _account;
     SyncJournalDb *_journal;
     QString _localPath;
+    int _activeJobs;
 public:
     explicit CleanupPollsJob(const QVector< SyncJournalDb::PollInfo > &pollInfos, AccountPtr account,
                              SyncJournalDb *journal, const QString &localPath, QObject* parent = 0)
-        : QObject(parent), _pollInfos(pollInfos), _account(account), _journal(journal), _localPath(localPath) {}
+        : QObject(parent), _pollInfos(pollInfos), _account(account), _journal(journal), _localPath(localPath)
+        , _activeJobs(0) {}
 
+    /**
+     * Polls up to maximumActivePolls() entries at once. An entry the server
+     * did not finish within pollDeadlineMsec() is kept for the next sync.
+     */
     void start();
+
+    static int maximumActivePolls();
+    static int pollDeadlineMsec();
 signals:
     void finished();
     void aborted(const QString &error);
+    /** The server finished the upload of \a file, its record was written */
+    void pollSucceeded(const QString &file);
 private slots:
     void slotPollFinished();
 };
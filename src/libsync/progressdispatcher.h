@@ -39,7 +39,8 @@ namespace Progress
 
 
     struct Info {
-        Info() : _totalFileCount(0), _totalSize(0), _completedFileCount(0), _completedSize(0) {}
+        Info() : _totalFileCount(0), _totalSize(0), _completedFileCount(0), _completedSize(0),
+            _currentCompletedSize(0) {}
 
         // Used during local and remote update phase
         QString _currentDiscoveredFolder;
@@ -112,8 +113,18 @@ namespace Progress
         QHash<QString, ProgressItem> _currentItems;
         SyncFileItem _lastCompletedItem;
 
+        // Sum of the _completedSize of the files in _currentItems, kept up to date
+        // so that completedSize() does not need to iterate
+        quint64 _currentCompletedSize;
+
         void setProgressComplete(const SyncFileItem &item) {
-            _currentItems.remove(item._file);
+            QHash<QString, ProgressItem>::iterator it = _currentItems.find(item._file);
+            if (it != _currentItems.end()) {
+                if (!it->_item._isDirectory) {
+                    _currentCompletedSize -= it->_completedSize;
+                }
+                _currentItems.erase(it);
+            }
             _completedFileCount += item._affectedItems;
             if (!item._isDirectory) {
                 if (Progress::isSizeDependent(item._instruction)) {
@@ -124,11 +135,18 @@ namespace Progress
             this->updateEstimation();
         }
         void setProgressItem(const SyncFileItem &item, quint64 size) {
-            _currentItems[item._file]._item = item;
-            _currentItems[item._file]._completedSize = size;
+            ProgressItem &current = _currentItems[item._file];
+            if (!current._item.isEmpty() && !current._item._isDirectory) {
+                _currentCompletedSize -= current._completedSize;
+            }
+            if (!item._isDirectory) {
+                _currentCompletedSize += size;
+            }
+            current._item = item;
+            current._completedSize = size;
             _lastCompletedItem = SyncFileItem();
             this->updateEstimation();
-            _currentItems[item._file]._etaEstimate.updateTime(size,item._size);
+            current._etaEstimate.updateTime(size,item._size);
         }
         
         void updateEstimation() {
@@ -140,12 +158,7 @@ namespace Progress
         }
 
         quint64 completedSize() const {
-            quint64 r = _completedSize;
-            foreach(const ProgressItem &i, _currentItems) {
-                if (!i._item._isDirectory)
-                    r += i._completedSize;
-            }
-            return r;
+            return _completedSize + _currentCompletedSize;
         }
         /**
          * Get the total completion estimate structure 
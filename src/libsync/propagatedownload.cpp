@@ -25,10 +25,80 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QSemaphore>
 #include <cmath>
 
 namespace OCC {
 
+// keep low so we can easier limit the bandwidth
+static const int limitedReadBufferSize = 16 * 1024;
+static const int limitedReadChunkSize = 8 * 1024;
+// without limit, read and write in large blocks
+static const int unlimitedReadBufferSize = 4 * 1024 * 1024;
+static const int unlimitedReadChunkSize = 256 * 1024;
+static const int writeCoalesceSize = 1024 * 1024;
+// compressed data can expand a thousandfold
+static const int decodeChunkSize = 16 * 1024;
+
+static bool backgroundFlushEnabled()
+{
+    QByteArray env = qgetenv("OWNCLOUD_DOWNLOAD_BACKGROUND_FLUSH");
+    return env == "1" || env == "true";
+}
+
+/**
+ * Writes the coalesced buffers of a GETFileJob on the global thread pool, so
+ * that reading from the network goes on while the disk is busy.
+ * There is at most one write in flight.
+ */
+class GETFileJobWriter : public QRunnable {
+public:
+    explicit GETFileJobWriter(QFile *device)
+        : _device(device), _idle(1), _failed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    ~GETFileJobWriter() {
+        waitForIdle();
+    }
+
+    /** Swaps \a data with the internal buffer and starts writing it */
+    void write(QByteArray &data) {
+        _idle.acquire();
+        _data.swap(data);
+        QThreadPool::globalInstance()->start(this);
+    }
+
+    /** Waits for the pending write. Returns false if any write failed. */
+    bool waitForIdle() {
+        _idle.acquire();
+        _idle.release();
+        return !_failed;
+    }
+
+    QString errorString() const { return _errorString; }
+
+    void run() Q_DECL_OVERRIDE {
+        qint64 w = _device->write(_data);
+        if (w != _data.size()) {
+            _failed = true;
+            _errorString = _device->errorString();
+        }
+        _data.resize(0);
+        _idle.release();
+    }
+
+private:
+    QFile *_device;
+    QByteArray _data;
+    QSemaphore _idle;
+    bool _failed;
+    QString _errorString;
+};
+
 // DOES NOT take owncership of the device.
 GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
                     const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
@@ -36,9 +106,11 @@ GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
 : AbstractNetworkJob(account, path, parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
 , _resumeStart(resumeStart) , _errorStatus(SyncFileItem::NoStatus)
-, _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
+, _bandwidthLimited(false), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _encodedBytes(0), _decodedBytes(0)
 {
+    setNetworkLane(Account::TransferLane);
 }
 
 GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
@@ -48,12 +120,22 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 : AbstractNetworkJob(account, url.toEncoded(), parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
 , _resumeStart(resumeStart), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
-, _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
+, _bandwidthLimited(false), _bandwidthManager(0)
 , _hasEmittedFinishedSignal(false), _lastModified()
+, _encodedBytes(0), _decodedBytes(0)
 {
+    setNetworkLane(Account::TransferLane);
 }
 
 
+GETFileJob::~GETFileJob()
+{
+    if (_bandwidthManager) {
+        _bandwidthManager->unregisterDownloadJob(this);
+    }
+    // _writer waits for its pending write when it is destroyed
+}
+
 void GETFileJob::start() {
     if (_resumeStart > 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) +'-';
@@ -75,11 +157,15 @@ void GETFileJob::start() {
     }
     setupConnections(reply());
 
-    reply()->setReadBufferSize(16 * 1024); // keep low so we can easier limit the bandwidth
-    qDebug() << Q_FUNC_INFO << _bandwidthManager << _bandwidthChoked << _bandwidthLimited;
     if (_bandwidthManager) {
         _bandwidthManager->registerDownloadJob(this);
     }
+    updateReadBufferSize();
+    qDebug() << Q_FUNC_INFO << _bandwidthManager << _bandwidthLimited;
+
+    if (backgroundFlushEnabled() && !_writer) {
+        _writer.reset(new GETFileJobWriter(_device));
+    }
 
     if( reply()->error() != QNetworkReply::NoError ) {
         qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
@@ -87,7 +173,7 @@ void GETFileJob::start() {
 
     connect(reply(), SIGNAL(metaDataChanged()), this, SLOT(slotMetaDataChanged()));
     connect(reply(), SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
-    connect(reply(), SIGNAL(downloadProgress(qint64,qint64)), this, SIGNAL(downloadProgress(qint64,qint64)));
+    connect(reply(), SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
     connect(this, SIGNAL(networkActivity()), account().data(), SIGNAL(propagatorNetworkActivity()));
 
     AbstractNetworkJob::start();
@@ -97,7 +183,7 @@ void GETFileJob::slotMetaDataChanged()
 {
     // For some reason setting the read buffer in GETFileJob::start doesn't seem to go
     // through the HTTP layer thread(?)
-    reply()->setReadBufferSize(16 * 1024);
+    updateReadBufferSize();
 
     int httpStatus = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
@@ -164,64 +250,152 @@ void GETFileJob::slotMetaDataChanged()
     if (!lastModified.isNull()) {
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
+
+    TransferCompression::Encoding encoding = TransferCompression::parseEncoding(reply()->rawHeader("Content-Encoding"));
+    if (encoding == TransferCompression::Unsupported || (encoding != TransferCompression::Identity && _resumeStart > 0)) {
+        // We only ask for gzip and deflate, and never when resuming
+        qDebug() << Q_FUNC_INFO << "Unexpected Content-Encoding" << reply()->rawHeader("Content-Encoding");
+        _errorString = tr("Server replied with an unsupported Content-Encoding");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
+    if (encoding != TransferCompression::Identity && !_decoder) {
+        _decoder.reset(new ZStream(ZStream::Decompress, encoding));
+    }
 }
 
-void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
+void GETFileJob::slotDownloadProgress(qint64 received, qint64 total)
 {
-    _bandwidthManager = bwm;
+    // For compressed replies, slotReadyRead() reports the decoded bytes instead
+    if (!_decoder) {
+        emit downloadProgress(received, total);
+    }
 }
 
-void GETFileJob::setChoked(bool c)
+void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
 {
-    _bandwidthChoked = c;
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    _bandwidthManager = bwm;
 }
 
 void GETFileJob::setBandwidthLimited(bool b)
 {
     _bandwidthLimited = b;
+    updateReadBufferSize();
     QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
 }
 
-void GETFileJob::giveBandwidthQuota(qint64 q)
+void GETFileJob::updateReadBufferSize()
 {
-    _bandwidthQuota = q;
-    qDebug() << Q_FUNC_INFO << "Got" << q << "bytes";
-    QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
+    if (reply()) {
+        reply()->setReadBufferSize(_bandwidthLimited ? limitedReadBufferSize : unlimitedReadBufferSize);
+    }
 }
 
-qint64 GETFileJob::currentDownloadPosition()
+bool GETFileJob::flushWriteBuffer(bool wait)
 {
-    if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
-        return _device->pos();
+    if (!_device->isOpen()) {
+        _writeBuffer.resize(0);
+        return true;
+    }
+
+    QString error;
+    if (_writer) {
+        if (!_writeBuffer.isEmpty()) {
+            if (_writer->waitForIdle()) {
+                _writer->write(_writeBuffer);
+            } else {
+                error = _writer->errorString();
+            }
+        }
+        if (error.isEmpty() && wait && !_writer->waitForIdle()) {
+            error = _writer->errorString();
+        }
+    } else if (!_writeBuffer.isEmpty()) {
+        qint64 w = _device->write(_writeBuffer);
+        if (w != _writeBuffer.size()) {
+            error = _device->errorString();
+        }
+        _writeBuffer.resize(0);
     }
-    return _resumeStart;
+
+    if (!error.isEmpty()) {
+        _errorString = error;
+        _errorStatus = SyncFileItem::NormalError;
+        qDebug() << "Error while writing to file" << _errorString;
+        return false;
+    }
+    return true;
+}
+
+void GETFileJob::emitFinished()
+{
+    if (_hasEmittedFinishedSignal) {
+        return;
+    }
+    flushWriteBuffer(true); // errors are reported through errorStatus()
+    if (_decoder && !_decoder->isFinished() && _device->isOpen()
+            && _errorStatus == SyncFileItem::NoStatus && reply()->error() == QNetworkReply::NoError) {
+        // The Content-Length check can't catch this for compressed replies
+        _errorString = tr("The file could not be downloaded completely.");
+        _errorStatus = SyncFileItem::SoftError;
+    }
+    if (_bandwidthManager) {
+        _bandwidthManager->unregisterDownloadJob(this);
+    }
+    _hasEmittedFinishedSignal = true;
+    emit finishedSignal();
+}
+
+bool GETFileJob::finished()
+{
+    if (reply()->bytesAvailable()) {
+        // Not all read yet because of bandwidth limits
+        return false;
+    }
+    emitFinished();
+    return true; // discard
 }
 
 void GETFileJob::slotReadyRead()
 {
-    int bufferSize = qMin(1024*8ll , reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    const int chunkSize = _bandwidthLimited ? limitedReadChunkSize : unlimitedReadChunkSize;
+    // When limited, write out what we got right away as we did before.
+    const int coalesceSize = _bandwidthLimited ? 0 : writeCoalesceSize;
 
     //qDebug() << Q_FUNC_INFO << reply()->bytesAvailable() << reply()->isOpen() << reply()->isFinished();
 
     while(reply()->bytesAvailable() > 0) {
-        if (_bandwidthChoked) {
-            qDebug() << Q_FUNC_INFO << "Download choked";
-            break;
+        qint64 toRead = qMin(qint64(chunkSize), reply()->bytesAvailable());
+        if (_decoder) {
+            // Keep what one read decompresses to within reason
+            toRead = qMin(toRead, qint64(decodeChunkSize));
         }
-        qint64 toRead = bufferSize;
-        if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
+        if (_bandwidthLimited && _bandwidthManager) {
+            toRead = _bandwidthManager->takeDownloadQuota(this, toRead);
             if (toRead == 0) {
-                qDebug() << Q_FUNC_INFO << "Out of quota";
+                // the bandwidth manager calls us again once we have quota
                 break;
             }
-            _bandwidthQuota -= toRead;
-            //qDebug() << Q_FUNC_INFO << "Reading" << toRead << "remaining" << _bandwidthQuota;
         }
 
-        qint64 r = reply()->read(buffer.data(), toRead);
+        // Read directly behind the data that is still waiting to be written.
+        // The buffers are only allocated once per job.
+        char *target;
+        int oldSize = _writeBuffer.size();
+        if (_device->isOpen() && !_decoder) {
+            if (_writeBuffer.capacity() < coalesceSize + chunkSize) {
+                _writeBuffer.reserve(coalesceSize + chunkSize);
+            }
+            _writeBuffer.resize(oldSize + toRead);
+            target = _writeBuffer.data() + oldSize;
+        } else {
+            // error reply, read and discard the body; or compressed data, decoded below
+            _readBuffer.resize(chunkSize);
+            target = _readBuffer.data();
+        }
+
+        qint64 r = reply()->read(target, toRead);
         if (r < 0) {
             _errorString = reply()->errorString();
             _errorStatus = SyncFileItem::NormalError;
@@ -229,13 +403,26 @@ void GETFileJob::slotReadyRead()
             reply()->abort();
             return;
         }
+        if (_bandwidthManager) {
+            _bandwidthManager->recordDownloaded(r);
+        }
+        _encodedBytes += r;
 
         if (_device->isOpen()) {
-            qint64 w = _device->write(buffer.constData(), r);
-            if (w != r) {
-                _errorString = _device->errorString();
+            if (!_decoder) {
+                _writeBuffer.resize(oldSize + r);
+            } else if (!_decoder->process(_readBuffer.constData(), r, &_writeBuffer)) {
+                _errorString = tr("The downloaded data could not be decompressed: %1").arg(_decoder->errorString());
                 _errorStatus = SyncFileItem::NormalError;
-                qDebug() << "Error while writing to file" << w << r <<  _errorString;
+                qDebug() << "Error while decompressing: " << _errorString;
+                reply()->abort();
+                return;
+            }
+            _decodedBytes += _writeBuffer.size() - oldSize;
+            if (_decoder) {
+                emit downloadProgress(_decodedBytes, -1);
+            }
+            if (_writeBuffer.size() > coalesceSize && !flushWriteBuffer(false)) {
                 reply()->abort();
                 return;
             }
@@ -245,13 +432,7 @@ void GETFileJob::slotReadyRead()
     //qDebug() << Q_FUNC_INFO << "END" << reply()->isFinished() << reply()->bytesAvailable() << _hasEmittedFinishedSignal;
     if (reply()->isFinished() && reply()->bytesAvailable() == 0) {
         qDebug() << Q_FUNC_INFO << "Actually finished!";
-        if (_bandwidthManager) {
-            _bandwidthManager->unregisterDownloadJob(this);
-        }
-        if (!_hasEmittedFinishedSignal) {
-            emit finishedSignal();
-        }
-        _hasEmittedFinishedSignal = true;
+        emitFinished();
         deleteLater();
     }
 }
@@ -286,7 +467,7 @@ void PropagateDownloadFileQNAM::start()
         // if the etag has changed meanwhile, remove the already downloaded part.
         if (progressInfo._etag != _item._etag) {
             QFile::remove(_propagator->getFilePath(progressInfo._tmpfile));
-            _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
+            _propagator->_journal->setDownloadInfoAsync(_item._file, SyncJournalDb::DownloadInfo());
         } else {
             tmpFileName = progressInfo._tmpfile;
             expectedEtagForResume = progressInfo._etag;
@@ -304,7 +485,25 @@ void PropagateDownloadFileQNAM::start()
     }
 
     _tmpFile.setFileName(_propagator->getFilePath(tmpFileName));
+
+    // Only the part that is not downloaded yet needs space
+    const qint64 partSize = QFileInfo(_tmpFile.fileName()).size();
+    if (qint64(_item._size) > partSize) {
+        if (!_propagator->reserveDiskSpace(_item._size - partSize)) {
+            if (_propagator->reservedDiskSpace() > 0) {
+                // The running downloads may leave enough space once they are done
+                _propagator->waitForDiskSpace(this);
+                return;
+            }
+            done(SyncFileItem::SoftError, tr("The download would reduce free disk space below %1")
+                 .arg(Utility::octetsToString(OwncloudPropagator::freeSpaceLimit())));
+            return;
+        }
+        _reservedBytes = _item._size - partSize;
+    }
+
     if (!_tmpFile.open(QIODevice::Append | QIODevice::Unbuffered)) {
+        releaseDiskSpace();
         done(SyncFileItem::NormalError, _tmpFile.errorString());
         return;
     }
@@ -316,6 +515,7 @@ void PropagateDownloadFileQNAM::start()
         pi._etag = _item._etag;
         pi._tmpfile = tmpFileName;
         pi._valid = true;
+        // Written right away, a crash must not leave the temporary file unknown
         _propagator->_journal->setDownloadInfo(_item._file, pi);
         _propagator->_journal->commit("download file start");
     }
@@ -332,6 +532,24 @@ void PropagateDownloadFileQNAM::start()
         }
     }
 
+    // Reserve the space for the whole file up front, this avoids fragmentation
+    // and lets us write without growing the file all the time.
+    // The reservation is kept until the GET is done, so that the other
+    // downloads wait for it, but the allocated space is not counted twice.
+    if (_item._size > startSize && FileSystem::preallocate(&_tmpFile, _item._size)) {
+        _propagator->allocateDiskSpace(_reservedBytes);
+        _reservationAllocated = true;
+    }
+
+    // Setting Accept-Encoding ourselves stops QNAM from decoding the reply,
+    // GETFileJob does it while writing. A range of compressed data is of no
+    // use for resuming, so only the full file may come compressed.
+    if (startSize == 0 && TransferCompression::isCandidate(_item._file, _item._size)) {
+        headers["Accept-Encoding"] = "gzip, deflate";
+    } else {
+        headers["Accept-Encoding"] = "identity";
+    }
+
     if (_item._directDownloadUrl.isEmpty()) {
         // Normal job, download from oC instance
         _job = new GETFileJob(_propagator->account(),
@@ -357,9 +575,17 @@ void PropagateDownloadFileQNAM::start()
     _job->start();
 }
 
+void PropagateDownloadFileQNAM::releaseDiskSpace()
+{
+    _propagator->releaseDiskSpace(_reservedBytes, _reservationAllocated);
+    _reservedBytes = 0;
+    _reservationAllocated = false;
+}
+
 void PropagateDownloadFileQNAM::slotGetFinished()
 {
     _propagator->_activeJobs--;
+    releaseDiskSpace();
 
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     Q_ASSERT(job);
@@ -369,7 +595,8 @@ void PropagateDownloadFileQNAM::slotGetFinished()
              << (job->reply()->error() == QNetworkReply::NoError ? QLatin1String("") : job->reply()->errorString());
 
     QNetworkReply::NetworkError err = job->reply()->error();
-    if (err != QNetworkReply::NoError) {
+    // A failed write of the last buffered data does not show up as network error
+    if (err != QNetworkReply::NoError || job->errorStatus() != SyncFileItem::NoStatus) {
         _item._httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
         // If we sent a 'Range' header and get 416 back, we want to retry
@@ -385,7 +612,7 @@ void PropagateDownloadFileQNAM::slotGetFinished()
         if (_tmpFile.size() == 0 || badRangeHeader) {
             _tmpFile.close();
             _tmpFile.remove();
-            _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
+            _propagator->_journal->setDownloadInfoAsync(_item._file, SyncJournalDb::DownloadInfo());
         }
 
         if(!_item._directDownloadUrl.isEmpty()) {
@@ -431,6 +658,11 @@ void PropagateDownloadFileQNAM::slotGetFinished()
      */
     const QByteArray sizeHeader("Content-Length");
     quint64 bodySize = job->reply()->rawHeader(sizeHeader).toULongLong();
+    if (job->isContentEncoded()) {
+        // The GETFileJob checked that the compressed stream was complete
+        bodySize = 0;
+        _propagator->recordCompression(false, job->decodedBytes(), job->encodedBytes());
+    }
 
     if(bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart() ) {
         qDebug() << bodySize << _tmpFile.size() << job->resumeStart();
@@ -509,8 +741,8 @@ void PropagateDownloadFileQNAM::downloadFinished()
         // which makes it look like we're just about to initially download
         // it.
         if (isConflict) {
-            _propagator->_journal->deleteFileRecord(fn);
-            _propagator->_journal->commit("download finished");
+            _propagator->_journal->deleteFileRecordAsync(fn);
+            _propagator->_journal->commitAsync("download finished");
         }
         _propagator->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, error);
@@ -522,9 +754,9 @@ void PropagateDownloadFileQNAM::downloadFinished()
     FileSystem::setModTime(fn, _item._modtime);
     _item._size = FileSystem::getSize(fn);
 
-    _propagator->_journal->setFileRecord(SyncJournalFileRecord(_item, fn));
-    _propagator->_journal->setDownloadInfo(_item._file, SyncJournalDb::DownloadInfo());
-    _propagator->_journal->commit("download file start2");
+    _propagator->_journal->setFileRecordAsync(SyncJournalFileRecord(_item, fn));
+    _propagator->_journal->setDownloadInfoAsync(_item._file, SyncJournalDb::DownloadInfo());
+    _propagator->_journal->commitAsync("download file start2");
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 }
 
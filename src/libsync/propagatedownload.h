@@ -15,12 +15,16 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "transfercompression.h"
 
 #include <QBuffer>
 #include <QFile>
+#include <QScopedPointer>
 
 namespace OCC {
 
+class GETFileJobWriter;
+
 class GETFileJob : public AbstractNetworkJob {
     Q_OBJECT
     QFile* _device;
@@ -31,12 +35,16 @@ class GETFileJob : public AbstractNetworkJob {
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _bandwidthChoked; // if download is paused (won't read on readyRead())
-    qint64 _bandwidthQuota;
+    bool _bandwidthLimited; // if quota must be taken from the _bandwidthManager before reading
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QByteArray _readBuffer; // error bodies and compressed data, before they are decoded
+    QByteArray _writeBuffer; // coalesces small reads into large writes
+    QScopedPointer<GETFileJobWriter> _writer; // only if background flushing is enabled
+    QScopedPointer<ZStream> _decoder; // only if the reply has a Content-Encoding
+    qint64 _encodedBytes; // read from the reply
+    qint64 _decodedBytes; // written to the device
 public:
 
     // DOES NOT take owncership of the device.
@@ -47,35 +55,13 @@ public:
     explicit GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
                         const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
                         quint64 resumeStart, QObject* parent = 0);
-    virtual ~GETFileJob() {
-        if (_bandwidthManager) {
-            _bandwidthManager->unregisterDownloadJob(this);
-        }
-    }
+    virtual ~GETFileJob();
 
     virtual void start() Q_DECL_OVERRIDE;
-    virtual bool finished() Q_DECL_OVERRIDE {
-//         qDebug() << Q_FUNC_INFO << reply()->bytesAvailable() << _hasEmittedFinishedSignal;
-        if (reply()->bytesAvailable()) {
-//             qDebug() << Q_FUNC_INFO << "Not all read yet because of bandwidth limits";
-            return false;
-        } else {
-            if (_bandwidthManager) {
-                _bandwidthManager->unregisterDownloadJob(this);
-            }
-            if (!_hasEmittedFinishedSignal) {
-                emit finishedSignal();
-            }
-            _hasEmittedFinishedSignal = true;
-            return true; // discard
-        }
-    }
+    virtual bool finished() Q_DECL_OVERRIDE;
 
     void setBandwidthManager(BandwidthManager *bwm);
-    void setChoked(bool c);
     void setBandwidthLimited(bool b);
-    void giveBandwidthQuota(qint64 q);
-    qint64 currentDownloadPosition();
 
     QString errorString() {
         return _errorString.isEmpty() ? reply()->errorString() : _errorString;
@@ -89,6 +75,11 @@ public:
     quint64 resumeStart() { return _resumeStart; }
     time_t lastModified() { return _lastModified; }
 
+    /** Whether the reply was compressed, its Content-Length is not the file size then */
+    bool isContentEncoded() const { return !_decoder.isNull(); }
+    qint64 encodedBytes() const { return _encodedBytes; }
+    qint64 decodedBytes() const { return _decodedBytes; }
+
 
 signals:
     void finishedSignal();
@@ -96,6 +87,11 @@ signals:
 private slots:
     void slotReadyRead();
     void slotMetaDataChanged();
+    void slotDownloadProgress(qint64 received, qint64 total);
+private:
+    void updateReadBufferSize();
+    bool flushWriteBuffer(bool wait);
+    void emitFinished();
 };
 
 
@@ -105,10 +101,14 @@ class PropagateDownloadFileQNAM : public PropagateItemJob {
 
 //  QFile *_file;
     QFile _tmpFile;
+    qint64 _reservedBytes; // disk space reserved with OwncloudPropagator::reserveDiskSpace()
+    bool _reservationAllocated; // the reserved space was preallocated for _tmpFile
 public:
     PropagateDownloadFileQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
-        : PropagateItemJob(propagator, item) {}
+        : PropagateItemJob(propagator, item), _reservedBytes(0), _reservationAllocated(false) {}
     void start() Q_DECL_OVERRIDE;
+private:
+    void releaseDiskSpace();
 private slots:
     void slotGetFinished();
     void abort() Q_DECL_OVERRIDE;
@@ -105,8 +105,8 @@ void PropagateRemoteDelete::slotDeleteJobFinished()
         return;
     }
 
-    _propagator->_journal->deleteFileRecord(_item._originalFile, _item._isDirectory);
-    _propagator->_journal->commit("Remote Remove");
+    _propagator->_journal->deleteFileRecordAsync(_item._originalFile, _item._isDirectory);
+    _propagator->_journal->commitAsync("Remote Remove");
     done(SyncFileItem::Success);
 }
 
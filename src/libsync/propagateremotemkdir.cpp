@@ -31,7 +31,7 @@ void PropagateRemoteMkdir::start()
                         _propagator->_remoteFolder + _item._file,
                         this);
     connect(_job, SIGNAL(finished(QNetworkReply::NetworkError)), this, SLOT(slotMkcolJobFinished()));
-    _propagator->_activeJobs++;
+    _propagator->_activeMkdirJobs++;
     _job->start();
 }
 
@@ -43,7 +43,7 @@ void PropagateRemoteMkdir::abort()
 
 void PropagateRemoteMkdir::slotMkcolJobFinished()
 {
-    _propagator->_activeJobs--;
+    _propagator->_activeMkdirJobs--;
 
     Q_ASSERT(_job);
 
@@ -79,7 +79,7 @@ void PropagateRemoteMkdir::slotMkcolJobFinished()
         // So we must get the file id using a PROPFIND
         // This is required so that we can detect moves even if the folder is renamed on the server
         // while files are still uploading
-        _propagator->_activeJobs++;
+        _propagator->_activeMkdirJobs++;
         auto propfindJob = new PropfindJob(_job->account(), _job->path(), this);
         propfindJob->setProperties(QList<QByteArray>() << "getetag" << "http://swissdisk.com/dav/props/:id");
         QObject::connect(propfindJob, SIGNAL(result(QVariantMap)), this, SLOT(propfindResult(QVariantMap)));
@@ -93,7 +93,7 @@ void PropagateRemoteMkdir::slotMkcolJobFinished()
 
 void PropagateRemoteMkdir::propfindResult(const QVariantMap &result)
 {
-    _propagator->_activeJobs--;
+    _propagator->_activeMkdirJobs--;
     if (result.contains("getetag")) {
         _item._etag = result["getetag"].toByteArray();
     }
@@ -106,7 +106,7 @@ void PropagateRemoteMkdir::propfindResult(const QVariantMap &result)
 void PropagateRemoteMkdir::propfindError()
 {
     // ignore the PROPFIND error
-    _propagator->_activeJobs--;
+    _propagator->_activeMkdirJobs--;
     done(SyncFileItem::Success);
 }
 
@@ -114,7 +114,7 @@ void PropagateRemoteMkdir::success()
 {
     // save the file id already so we can detect rename or remove
     SyncJournalFileRecord record(_item, _propagator->_localDir + _item.destination());
-    _propagator->_journal->setFileRecord(record);
+    _propagator->_journal->setFileRecordAsync(record);
 
     done(SyncFileItem::Success);
 }
@@ -126,12 +126,12 @@ void PropagateRemoteMove::slotMoveJobFinished()
 
 void PropagateRemoteMove::finalize()
 {
-    _propagator->_journal->deleteFileRecord(_item._originalFile);
+    _propagator->_journal->deleteFileRecordAsync(_item._originalFile);
     SyncJournalFileRecord record(_item, _propagator->getFilePath(_item._renameTarget));
     record._path = _item._renameTarget;
 
-    _propagator->_journal->setFileRecord(record);
-    _propagator->_journal->commit("Remote Rename");
+    _propagator->_journal->setFileRecordAsync(record);
+    _propagator->_journal->commitAsync("Remote Rename");
     done(SyncFileItem::Success);
 }
 
@@ -21,13 +21,20 @@
 #include "utility.h"
 #include "filesystem.h"
 #include "propagatorjobs.h"
+#include "syncmetrics.h"
 #include <json.h>
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QTimer>
+#include <QThreadPool>
 #include <cmath>
 #include <cstring>
 
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
 namespace OCC {
 
 /**
@@ -42,6 +49,9 @@ namespace OCC {
  */
 static int minFileAgeForUpload = 2000;
 
+// The file is read twice when compressing, don't do that for large files
+static const qint64 maxCompressedFileSize = 32 * 1024 * 1024;
+
 static qint64 chunkSize() {
     return 0x10000000000ULL;
 }
@@ -70,8 +80,38 @@ void PUTFileJob::slotTimeout() {
     reply()->abort();
 }
 
+void CheckUploadFeaturesJob::start()
+{
+    setReply(davRequest("OPTIONS", path()));
+    setupConnections(reply());
+    AbstractNetworkJob::start();
+}
+
+bool CheckUploadFeaturesJob::finished()
+{
+    int maxFiles = 0;
+    QByteArray acceptEncoding;
+    if (reply()->error() == QNetworkReply::NoError) {
+        maxFiles = reply()->rawHeader("X-SwissDisk-Bundle").toInt();
+        acceptEncoding = reply()->rawHeader("Accept-Encoding");
+        account()->setUploadFeatures(maxFiles, acceptEncoding);
+    }
+    qDebug() << Q_FUNC_INFO << "Server accepts bundles of up to" << maxFiles << "files"
+             << "and the encodings" << acceptEncoding;
+    emit uploadFeaturesChecked(maxFiles, acceptEncoding);
+    return true;
+}
+
+// The server usually needs a moment to assemble the file, a poll that
+// immediately follows the previous one is not going to find it done.
+static const int initialPollDelayMsec = 1000;
+static const int maximumPollDelayMsec = 30 * 1000;
+
 void PollJob::start()
 {
+    if (!_deadlineTimer.isValid()) {
+        _deadlineTimer.start();
+    }
     setTimeout(120 * 1000);
     QUrl accountUrl = account()->url();
     QUrl finalUrl = QUrl::fromUserInput(accountUrl.scheme() + QLatin1String("://") +  accountUrl.authority()
@@ -95,15 +135,14 @@ bool PollJob::finished()
                 SyncJournalDb::PollInfo info;
                 info._file = _item._file;
                 // no info._url removes it from the database
-                _journal->setPollInfo(info);
-                _journal->commit("remove poll info");
+                _journal->setPollInfoAsync(info);
+                _journal->commitAsync("remove poll info");
 
             }
             emit finishedSignal();
             return true;
         }
-        start();
-        return false;
+        return retry();
     }
 
     bool ok = false;
@@ -118,8 +157,7 @@ bool PollJob::finished()
     }
 
     if (status["unfinished"].isValid()) {
-        start();
-        return false;
+        return retry();
     }
 
     _item._errorString = status["error"].toString();
@@ -131,23 +169,46 @@ bool PollJob::finished()
     SyncJournalDb::PollInfo info;
     info._file = _item._file;
     // no info._url removes it from the database
-    _journal->setPollInfo(info);
-    _journal->commit("remove poll info");
+    _journal->setPollInfoAsync(info);
+    _journal->commitAsync("remove poll info");
 
     emit finishedSignal();
     return true;
 }
 
+bool PollJob::retry()
+{
+    _retryDelayMsec = _retryDelayMsec ? qMin(2 * _retryDelayMsec, maximumPollDelayMsec)
+                                      : initialPollDelayMsec;
+    if (_deadlineMsec > 0 && _deadlineTimer.elapsed() + _retryDelayMsec > _deadlineMsec) {
+        qDebug() << Q_FUNC_INFO << "Giving up polling" << _item._file << "after" << _deadlineTimer.elapsed() << "ms";
+        SyncMetrics::addToCounter("poll.deadline_exceeded");
+        _item._status = SyncFileItem::SoftError;
+        _item._errorString = tr("The server did not finish processing the file in time");
+        emit finishedSignal();
+        return true;
+    }
+    SyncMetrics::addToCounter("poll.retries");
+    QTimer::singleShot(_retryDelayMsec, this, SLOT(slotRetry()));
+    return false;
+}
 
-void PropagateUploadFileQNAM::start()
+void PollJob::slotRetry()
+{
+    start();
+}
+
+
+// Returns false if the upload can't be started, done() was called then unless aborting.
+bool PropagateUploadFileQNAM::prepareUpload()
 {
     if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
-        return;
+        return false;
 
     QFileInfo fi(_propagator->getFilePath(_item._file));
     if (!fi.exists()) {
         done(SyncFileItem::SoftError, tr("File Removed"));
-        return;
+        return false;
     }
 
     // Update the mtime and size, it might have changed since discovery.
@@ -159,8 +220,21 @@ void PropagateUploadFileQNAM::start()
     // or not yet fully copied to the destination.
     QDateTime modtime = Utility::qDateTimeFromTime_t(_item._modtime);
     if (modtime.msecsTo(QDateTime::currentDateTime()) < minFileAgeForUpload) {
-        _propagator->_anotherSyncNeeded = true;
+        _propagator->_pathsToRetry.append(_item._file);
         done(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return false;
+    }
+    return true;
+}
+
+void PropagateUploadFileQNAM::start()
+{
+    if (!_propagator->uploadFeaturesKnown()) {
+        // Compression is decided when the upload starts
+        _propagator->waitForUploadFeatures(this);
+        return;
+    }
+    if (!prepareUpload()) {
         return;
     }
 
@@ -180,15 +254,96 @@ void PropagateUploadFileQNAM::start()
     _duration.start();
 
     emit progress(_item, 0);
+
+    if (_propagator->_uploadEncoding != TransferCompression::Identity
+            && TransferCompression::isCandidate(_item._file, _item._size)
+            && _item._size <= maxCompressedFileSize) {
+        // Compressing the whole file takes a while, don't block the event loop with it
+        CompressedSizeJob *job = new CompressedSizeJob(_propagator->getFilePath(_item._file), _propagator->_uploadEncoding);
+        connect(job, SIGNAL(finished()), this, SLOT(slotCompressedSizeFinished()));
+        job->start();
+        return;
+    }
     this->startNextChunk();
 }
 
+void PropagateUploadFileQNAM::slotCompressedSizeFinished()
+{
+    CompressedSizeJob *job = qobject_cast<CompressedSizeJob *>(sender());
+    Q_ASSERT(job);
+    _compression = job->result();
+    startNextChunk();
+}
+
+bool PropagateUploadFileQNAM::prepareBundledUpload(QByteArray *data)
+{
+    _state = Running;
+    _traceStartUsec = SyncTrace::nowUsec();
+    if (!prepareUpload()) {
+        return false;
+    }
+
+    QFile file(_propagator->getFilePath(_item._file));
+    QString openError;
+    if (!FileSystem::openFileSharedRead(&file, &openError)) {
+        // Soft error because this is likely caused by the user modifying his files while syncing
+        done(SyncFileItem::SoftError, openError);
+        return false;
+    }
+    *data = file.readAll();
+    if (quint64(data->size()) != _item._size) {
+        _propagator->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return false;
+    }
+
+    _duration.start();
+    emit progress(_item, 0);
+    return true;
+}
+
+void PropagateUploadFileQNAM::bundledUploadFinished(const SyncFileItem &result)
+{
+    _finished = true;
+    _item._httpErrorCode = result._httpErrorCode;
+
+    if (result._status != SyncFileItem::Success) {
+        if(checkForProblemsWithShared(_item._httpErrorCode,
+            tr("The file was edited locally but is part of a read only share. "
+               "It is restored and your edit is in the conflict file."))) {
+            return;
+        }
+        if (_item._httpErrorCode == 412) {
+            // Same as for a PUT, the etag in the database might be wrong
+            _propagator->_journal->avoidReadFromDbOnNextSync(_item._file);
+            _propagator->_anotherSyncNeeded = true;
+        }
+        done(result._status, result._errorString);
+        return;
+    }
+
+    // The file is on the server, but if it changed meanwhile we need to upload it again
+    const QString fileName = _propagator->getFilePath(_item._file);
+    if (!QFileInfo(fileName).exists() || FileSystem::getModTime(fileName) != _item._modtime
+            || FileSystem::getSize(fileName) != qint64(_item._size)) {
+        qDebug() << "The local file has changed during the bundled upload:" << _item._file;
+        _propagator->_anotherSyncNeeded = true;
+    }
+
+    _item._responseTimeStamp = result._responseTimeStamp;
+    finalize(result);
+}
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
     : _read(0),
+      _filesize(0),
+      _rawSize(0),
+      _modtime(0),
+      _fileChanged(false),
+      _rawRead(0),
+      _blockStart(0),
       _bandwidthManager(bwm),
-      _bandwidthQuota(0),
-      _readWithProgress(0),
-      _bandwidthLimited(false), _choked(false)
+      _bandwidthLimited(false)
 {
     _bandwidthManager->registerUploadDevice(this);
 }
@@ -200,10 +355,93 @@ UploadDevice::~UploadDevice() {
     }
 }
 
+// Large enough that reading the file costs few syscalls, QNAM asks for 16 KiB at a time.
+static const qint64 uploadBlockSize = 1024 * 1024;
+
+// The start of the file that is looked at before compressing it
+static const qint64 compressionSampleSize = 64 * 1024;
+// Compressing is not worth it if it saves less than this fraction
+static const double minCompressionSavings = 0.1;
+
+CompressedSizeJob::CompressedSizeJob(const QString &fileName, TransferCompression::Encoding encoding)
+    : QObject(), _fileName(fileName)
+{
+    // Deleted by slotFinished(), also if the upload is gone by then
+    setAutoDelete(false);
+    _result._encoding = encoding;
+}
+
+void CompressedSizeJob::start()
+{
+    QThreadPool::globalInstance()->start(this);
+}
+
+void CompressedSizeJob::run()
+{
+    _result._fileSize = FileSystem::getSize(_fileName);
+    _result._modtime = FileSystem::getModTime(_fileName);
+    _result._size = compressedSize();
+    QMetaObject::invokeMethod(this, "slotFinished", Qt::QueuedConnection);
+}
+
+void CompressedSizeJob::slotFinished()
+{
+    emit finished();
+    deleteLater();
+}
+
+qint64 CompressedSizeJob::compressedSize()
+{
+    QFile file(_fileName);
+    QString openError;
+    if (!FileSystem::openFileSharedRead(&file, &openError)) {
+        return -1;
+    }
+
+    QByteArray sample = file.read(compressionSampleSize);
+    if (!TransferCompression::looksCompressible(sample)) {
+        qDebug() << Q_FUNC_INFO << _fileName << "does not look compressible";
+        return -1;
+    }
+
+    // Compressing the same data gives the same result
+    ZStream deflater(ZStream::Compress, _result._encoding);
+    QByteArray raw;
+    raw.resize(uploadBlockSize);
+    QByteArray compressed;
+    qint64 compressedSize = 0;
+    if (!file.seek(0)) {
+        return -1;
+    }
+    forever {
+        qint64 r = file.read(raw.data(), uploadBlockSize);
+        if (r < 0) {
+            return -1;
+        }
+        bool finish = r < uploadBlockSize;
+        compressed.resize(0);
+        if (!deflater.process(raw.constData(), r, &compressed, finish)) {
+            qWarning() << Q_FUNC_INFO << deflater.errorString();
+            return -1;
+        }
+        compressedSize += compressed.size();
+        if (finish) {
+            break;
+        }
+    }
+
+    qDebug() << Q_FUNC_INFO << _fileName << _result._fileSize << "bytes compress to" << compressedSize;
+    if (compressedSize > _result._fileSize * (1 - minCompressionSavings)) {
+        return -1;
+    }
+    return compressedSize;
+}
+
 bool UploadDevice::prepareAndOpen(const QString& fileName)
 {
     file.setFileName(fileName);
-    _filesize = FileSystem::getSize(fileName);
+    _filesize = _rawSize = FileSystem::getSize(fileName);
+    _modtime = FileSystem::getModTime(fileName);
 
     QString openError;
     if (!FileSystem::openFileSharedRead(&file, &openError)) {
@@ -211,9 +449,122 @@ bool UploadDevice::prepareAndOpen(const QString& fileName)
         return false;
     }
 
-    return QIODevice::open(QIODevice::ReadOnly);
+#ifdef Q_OS_LINUX
+    // We read the whole file front to back, let the kernel read ahead aggressively.
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // The compressed size is only right for the file it was computed for
+    if (_compression._size >= 0 && _compression._fileSize == _rawSize && _compression._modtime == _modtime) {
+        _filesize = _compression._size;
+        _deflater.reset(new ZStream(ZStream::Compress, _compression._encoding));
+        _rawRead = 0;
+    }
+
+    // Unbuffered: readData() already serves from _block, don't copy it once more.
+    return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+bool UploadDevice::prepareAndOpen(const QByteArray& data)
+{
+    // All of the data is one block, so readBlock() is never called
+    _block = data;
+    _blockStart = 0;
+    _filesize = _rawSize = data.size();
+    return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+bool UploadDevice::checkFileUnchanged()
+{
+    // Check for concurrent modification once per block. A file that is
+    // changed while being uploaded would end up corrupted on the server.
+    if (FileSystem::getSize(file.fileName()) != _rawSize
+            || FileSystem::getModTime(file.fileName()) != _modtime) {
+        qDebug() << Q_FUNC_INFO << file.fileName() << "changed during upload";
+        _fileChanged = true;
+        setErrorString(tr("Local file changed during sync."));
+        return false;
+    }
+    return true;
+}
+
+bool UploadDevice::readCompressedBlock()
+{
+    if (_read < _blockStart) {
+        // The compressed stream can only be produced from the start, which
+        // QNAM does when it sends the data again, e.g. after a redirect.
+        _deflater->reset();
+        _rawRead = 0;
+        _blockStart = 0;
+        _block.resize(0);
+    }
+
+    while (_read >= _blockStart + _block.size()) {
+        if (!checkFileUnchanged()) {
+            return false;
+        }
+        qint64 len = qMin(uploadBlockSize, _rawSize - _rawRead);
+        _rawBlock.resize(len);
+        if (!file.seek(_rawRead)) {
+            setErrorString(file.errorString());
+            return false;
+        }
+        qint64 r = file.read(_rawBlock.data(), len);
+        if (r != len) {
+            setErrorString(r < 0 ? file.errorString() : tr("Local file changed during sync."));
+            _fileChanged = r >= 0;
+            return false;
+        }
+        _rawRead += r;
+        bool finish = _rawRead >= _rawSize;
+
+        _blockStart += _block.size();
+        _block.resize(0);
+        if (!_deflater->process(_rawBlock.constData(), r, &_block, finish)) {
+            setErrorString(_deflater->errorString());
+            return false;
+        }
+        if (_blockStart + _block.size() > _filesize || (finish && _blockStart + _block.size() != _filesize)) {
+            // The file changed since its compressed size was computed
+            qDebug() << Q_FUNC_INFO << file.fileName() << "compressed to a different size";
+            _fileChanged = true;
+            setErrorString(tr("Local file changed during sync."));
+            return false;
+        }
+    }
+    return true;
 }
 
+bool UploadDevice::readBlock()
+{
+    if (_deflater) {
+        return readCompressedBlock();
+    }
+    if (!checkFileUnchanged()) {
+        return false;
+    }
+
+    qint64 start = _read - _read % uploadBlockSize;
+    qint64 len = qMin(uploadBlockSize, _filesize - start);
+    if (_block.capacity() < len) {
+        _block.reserve(len);
+    }
+    _block.resize(len);
+
+    if (!file.seek(start)) {
+        setErrorString(file.errorString());
+        return false;
+    }
+    qint64 r = file.read(_block.data(), len);
+    if (r != len) {
+        setErrorString(r < 0 ? file.errorString() : tr("Local file changed during sync."));
+        _fileChanged = r >= 0;
+        _block.resize(0);
+        return false;
+    }
+    _blockStart = start;
+    return true;
+}
 
 qint64 UploadDevice::writeData(const char* , qint64 ) {
     Q_ASSERT(!"write to read only device");
@@ -233,38 +584,32 @@ qint64 UploadDevice::readData(char* data, qint64 maxlen) {
     if (maxlen == 0) {
         return 0;
     }
-    if (isChoked()) {
-        return 0;
-    }
-    if (isBandwidthLimited()) {
-        maxlen = qMin(maxlen, _bandwidthQuota);
-        if (maxlen <= 0) {  // no quota
-            qDebug() << "no quota";
-            return 0;
+
+    if (_read < _blockStart || _read >= _blockStart + _block.size()) {
+        if (!readBlock()) {
+            return -1;
         }
-        _bandwidthQuota -= maxlen;
     }
+    // Don't cross the block boundary, so we never take quota we can't use.
+    maxlen = qMin(maxlen, _blockStart + _block.size() - _read);
 
-    auto read = file.read(data, maxlen);
-    if (read != maxlen) {
-        setErrorString(file.errorString());
-        return -1;
+    if (isBandwidthLimited() && _bandwidthManager) {
+        maxlen = _bandwidthManager->takeUploadQuota(this, maxlen);
+        if (maxlen <= 0) {
+            // no quota, the bandwidth manager emits readyRead() once we have some
+            return 0;
+        }
     }
 
+    memcpy(data, _block.constData() + (_read - _blockStart), maxlen);
     _read += maxlen;
+    if (_bandwidthManager) {
+        _bandwidthManager->recordUploaded(maxlen);
+    }
 
     return maxlen;
 }
 
-void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
-{
-    //qDebug() << Q_FUNC_INFO << sent << _read << t << _size << _bandwidthQuota;
-    if (sent == 0 || t == 0) {
-        return;
-    }
-    _readWithProgress = sent;
-}
-
 bool UploadDevice::atEnd() const {
     return _read >= _filesize;
 }
@@ -287,6 +632,10 @@ bool UploadDevice::isSequential() const{
 }
 
 bool UploadDevice::seek ( qint64 pos ) {
+    if (_deflater && pos != 0 && (pos < _blockStart || pos > _blockStart + _block.size())) {
+        // Only going back to the start is possible, see readCompressedBlock()
+        return false;
+    }
     if (! QIODevice::seek(pos)) {
         return false;
     }
@@ -294,25 +643,11 @@ bool UploadDevice::seek ( qint64 pos ) {
     return true;
 }
 
-void UploadDevice::giveBandwidthQuota(qint64 bwq) {
-    if (!atEnd()) {
-        _bandwidthQuota = bwq;
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
-    }
-}
-
 void UploadDevice::setBandwidthLimited(bool b) {
     _bandwidthLimited = b;
     QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
 }
 
-void UploadDevice::setChoked(bool b) {
-    _choked = b;
-    if (!_choked) {
-        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
-    }
-}
-
 void PropagateUploadFileQNAM::startNextChunk()
 {
     if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
@@ -338,6 +673,10 @@ void PropagateUploadFileQNAM::startNextChunk()
     QString path = _item._file;
 
     UploadDevice *device = new UploadDevice(&_propagator->_bandwidthManager);
+    // After a 415 the encoding is Identity, and the file is sent as it is
+    if (_compression._size >= 0 && _compression._encoding == _propagator->_uploadEncoding) {
+        device->setCompression(_compression);
+    }
 
     if (! device->prepareAndOpen(_propagator->getFilePath(_item._file))) {
         qDebug() << "ERR: Could not prepare upload device: " << device->errorString();
@@ -346,12 +685,14 @@ void PropagateUploadFileQNAM::startNextChunk()
         delete device;
         return;
     }
+    if (device->isCompressed()) {
+        headers["Content-Encoding"] = TransferCompression::encodingName(_propagator->_uploadEncoding);
+    }
 
     PUTFileJob* job = new PUTFileJob(_propagator->account(), _propagator->_remoteFolder + path, device, headers, _currentChunk);
     _jobs.append(job);
     connect(job, SIGNAL(finishedSignal()), this, SLOT(slotPutFinished()));
     connect(job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
-    connect(job, SIGNAL(uploadProgress(qint64,qint64)), device, SLOT(slotJobUploadProgress(qint64,qint64)));
     connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(slotJobDestroyed(QObject*)));
     job->start();
     _propagator->_activeJobs++;
@@ -387,6 +728,22 @@ void PropagateUploadFileQNAM::slotPutFinished()
                "It is restored and your edit is in the conflict file."))) {
             return;
         }
+        UploadDevice *device = qobject_cast<UploadDevice*>(job->device());
+        if (device && device->fileChanged()) {
+            _propagator->_anotherSyncNeeded = true;
+            abortWithError(SyncFileItem::SoftError, device->errorString());
+            return;
+        }
+        if (_item._httpErrorCode == 415 && device && device->isCompressed()) {
+            // "Unsupported Media Type": the server does not take compressed uploads after all
+            qWarning() << "Compressed upload rejected, uploading uncompressed";
+            _propagator->_uploadEncoding = TransferCompression::Identity;
+            _propagator->account()->setUploadFeatures(_propagator->_maxBundledFiles, QByteArray());
+            _currentChunk--;
+            startNextChunk();
+            return;
+        }
+
         QString errorString = job->errorString();
 
         QByteArray replyContent = job->reply()->readAll();
@@ -484,14 +841,18 @@ void PropagateUploadFileQNAM::slotPutFinished()
         pi._chunk = (currentChunk + _startChunk + 1) % _chunkCount ; // next chunk to start with
         pi._transferid = _transferId;
         pi._modtime =  Utility::qDateTimeFromTime_t(_item._modtime);
-        _propagator->_journal->setUploadInfo(_item._file, pi);
-        _propagator->_journal->commit("Upload info");
+        _propagator->_journal->setUploadInfoAsync(_item._file, pi);
+        _propagator->_journal->commitAsync("Upload info");
         startNextChunk();
         return;
     }
 
     // the following code only happens after all chunks were uploaded.
     _finished = true;
+    UploadDevice *device = qobject_cast<UploadDevice*>(job->device());
+    if (device && device->isCompressed()) {
+        _propagator->recordCompression(true, device->fileSize(), device->size());
+    }
     // the file id should only be empty for new files up- or downloaded
     QByteArray fid = job->reply()->rawHeader("X-SwissDisk-FileId");
     if( !fid.isEmpty() ) {
@@ -529,10 +890,10 @@ void PropagateUploadFileQNAM::finalize(const SyncFileItem &copy)
 
     _item._requestDuration = _duration.elapsed();
 
-    _propagator->_journal->setFileRecord(SyncJournalFileRecord(_item, _propagator->getFilePath(_item._file)));
+    _propagator->_journal->setFileRecordAsync(SyncJournalFileRecord(_item, _propagator->getFilePath(_item._file)));
     // Remove from the progress database:
-    _propagator->_journal->setUploadInfo(_item._file, SyncJournalDb::UploadInfo());
-    _propagator->_journal->commit("upload file start");
+    _propagator->_journal->setUploadInfoAsync(_item._file, SyncJournalDb::UploadInfo());
+    _propagator->_journal->commitAsync("upload file start");
 
     _finished = true;
     done(SyncFileItem::Success);
@@ -540,6 +901,13 @@ void PropagateUploadFileQNAM::finalize(const SyncFileItem &copy)
 
 void PropagateUploadFileQNAM::slotUploadProgress(qint64 sent, qint64)
 {
+    PUTFileJob *job = qobject_cast<PUTFileJob *>(sender());
+    UploadDevice *device = job ? qobject_cast<UploadDevice*>(job->device()) : 0;
+    if (device && device->isCompressed() && device->size() > 0) {
+        // The progress is about the file, not about what went over the wire
+        sent = sent * device->fileSize() / device->size();
+    }
+
     int progressChunk = _currentChunk + _startChunk - 1;
     if (progressChunk >= _chunkCount)
         progressChunk = _currentChunk - 1;
@@ -565,8 +933,8 @@ void PropagateUploadFileQNAM::startPollJob(const QString& path)
     info._file = _item._file;
     info._url = path;
     info._modtime = _item._modtime;
-    _propagator->_journal->setPollInfo(info);
-    _propagator->_journal->commit("add poll info");
+    _propagator->_journal->setPollInfoAsync(info);
+    _propagator->_journal->commitAsync("add poll info");
     _propagator->_activeJobs++;
     job->start();
 }
@@ -15,14 +15,60 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "transfercompression.h"
 
 #include <QBuffer>
 #include <QFile>
 #include <QDebug>
+#include <QScopedPointer>
+#include <QElapsedTimer>
+#include <QRunnable>
 
 namespace OCC {
 class BandwidthManager;
 
+/**
+ * How a file is compressed for its upload, and for which version of the file
+ */
+struct UploadCompression {
+    UploadCompression() : _encoding(TransferCompression::Identity), _size(-1), _fileSize(0), _modtime(0) {}
+    TransferCompression::Encoding _encoding;
+    qint64 _size; // of the compressed data, -1 if the file is sent as it is
+    qint64 _fileSize;
+    time_t _modtime;
+};
+
+/**
+ * @brief Computes the compressed size of a file on the global thread pool
+ *
+ * The size of an upload must be known before it starts, so the file is
+ * compressed once without keeping the output. finished() is emitted in the
+ * thread that called start(), the job deletes itself afterwards.
+ */
+class CompressedSizeJob : public QObject, public QRunnable {
+    Q_OBJECT
+public:
+    CompressedSizeJob(const QString &fileName, TransferCompression::Encoding encoding);
+
+    void start();
+    void run() Q_DECL_OVERRIDE;
+
+    /** Valid once finished() was emitted, the _size is -1 if compressing is not worth it */
+    UploadCompression result() const { return _result; }
+
+signals:
+    void finished();
+
+private slots:
+    void slotFinished();
+
+private:
+    qint64 compressedSize();
+
+    QString _fileName;
+    UploadCompression _result;
+};
+
 class UploadDevice : public QIODevice {
     Q_OBJECT
 public:
@@ -32,6 +78,25 @@ public:
     /** Reads the data from the file and opens the device */
     bool prepareAndOpen(const QString& fileName);
 
+    /** Opens the device to upload data that is already in memory, like a bundle */
+    bool prepareAndOpen(const QByteArray& data);
+
+    /**
+     * Compress the file as computed by a CompressedSizeJob. Must be called
+     * before prepareAndOpen(), which ignores it if the file changed since.
+     * size() is the compressed size then, the file is compressed while it is read.
+     */
+    void setCompression(const UploadCompression &compression) { _compression = compression; }
+
+    /** Whether the data is compressed, with the encoding passed to setCompression() */
+    bool isCompressed() const { return !_deflater.isNull(); }
+
+    /** The size of the file, while size() is the size of the upload */
+    qint64 fileSize() const { return _rawSize; }
+
+    /** Whether reading stopped because the file changed on disk since prepareAndOpen() */
+    bool fileChanged() const { return _fileChanged; }
+
     qint64 writeData(const char* , qint64 ) Q_DECL_OVERRIDE;
     qint64 readData(char* data, qint64 maxlen) Q_DECL_OVERRIDE;
     bool atEnd() const Q_DECL_OVERRIDE;
@@ -42,25 +107,37 @@ public:
 
     void setBandwidthLimited(bool);
     bool isBandwidthLimited() { return _bandwidthLimited; }
-    void setChoked(bool);
-    bool isChoked() { return _choked; }
-    void giveBandwidthQuota(qint64 bwq);
 private:
 
-    // Position in the data and total filesize
+    /** Reads the aligned block that contains _read into _block */
+    bool readBlock();
+    /** Compresses the file up to the block that contains _read into _block */
+    bool readCompressedBlock();
+    /** Returns false and sets the error if the file changed since prepareAndOpen() */
+    bool checkFileUnchanged();
+
+    // Position in the data and total size of the upload
     qint64 _read, _filesize;
     // The file we are reading from
     QFile file;
+    qint64 _rawSize;
+    // Modification time at prepareAndOpen(), to detect concurrent changes
+    time_t _modtime;
+    bool _fileChanged;
+
+    // Compression related, _deflater is only set if the upload is compressed
+    UploadCompression _compression;
+    QScopedPointer<ZStream> _deflater;
+    qint64 _rawRead; // how much of the file went into _deflater
+    QByteArray _rawBlock;
+
+    // The file is read in large blocks, QNAM is served from this buffer
+    QByteArray _block;
+    qint64 _blockStart;
 
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
-    qint64 _bandwidthQuota;
-    qint64 _readWithProgress;
-    bool _bandwidthLimited; // if _bandwidthQuota will be used
-    bool _choked; // if upload is paused (readData() will return 0)
-    friend class BandwidthManager;
-protected slots:
-    void slotJobUploadProgress(qint64 sent, qint64 t);
+    bool _bandwidthLimited; // if quota must be taken from the _bandwidthManager before reading
 };
 
 class PUTFileJob : public AbstractNetworkJob {
@@ -73,10 +150,15 @@ public:
     // Takes ownership of the device
     explicit PUTFileJob(AccountPtr account, const QString& path, QIODevice *device,
                         const QMap<QByteArray, QByteArray> &headers, int chunk, QObject* parent = 0)
-        : AbstractNetworkJob(account, path, parent), _device(device), _headers(headers), _chunk(chunk) {}
+        : AbstractNetworkJob(account, path, parent), _device(device), _headers(headers), _chunk(chunk)
+    {
+        setNetworkLane(Account::TransferLane);
+    }
 
     int _chunk;
 
+    QIODevice *device() { return _device.data(); }
+
     virtual void start() Q_DECL_OVERRIDE;
 
     virtual bool finished() Q_DECL_OVERRIDE {
@@ -96,16 +178,47 @@ signals:
     void uploadProgress(qint64,qint64);
 };
 
+/**
+ * @brief Asks the server which upload features it supports
+ *
+ * Sends OPTIONS to the given path. A server supporting bundled uploads (see
+ * PropagateUploadBundle) answers with the header "X-SwissDisk-Bundle: <n>",
+ * n being the maximum number of files per bundle. The content codings it
+ * accepts for requests are in the Accept-Encoding header (RFC 7694).
+ * If the request fails, the server is assumed to support neither for this
+ * propagation. An answer is remembered by the Account.
+ */
+class CheckUploadFeaturesJob : public AbstractNetworkJob {
+    Q_OBJECT
+public:
+    explicit CheckUploadFeaturesJob(AccountPtr account, const QString &path, QObject *parent = 0)
+        : AbstractNetworkJob(account, path, parent) {}
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+signals:
+    void uploadFeaturesChecked(int maxBundledFiles, const QByteArray &acceptEncoding);
+};
+
 class PollJob : public AbstractNetworkJob {
     Q_OBJECT
     SyncJournalDb *_journal;
     QString _localPath;
+    int _retryDelayMsec;
+    qint64 _deadlineMsec;
+    QElapsedTimer _deadlineTimer;
 public:
     SyncFileItem _item;
     // Takes ownership of the device
     explicit PollJob(AccountPtr account, const QString &path, const SyncFileItem &item,
                      SyncJournalDb *journal, const QString &localPath, QObject *parent)
-        : AbstractNetworkJob(account, path, parent), _journal(journal), _localPath(localPath), _item(item) {}
+        : AbstractNetworkJob(account, path, parent), _journal(journal), _localPath(localPath)
+        , _retryDelayMsec(0), _deadlineMsec(0), _item(item) {}
+
+    /**
+     * Give up once \a msec passed, the item then ends with a SoftError and
+     * the poll URL is kept for the next sync. Must be called before start().
+     */
+    void setDeadline(qint64 msec) { _deadlineMsec = msec; }
 
     void start() Q_DECL_OVERRIDE;
     bool finished() Q_DECL_OVERRIDE;
@@ -116,6 +229,12 @@ public:
         reply()->abort();
     }
 
+private:
+    /** Polls again after a delay that doubles each time, returns false if the deadline passed */
+    bool retry();
+private slots:
+    void slotRetry();
+
 signals:
     void finishedSignal();
 };
@@ -127,7 +246,22 @@ public:
     PropagateUploadFileQNAM(OwncloudPropagator* propagator,const SyncFileItem& item)
         : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0), _finished(false) {}
     void start() Q_DECL_OVERRIDE;
+
+    /**
+     * Used by PropagateUploadBundle instead of start(): does the same checks
+     * and reads the whole file into \a data.
+     * Returns false if the file can't be uploaded now, the job is done then.
+     */
+    bool prepareBundledUpload(QByteArray *data);
+
+    /**
+     * Finishes the job with the result the server gave for this file in a
+     * bundle. Like for the PollJob, \a result carries the status, error,
+     * etag, file id and response timestamp.
+     */
+    void bundledUploadFinished(const SyncFileItem &result);
 private slots:
+    void slotCompressedSizeFinished();
     void slotPutFinished();
     void slotPollFinished();
     void slotUploadProgress(qint64,qint64);
@@ -143,7 +277,9 @@ private:
     QElapsedTimer _duration;
     QVector<PUTFileJob*> _jobs;
     bool _finished; // Tells that all the jobs have been finished
+    UploadCompression _compression;
     void startPollJob(const QString& path);
+    bool prepareUpload();
     void abortWithError(SyncFileItem::Status status, const QString &error);
 };
 
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagateuploadbundle.h"
+#include "propagateupload.h"
+#include "owncloudpropagator_p.h"
+#include "account.h"
+#include <json.h>
+
+#include <QUrl>
+#include <QDateTime>
+
+#include <limits>
+
+namespace OCC {
+
+// Only files up to this size are bundled, larger ones gain little from it.
+static const qint64 bundleMaxFileSize = 256 * 1024;
+static const int bundleMaxFiles = 100;
+static const qint64 bundleMaxBytes = 4 * 1024 * 1024;
+
+void POSTBundleJob::start()
+{
+    QNetworkRequest req;
+    req.setHeader(QNetworkRequest::ContentTypeHeader, _contentType);
+
+    setReply(davRequest("POST", path(), req, _device.data()));
+    setupConnections(reply());
+
+    if( reply()->error() != QNetworkReply::NoError ) {
+        qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
+    }
+
+    connect(this, SIGNAL(networkActivity()), account().data(), SIGNAL(propagatorNetworkActivity()));
+
+    AbstractNetworkJob::start();
+}
+
+void POSTBundleJob::slotTimeout()
+{
+    _errorString =  tr("Connection Timeout");
+    reply()->abort();
+}
+
+PropagateUploadBundle::PropagateUploadBundle(OwncloudPropagator *propagator, const QString &directory)
+    : PropagatorJob(propagator)
+    , _directory(directory)
+    , _bytes(0)
+    , _decided(false)
+    , _bundled(false)
+    , _nextJob(0)
+    , _hasError(SyncFileItem::NoStatus)
+{
+    if (_directory.endsWith(QLatin1Char('/'))) {
+        _directory.chop(1);
+    }
+}
+
+PropagateUploadBundle::~PropagateUploadBundle()
+{
+    qDeleteAll(_jobs);
+}
+
+bool PropagateUploadBundle::isBundleCandidate(const SyncFileItem &item)
+{
+    return item._direction == SyncFileItem::Up && !item._isDirectory
+            && (item._instruction == CSYNC_INSTRUCTION_NEW || item._instruction == CSYNC_INSTRUCTION_SYNC)
+            && qint64(item._size) <= bundleMaxFileSize;
+}
+
+void PropagateUploadBundle::append(const SyncFileItem &item)
+{
+    PropagateUploadFileQNAM *job = new PropagateUploadFileQNAM(_propagator, item);
+    connect(job, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
+    connect(job, SIGNAL(completed(SyncFileItem)), this, SIGNAL(completed(SyncFileItem)));
+    connect(job, SIGNAL(progress(SyncFileItem,quint64)), this, SIGNAL(progress(SyncFileItem,quint64)));
+    connect(job, SIGNAL(ready()), this, SIGNAL(ready()));
+    _jobs.append(job);
+    _bytes += item._size;
+}
+
+bool PropagateUploadBundle::isFull() const
+{
+    return _jobs.count() >= bundleMaxFiles || _bytes >= bundleMaxBytes;
+}
+
+quint64 PropagateUploadBundle::priority()
+{
+    quint64 result = std::numeric_limits<quint64>::max();
+    foreach (PropagateUploadFileQNAM *job, _jobs) {
+        result = qMin(result, job->priority());
+    }
+    return result;
+}
+
+bool PropagateUploadBundle::scheduleNextJob()
+{
+    if (_state == Finished) {
+        return false;
+    }
+
+    if (_state == NotYetStarted) {
+        _state = Running;
+    }
+
+    if (!_decided) {
+        if (!_propagator->uploadFeaturesKnown()) {
+            // OwncloudPropagator::slotUploadFeaturesChecked() schedules again
+            return false;
+        }
+        _decided = true;
+        // A bundle of one file is just a normal PUT
+        _bundled = _jobs.count() > 1 && _propagator->_maxBundledFiles > 0;
+        if (_bundled) {
+            startNextPost();
+            return true;
+        }
+    }
+
+    if (_bundled) {
+        return false;
+    }
+
+    foreach (PropagateUploadFileQNAM *job, _jobs) {
+        if (job->_state == NotYetStarted) {
+            return job->scheduleNextJob();
+        }
+    }
+    return false;
+}
+
+QString PropagateUploadBundle::relativePath(const SyncFileItem &item) const
+{
+    return _directory.isEmpty() ? item._file : item._file.mid(_directory.length() + 1);
+}
+
+void PropagateUploadBundle::startNextPost()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    const int maxFiles = qMin(_propagator->_maxBundledFiles, bundleMaxFiles);
+    const QByteArray boundary = "swissdisk-bundle-" + QByteArray::number(qrand(), 16)
+            + QByteArray::number(QDateTime::currentMSecsSinceEpoch(), 16);
+
+    QByteArray body;
+    while (_nextJob < _jobs.count() && _posted.count() < maxFiles) {
+        PropagateUploadFileQNAM *job = _jobs.at(_nextJob++);
+        QByteArray data;
+        if (!job->prepareBundledUpload(&data)) {
+            continue; // the job is done already
+        }
+        const SyncFileItem &item = job->_item;
+        body += "--" + boundary + "\r\n";
+        body += "Content-Type: application/octet-stream\r\n";
+        body += "Content-Length: " + QByteArray::number(data.size()) + "\r\n";
+        body += "X-SwissDisk-Path: " + QUrl::toPercentEncoding(relativePath(item)) + "\r\n";
+        body += "X-SwissDisk-MTime: " + QByteArray::number(qint64(item._modtime)) + "\r\n";
+        if (!item._etag.isEmpty() && item._etag != "empty_etag"
+                && item._instruction != CSYNC_INSTRUCTION_NEW) { // On new files never send a If-Match
+            body += "If-Match: \"" + item._etag + "\"\r\n";
+        }
+        body += "\r\n" + data + "\r\n";
+        _posted.append(job);
+    }
+    if (_posted.isEmpty()) {
+        // slotSubJobFinished() finalizes once the jobs that were done already reported it
+        return;
+    }
+    body += "--" + boundary + "--\r\n";
+
+    UploadDevice *device = new UploadDevice(&_propagator->_bandwidthManager);
+    device->prepareAndOpen(body);
+
+    qDebug() << Q_FUNC_INFO << _directory << _posted.count() << "files," << body.size() << "bytes";
+    _postJob = new POSTBundleJob(_propagator->account(), _propagator->_remoteFolder + _directory, device,
+                                 "multipart/related; boundary=" + boundary, this);
+    connect(_postJob, SIGNAL(finishedSignal()), this, SLOT(slotPostFinished()));
+    _postJob->start();
+    _propagator->_activeJobs++;
+}
+
+void PropagateUploadBundle::slotPostFinished()
+{
+    POSTBundleJob *job = qobject_cast<POSTBundleJob *>(sender());
+    Q_ASSERT(job);
+    _postJob = 0;
+    _propagator->_activeJobs--;
+
+    QVector<PropagateUploadFileQNAM *> posted = _posted;
+    _posted.clear();
+
+    const QNetworkReply::NetworkError err = job->reply()->error();
+    const int httpCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    qDebug() << Q_FUNC_INFO << job->reply()->request().url() << "FINISHED WITH STATUS" << err << httpCode;
+
+    if (err != QNetworkReply::NoError && (httpCode == 404 || httpCode == 405 || httpCode == 501)) {
+        if (httpCode == 404) {
+            // The directory may have been moved or deleted on the server, the
+            // single PUTs of this bundle report it for their own files
+            qWarning() << "Bundled upload to" << _directory << "not found, uploading its files one by one";
+        } else {
+            // The server does not know about bundles after all
+            qWarning() << "Bundled upload rejected, uploading the files one by one";
+            _propagator->_maxBundledFiles = 0;
+            _propagator->account()->setUploadFeatures(0, _propagator->account()->uploadAcceptEncoding());
+        }
+        foreach (PropagateUploadFileQNAM *fileJob, posted) {
+            fileJob->_state = NotYetStarted;
+        }
+        fallBackToSingleUploads();
+        return;
+    }
+
+    QMap<QString, QVariantMap> results;
+    if (err == QNetworkReply::NoError) {
+        bool ok = false;
+        QVariantMap json = QtJson::parse(QString::fromUtf8(job->reply()->readAll()), ok).toMap();
+        foreach (const QVariant &entry, json.value("files").toList()) {
+            QVariantMap map = entry.toMap();
+            results.insert(map.value("path").toString(), map);
+        }
+    }
+
+    foreach (PropagateUploadFileQNAM *fileJob, posted) {
+        SyncFileItem result = fileJob->_item;
+        result._responseTimeStamp = job->responseTimestamp();
+        const QString path = relativePath(result);
+        if (err != QNetworkReply::NoError) {
+            result._httpErrorCode = httpCode;
+            result._status = classifyError(err, httpCode);
+            result._errorString = job->errorString();
+        } else if (!results.contains(path)) {
+            result._status = SyncFileItem::NormalError;
+            result._errorString = tr("The server did not acknowledge the file in the bundle.");
+        } else {
+            const QVariantMap &entry = results[path];
+            result._httpErrorCode = entry.value("status").toInt();
+            result._etag = parseEtag(entry.value("etag").toByteArray().constData());
+            if (result._httpErrorCode >= 200 && result._httpErrorCode < 300 && !result._etag.isEmpty()) {
+                result._status = SyncFileItem::Success;
+                QByteArray fid = entry.value("fileid").toByteArray();
+                if (!fid.isEmpty()) {
+                    result._fileId = fid;
+                }
+                if (entry.value("mtime").toString() != QLatin1String("accepted")) {
+                    qWarning() << "Server did not accept the mtime of" << result._file;
+                }
+            } else {
+                // "Precondition Failed" is a soft error, like for a PUT
+                result._status = result._httpErrorCode == 412 ? SyncFileItem::SoftError : SyncFileItem::NormalError;
+                result._errorString = entry.value("error").toString();
+                if (result._errorString.isEmpty()) {
+                    result._errorString = tr("Server replied with status %1").arg(result._httpErrorCode);
+                }
+            }
+        }
+        fileJob->bundledUploadFinished(result);
+    }
+
+    if (err != QNetworkReply::NoError && classifyError(err, httpCode) == SyncFileItem::FatalError) {
+        // slotSubJobFinished() aborts
+        return;
+    }
+    if (_nextJob < _jobs.count()) {
+        startNextPost();
+    }
+}
+
+void PropagateUploadBundle::fallBackToSingleUploads()
+{
+    _bundled = false;
+    emit ready();
+}
+
+void PropagateUploadBundle::slotSubJobFinished(SyncFileItem::Status status)
+{
+    if (_state == Finished) {
+        return;
+    }
+    if (status == SyncFileItem::FatalError) {
+        abort();
+        _state = Finished;
+        emit finished(status);
+        return;
+    } else if (status == SyncFileItem::NormalError || status == SyncFileItem::SoftError) {
+        _hasError = status;
+    }
+    finalizeIfDone();
+    if (_state != Finished && !_bundled) {
+        // the next file may be started
+        emit ready();
+    }
+}
+
+void PropagateUploadBundle::finalizeIfDone()
+{
+    if (_state == Finished || _postJob) {
+        return;
+    }
+    foreach (PropagateUploadFileQNAM *job, _jobs) {
+        if (job->_state != Finished) {
+            return;
+        }
+    }
+    _state = Finished;
+    emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
+}
+
+void PropagateUploadBundle::abort()
+{
+    if (_postJob && _postJob->reply()) {
+        _postJob->reply()->abort();
+    }
+    foreach (PropagatorJob *job, _jobs) {
+        job->abort();
+    }
+}
+
+}
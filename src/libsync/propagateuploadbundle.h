@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+#include "networkjobs.h"
+
+namespace OCC {
+
+class PropagateUploadFileQNAM;
+
+class POSTBundleJob : public AbstractNetworkJob {
+    Q_OBJECT
+    QScopedPointer<QIODevice> _device;
+    QByteArray _contentType;
+    QString _errorString;
+
+public:
+    // Takes ownership of the device
+    explicit POSTBundleJob(AccountPtr account, const QString& path, QIODevice *device,
+                           const QByteArray &contentType, QObject* parent = 0)
+        : AbstractNetworkJob(account, path, parent), _device(device), _contentType(contentType)
+    {
+        setNetworkLane(Account::TransferLane);
+    }
+
+    void start() Q_DECL_OVERRIDE;
+
+    bool finished() Q_DECL_OVERRIDE {
+        emit finishedSignal();
+        return true;
+    }
+
+    QString errorString() {
+        return _errorString.isEmpty() ? reply()->errorString() : _errorString;
+    }
+
+    void slotTimeout() Q_DECL_OVERRIDE;
+
+signals:
+    void finishedSignal();
+};
+
+/**
+ * @brief Uploads many small files of one directory with few requests
+ *
+ * The files are sent as parts of a "multipart/related" POST to the directory.
+ * Every part has the headers X-SwissDisk-Path (the percent encoded path
+ * relative to the directory), X-SwissDisk-MTime, Content-Length and, for
+ * changed files, If-Match. The server answers with a JSON object
+ *   {"files":[{"path":..,"status":201,"etag":..,"fileid":..,"mtime":"accepted","error":..},..]}
+ * from which every file gets its own result, like it would from its own PUT.
+ *
+ * Each file still has its PropagateUploadFileQNAM, which does the local checks
+ * and the journal update. If the server did not announce bundle support (see
+ * CheckUploadFeaturesJob), or rejects the POST, these jobs are scheduled one
+ * by one and upload with a normal PUT.
+ */
+class PropagateUploadBundle : public PropagatorJob {
+    Q_OBJECT
+public:
+    PropagateUploadBundle(OwncloudPropagator *propagator, const QString &directory);
+    ~PropagateUploadBundle();
+
+    /** Whether the item is a small upload that may be part of a bundle */
+    static bool isBundleCandidate(const SyncFileItem &item);
+
+    void append(const SyncFileItem &item);
+    bool isFull() const;
+
+    bool scheduleNextJob() Q_DECL_OVERRIDE;
+    quint64 priority() Q_DECL_OVERRIDE;
+
+public slots:
+    void abort() Q_DECL_OVERRIDE;
+
+private slots:
+    void slotPostFinished();
+    void slotSubJobFinished(SyncFileItem::Status status);
+
+private:
+    void startNextPost();
+    void fallBackToSingleUploads();
+    void finalizeIfDone();
+    QString relativePath(const SyncFileItem &item) const;
+
+    QString _directory; // relative to the sync root, without trailing slash
+    QVector<PropagateUploadFileQNAM *> _jobs;
+    qint64 _bytes;
+    bool _decided; // whether _bundled was set, that waits for the upload features
+    bool _bundled; // false once the files are uploaded one by one
+    int _nextJob; // the first job that was not yet part of a POST
+    QVector<PropagateUploadFileQNAM *> _posted; // the files of the running POST
+    QPointer<POSTBundleJob> _postJob;
+    SyncFileItem::Status _hasError; // NoStatus, or NormalError / SoftError if there was an error
+};
+
+}
@@ -101,8 +101,8 @@ void PropagateLocalRemove::start()
         }
     }
     emit progress(_item, 0);
-    _propagator->_journal->deleteFileRecord(_item._originalFile, _item._isDirectory);
-    _propagator->_journal->commit("Local remove");
+    _propagator->_journal->deleteFileRecordAsync(_item._originalFile, _item._isDirectory);
+    _propagator->_journal->commitAsync("Local remove");
     done(SyncFileItem::Success);
 }
 
@@ -161,7 +161,7 @@ void PropagateLocalRename::start()
         }
     }
 
-    _propagator->_journal->deleteFileRecord(_item._originalFile);
+    _propagator->_journal->deleteFileRecordAsync(_item._originalFile);
 
     // store the rename file name in the item.
     _item._file = _item._renameTarget;
@@ -170,9 +170,9 @@ void PropagateLocalRename::start()
     record._path = _item._renameTarget;
 
     if (!_item._isDirectory) { // Directory are saved at the end
-        _propagator->_journal->setFileRecord(record);
+        _propagator->_journal->setFileRecordAsync(record);
     }
-    _propagator->_journal->commit("localRename");
+    _propagator->_journal->commitAsync("localRename");
 
 
     done(SyncFileItem::Success);
@@ -24,6 +24,13 @@
 #include "csync_util.h"
 #include "syncfilestatus.h"
 #include "csync_private.h"
+#include "synctrace.h"
+#include "syncmetrics.h"
+#include "filesystem.h"
+
+extern "C" {
+#include "csync_exclude.h"
+}
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -46,11 +53,28 @@
 #include <QSslCertificate>
 #include <QProcess>
 #include <QElapsedTimer>
+#include <QFileInfo>
 #include <qtextcodec.h>
 
 namespace OCC {
 
-bool SyncEngine::_syncRunning = false;
+int SyncEngine::_syncRunning = 0;
+
+// The traces of the last few runs are kept next to the sync run log (see SyncRunFileLog),
+// their names are excluded from the sync as well.
+static QString traceFileForRun(const QString &localPath)
+{
+    static const int keptTraces = 5;
+    QDir dir(localPath);
+    QStringList old = dir.entryList(QStringList(QLatin1String(".swissdisksync.log.trace-*.json")),
+                                    QDir::Files | QDir::Hidden, QDir::Name);
+    while (old.count() >= keptTraces) {
+        dir.remove(old.takeFirst());
+    }
+    return dir.filePath(QLatin1String(".swissdisksync.log.trace-")
+                        + QDateTime::currentDateTime().toString(QLatin1String("yyyyMMdd-hhmmss"))
+                        + QLatin1String(".json"));
+}
 
 SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
                        const QString& remoteURL, const QString& remotePath, OCC::SyncJournalDb* journal)
@@ -63,9 +87,23 @@ SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
   , _journal(journal)
   , _hasNoneFiles(false)
   , _hasRemoveFile(false)
+  , _treeWalkComplete(false)
+  , _treeWalkTime(0)
+  , _blacklistSize(0)
+  , _blacklistHits(0)
+  , _blacklistMisses(0)
   , _uploadLimit(0)
   , _downloadLimit(0)
   , _anotherSyncNeeded(false)
+  , _dryRun(false)
+  , _syncStartUsec(0)
+  , _propagationStartUsec(0)
+  , _firstCompletionMsec(-1)
+  , _medianCompletionMsec(-1)
+  , _discoveryPeakMemory(0)
+  , _targetedListingsPending(0)
+  , _targetedFallback(false)
+  , _finishWaitsForPolls(false)
 {
     qRegisterMetaType<SyncFileItem>("SyncFileItem");
     qRegisterMetaType<SyncFileItem::Status>("SyncFileItem::Status");
@@ -73,12 +111,19 @@ SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
 
     _thread.setObjectName("CSync_Neon_Thread");
     _thread.start();
+
+    _progressTimer.setSingleShot(true);
+    _progressTimer.setInterval(progressIntervalMsec);
+    connect(&_progressTimer, SIGNAL(timeout()), this, SLOT(slotEmitProgress()));
 }
 
 SyncEngine::~SyncEngine()
 {
     _thread.quit();
     _thread.wait();
+    foreach (csync_vio_file_stat_t *stat, _targetedRemoteStats) {
+        csync_vio_file_stat_destroy(stat);
+    }
 }
 
 //Convert an error code from csync to a user readable string.
@@ -173,17 +218,25 @@ bool SyncEngine::checkErrorBlacklisting( SyncFileItem *item )
         return false;
     }
 
-    SyncJournalErrorBlacklistRecord entry = _journal->errorBlacklistEntry(item->_file);
     item->_hasBlacklistEntry = false;
 
+    // The blacklist was preloaded for the tree walk, usually it is empty
+    if( _blacklistSize == 0 ) {
+        _blacklistMisses++;
+        return false;
+    }
+
+    SyncJournalErrorBlacklistRecord entry = _journal->errorBlacklistEntry(item->_file);
     if( !entry.isValid() ) {
+        _blacklistMisses++;
         return false;
     }
 
+    _blacklistHits++;
     item->_hasBlacklistEntry = true;
 
     // If duration has expired, it's not blacklisted anymore
-    time_t now = Utility::qDateTimeToTime_t(QDateTime::currentDateTime());
+    const time_t now = _treeWalkTime;
     if( now > entry._lastTryTime + entry._ignoreDuration ) {
         qDebug() << "blacklist entry for " << item->_file << " has expired!";
         return false;
@@ -221,19 +274,20 @@ bool SyncEngine::checkErrorBlacklisting( SyncFileItem *item )
 
 void SyncEngine::deleteStaleDownloadInfos()
 {
-    // Find all downloadinfo paths that we want to preserve.
-    QSet<QString> download_file_paths;
-    foreach(const SyncFileItem& it, _syncedItems) {
-        if (it._direction == SyncFileItem::Down
-                && it._type == SyncFileItem::File)
-        {
-            download_file_paths.insert(it._file);
+    // Mark the downloadinfo of the files we are going to download as still needed.
+    if (_journal->downloadInfoCount() > 0) {
+        foreach(const SyncFileItem& it, _syncedItems) {
+            if (it._direction == SyncFileItem::Down
+                    && it._type == SyncFileItem::File)
+            {
+                _journal->keepDownloadInfo(it._file);
+            }
         }
     }
 
     // Delete from journal and from filesystem.
     const QVector<SyncJournalDb::DownloadInfo> deleted_infos =
-            _journal->getAndDeleteStaleDownloadInfos(download_file_paths);
+            _journal->getAndDeleteStaleDownloadInfos();
     foreach (const SyncJournalDb::DownloadInfo & deleted_info, deleted_infos) {
         const QString tmppath = _propagator->getFilePath(deleted_info._tmpfile);
         qDebug() << "Deleting stale temporary file: " << tmppath;
@@ -243,31 +297,31 @@ void SyncEngine::deleteStaleDownloadInfos()
 
 void SyncEngine::deleteStaleUploadInfos()
 {
-    // Find all blacklisted paths that we want to preserve.
-    QSet<QString> upload_file_paths;
-    foreach(const SyncFileItem& it, _syncedItems) {
-        if (it._direction == SyncFileItem::Up
-                && it._type == SyncFileItem::File)
-        {
-            upload_file_paths.insert(it._file);
+    // Mark the uploadinfo of the files we are going to upload as still needed.
+    if (_journal->uploadInfoCount() > 0) {
+        foreach(const SyncFileItem& it, _syncedItems) {
+            if (it._direction == SyncFileItem::Up
+                    && it._type == SyncFileItem::File)
+            {
+                _journal->keepUploadInfo(it._file);
+            }
         }
     }
 
     // Delete from journal.
-    _journal->deleteStaleUploadInfos(upload_file_paths);
+    _journal->deleteStaleUploadInfos();
 }
 
 void SyncEngine::deleteStaleErrorBlacklistEntries()
 {
-    // Find all blacklisted paths that we want to preserve.
-    QSet<QString> blacklist_file_paths;
+    // Mark the blacklist entries that still apply.
     foreach(const SyncFileItem& it, _syncedItems) {
         if (it._hasBlacklistEntry)
-            blacklist_file_paths.insert(it._file);
+            _journal->keepErrorBlacklistEntry(it._file);
     }
 
     // Delete from journal.
-    _journal->deleteStaleErrorBlacklistEntries(blacklist_file_paths);
+    _journal->deleteStaleErrorBlacklistEntries();
 }
 
 int SyncEngine::treewalkLocal( TREE_WALK_FILE* file, void *data )
@@ -280,6 +334,13 @@ int SyncEngine::treewalkRemote( TREE_WALK_FILE* file, void *data )
     return static_cast<SyncEngine*>(data)->treewalkFile( file, true );
 }
 
+// "" for the entries at the top of the sync folder
+static QString parentPath(const QString &path)
+{
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QString() : path.left(slash);
+}
+
 int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 {
     if( ! file ) return -1;
@@ -339,11 +400,14 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     }
     item._should_update_etag = item._should_update_etag || file->should_update_etag;
 
-    // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item._file);
-    if (!renameTarget.isEmpty()) {
+    // Stamp the seen files with the current generation to be able to clean the journal later.
+    // Only the entries of listed directories can be stale, the others are not touched.
+    if (!_syncItemMap.contains(key) && _listedDirectories.contains(parentPath(item._file))) {
+        _journal->markFileRecordSeen(item._file);
+    }
+    if (!renameTarget.isEmpty() && _listedDirectories.contains(parentPath(renameTarget))) {
         // Yes, this record both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        _journal->markFileRecordSeen(renameTarget);
     }
 
     if (remote && file->remotePerm && file->remotePerm[0]) {
@@ -534,21 +598,36 @@ void SyncEngine::handleSyncError(CSYNC *ctx, const char *state) {
 
 void SyncEngine::startSync()
 {
-    if (_journal->exists()) {
+    _pendingPollPaths.clear();
+    _succeededPollPaths.clear();
+    _pollSkippedPaths.clear();
+    _cleanupPollsError.clear();
+    _finishWaitsForPolls = false;
+
+    // A dry run must not touch the server, so unfinished uploads are not polled
+    if (_journal->exists() && !_dryRun) {
         QVector< SyncJournalDb::PollInfo > pollInfos = _journal->getPollInfos();
         if (!pollInfos.isEmpty()) {
-            qDebug() << "Finish Poll jobs before starting a sync";
-            CleanupPollsJob *job = new CleanupPollsJob(pollInfos, _account,
-                                                       _journal, _localPath, this);
-            connect(job, SIGNAL(finished()), this, SLOT(startSync()));
-            connect(job, SIGNAL(aborted(QString)), this, SLOT(slotCleanPollsJobAborted(QString)));
-            job->start();
-            return;
+            // Nothing waits for the polls but the end of the sync, see skipItemsWithPendingPolls()
+            qDebug() << "Finish" << pollInfos.count() << "poll jobs during the sync";
+            foreach (const SyncJournalDb::PollInfo &info, pollInfos) {
+                _pendingPollPaths.insert(info._file);
+            }
+            _cleanupPollsJob = new CleanupPollsJob(pollInfos, _account,
+                                                   _journal, _localPath, this);
+            connect(_cleanupPollsJob, SIGNAL(finished()), this, SLOT(slotCleanPollsJobFinished()));
+            connect(_cleanupPollsJob, SIGNAL(aborted(QString)), this, SLOT(slotCleanPollsJobAborted(QString)));
+            connect(_cleanupPollsJob, SIGNAL(pollSucceeded(QString)), this, SLOT(slotPollSucceeded(QString)));
+            _cleanupPollsJob->start();
         }
     }
 
-    Q_ASSERT(!_syncRunning);
-    _syncRunning = true;
+    // Several engines may run at once (owncloudcmd with a manifest), but
+    // the client itself only ever runs one.
+    _syncRunning++;
+    if (_syncRunning > 1) {
+        qDebug() << Q_FUNC_INFO << _syncRunning << "syncs are running in this process";
+    }
 
     Q_ASSERT(_csync_ctx);
 
@@ -617,7 +696,29 @@ void SyncEngine::startSync()
     csync_set_module_property(_csync_ctx, "timeout", &timeout);
 
     _stopWatch.start();
+    if (SyncTrace::isEnabled()) {
+        SyncTrace::startRun(traceFileForRun(_localPath));
+    }
+    _syncStartUsec = SyncTrace::nowUsec();
+
+    // The targeted sync compares with the journal, it needs a complete one
+    bool canTarget = fileRecordCount > 0 && !isUpdateFrom_1_5;
+#ifdef USE_NEON
+    // The legacy jobs need the neon session that the discovery sets up
+    ne_session_s *session = 0;
+    csync_set_module_property(_csync_ctx, "get_dav_session", &session);
+    canTarget = canTarget && session;
+#endif
+    if (!_targetedPaths.isEmpty() && canTarget) {
+        startTargetedSync();
+        return;
+    }
+    _targetedPaths.clear();
+    startFullDiscovery();
+}
 
+void SyncEngine::startFullDiscovery()
+{
     qDebug() << "#### Discovery start #################################################### >>";
 
     _discoveryMainThread = new DiscoveryMainThread(account());
@@ -629,6 +730,7 @@ void SyncEngine::startSync()
     DiscoveryJob *discoveryJob = new DiscoveryJob(_csync_ctx);
     discoveryJob->_selectiveSyncBlackList = _selectiveSyncBlackList;
     discoveryJob->moveToThread(&_thread);
+    connect(discoveryJob, SIGNAL(peakListingMemory(qint64)), this, SLOT(slotDiscoveryPeakMemory(qint64)));
     connect(discoveryJob, SIGNAL(finished(int)), this, SLOT(slotDiscoveryJobFinished(int)));
     connect(discoveryJob, SIGNAL(folderDiscovered(bool,QString)),
             this, SIGNAL(folderDiscovered(bool,QString)));
@@ -642,6 +744,279 @@ void SyncEngine::startSync()
     QMetaObject::invokeMethod(discoveryJob, "start", Qt::QueuedConnection);
 }
 
+void SyncEngine::setTargetedPaths(const QStringList &paths)
+{
+    _targetedPaths.clear();
+    foreach (const QString &path, paths) {
+        QString cleanPath = QDir::cleanPath(path);
+        while (cleanPath.startsWith(QLatin1Char('/'))) {
+            cleanPath.remove(0, 1);
+        }
+        if (!cleanPath.isEmpty() && cleanPath != QLatin1String(".") && !_targetedPaths.contains(cleanPath)) {
+            _targetedPaths.append(cleanPath);
+        }
+    }
+}
+
+static QString parentDirectory(const QString &path)
+{
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QString() : path.left(slash);
+}
+
+void SyncEngine::startTargetedSync()
+{
+    qDebug() << "#### Targeted sync of" << _targetedPaths.count() << "files ################## >>";
+    SyncMetrics::addToCounter("sync.targeted_runs");
+
+    _targetedFallback = false;
+    _targetedDirectoryPerms.clear();
+
+    QStringList directories;
+    QStringList paths;
+    foreach (const QString &path, _targetedPaths) {
+        // The excluded and unselected files are not synced at all
+        QFileInfo fi(_localPath + path);
+        int type = fi.isDir() ? CSYNC_FTW_TYPE_DIR : CSYNC_FTW_TYPE_FILE;
+        if (csync_excluded(_csync_ctx, path.toUtf8(), type) != CSYNC_NOT_EXCLUDED) {
+            continue;
+        }
+        bool unselected = false;
+        foreach (const QString &blacklisted, _selectiveSyncBlackList) {
+            if ((path + QLatin1Char('/')).startsWith(blacklisted)) {
+                unselected = true;
+                break;
+            }
+        }
+        if (unselected) {
+            continue;
+        }
+
+        paths.append(path);
+        QString dir = parentDirectory(path);
+        if (!directories.contains(dir)) {
+            directories.append(dir);
+        }
+    }
+    _targetedPaths = paths;
+
+    // One listing per directory, they run at the same time
+    _targetedListingsPending = directories.count();
+    foreach (const QString &dir, directories) {
+        QString fullPath = _remotePath;
+        if (!fullPath.endsWith(QLatin1Char('/'))) {
+            fullPath += QLatin1Char('/');
+        }
+        fullPath += dir;
+        while (fullPath.endsWith(QLatin1Char('/'))) {
+            fullPath.chop(1);
+        }
+
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(_account, fullPath, this);
+        job->setProperty("owncloud_targeted_directory", dir);
+        connect(job, SIGNAL(firstDirectoryPermissions(QString)),
+                this, SLOT(slotTargetedDirectoryPermissions(QString)));
+        connect(job, SIGNAL(finishedWithResult(QLinkedList<csync_vio_file_stat_t*>)),
+                this, SLOT(slotTargetedListingFinished(QLinkedList<csync_vio_file_stat_t*>)));
+        connect(job, SIGNAL(finishedWithError(int,QString)),
+                this, SLOT(slotTargetedListingFailed(int,QString)));
+        job->start();
+    }
+
+    if (_targetedListingsPending == 0) {
+        finishTargetedDiscovery();
+    }
+}
+
+void SyncEngine::slotTargetedDirectoryPermissions(const QString &perms)
+{
+    QString dir = sender()->property("owncloud_targeted_directory").toString();
+    _targetedDirectoryPerms[dir] = perms.toUtf8();
+}
+
+void SyncEngine::slotTargetedListingFinished(QLinkedList<csync_vio_file_stat_t *> result)
+{
+    QString dir = sender()->property("owncloud_targeted_directory").toString();
+    QString prefix = dir.isEmpty() ? QString() : dir + QLatin1Char('/');
+
+    // Only the entries of the targeted files are kept
+    foreach (csync_vio_file_stat_t *stat, result) {
+        QString path = prefix + QString::fromUtf8(stat->name);
+        if (_targetedPaths.contains(path) && !_targetedRemoteStats.contains(path)) {
+            _targetedRemoteStats.insert(path, stat);
+        } else {
+            csync_vio_file_stat_destroy(stat);
+        }
+    }
+
+    if (--_targetedListingsPending == 0) {
+        finishTargetedDiscovery();
+    }
+}
+
+void SyncEngine::slotTargetedListingFailed(int csyncErrnoCode, const QString &msg)
+{
+    // Also when the directory is gone on the server, only csync can tell what happened
+    qDebug() << Q_FUNC_INFO << sender()->property("owncloud_targeted_directory").toString()
+             << csyncErrnoCode << msg;
+    _targetedFallback = true;
+
+    if (--_targetedListingsPending == 0) {
+        finishTargetedDiscovery();
+    }
+}
+
+bool SyncEngine::targetedSyncItem(const QString &path, SyncFileItem *item)
+{
+    SyncJournalFileRecord record = _journal->getFileRecord(path);
+    const csync_vio_file_stat_t *remote = _targetedRemoteStats.value(path);
+
+    QFileInfo fi(_localPath + path);
+    bool localExists = fi.exists() || fi.isSymLink();
+    if ((localExists && (!fi.isFile() || fi.isSymLink()))
+            || (remote && remote->type != CSYNC_VIO_FILE_TYPE_REGULAR)
+            || (record.isValid() && record._type != SyncFileItem::File)) {
+        return false; // not a plain file
+    }
+
+    time_t localModtime = localExists ? FileSystem::getModTime(fi.absoluteFilePath()) : 0;
+    qint64 localSize = localExists ? FileSystem::getSize(fi.absoluteFilePath()) : 0;
+
+    bool localChanged = localExists;
+    bool remoteChanged = remote != 0;
+    if (record.isValid()) {
+        localChanged = !localExists
+                || Utility::qDateTimeToTime_t(record._modtime) != localModtime
+                || record._fileSize != localSize;
+        remoteChanged = !remote || record._etag != QByteArray(remote->etag);
+    }
+
+    // Conflicts, deletions and renames are left to csync
+    if ((localChanged && remoteChanged) || (localChanged && !localExists) || (remoteChanged && !remote)) {
+        return false;
+    }
+
+    item->_file = path;
+    item->_originalFile = path;
+    item->_type = SyncFileItem::File;
+    item->_isDirectory = false;
+    if (!localChanged && !remoteChanged) {
+        item->_instruction = CSYNC_INSTRUCTION_NONE;
+        return true;
+    }
+    item->_instruction = record.isValid() ? CSYNC_INSTRUCTION_SYNC : CSYNC_INSTRUCTION_NEW;
+
+    if (localChanged) {
+        // The same permissions that checkForPermission() wants, it knows how to recover
+        QByteArray perms = record.isValid() ? record._remotePerm
+                                            : _targetedDirectoryPerms.value(parentDirectory(path));
+        if (remote && remote->remotePerm[0]) {
+            perms = QByteArray(remote->remotePerm);
+        }
+        char needed = record.isValid() ? 'W' : 'C';
+        if (!perms.isEmpty() && !perms.contains(needed)) {
+            return false;
+        }
+
+        item->_direction = SyncFileItem::Up;
+        item->_modtime = localModtime;
+        item->_size = localSize;
+        item->_etag = record._etag;
+        item->_fileId = record._fileId;
+        item->_remotePerm = record._remotePerm;
+        // a new file has no record, and a saved file may have been replaced
+        item->_inode = FileSystem::getInode(fi.absoluteFilePath());
+    } else {
+        item->_direction = SyncFileItem::Down;
+        item->_modtime = remote->mtime;
+        item->_size = remote->size;
+        item->_etag = remote->etag;
+        item->_fileId = remote->file_id;
+        if (remote->remotePerm[0]) {
+            item->_remotePerm = QByteArray(remote->remotePerm);
+        }
+        if (remote->directDownloadUrl) {
+            item->_directDownloadUrl = QString::fromUtf8(remote->directDownloadUrl);
+        }
+        if (remote->directDownloadCookies) {
+            item->_directDownloadCookies = QString::fromUtf8(remote->directDownloadCookies);
+        }
+        item->_inode = record._inode;
+    }
+
+    item->log._etag = item->_etag;
+    item->log._fileId = item->_fileId;
+    item->log._instruction = item->_instruction;
+    item->log._modtime = item->_modtime;
+    item->log._size = item->_size;
+
+    checkErrorBlacklisting(item);
+    return true;
+}
+
+void SyncEngine::finishTargetedDiscovery()
+{
+    if (_csync_ctx->abort) {
+        qDebug() << "Targeted sync was aborted";
+        finalize();
+        return;
+    }
+
+    _syncedItems.clear();
+    _progressInfo = Progress::Info();
+    _blacklistSize = _journal->preloadErrorBlacklist();
+    _blacklistHits = 0;
+    _blacklistMisses = 0;
+    _treeWalkTime = Utility::qDateTimeToTime_t(QDateTime::currentDateTime());
+
+    for (int i = 0; i < _targetedPaths.count() && !_targetedFallback; ++i) {
+        SyncFileItem item;
+        if (!targetedSyncItem(_targetedPaths.at(i), &item)) {
+            qDebug() << "Targeted sync can not handle" << _targetedPaths.at(i);
+            _targetedFallback = true;
+        } else if (item._instruction != CSYNC_INSTRUCTION_NONE) {
+            _progressInfo._totalFileCount++;
+            if (Progress::isSizeDependent(item._instruction)) {
+                _progressInfo._totalSize += item._size;
+            }
+            _syncedItems.append(item);
+        }
+    }
+
+    foreach (csync_vio_file_stat_t *stat, _targetedRemoteStats) {
+        csync_vio_file_stat_destroy(stat);
+    }
+    _targetedRemoteStats.clear();
+
+    if (_targetedFallback) {
+        qDebug() << "Falling back to the full discovery";
+        SyncMetrics::addToCounter("sync.targeted_fallbacks");
+        _targetedPaths.clear();
+        _syncedItems.clear();
+        startFullDiscovery();
+        return;
+    }
+
+    qDebug() << "<<#### Targeted discovery end ########################################### "
+             << _stopWatch.addLapTime(QLatin1String("Discovery Finished"))
+             << _syncedItems.count() << "of" << _targetedPaths.count() << "files to propagate";
+
+    // Only the targeted records were looked at, the others must survive
+    _treeWalkComplete = false;
+    _hasNoneFiles = true;
+    _hasRemoveFile = false;
+    _needsUpdate = !_syncedItems.isEmpty();
+    _journal->commitIfNeededAndStartNewTransaction("Post targeted discovery");
+
+    std::sort(_syncedItems.begin(), _syncedItems.end());
+    startPropagation();
+}
+
+void SyncEngine::slotDiscoveryPeakMemory(qint64 bytes)
+{
+    _discoveryPeakMemory = bytes;
+}
+
 void SyncEngine::slotRootEtagReceived(QString e) {
     qDebug() << Q_FUNC_INFO << e;
     if (_remoteRootEtag.isEmpty()) {
@@ -672,9 +1047,12 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         _journal->commitIfNeededAndStartNewTransaction("Post discovery");
     }
 
-    if( csync_reconcile(_csync_ctx) < 0 ) {
-        handleSyncError(_csync_ctx, "csync_reconcile");
-        return;
+    {
+        TraceSpan span("csync", QLatin1String("csync_reconcile"));
+        if( csync_reconcile(_csync_ctx) < 0 ) {
+            handleSyncError(_csync_ctx, "csync_reconcile");
+            return;
+        }
     }
 
     _stopWatch.addLapTime(QLatin1String("Reconcile Finished"));
@@ -684,15 +1062,31 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _hasNoneFiles = false;
     _hasRemoveFile = false;
     bool walkOk = true;
-    _seenFiles.clear();
-
-    if( csync_walk_local_tree(_csync_ctx, &treewalkLocal, 0) < 0 ) {
-        qDebug() << "Error in local treewalk.";
-        walkOk = false;
-    }
-    if( walkOk && csync_walk_remote_tree(_csync_ctx, &treewalkRemote, 0) < 0 ) {
-        qDebug() << "Error in remote treewalk.";
+    _journal->startSyncGeneration();
+    _listedDirectories = _discoveryMainThread ? _discoveryMainThread->listedDirectories() : QSet<QString>();
+
+    _blacklistSize = _journal->preloadErrorBlacklist();
+    _blacklistHits = 0;
+    _blacklistMisses = 0;
+    _treeWalkTime = Utility::qDateTimeToTime_t(QDateTime::currentDateTime());
+
+    {
+        TraceSpan span("csync", QLatin1String("treewalk"));
+        if( csync_walk_local_tree(_csync_ctx, &treewalkLocal, 0) < 0 ) {
+            qDebug() << "Error in local treewalk.";
+            walkOk = false;
+        }
+        if( walkOk && csync_walk_remote_tree(_csync_ctx, &treewalkRemote, 0) < 0 ) {
+            qDebug() << "Error in remote treewalk.";
+            walkOk = false;
+        }
     }
+    _treeWalkComplete = walkOk;
+
+    qDebug() << "Error blacklist:" << _blacklistSize << "entries," << _blacklistHits << "hits,"
+             << _blacklistMisses << "misses";
+    SyncMetrics::addToCounter("blacklist.hits", _blacklistHits);
+    SyncMetrics::addToCounter("blacklist.misses", _blacklistMisses);
 
     if (_csync_ctx->remote.root_perms) {
         _remotePerms[QLatin1String("")] = _csync_ctx->remote.root_perms;
@@ -714,12 +1108,36 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // make sure everything is allowed
     checkForPermission();
 
+    startPropagation();
+}
+
+void SyncEngine::startPropagation()
+{
+    if (!_cleanupPollsError.isEmpty()) {
+        emit csyncError(_cleanupPollsError);
+        finalize();
+        return;
+    }
+    skipItemsWithPendingPolls();
+
+    // The jobs report their completion with the position of their item
+    for (int i = 0; i < _syncedItems.size(); ++i) {
+        _syncedItems[i]._syncIndex = i;
+    }
+
     // To announce the beginning of the sync
     emit aboutToPropagate(_syncedItems);
     _progressInfo._completedFileCount = ULLONG_MAX; // indicate the start with max
     emit transmissionProgress(_progressInfo);
     _progressInfo._completedFileCount = 0;
 
+    if (_dryRun) {
+        qDebug() << Q_FUNC_INFO << "Dry run, not propagating" << _syncedItems.count() << "items";
+        _journal->commit("dry run");
+        finalize();
+        return;
+    }
+
     if (!_hasNoneFiles && _hasRemoveFile) {
         qDebug() << Q_FUNC_INFO << "All the files are going to be changed, asking the user";
         bool cancel = false;
@@ -764,22 +1182,102 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
 
-    deleteStaleDownloadInfos();
-    deleteStaleUploadInfos();
-    deleteStaleErrorBlacklistEntries();
-    _journal->commit("post stale entry removal");
+    foreach (const QString &path, _prioritizedPaths) {
+        _propagator->prioritizePath(path);
+    }
+    // The skipped files whose poll succeeded already are retried, the others
+    // once it does, see slotPollSucceeded()
+    foreach (const QString &path, _pollSkippedPaths) {
+        if (_succeededPollPaths.contains(path)) {
+            _propagator->_pathsToRetry.append(path);
+        }
+    }
+    _pollSkippedPaths.subtract(_succeededPollPaths);
+
+    // A targeted sync did not look at the other entries, they are not stale
+    if (_targetedPaths.isEmpty()) {
+        deleteStaleDownloadInfos();
+        deleteStaleUploadInfos();
+        deleteStaleErrorBlacklistEntries();
+        _journal->commit("post stale entry removal");
+    }
 
     // Emit the started signal only after the propagator has been set up.
     if (_needsUpdate)
         emit(started());
 
+    _propagationStartUsec = SyncTrace::nowUsec();
     _propagator->start(_syncedItems);
 }
 
+/**
+ * The discovery may have looked at a file before its poll wrote the record,
+ * so the items of the files that had a poll URL are left out. They are
+ * retried once their poll succeeded, or left to the next sync.
+ */
+void SyncEngine::skipItemsWithPendingPolls()
+{
+    if (_pendingPollPaths.isEmpty()) {
+        return;
+    }
+
+    SyncFileItemVector kept;
+    kept.reserve(_syncedItems.size());
+    foreach (const SyncFileItem &item, _syncedItems) {
+        if (!_pendingPollPaths.contains(item._file)
+                && (item._renameTarget.isEmpty() || !_pendingPollPaths.contains(item._renameTarget))) {
+            kept.append(item);
+            continue;
+        }
+        qDebug() << Q_FUNC_INFO << "Skipping" << item._file << "because of its poll";
+        if (!item._isDirectory && _progressInfo._totalFileCount > 0) {
+            _progressInfo._totalFileCount--;
+            if (Progress::isSizeDependent(item._instruction) && _progressInfo._totalSize >= item._size) {
+                _progressInfo._totalSize -= item._size;
+            }
+        }
+        if (item._instruction != CSYNC_INSTRUCTION_NONE) {
+            _pollSkippedPaths.insert(item._file);
+        }
+    }
+    SyncMetrics::addToCounter("sync.poll_skipped_items", _syncedItems.size() - kept.size());
+    _syncedItems = kept;
+}
+
+void SyncEngine::slotPollSucceeded(const QString &file)
+{
+    _succeededPollPaths.insert(file);
+    if (_propagator && _pollSkippedPaths.remove(file)) {
+        _propagator->_pathsToRetry.append(file);
+    }
+}
+
+void SyncEngine::slotCleanPollsJobFinished()
+{
+    _cleanupPollsJob = 0;
+    if (_finishWaitsForPolls) {
+        slotFinished();
+    }
+}
+
 void SyncEngine::slotCleanPollsJobAborted(const QString &error)
 {
-    csyncError(error);
-    finalize();
+    // Reported at the end of the sync, the discovery can't be stopped in the middle
+    _cleanupPollsJob = 0;
+    _cleanupPollsError = error;
+    if (_finishWaitsForPolls) {
+        slotFinished();
+    }
+}
+
+void SyncEngine::stopCleanupPollsJob()
+{
+    if (_cleanupPollsJob) {
+        // The polls that did not finish are repeated by the next sync
+        _cleanupPollsJob->disconnect(this);
+        _cleanupPollsJob->deleteLater();
+        _cleanupPollsJob = 0;
+    }
 }
 
 void SyncEngine::setNetworkLimits(int upload, int download)
@@ -791,6 +1289,7 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 
     _propagator->_uploadLimit = upload;
     _propagator->_downloadLimit = download;
+    QMetaObject::invokeMethod(&_propagator->_bandwidthManager, "slotLimitsChanged", Qt::QueuedConnection);
 
     int propDownloadLimit = _propagator->_downloadLimit
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
@@ -813,7 +1312,11 @@ void SyncEngine::slotJobCompleted(const SyncFileItem &item)
     qDebug() << Q_FUNC_INFO << item._file << item._status << item._errorString;
 
     /* Update the _syncedItems vector */
-    int idx = _syncedItems.indexOf(item);
+    int idx = item._syncIndex;
+    if (idx < 0 || idx >= _syncedItems.size() || !(_syncedItems.at(idx) == item)) {
+        // Not an item of the tree walk, or the vector changed
+        idx = _syncedItems.indexOf(item);
+    }
     if (idx >= 0) {
         _syncedItems[idx]._instruction = item._instruction;
         _syncedItems[idx]._errorString = item._errorString;
@@ -832,16 +1335,59 @@ void SyncEngine::slotJobCompleted(const SyncFileItem &item)
         emit csyncError(item._errorString);
     }
 
-    emit transmissionProgress(_progressInfo);
+    scheduleProgress();
     emit jobCompleted(item);
 }
 
+void SyncEngine::prioritizePath(const QString &path)
+{
+    _prioritizedPaths.append(path);
+    if (_propagator) {
+        _propagator->prioritizePath(path);
+    }
+}
+
 void SyncEngine::slotFinished()
 {
+    if (_cleanupPollsJob) {
+        // The polls end at their deadline at the latest, their files are retried
+        qDebug() << Q_FUNC_INFO << "Waiting for the poll jobs";
+        _finishWaitsForPolls = true;
+        return;
+    }
+    _finishWaitsForPolls = false;
+    if (!_cleanupPollsError.isEmpty()) {
+        emit csyncError(_cleanupPollsError);
+    }
+
     _anotherSyncNeeded = _anotherSyncNeeded || _propagator->_anotherSyncNeeded;
+    _pathsToRetry = _propagator->_pathsToRetry;
 
-    // emit the treewalk results.
-    if( ! _journal->postSyncCleanup( _seenFiles ) ) {
+    if (SyncTrace::isRecording()) {
+        SyncTrace::addSpan("csync", QLatin1String("propagation"), _propagationStartUsec,
+                           SyncTrace::nowUsec() - _propagationStartUsec);
+    }
+
+    _firstCompletionMsec = _propagator->firstCompletionMsec();
+    _medianCompletionMsec = _propagator->medianCompletionMsec();
+    qDebug() << "Propagation latency: first file after" << _firstCompletionMsec
+             << "ms, median file after" << _medianCompletionMsec << "ms";
+    if (_firstCompletionMsec >= 0) {
+        SyncMetrics::recordValue("sync.first_file_msec", _firstCompletionMsec);
+    }
+    SyncMetrics::setGauge("propagator.pending_items", 0);
+    SyncMetrics::setGauge("propagator.active_jobs", 0);
+
+    if (_propagator->compressedFileBytes() > 0) {
+        qDebug() << "Compression saved" << _propagator->compressionSavedBytes() << "of"
+                 << _propagator->compressedFileBytes() << "bytes";
+        SyncMetrics::recordValue("sync.compression_saved_bytes", _propagator->compressionSavedBytes());
+    }
+
+    // Only a complete tree walk stamped all the records that are still needed.
+    if (!_treeWalkComplete) {
+        qDebug() << "Incomplete tree walk, keeping the journal entries that were not seen";
+    } else if( ! _journal->postSyncCleanup(_listedDirectories) ) {
         qDebug() << "Cleaning of synced ";
     }
 
@@ -852,6 +1398,14 @@ void SyncEngine::slotFinished()
 
 void SyncEngine::finalize()
 {
+    stopCleanupPollsJob();
+    _finishWaitsForPolls = false;
+
+    // Publish the final state of a coalesced progress update
+    if (_progressTimer.isActive()) {
+        slotEmitProgress();
+    }
+
     _thread.quit();
     _thread.wait();
     csync_commit(_csync_ctx);
@@ -859,7 +1413,16 @@ void SyncEngine::finalize()
     qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
     _stopWatch.stop();
 
-    _syncRunning = false;
+    SyncMetrics::addToCounter("sync.runs");
+    SyncMetrics::recordValue("sync.duration_msec", (SyncTrace::nowUsec() - _syncStartUsec) / 1000);
+
+    if (SyncTrace::isRecording()) {
+        SyncTrace::addSpan("csync", QLatin1String("sync run"), _syncStartUsec,
+                           SyncTrace::nowUsec() - _syncStartUsec);
+        SyncTrace::finishRun();
+    }
+
+    _syncRunning--;
     emit finished();
 
     // Delete the propagator only after emitting the signal.
@@ -869,6 +1432,19 @@ void SyncEngine::finalize()
 void SyncEngine::slotProgress(const SyncFileItem& item, quint64 current)
 {
     _progressInfo.setProgressItem(item, current);
+    scheduleProgress();
+}
+
+void SyncEngine::scheduleProgress()
+{
+    if (!_progressTimer.isActive()) {
+        _progressTimer.start();
+    }
+}
+
+void SyncEngine::slotEmitProgress()
+{
+    _progressTimer.stop();
     emit transmissionProgress(_progressInfo);
 }
 
@@ -1181,6 +1757,11 @@ void SyncEngine::abort()
     if(_propagator) {
         _propagator->abort();
     }
+    // Nothing else runs while the end of the sync waits for the polls
+    if (_finishWaitsForPolls) {
+        stopCleanupPollsJob();
+        slotFinished();
+    }
 }
 
 } // namespace OCC
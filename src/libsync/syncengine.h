@@ -25,6 +25,7 @@
 #include <QMap>
 #include <QStringList>
 #include <QSharedPointer>
+#include <QTimer>
 
 #include <csync.h>
 
@@ -45,6 +46,7 @@ namespace OCC {
 class SyncJournalFileRecord;
 class SyncJournalDb;
 class OwncloudPropagator;
+class CleanupPollsJob;
 
 class OWNCLOUDSYNC_EXPORT SyncEngine : public QObject
 {
@@ -64,8 +66,43 @@ public:
 
     Utility::StopWatch &stopWatch() { return _stopWatch; }
 
+    /** The most memory the remote directory listings used at once during the last discovery */
+    qint64 discoveryPeakMemory() const { return _discoveryPeakMemory; }
+
     void setSelectiveSyncBlackList(const QStringList &list);
 
+    /**
+     * Only run discovery and reconcile. aboutToPropagate() is emitted with what
+     * would be done, then the sync finishes without changing any file.
+     */
+    void setDryRun(bool dryRun) { _dryRun = dryRun; }
+    bool isDryRun() const { return _dryRun; }
+
+    /**
+     * Propagate the item at \a path (relative to the sync folder) before the others.
+     * Can be called before or during the sync.
+     */
+    void prioritizePath(const QString &path);
+
+    /**
+     * Makes startSync() sync only these files (relative to the sync folder)
+     * instead of running the discovery over the whole folder.
+     *
+     * Each file is compared with its journal record, its local stat and the
+     * listing of its remote directory. Directories, deletions, changes on both
+     * sides and everything else that needs csync to decide make the engine
+     * fall back to the full discovery.
+     */
+    void setTargetedPaths(const QStringList &paths);
+
+    /** Files that were left alone because they were still changing. Valid after finished() */
+    QStringList pathsToRetry() const { return _pathsToRetry; }
+
+    /** Time until the first file was propagated, -1 if none was. Valid after finished() */
+    qint64 firstCompletionMsec() const { return _firstCompletionMsec; }
+    /** Median time until a file was propagated, -1 if none was. Valid after finished() */
+    qint64 medianCompletionMsec() const { return _medianCompletionMsec; }
+
     /* Return true if we detected that another sync is needed to complete the sync */
     bool isAnotherSyncNeeded() { return _anotherSyncNeeded; }
 
@@ -115,12 +152,27 @@ private slots:
     void slotFinished();
     void slotProgress(const SyncFileItem& item, quint64 curent);
     void slotAdjustTotalTransmissionSize(qint64 change);
+    void slotEmitProgress();
     void slotDiscoveryJobFinished(int updateResult);
+    void slotDiscoveryPeakMemory(qint64 bytes);
+    void slotCleanPollsJobFinished();
     void slotCleanPollsJobAborted(const QString &error);
+    void slotPollSucceeded(const QString &file);
+    void slotTargetedListingFinished(QLinkedList<csync_vio_file_stat_t*> result);
+    void slotTargetedListingFailed(int csyncErrnoCode, const QString &msg);
+    void slotTargetedDirectoryPermissions(const QString &perms);
 
 private:
     void handleSyncError(CSYNC *ctx, const char *state);
 
+    void startFullDiscovery();
+    void startTargetedSync();
+    void finishTargetedDiscovery();
+    bool targetedSyncItem(const QString &path, SyncFileItem *item);
+    void startPropagation();
+    void skipItemsWithPendingPolls();
+    void stopCleanupPollsJob();
+
     static int treewalkLocal( TREE_WALK_FILE*, void *);
     static int treewalkRemote( TREE_WALK_FILE*, void *);
     int treewalkFile( TREE_WALK_FILE*, bool );
@@ -139,7 +191,10 @@ private:
     // cleanup and emit the finished signal
     void finalize();
 
-    static bool _syncRunning; //true when one sync is running somewhere (for debugging)
+    // emits transmissionProgress when _progressTimer fires
+    void scheduleProgress();
+
+    static int _syncRunning; // number of syncs running in this process (for debugging)
 
     QMap<QString, SyncFileItem> _syncItemMap;
 
@@ -158,11 +213,20 @@ private:
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer <OwncloudPropagator> _propagator;
     QString _lastDeleted; // if the last item was a path and it has been deleted
-    QSet<QString> _seenFiles;
+    bool _treeWalkComplete; // whether every file record was stamped, so stale ones may be removed
+    QSet<QString> _listedDirectories; // the remote directories discovery listed, see postSyncCleanup()
+    time_t _treeWalkTime; // the blacklist expiry is checked against this
+    int _blacklistSize; // entries preloaded for the tree walk, -1 if that failed
+    int _blacklistHits;
+    int _blacklistMisses;
     QThread _thread;
 
     Progress::Info _progressInfo;
 
+    // transmissionProgress is emitted at most once per progressIntervalMsec
+    static const int progressIntervalMsec = 200;
+    QTimer _progressTimer;
+
     Utility::StopWatch _stopWatch;
 
     // maps the origin and the target of the folders that have been renamed
@@ -188,6 +252,30 @@ private:
     QStringList _selectiveSyncBlackList;
 
     bool _anotherSyncNeeded;
+    bool _dryRun;
+
+    QStringList _prioritizedPaths;
+    qint64 _syncStartUsec; // for SyncTrace
+    qint64 _propagationStartUsec;
+    qint64 _firstCompletionMsec;
+    qint64 _medianCompletionMsec;
+    qint64 _discoveryPeakMemory;
+
+    QStringList _targetedPaths; // empty for a full sync
+    int _targetedListingsPending;
+    bool _targetedFallback; // a targeted path needs the full discovery
+    QHash<QString, csync_vio_file_stat_t *> _targetedRemoteStats; // by path, owned
+    QHash<QString, QByteArray> _targetedDirectoryPerms; // by directory
+    QStringList _pathsToRetry;
+
+    // The polls for the uploads the server was still processing run alongside the
+    // discovery and the propagation, only the end of the sync waits for them
+    QPointer<CleanupPollsJob> _cleanupPollsJob;
+    QSet<QString> _pendingPollPaths; // the files that had a poll URL when the sync started
+    QSet<QString> _succeededPollPaths;
+    QSet<QString> _pollSkippedPaths; // skipped items, retried once their poll succeeds
+    bool _finishWaitsForPolls;
+    QString _cleanupPollsError;
 };
 
 }
@@ -54,7 +54,7 @@ public:
         _instruction(CSYNC_INSTRUCTION_NONE), _modtime(0),
         _size(0), _inode(0), _should_update_etag(false), _hasBlacklistEntry(false),
         _status(NoStatus), _httpErrorCode(0), _requestDuration(0), _isRestoration(false),
-        _affectedItems(1)
+        _affectedItems(1), _syncIndex(-1)
     {
     }
 
@@ -145,6 +145,7 @@ public:
     bool                 _isRestoration; // The original operation was forbidden, and this is a restoration
     int                  _affectedItems; // the number of affected items by the operation on this item.
      // usually this value is 1, but for removes on dirs, it might be much higher.
+    int                  _syncIndex; // position in the item vector of the SyncEngine, -1 if unknown
     struct {
         quint64     _size;
         time_t      _modtime;
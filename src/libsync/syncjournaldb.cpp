@@ -15,22 +15,214 @@
 #include <QStringList>
 #include <QDebug>
 #include <QElapsedTimer>
+#include <QThread>
+#include <QWaitCondition>
 #include "ownsql.h"
 
 #include <inttypes.h>
+#include <limits>
 
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
+#include "syncfileitem.h"
 #include "utility.h"
 #include "version.h"
 #include "filesystem.h"
+#include "synctrace.h"
+#include "syncmetrics.h"
 
 #include "../../csync/src/std/c_jhash.h"
 
 namespace OCC {
 
+/*
+ * The thread that runs the writes queued by the *Async() functions, one by one
+ * and in the order they were queued. It calls the normal journal functions, so
+ * it takes the journal mutex like every other caller.
+ */
+class SyncJournalDb::AsyncWriter : public QThread
+{
+public:
+    struct Write {
+        enum Kind { SetFileRecord, DeleteFileRecord, SetDownloadInfo, SetUploadInfo, SetPollInfo,
+                    SetErrorBlacklistEntry, Commit };
+
+        explicit Write(Kind kind) : _kind(kind), _recursively(false), _queuedUsec(0) {}
+
+        Kind _kind;
+        SyncJournalFileRecord _record;
+        QString _file; // the commit context for Commit
+        bool _recursively;
+        DownloadInfo _downloadInfo;
+        UploadInfo _uploadInfo;
+        PollInfo _pollInfo;
+        SyncJournalErrorBlacklistRecord _blacklistRecord; // wipes the entry of _file if not valid
+        qint64 _queuedUsec;
+    };
+
+    explicit AsyncWriter(SyncJournalDb *journal)
+        : _journal(journal), _current(Write::Commit), _busy(false), _stopping(false)
+    {}
+
+    void enqueue(Write write)
+    {
+        write._queuedUsec = SyncTrace::nowUsec();
+        QMutexLocker locker(&_queueMutex);
+        if (_stopping) {
+            // close() is draining the queue, let it finish before restarting
+            locker.unlock();
+            wait();
+            locker.relock();
+        }
+        _queue.append(write);
+        SyncMetrics::setGauge("journal.queue_depth", _queue.count());
+        if (!isRunning()) {
+            _stopping = false;
+            start();
+        }
+        _queueChanged.wakeOne();
+    }
+
+    /*
+     * Finds the last write of the given kind for file that is not done yet, so
+     * that reads can return it without waiting for the queue. If there is none,
+     * the database is up to date for file, as only the caller's thread queues
+     * writes.
+     */
+    bool findPending(Write::Kind kind, const QString &file, Write *write)
+    {
+        QMutexLocker locker(&_queueMutex);
+        for (int i = _queue.count() - 1; i >= 0; --i) {
+            if (_queue.at(i)._kind == kind && _queue.at(i)._file == file) {
+                *write = _queue.at(i);
+                return true;
+            }
+        }
+        if (_busy && _current._kind == kind && _current._file == file) {
+            *write = _current;
+            return true;
+        }
+        return false;
+    }
+
+    void waitUntilIdle()
+    {
+        if (QThread::currentThread() == this) {
+            return; // the writes call back into the journal
+        }
+        QMutexLocker locker(&_queueMutex);
+        if (_queue.isEmpty() && !_busy) {
+            return;
+        }
+        qint64 startUsec = SyncTrace::nowUsec();
+        while (!_queue.isEmpty() || _busy) {
+            _idle.wait(&_queueMutex);
+        }
+        SyncMetrics::recordValue("journal.queue_wait_usec", SyncTrace::nowUsec() - startUsec);
+    }
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&_queueMutex);
+            _stopping = true;
+            _queueChanged.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        forever {
+            Write write(Write::Commit);
+            {
+                QMutexLocker locker(&_queueMutex);
+                while (_queue.isEmpty() && !_stopping) {
+                    _queueChanged.wait(&_queueMutex);
+                }
+                if (_queue.isEmpty()) {
+                    return;
+                }
+                write = _queue.takeFirst();
+                _current = write;
+                _busy = true;
+            }
+
+            qint64 startUsec = SyncTrace::nowUsec();
+            execute(write);
+            qint64 nowUsec = SyncTrace::nowUsec();
+            SyncMetrics::recordValue("journal.queued_usec", startUsec - write._queuedUsec);
+            SyncMetrics::recordValue(statementMetric(write._kind), nowUsec - startUsec);
+
+            QMutexLocker locker(&_queueMutex);
+            _busy = false;
+            SyncMetrics::setGauge("journal.queue_depth", _queue.count());
+            if (_queue.isEmpty()) {
+                _idle.wakeAll();
+            }
+        }
+    }
+
+private:
+    void execute(const Write &write)
+    {
+        switch (write._kind) {
+        case Write::SetFileRecord:
+            _journal->setFileRecord(write._record);
+            break;
+        case Write::DeleteFileRecord:
+            _journal->deleteFileRecord(write._file, write._recursively);
+            break;
+        case Write::SetDownloadInfo:
+            _journal->setDownloadInfo(write._file, write._downloadInfo);
+            break;
+        case Write::SetUploadInfo:
+            _journal->setUploadInfo(write._file, write._uploadInfo);
+            break;
+        case Write::SetPollInfo:
+            _journal->setPollInfo(write._pollInfo);
+            break;
+        case Write::SetErrorBlacklistEntry:
+            if (write._blacklistRecord.isValid()) {
+                _journal->updateErrorBlacklistEntry(write._blacklistRecord);
+            } else {
+                _journal->wipeErrorBlacklistEntry(write._file);
+            }
+            break;
+        case Write::Commit:
+            _journal->commit(write._file);
+            break;
+        }
+    }
+
+    static const char *statementMetric(Write::Kind kind)
+    {
+        switch (kind) {
+        case Write::SetFileRecord: return "journal.set_file_record_usec";
+        case Write::DeleteFileRecord: return "journal.delete_file_record_usec";
+        case Write::SetDownloadInfo: return "journal.set_download_info_usec";
+        case Write::SetUploadInfo: return "journal.set_upload_info_usec";
+        case Write::SetPollInfo: return "journal.set_poll_info_usec";
+        case Write::SetErrorBlacklistEntry: return "journal.set_blacklist_entry_usec";
+        case Write::Commit: return "journal.async_commit_usec";
+        }
+        return "journal.unknown_usec";
+    }
+
+    SyncJournalDb *_journal;
+    QMutex _queueMutex;
+    QWaitCondition _queueChanged;
+    QWaitCondition _idle;
+    QList<Write> _queue;
+    Write _current; // the write taken from the queue last
+    bool _busy; // a write was taken from the queue but is not done yet
+    bool _stopping;
+};
+
 SyncJournalDb::SyncJournalDb(const QString& path, QObject *parent) :
-    QObject(parent), _transaction(0), _possibleUpgradeFromMirall_1_5(false)
+    QObject(parent), _transaction(0), _transactionStartUsec(0), _possibleUpgradeFromMirall_1_5(false),
+    _generation(0), _errorBlacklistCacheLoaded(false), _asyncWriter(new AsyncWriter(this))
 {
 
     _dbFile = path;
@@ -58,6 +250,7 @@ QString SyncJournalDb::databaseFilePath()
 // Then the next sync (and the SocketAPI) will have a faster access.
 void SyncJournalDb::walCheckpoint()
 {
+    waitForQueuedWrites();
     QElapsedTimer t;
     t.start();
     SqlQuery pragma1(_db);
@@ -77,6 +270,7 @@ void SyncJournalDb::startTransaction()
             return;
         }
         _transaction = 1;
+        _transactionStartUsec = SyncTrace::nowUsec();
         // qDebug() << "XXX Transaction start!";
     } else {
         qDebug() << "Database Transaction is running, do not starting another one!";
@@ -86,11 +280,24 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if( _transaction == 1 ) {
-        if( ! _db.commit() ) {
-            qDebug() << "ERROR committing to the database: " << _db.error();
-            return;
+        qint64 commitStartUsec = SyncTrace::nowUsec();
+        {
+            TraceSpan span("journal", QLatin1String("commit"));
+            if( ! _db.commit() ) {
+                qDebug() << "ERROR committing to the database: " << _db.error();
+                SyncMetrics::addToCounter("journal.commit_errors");
+                return;
+            }
         }
         _transaction = 0;
+        qint64 nowUsec = SyncTrace::nowUsec();
+        SyncMetrics::addToCounter("journal.commits");
+        SyncMetrics::recordValue("journal.commit_usec", nowUsec - commitStartUsec);
+        SyncMetrics::recordValue("journal.transaction_usec", nowUsec - _transactionStartUsec);
+        if (SyncTrace::isRecording()) {
+            SyncTrace::addAsyncSpan("journal", QLatin1String("transaction"), _transactionStartUsec,
+                                    nowUsec - _transactionStartUsec);
+        }
         // qDebug() << "XXX Transaction END!";
     } else {
         qDebug() << "No database Transaction to commit";
@@ -206,6 +413,7 @@ bool SyncJournalDb::checkConnect()
                          "md5 VARCHAR(32)," /* This is the etag.  Called md5 for compatibility */
                         // updateDatabaseStructure() will add a fileid column
                         // updateDatabaseStructure() will add a remotePerm column
+                        // updateDatabaseStructure() will add a generation column
                          "PRIMARY KEY(phash)"
                          ");");
 
@@ -323,8 +531,11 @@ bool SyncJournalDb::checkConnect()
 
     _setFileRecordQuery.reset(new SqlQuery(_db) );
     _setFileRecordQuery->prepare("INSERT OR REPLACE INTO metadata "
-                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize) "
-                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13);" );
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, generation) "
+                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14);" );
+
+    _markFileRecordSeenQuery.reset(new SqlQuery(_db));
+    _markFileRecordSeenQuery->prepare("UPDATE metadata SET generation=?1 WHERE phash=?2");
 
     _getDownloadInfoQuery.reset(new SqlQuery(_db) );
     _getDownloadInfoQuery->prepare( "SELECT tmpfile, etag, errorcount FROM "
@@ -332,8 +543,11 @@ bool SyncJournalDb::checkConnect()
 
     _setDownloadInfoQuery.reset(new SqlQuery(_db) );
     _setDownloadInfoQuery->prepare( "INSERT OR REPLACE INTO downloadinfo "
-                                    "(path, tmpfile, etag, errorcount) "
-                                    "VALUES ( ?1 , ?2, ?3, ?4 )" );
+                                    "(path, tmpfile, etag, errorcount, generation) "
+                                    "VALUES ( ?1 , ?2, ?3, ?4, ?5 )" );
+
+    _keepDownloadInfoQuery.reset(new SqlQuery(_db) );
+    _keepDownloadInfoQuery->prepare( "UPDATE downloadinfo SET generation=?1 WHERE path=?2" );
 
     _deleteDownloadInfoQuery.reset(new SqlQuery(_db) );
     _deleteDownloadInfoQuery->prepare( "DELETE FROM downloadinfo WHERE path=?1" );
@@ -344,8 +558,11 @@ bool SyncJournalDb::checkConnect()
 
     _setUploadInfoQuery.reset(new SqlQuery(_db));
     _setUploadInfoQuery->prepare( "INSERT OR REPLACE INTO uploadinfo "
-                                  "(path, chunk, transferid, errorcount, size, modtime) "
-                                  "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6 )");
+                                  "(path, chunk, transferid, errorcount, size, modtime, generation) "
+                                  "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6, ?7 )");
+
+    _keepUploadInfoQuery.reset(new SqlQuery(_db));
+    _keepUploadInfoQuery->prepare( "UPDATE uploadinfo SET generation=?1 WHERE path=?2" );
 
     _deleteUploadInfoQuery.reset(new SqlQuery(_db));
     _deleteUploadInfoQuery->prepare("DELETE FROM uploadinfo WHERE path=?1" );
@@ -369,8 +586,11 @@ bool SyncJournalDb::checkConnect()
 
     _setErrorBlacklistQuery.reset(new SqlQuery(_db));
     _setErrorBlacklistQuery->prepare("INSERT OR REPLACE INTO blacklist "
-                                "(path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration) "
-                                "VALUES ( ?1, ?2, ?3, ?4, ?5, ?6, ?7)");
+                                "(path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, generation) "
+                                "VALUES ( ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)");
+
+    _keepErrorBlacklistQuery.reset(new SqlQuery(_db));
+    _keepErrorBlacklistQuery->prepare("UPDATE blacklist SET generation=?1 WHERE path=?2");
 
     // don't start a new transaction now
     commitInternal(QString("checkConnect End"), false);
@@ -386,6 +606,8 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    _asyncWriter->stop();
+
     QMutexLocker locker(&_mutex);
     qDebug() << Q_FUNC_INFO << _dbFile;
 
@@ -403,10 +625,16 @@ void SyncJournalDb::close()
     _deleteFileRecordRecursively.reset(0);
     _getErrorBlacklistQuery.reset(0);
     _setErrorBlacklistQuery.reset(0);
+    _markFileRecordSeenQuery.reset(0);
+    _keepDownloadInfoQuery.reset(0);
+    _keepUploadInfoQuery.reset(0);
+    _keepErrorBlacklistQuery.reset(0);
     _possibleUpgradeFromMirall_1_5 = false;
 
     _db.close();
     _avoidReadFromDbOnNextSyncFilter.clear();
+    _errorBlacklistCache.clear();
+    _errorBlacklistCacheLoaded = false;
 }
 
 
@@ -416,6 +644,8 @@ bool SyncJournalDb::updateDatabaseStructure()
         return false;
     if (!updateErrorBlacklistTableStructure())
         return false;
+    if (!updateGenerationColumns())
+        return false;
     return true;
 }
 
@@ -517,6 +747,35 @@ bool SyncJournalDb::updateErrorBlacklistTableStructure()
     return re;
 }
 
+bool SyncJournalDb::updateGenerationColumns()
+{
+    static const char *tables[] = { "metadata", "downloadinfo", "uploadinfo", "blacklist", 0 };
+    bool re = true;
+
+    for (const char **table = tables; *table; ++table) {
+        const QString name = QString::fromLatin1(*table);
+        if( tableColumns(name).indexOf(QLatin1String("generation")) != -1 ) {
+            continue;
+        }
+
+        // Rows written before the upgrade count as generation 0: they are kept
+        // until the first full sync decides whether they are still needed.
+        SqlQuery query(_db);
+        query.prepare(QString("ALTER TABLE %1 ADD COLUMN generation INTEGER DEFAULT 0;").arg(name));
+        if( !query.exec() ) {
+            sqlFail("updateGenerationColumns: add column generation to " + name, query);
+            re = false;
+        }
+        query.prepare(QString("CREATE INDEX IF NOT EXISTS %1_generation ON %1(generation);").arg(name));
+        if( !query.exec() ) {
+            sqlFail("updateGenerationColumns: create index generation on " + name, query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation col to " + name);
+    }
+    return re;
+}
+
 QStringList SyncJournalDb::tableColumns( const QString& table )
 {
     QStringList columns;
@@ -560,6 +819,7 @@ qint64 SyncJournalDb::getPHash(const QString& file)
 
 bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
 {
+    waitForQueuedWrites();
     SyncJournalFileRecord record = _record;
     QMutexLocker locker(&_mutex);
 
@@ -600,6 +860,7 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         _setFileRecordQuery->bindValue(11, fileId );
         _setFileRecordQuery->bindValue(12, remotePerm );
         _setFileRecordQuery->bindValue(13, record._fileSize );
+        _setFileRecordQuery->bindValue(14, currentGeneration() );
 
         if( !_setFileRecordQuery->exec() ) {
             qWarning() << "Error SQL statement setFileRecord: " << _setFileRecordQuery->lastQuery() <<  " :"
@@ -622,6 +883,7 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
 
 bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( checkConnect() ) {
@@ -662,6 +924,7 @@ bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 
 SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash( filename );
@@ -698,44 +961,122 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
     return rec;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
+qint64 SyncJournalDb::currentGeneration()
+{
+    if (_generation == 0 && checkConnect()) {
+        // Continue after the newest row, the counter is not stored separately.
+        SqlQuery query("SELECT MAX(g) FROM ("
+                       "SELECT MAX(generation) AS g FROM metadata UNION ALL "
+                       "SELECT MAX(generation) FROM downloadinfo UNION ALL "
+                       "SELECT MAX(generation) FROM uploadinfo UNION ALL "
+                       "SELECT MAX(generation) FROM blacklist)", _db);
+        if (query.exec() && query.next()) {
+            _generation = query.int64Value(0);
+        }
+        if (_generation == 0) {
+            _generation = 1;
+        }
+    }
+    return _generation;
+}
+
+qint64 SyncJournalDb::startSyncGeneration()
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+    _generation = currentGeneration() + 1;
+    qDebug() << Q_FUNC_INFO << _generation;
+    return _generation;
+}
+
+void SyncJournalDb::stampGeneration(SqlQuery *query, const QVariant &key, const QString &fileName)
+{
+    query->reset();
+    query->bindValue(1, currentGeneration());
+    query->bindValue(2, key);
+    if( !query->exec() ) {
+        qWarning() << "Exec error of SQL statement: " << query->lastQuery() << fileName << " : " << query->error();
+    }
+    query->reset();
+}
+
+void SyncJournalDb::markFileRecordSeen(const QString &fileName)
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+    if( checkConnect() ) {
+        stampGeneration(_markFileRecordSeenQuery.data(), QString::number(getPHash(fileName)), fileName);
+    }
+}
+
+bool SyncJournalDb::postSyncCleanup(const QSet<QString> &listedDirectories)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
         return false;
     }
 
+    // The listed directories go into a temporary table, with a trailing slash
+    // like the parent directories computed by the query below.
     SqlQuery query(_db);
-    query.prepare("SELECT phash, path FROM metadata order by path");
-
+    query.prepare("CREATE TEMP TABLE IF NOT EXISTS listed_dirs(path TEXT PRIMARY KEY)");
     if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;;
+        qWarning() << "Error creating listed_dirs: " << query.error();
         return false;
     }
-
-    QStringList superfluousItems;
-
-    while(query.next()) {
-        const QString file = query.stringValue(1);
-        bool contained = items.contains(file);
-        if( !contained ) {
-            superfluousItems.append(query.stringValue(0));
+    query.prepare("DELETE FROM listed_dirs");
+    query.exec();
+    query.prepare("INSERT OR IGNORE INTO listed_dirs (path) VALUES (?1)");
+    foreach (const QString &dir, listedDirectories) {
+        query.reset();
+        query.bindValue(1, dir.isEmpty() ? dir : dir + QLatin1Char('/'));
+        if (!query.exec()) {
+            qWarning() << "Error filling listed_dirs: " << query.error();
+            return false;
         }
     }
 
-    if( superfluousItems.count() )  {
-        QString sql = "DELETE FROM metadata WHERE phash in ("+ superfluousItems.join(",")+")";
-        qDebug() << "Sync Journal cleanup: " << sql;
-        SqlQuery delQuery(_db);
-        delQuery.prepare(sql);
-        if( !delQuery.exec() ) {
-            QString err = delQuery.error();
-            qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
+    // Trimming all characters but the slash from the end of a path leaves its
+    // parent directory. This reads the table once but writes only stale rows.
+    SqlQuery staleQuery(_db);
+    staleQuery.prepare("SELECT path, type FROM metadata WHERE generation < ?1 "
+                       "AND rtrim(path, replace(path, '/', '')) IN (SELECT path FROM listed_dirs)");
+    staleQuery.bindValue(1, currentGeneration());
+    if (!staleQuery.exec()) {
+        QString err = staleQuery.error();
+        qDebug() << "Error finding superfluous journal entries: " << staleQuery.lastQuery() << ", Error:" << err;
+        return false;
+    }
+    QList<QPair<QString, bool> > stale;
+    while (staleQuery.next()) {
+        stale.append(qMakePair(staleQuery.stringValue(0), staleQuery.intValue(1) == SyncFileItem::Directory));
+    }
+
+    for (int i = 0; i < stale.count(); ++i) {
+        _deleteFileRecordPhash->reset();
+        _deleteFileRecordPhash->bindValue(1, QString::number(getPHash(stale.at(i).first)));
+        if (!_deleteFileRecordPhash->exec()) {
+            qWarning() << "Exec error of SQL statement: " << _deleteFileRecordPhash->lastQuery()
+                       << " : " << _deleteFileRecordPhash->error();
             return false;
         }
+        _deleteFileRecordPhash->reset();
+        // Discovery did not look below a directory that is gone
+        if (stale.at(i).second) {
+            _deleteFileRecordRecursively->reset();
+            _deleteFileRecordRecursively->bindValue(1, stale.at(i).first);
+            if (!_deleteFileRecordRecursively->exec()) {
+                qWarning() << "Exec error of SQL statement: " << _deleteFileRecordRecursively->lastQuery()
+                           << " : " << _deleteFileRecordRecursively->error();
+                return false;
+            }
+            _deleteFileRecordRecursively->reset();
+        }
     }
+    qDebug() << "Sync Journal cleanup: removed" << stale.count() << "entries older than generation" << _generation
+             << "in" << listedDirectories.count() << "listed directories";
 
     // Incoroporate results back into main DB
     walCheckpoint();
@@ -749,6 +1090,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &items )
 
 int SyncJournalDb::getFileRecordCount()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -781,30 +1123,29 @@ static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo * res)
     res->_valid      = ok;
 }
 
-static bool deleteBatch(SqlQuery & query, const QStringList & entries, const QString & name)
+bool SyncJournalDb::deleteOlderThan(const char *table, qint64 generation)
 {
-    if (entries.isEmpty())
-        return true;
-
-    qDebug() << "Removing stale " << qPrintable(name) << " entries: " << entries.join(", ");
-    // FIXME: Was ported from execBatch, check if correct!
-    foreach( const QString& entry, entries ) {
-        query.reset();
-        query.bindValue(1, entry);
-        if (!query.exec()) {
-            QString err = query.error();
-            qDebug() << "Error removing stale " << qPrintable(name) << " entries: "
-                     << query.lastQuery() << ", Error:" << err;
-            return false;
-        }
+    SqlQuery query(_db);
+    query.prepare(QString("DELETE FROM %1 WHERE generation < ?1").arg(QLatin1String(table)));
+    query.bindValue(1, generation);
+    if (!query.exec()) {
+        QString err = query.error();
+        qDebug() << "Error removing stale " << table << " entries: "
+                 << query.lastQuery() << ", Error:" << err;
+        return false;
+    }
+    if (query.numRowsAffected() > 0) {
+        qDebug() << "Removed" << query.numRowsAffected() << "stale" << table << "entries";
     }
-    query.reset(); // viel hilft viel ;-)
-
     return true;
 }
 
 SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
 {
+    AsyncWriter::Write pending(AsyncWriter::Write::SetDownloadInfo);
+    if (_asyncWriter->findPending(pending._kind, file, &pending)) {
+        return pending._downloadInfo;
+    }
     QMutexLocker locker(&_mutex);
 
     DownloadInfo res;
@@ -831,6 +1172,7 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
 
 void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::DownloadInfo& i)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -843,6 +1185,7 @@ void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::Do
         _setDownloadInfoQuery->bindValue(2, i._tmpfile);
         _setDownloadInfoQuery->bindValue(3, i._etag );
         _setDownloadInfoQuery->bindValue(4, i._errorCount );
+        _setDownloadInfoQuery->bindValue(5, currentGeneration() );
 
         if( !_setDownloadInfoQuery->exec() ) {
             qWarning() << "Exec error of SQL statement: " << _setDownloadInfoQuery->lastQuery() <<  " :"   << _setDownloadInfoQuery->error();
@@ -865,10 +1208,32 @@ void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::Do
     }
 }
 
-QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QSet<QString>& keep)
+void SyncJournalDb::keepDownloadInfo(const QString &file)
 {
-    QVector<SyncJournalDb::DownloadInfo> empty_result;
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    if( checkConnect() ) {
+        stampGeneration(_keepDownloadInfoQuery.data(), file, file);
+    }
+}
+
+QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos()
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+    return getAndDeleteDownloadInfosBefore(currentGeneration());
+}
+
+QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteAllDownloadInfos()
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+    return getAndDeleteDownloadInfosBefore(std::numeric_limits<qint64>::max());
+}
+
+QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteDownloadInfosBefore(qint64 generation)
+{
+    QVector<SyncJournalDb::DownloadInfo> empty_result;
 
     if (!checkConnect()) {
         return empty_result;
@@ -876,7 +1241,8 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE generation < ?1");
+    query.bindValue(1, generation);
 
     if (!query.exec()) {
         QString err = query.error();
@@ -884,20 +1250,14 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
         return empty_result;
     }
 
-    QStringList superfluousPaths;
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
-
     while (query.next()) {
-        const QString file = query.stringValue(3); // path
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
-            DownloadInfo info;
-            toDownloadInfo(query, &info);
-            deleted_entries.append(info);
-        }
+        DownloadInfo info;
+        toDownloadInfo(query, &info);
+        deleted_entries.append(info);
     }
 
-    if (!deleteBatch(*_deleteDownloadInfoQuery, superfluousPaths, "downloadinfo"))
+    if (!deleteOlderThan("downloadinfo", generation))
         return empty_result;
 
     return deleted_entries;
@@ -905,6 +1265,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
 int SyncJournalDb::downloadInfoCount()
 {
+    waitForQueuedWrites();
     int re = 0;
 
     QMutexLocker locker(&_mutex);
@@ -923,6 +1284,10 @@ int SyncJournalDb::downloadInfoCount()
 
 SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 {
+    AsyncWriter::Write pending(AsyncWriter::Write::SetUploadInfo);
+    if (_asyncWriter->findPending(pending._kind, file, &pending)) {
+        return pending._uploadInfo;
+    }
     QMutexLocker locker(&_mutex);
 
     UploadInfo res;
@@ -954,6 +1319,7 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 
 void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::UploadInfo& i)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -968,6 +1334,7 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
         _setUploadInfoQuery->bindValue(4, i._errorCount );
         _setUploadInfoQuery->bindValue(5, i._size );
         _setUploadInfoQuery->bindValue(6, Utility::qDateTimeToTime_t(i._modtime) );
+        _setUploadInfoQuery->bindValue(7, currentGeneration() );
 
         if( !_setUploadInfoQuery->exec() ) {
             qWarning() << "Exec error of SQL statement: " << _setUploadInfoQuery->lastQuery() <<  " :"   << _setUploadInfoQuery->error();
@@ -989,42 +1356,69 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
     }
 }
 
-bool SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
+void SyncJournalDb::keepUploadInfo(const QString &file)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
-
-    if (!checkConnect()) {
-        return false;
+    if( checkConnect() ) {
+        stampGeneration(_keepUploadInfoQuery.data(), file, file);
     }
+}
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM uploadinfo");
+bool SyncJournalDb::deleteStaleUploadInfos()
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
 
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
+    if (!checkConnect()) {
         return false;
     }
+    return deleteOlderThan("uploadinfo", currentGeneration());
+}
 
-    QStringList superfluousPaths;
+int SyncJournalDb::uploadInfoCount()
+{
+    waitForQueuedWrites();
+    int re = 0;
 
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+    QMutexLocker locker(&_mutex);
+    if( checkConnect() ) {
+        SqlQuery query("SELECT count(*) FROM uploadinfo", _db);
+
+        if( ! query.exec() ) {
+            sqlFail("Count number of uploadinfo entries failed", query);
+        }
+        if( query.next() ) {
+            re = query.intValue(0);
         }
     }
-
-    return deleteBatch(*_deleteUploadInfoQuery, superfluousPaths, "uploadinfo");
+    return re;
 }
 
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QString& file )
 {
-    QMutexLocker locker(&_mutex);
     SyncJournalErrorBlacklistRecord entry;
 
     if( file.isEmpty() ) return entry;
 
+    AsyncWriter::Write pending(AsyncWriter::Write::SetErrorBlacklistEntry);
+    if (_asyncWriter->findPending(pending._kind, file, &pending)) {
+        if (pending._blacklistRecord.isValid()) {
+            entry = pending._blacklistRecord;
+        }
+        return entry;
+    }
+
+    QMutexLocker locker(&_mutex);
+
+    if( _errorBlacklistCacheLoaded ) {
+        entry = _errorBlacklistCache.value(errorBlacklistKey(file));
+        if( entry.isValid() ) {
+            entry._file = file;
+        }
+        return entry;
+    }
+
     // SELECT lastTryEtag, lastTryModtime, retrycount, errorstring
 
     if( checkConnect() ) {
@@ -1050,41 +1444,84 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QStrin
     return entry;
 }
 
-bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
+void SyncJournalDb::keepErrorBlacklistEntry(const QString &file)
 {
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+    if( checkConnect() ) {
+        stampGeneration(_keepErrorBlacklistQuery.data(), file, file);
+    }
+}
+
+bool SyncJournalDb::deleteStaleErrorBlacklistEntries()
+{
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
         return false;
     }
+    if (!deleteOlderThan("blacklist", currentGeneration())) {
+        return false;
+    }
+    if (_errorBlacklistCacheLoaded) {
+        // The blacklist is small, reading it again is simpler than tracking generations here
+        return loadErrorBlacklist();
+    }
+    return true;
+}
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
+QString SyncJournalDb::errorBlacklistKey(const QString &file)
+{
+    // Same as the COLLATE NOCASE of _getErrorBlacklistQuery
+    static const bool caseInsensitive = Utility::fsCasePreserving();
+    return caseInsensitive ? file.toLower() : file;
+}
+
+bool SyncJournalDb::loadErrorBlacklist()
+{
+    _errorBlacklistCache.clear();
+    _errorBlacklistCacheLoaded = false;
 
+    SqlQuery query("SELECT path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration "
+                   "FROM blacklist", _db);
     if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
+        qWarning() << "Exec error blacklist: " << query.lastQuery() << " : " << query.error();
         return false;
     }
 
-    QStringList superfluousPaths;
-
     while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
-        }
-    }
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file           = query.stringValue(0);
+        entry._lastTryEtag    = query.baValue(1);
+        entry._lastTryModtime = query.int64Value(2);
+        entry._retryCount     = query.intValue(3);
+        entry._errorString    = query.stringValue(4);
+        entry._lastTryTime    = query.int64Value(5);
+        entry._ignoreDuration = query.int64Value(6);
+        _errorBlacklistCache.insert(errorBlacklistKey(entry._file), entry);
+    }
+    _errorBlacklistCacheLoaded = true;
+    return true;
+}
+
+int SyncJournalDb::preloadErrorBlacklist()
+{
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
 
-    SqlQuery delQuery(_db);
-    delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
-    return deleteBatch(delQuery, superfluousPaths, "blacklist");
+    if (!checkConnect() || !loadErrorBlacklist()) {
+        return -1;
+    }
+    SyncMetrics::setGauge("blacklist.entries", _errorBlacklistCache.count());
+    return _errorBlacklistCache.count();
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
 {
     int re = 0;
 
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
         SqlQuery query("SELECT count(*) FROM blacklist", _db);
@@ -1101,6 +1538,7 @@ int SyncJournalDb::errorBlackListEntryCount()
 
 int SyncJournalDb::wipeErrorBlacklist()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
         SqlQuery query(_db);
@@ -1111,6 +1549,7 @@ int SyncJournalDb::wipeErrorBlacklist()
             sqlFail("Deletion of whole blacklist failed", query);
             return -1;
         }
+        _errorBlacklistCache.clear();
         return query.numRowsAffected();
     }
     return -1;
@@ -1122,6 +1561,7 @@ void SyncJournalDb::wipeErrorBlacklistEntry( const QString& file )
         return;
     }
 
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if( checkConnect() ) {
         SqlQuery query(_db);
@@ -1131,17 +1571,22 @@ void SyncJournalDb::wipeErrorBlacklistEntry( const QString& file )
         if( ! query.exec() ) {
             sqlFail("Deletion of blacklist item failed.", query);
         }
+        const QString key = errorBlacklistKey(file);
+        if( _errorBlacklistCache.value(key)._file == file ) {
+            _errorBlacklistCache.remove(key);
+        }
     }
 }
 
 void SyncJournalDb::updateErrorBlacklistEntry( const SyncJournalErrorBlacklistRecord& item )
 {
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
+
     if( !checkConnect() ) {
         return;
     }
 
-    QMutexLocker locker(&_mutex);
-
     _setErrorBlacklistQuery->bindValue(1, item._file);
     _setErrorBlacklistQuery->bindValue(2, item._lastTryEtag);
     _setErrorBlacklistQuery->bindValue(3, QString::number(item._lastTryModtime));
@@ -1149,9 +1594,12 @@ void SyncJournalDb::updateErrorBlacklistEntry( const SyncJournalErrorBlacklistRe
     _setErrorBlacklistQuery->bindValue(5, item._errorString);
     _setErrorBlacklistQuery->bindValue(6, QString::number(item._lastTryTime));
     _setErrorBlacklistQuery->bindValue(7, QString::number(item._ignoreDuration));
+    _setErrorBlacklistQuery->bindValue(8, currentGeneration());
     if( !_setErrorBlacklistQuery->exec() ) {
         QString bug = _setErrorBlacklistQuery->error();
         qDebug() << "SQL exec blacklistitem insert or replace failed: "<< bug;
+    } else if( _errorBlacklistCacheLoaded ) {
+        _errorBlacklistCache.insert(errorBlacklistKey(item._file), item);
     }
     qDebug() << "set blacklist entry for " << item._file << item._retryCount
              << item._errorString << item._lastTryTime << item._ignoreDuration
@@ -1162,6 +1610,7 @@ void SyncJournalDb::updateErrorBlacklistEntry( const SyncJournalErrorBlacklistRe
 
 QVector< SyncJournalDb::PollInfo > SyncJournalDb::getPollInfos()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     QVector< SyncJournalDb::PollInfo > res;
@@ -1191,6 +1640,7 @@ QVector< SyncJournalDb::PollInfo > SyncJournalDb::getPollInfos()
 
 void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo& info)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if( !checkConnect() ) {
         return;
@@ -1220,6 +1670,7 @@ void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo& info)
 
 void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1244,6 +1695,7 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
 
 void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
 {
+    waitForQueuedWrites();
     //Make sure that on the next sync, filName is not read from the DB but use the PROPFIND to
     //get the info from the server
     // We achieve that by clearing the etag of the parents directory recursively
@@ -1268,14 +1720,84 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
     _avoidReadFromDbOnNextSyncFilter.append(fileName);
 }
 
+void SyncJournalDb::setFileRecordAsync(const SyncJournalFileRecord &record)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::SetFileRecord);
+    write._record = record;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::deleteFileRecordAsync(const QString &filename, bool recursively)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::DeleteFileRecord);
+    write._file = filename;
+    write._recursively = recursively;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::setDownloadInfoAsync(const QString &file, const DownloadInfo &i)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::SetDownloadInfo);
+    write._file = file;
+    write._downloadInfo = i;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::setUploadInfoAsync(const QString &file, const UploadInfo &i)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::SetUploadInfo);
+    write._file = file;
+    write._uploadInfo = i;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::setPollInfoAsync(const PollInfo &info)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::SetPollInfo);
+    write._pollInfo = info;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::updateErrorBlacklistEntryAsync(const SyncJournalErrorBlacklistRecord &item)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::SetErrorBlacklistEntry);
+    write._file = item._file;
+    write._blacklistRecord = item;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::wipeErrorBlacklistEntryAsync(const QString &file)
+{
+    if (file.isEmpty()) {
+        return;
+    }
+    AsyncWriter::Write write(AsyncWriter::Write::SetErrorBlacklistEntry);
+    write._file = file;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::commitAsync(const QString &context)
+{
+    AsyncWriter::Write write(AsyncWriter::Write::Commit);
+    write._file = context;
+    _asyncWriter->enqueue(write);
+}
+
+void SyncJournalDb::waitForQueuedWrites()
+{
+    _asyncWriter->waitUntilIdle();
+}
+
 void SyncJournalDb::commit(const QString& context, bool startTrans)
 {
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
     commitInternal(context, startTrans);
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
     if( _transaction == 1 ) {
         commitInternal(context, true);
@@ -1298,6 +1820,7 @@ void SyncJournalDb::commitInternal(const QString& context, bool startTrans )
 SyncJournalDb::~SyncJournalDb()
 {
     close();
+    delete _asyncWriter;
 }
 
 bool SyncJournalDb::isConnected()
@@ -18,13 +18,13 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QSet>
 
 #include "utility.h"
 #include "ownsql.h"
+#include "syncjournalfilerecord.h"
 
 namespace OCC {
-class SyncJournalFileRecord;
-class SyncJournalErrorBlacklistRecord;
 
 /**
  * Class that handle the sync database
@@ -77,15 +77,28 @@ public:
 
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
-    QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString>& keep);
+    void keepDownloadInfo(const QString &file);
+    QVector<DownloadInfo> getAndDeleteStaleDownloadInfos();
+    QVector<DownloadInfo> getAndDeleteAllDownloadInfos();
     int downloadInfoCount();
 
     UploadInfo getUploadInfo(const QString &file);
     void setUploadInfo(const QString &file, const UploadInfo &i);
-    bool deleteStaleUploadInfos(const QSet<QString>& keep);
+    void keepUploadInfo(const QString &file);
+    bool deleteStaleUploadInfos();
+    int uploadInfoCount();
 
     SyncJournalErrorBlacklistRecord errorBlacklistEntry( const QString& );
-    bool deleteStaleErrorBlacklistEntries(const QSet<QString>& keep);
+
+    /**
+     * Reads the whole blacklist into memory, so that errorBlacklistEntry() no
+     * longer queries the database. The copy is kept up to date by the
+     * functions that change the blacklist until the journal is closed.
+     * Returns the number of entries.
+     */
+    int preloadErrorBlacklist();
+    void keepErrorBlacklistEntry(const QString &file);
+    bool deleteStaleErrorBlacklistEntries();
 
     void avoidRenamesOnNextSync(const QString &path);
     void setPollInfo(const PollInfo &);
@@ -97,7 +110,51 @@ public:
      */
     void avoidReadFromDbOnNextSync(const QString& fileName);
 
-    bool postSyncCleanup( const QSet<QString>& items );
+    /**
+     * Every row of the journal carries the generation of the last sync run
+     * that wrote it or marked it as still needed.
+     *
+     * A sync run starts a new generation, then stamps the transfer and
+     * blacklist entries it still needs with the keep*() functions. Everything
+     * older is stale and removed by the deleteStale*() functions with one
+     * indexed DELETE each.
+     *
+     * The metadata of a file can only become stale if its remote directory
+     * changed, so it is only stamped with markFileRecordSeen() if discovery
+     * listed that directory. The entries of the other directories keep the
+     * generation of the run that wrote them.
+     */
+    qint64 startSyncGeneration();
+    void markFileRecordSeen(const QString &fileName);
+
+    /**
+     * Removes the file records directly in \a listedDirectories (relative
+     * paths, "" for the top level) that were not seen in the current
+     * generation, with everything below them.
+     */
+    bool postSyncCleanup(const QSet<QString> &listedDirectories);
+
+    /**
+     * Queued writes for callers that must not wait for SQLite, like the
+     * propagator jobs when they finish.
+     *
+     * The writes are done in order on a journal thread. getDownloadInfo(),
+     * getUploadInfo() and errorBlacklistEntry() return a queued write of the
+     * file without waiting. All other functions first wait until the queued
+     * writes are done, so they never see the journal in an older state than
+     * what was queued before. The thread is stopped by close().
+     */
+    void setFileRecordAsync(const SyncJournalFileRecord &record);
+    void deleteFileRecordAsync(const QString &filename, bool recursively = false);
+    void setDownloadInfoAsync(const QString &file, const DownloadInfo &i);
+    void setUploadInfoAsync(const QString &file, const UploadInfo &i);
+    void setPollInfoAsync(const PollInfo &info);
+    void updateErrorBlacklistEntryAsync(const SyncJournalErrorBlacklistRecord &item);
+    void wipeErrorBlacklistEntryAsync(const QString &file);
+    void commitAsync(const QString &context);
+
+    /** Blocks until all queued writes are done */
+    void waitForQueuedWrites();
 
     /* Because sqlite transactions is really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
@@ -119,21 +176,32 @@ public:
     bool isUpdateFrom_1_5();
 
 private:
+    class AsyncWriter;
+
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
+    bool updateGenerationColumns();
+    qint64 currentGeneration();
+    void stampGeneration(SqlQuery *query, const QVariant &key, const QString &fileName);
+    bool deleteOlderThan(const char *table, qint64 generation);
+    QVector<DownloadInfo> getAndDeleteDownloadInfosBefore(qint64 generation);
     bool sqlFail(const QString& log, const SqlQuery &query );
     void commitInternal(const QString &context, bool startTrans = true);
     void startTransaction();
     void commitTransaction();
     QStringList tableColumns( const QString& table );
+    bool loadErrorBlacklist();
+    static QString errorBlacklistKey(const QString &file);
     bool checkConnect();
 
     SqlDatabase _db;
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
     int _transaction;
+    qint64 _transactionStartUsec; // for SyncTrace
     bool _possibleUpgradeFromMirall_1_5;
+    qint64 _generation; // 0 until read from the database
     QScopedPointer<SqlQuery> _getFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _getDownloadInfoQuery;
@@ -146,12 +214,24 @@ private:
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
     QScopedPointer<SqlQuery> _setErrorBlacklistQuery;
+    QScopedPointer<SqlQuery> _markFileRecordSeenQuery;
+    QScopedPointer<SqlQuery> _keepDownloadInfoQuery;
+    QScopedPointer<SqlQuery> _keepUploadInfoQuery;
+    QScopedPointer<SqlQuery> _keepErrorBlacklistQuery;
 
     /* This is the list of paths we called avoidReadFromDbOnNextSync on.
      * It means that they should not be written to the DB in any case since doing
      * that would write the etag and would void the purpose of avoidReadFromDbOnNextSync
      */
     QList<QString> _avoidReadFromDbOnNextSyncFilter;
+
+    /* In-memory copy of the blacklist table, see preloadErrorBlacklist().
+     * The keys are folded with errorBlacklistKey().
+     */
+    QHash<QString, SyncJournalErrorBlacklistRecord> _errorBlacklistCache;
+    bool _errorBlacklistCacheLoaded;
+
+    AsyncWriter *_asyncWriter; // runs the *Async() writes
 };
 
 bool OWNCLOUDSYNC_EXPORT
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncmetrics.h"
+
+#include <QDateTime>
+#include <QMap>
+#include <QMutex>
+#include <QVector>
+
+namespace OCC {
+
+namespace {
+
+// bucket i counts the values v with 2^(i-1) < v <= 2^i, bucket 0 also takes v <= 0
+const int histogramBucketCount = 48;
+
+struct Histogram {
+    Histogram() : count(0), sum(0), min(0), max(0), buckets(histogramBucketCount, 0) {}
+
+    void record(qint64 value) {
+        if (count == 0 || value < min) {
+            min = value;
+        }
+        if (count == 0 || value > max) {
+            max = value;
+        }
+        count++;
+        sum += value;
+        int bucket = 0;
+        while (bucket < histogramBucketCount - 1 && (Q_INT64_C(1) << bucket) < value) {
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+
+    // upper bound of the bucket that contains the given fraction of the values
+    qint64 percentile(double fraction) const {
+        qint64 wanted = qint64(fraction * count + 0.5);
+        qint64 seen = 0;
+        for (int i = 0; i < histogramBucketCount; ++i) {
+            seen += buckets[i];
+            if (seen >= wanted && seen > 0) {
+                return qBound(min, Q_INT64_C(1) << i, max);
+            }
+        }
+        return max;
+    }
+
+    qint64 count;
+    qint64 sum;
+    qint64 min;
+    qint64 max;
+    QVector<qint64> buckets;
+};
+
+}
+
+// Everything below is protected by metricsMutex
+static QMutex metricsMutex;
+static QMap<QByteArray, qint64> metricsCounters;
+static QMap<QByteArray, qint64> metricsGauges;
+static QMap<QByteArray, Histogram> metricsHistograms;
+
+void SyncMetrics::addToCounter(const char *name, qint64 delta)
+{
+    QMutexLocker lock(&metricsMutex);
+    metricsCounters[name] += delta;
+}
+
+void SyncMetrics::setGauge(const char *name, qint64 value)
+{
+    QMutexLocker lock(&metricsMutex);
+    metricsGauges[name] = value;
+}
+
+void SyncMetrics::addToGauge(const char *name, qint64 delta)
+{
+    QMutexLocker lock(&metricsMutex);
+    metricsGauges[name] += delta;
+}
+
+void SyncMetrics::recordValue(const char *name, qint64 value)
+{
+    QMutexLocker lock(&metricsMutex);
+    metricsHistograms[name].record(value);
+}
+
+qint64 SyncMetrics::counter(const char *name)
+{
+    QMutexLocker lock(&metricsMutex);
+    return metricsCounters.value(name);
+}
+
+qint64 SyncMetrics::gauge(const char *name)
+{
+    QMutexLocker lock(&metricsMutex);
+    return metricsGauges.value(name);
+}
+
+static QByteArray jsonValues(const QMap<QByteArray, qint64> &values)
+{
+    QByteArray out = "{";
+    for (QMap<QByteArray, qint64>::const_iterator it = values.constBegin(); it != values.constEnd(); ++it) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        out += '"' + it.key() + "\":" + QByteArray::number(it.value());
+    }
+    out += '}';
+    return out;
+}
+
+QByteArray SyncMetrics::toJson()
+{
+    QMutexLocker lock(&metricsMutex);
+    QByteArray out = "{\"timestamp\":" + QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+    out += ",\"counters\":" + jsonValues(metricsCounters);
+    out += ",\"gauges\":" + jsonValues(metricsGauges);
+    out += ",\"histograms\":{";
+    bool first = true;
+    for (QMap<QByteArray, Histogram>::const_iterator it = metricsHistograms.constBegin();
+         it != metricsHistograms.constEnd(); ++it) {
+        const Histogram &h = it.value();
+        QMap<QByteArray, qint64> values;
+        values.insert("count", h.count);
+        values.insert("sum", h.sum);
+        values.insert("min", h.min);
+        values.insert("max", h.max);
+        values.insert("p50", h.percentile(0.5));
+        values.insert("p95", h.percentile(0.95));
+        values.insert("p99", h.percentile(0.99));
+        out += (first ? "\"" : ",\"") + it.key() + "\":" + jsonValues(values);
+        first = false;
+    }
+    out += "}}";
+    return out;
+}
+
+void SyncMetrics::reset()
+{
+    QMutexLocker lock(&metricsMutex);
+    metricsCounters.clear();
+    metricsGauges.clear();
+    metricsHistograms.clear();
+}
+
+}
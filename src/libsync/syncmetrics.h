@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+
+namespace OCC {
+
+/**
+ * @brief Process wide registry of counters, gauges and histograms
+ *
+ * Metrics are created on first use and identified by a dotted name like
+ * "journal.commit_usec". Counters only grow, gauges hold the last value set
+ * and histograms keep count, sum, minimum, maximum and power-of-two buckets
+ * of the recorded values, from which toJson() estimates percentiles.
+ *
+ * All functions are thread-safe.
+ */
+class OWNCLOUDSYNC_EXPORT SyncMetrics {
+public:
+    static void addToCounter(const char *name, qint64 delta = 1);
+    static void setGauge(const char *name, qint64 value);
+    static void addToGauge(const char *name, qint64 delta);
+    static void recordValue(const char *name, qint64 value);
+
+    static qint64 counter(const char *name);
+    static qint64 gauge(const char *name);
+
+    /**
+     * All metrics as one line of JSON:
+     * {"timestamp":..,"counters":{..},"gauges":{..},"histograms":{"name":{"count":..,"p50":..},..}}
+     */
+    static QByteArray toJson();
+
+    /** Forgets all metrics */
+    static void reset();
+};
+
+}
+
+#endif // SYNCMETRICS_H
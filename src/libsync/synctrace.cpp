@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "synctrace.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QDebug>
+
+namespace OCC {
+
+static QAtomicInt enabledFlag(qgetenv("OWNCLOUD_SYNC_TRACE") == "1" ? 1 : 0);
+static QAtomicInt recordingFlag(0);
+
+// Everything below is protected by traceMutex
+static QMutex traceMutex;
+static QString traceFileName;
+static QVector<QByteArray> traceEvents;
+static QHash<Qt::HANDLE, int> traceThreadIds;
+static QHash<int, QString> traceThreadNames;
+static int traceAsyncId = 0;
+
+static QByteArray jsonString(const QString &s)
+{
+    QByteArray utf8 = s.toUtf8();
+    QByteArray out;
+    out.reserve(utf8.size() + 2);
+    out += '"';
+    foreach (char c, utf8) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (uchar(c) < 0x20) {
+                out += "\\u00";
+                out += QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+static QByteArray jsonArgs(const QVariantMap &args)
+{
+    QByteArray out = "{";
+    for (QVariantMap::const_iterator it = args.constBegin(); it != args.constEnd(); ++it) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        out += jsonString(it.key());
+        out += ':';
+        switch (it.value().type()) {
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+        case QVariant::Double:
+            out += it.value().toString().toLatin1();
+            break;
+        default:
+            out += jsonString(it.value().toString());
+        }
+    }
+    out += '}';
+    return out;
+}
+
+// Needs traceMutex
+static int currentThreadTraceId()
+{
+    Qt::HANDLE handle = QThread::currentThreadId();
+    QHash<Qt::HANDLE, int>::const_iterator it = traceThreadIds.constFind(handle);
+    if (it != traceThreadIds.constEnd()) {
+        return it.value();
+    }
+    int id = traceThreadIds.count() + 1;
+    traceThreadIds.insert(handle, id);
+    QString name = QThread::currentThread()->objectName();
+    if (name.isEmpty()) {
+        QCoreApplication *app = QCoreApplication::instance();
+        name = app && QThread::currentThread() == app->thread() ? QString::fromLatin1("Main")
+                                                                : QString::fromLatin1("Thread %1").arg(id);
+    }
+    traceThreadNames.insert(id, name);
+    return id;
+}
+
+void SyncTrace::setEnabled(bool enabled)
+{
+    qDebug() << Q_FUNC_INFO << enabled;
+    enabledFlag.fetchAndStoreOrdered(enabled ? 1 : 0);
+}
+
+bool SyncTrace::isEnabled()
+{
+    return enabledFlag.fetchAndAddRelaxed(0);
+}
+
+bool SyncTrace::isRecording()
+{
+    return recordingFlag.fetchAndAddRelaxed(0);
+}
+
+qint64 SyncTrace::nowUsec()
+{
+    static QElapsedTimer timer;
+    static bool started = (timer.start(), true);
+    Q_UNUSED(started);
+    return timer.nsecsElapsed() / 1000;
+}
+
+void SyncTrace::startRun(const QString &fileName)
+{
+    if (!isEnabled()) {
+        return;
+    }
+    QMutexLocker lock(&traceMutex);
+    traceFileName = fileName;
+    traceEvents.clear();
+    traceThreadIds.clear();
+    traceThreadNames.clear();
+    recordingFlag.fetchAndStoreOrdered(1);
+}
+
+void SyncTrace::finishRun()
+{
+    if (!recordingFlag.fetchAndStoreOrdered(0)) {
+        return;
+    }
+
+    QMutexLocker lock(&traceMutex);
+    QFile file(traceFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << Q_FUNC_INFO << "Could not write" << traceFileName << file.errorString();
+        traceEvents.clear();
+        return;
+    }
+
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (QHash<int, QString>::const_iterator it = traceThreadNames.constBegin(); it != traceThreadNames.constEnd(); ++it) {
+        file.write(first ? "" : ",\n");
+        first = false;
+        file.write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + QByteArray::number(it.key())
+                   + ",\"args\":{\"name\":" + jsonString(it.value()) + "}}");
+    }
+    foreach (const QByteArray &event, traceEvents) {
+        file.write(first ? "" : ",\n");
+        first = false;
+        file.write(event);
+    }
+    file.write("\n]}\n");
+    qDebug() << Q_FUNC_INFO << "Wrote" << traceEvents.count() << "trace events to" << traceFileName;
+    traceEvents.clear();
+}
+
+void SyncTrace::addSpan(const char *category, const QString &name, qint64 startUsec,
+                        qint64 durationUsec, const QVariantMap &args)
+{
+    if (!isRecording()) {
+        return;
+    }
+    QByteArray common = "\"cat\":\"" + QByteArray(category) + "\",\"name\":" + jsonString(name)
+            + ",\"args\":" + jsonArgs(args);
+
+    QMutexLocker lock(&traceMutex);
+    traceEvents.append("{\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(currentThreadTraceId())
+                       + ",\"ts\":" + QByteArray::number(startUsec)
+                       + ",\"dur\":" + QByteArray::number(durationUsec) + ',' + common + '}');
+}
+
+void SyncTrace::addAsyncSpan(const char *category, const QString &name, qint64 startUsec,
+                             qint64 durationUsec, const QVariantMap &args)
+{
+    if (!isRecording()) {
+        return;
+    }
+    QByteArray common = "\"cat\":\"" + QByteArray(category) + "\",\"name\":" + jsonString(name);
+
+    QMutexLocker lock(&traceMutex);
+    QByteArray idAndThread = ",\"pid\":1,\"tid\":" + QByteArray::number(currentThreadTraceId())
+            + ",\"id\":" + QByteArray::number(++traceAsyncId) + ',';
+    traceEvents.append("{\"ph\":\"b\"" + idAndThread + "\"ts\":" + QByteArray::number(startUsec)
+                       + ',' + common + ",\"args\":" + jsonArgs(args) + '}');
+    traceEvents.append("{\"ph\":\"e\"" + idAndThread + "\"ts\":" + QByteArray::number(startUsec + durationUsec)
+                       + ',' + common + '}');
+}
+
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SYNCTRACE_H
+#define SYNCTRACE_H
+
+#include "owncloudlib.h"
+
+#include <QString>
+#include <QVariantMap>
+
+namespace OCC {
+
+/**
+ * @brief Records what a sync run spends its time on
+ *
+ * While enabled, every sync run collects spans for the csync phases, the
+ * discovery of each remote directory, journal transactions, propagator jobs
+ * and network requests. At the end of the run they are written as a Chrome
+ * trace_event JSON file, which chrome://tracing, Perfetto or speedscope show
+ * as timeline or flame graph.
+ *
+ * All functions are thread-safe. While no run is recorded, the cost of a
+ * span is one atomic read.
+ */
+class OWNCLOUDSYNC_EXPORT SyncTrace {
+public:
+    /** Switches tracing of the following sync runs on or off */
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    /** Whether spans are being collected right now */
+    static bool isRecording();
+
+    /** Starts collecting spans if tracing is enabled. finishRun() writes them to \a fileName */
+    static void startRun(const QString &fileName);
+    static void finishRun();
+
+    /** Monotonic time in microseconds, the time base of all spans */
+    static qint64 nowUsec();
+
+    /**
+     * Adds a span on the calling thread. Spans of one thread must nest,
+     * use addAsyncSpan() for things that overlap, like network requests.
+     */
+    static void addSpan(const char *category, const QString &name, qint64 startUsec,
+                        qint64 durationUsec, const QVariantMap &args = QVariantMap());
+
+    /** Adds a span that is shown on its own track of the category */
+    static void addAsyncSpan(const char *category, const QString &name, qint64 startUsec,
+                             qint64 durationUsec, const QVariantMap &args = QVariantMap());
+};
+
+/**
+ * @brief Adds a span from its construction until it goes out of scope
+ */
+class OWNCLOUDSYNC_EXPORT TraceSpan {
+public:
+    TraceSpan(const char *category, const QString &name)
+        : _category(category), _name(name), _startUsec(SyncTrace::isRecording() ? SyncTrace::nowUsec() : -1) {}
+
+    ~TraceSpan() {
+        if (_startUsec >= 0) {
+            SyncTrace::addSpan(_category, _name, _startUsec, SyncTrace::nowUsec() - _startUsec, _args);
+        }
+    }
+
+    void setArg(const QString &key, const QVariant &value) {
+        if (_startUsec >= 0) {
+            _args.insert(key, value);
+        }
+    }
+
+private:
+    const char *_category;
+    QString _name;
+    qint64 _startUsec;
+    QVariantMap _args;
+};
+
+}
+
+#endif // SYNCTRACE_H
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "transfercompression.h"
+
+#include <QList>
+#include <QSet>
+
+#include <cmath>
+#include <zlib.h>
+
+namespace OCC {
+
+// Below this, the headers and the CPU time cost more than what we save.
+static const qint64 minCompressedFileSize = 4 * 1024;
+
+// Random or compressed data has close to 8 bits per byte.
+static const double maxCompressibleEntropy = 7.0;
+
+// Fast: on a fast link, we should not be waiting for zlib.
+static const int compressionLevel = 1;
+
+static const char *compressedExtensions[] = {
+    // archives
+    "7z", "apk", "bz2", "cab", "deb", "dmg", "gz", "jar", "lz", "lzma", "rar",
+    "rpm", "tbz2", "tgz", "txz", "xz", "z", "zip", "zst",
+    // documents that are zip files
+    "docx", "epub", "key", "numbers", "odg", "odp", "ods", "odt", "pages",
+    "pptx", "xlsx",
+    // images
+    "gif", "heic", "jpeg", "jpg", "png", "webp",
+    // audio and video
+    "aac", "avi", "flac", "m4a", "m4v", "mkv", "mov", "mp3", "mp4", "mpeg",
+    "mpg", "ogg", "opus", "webm", "wma", "wmv",
+    // encrypted
+    "gpg", "pgp",
+    0
+};
+
+static QSet<QString> compressedExtensionSet()
+{
+    QSet<QString> set;
+    for (const char **ext = compressedExtensions; *ext; ++ext) {
+        set.insert(QString::fromLatin1(*ext));
+    }
+    return set;
+}
+
+TransferCompression::Encoding TransferCompression::parseEncoding(const QByteArray &contentEncoding)
+{
+    const QByteArray name = contentEncoding.trimmed().toLower();
+    if (name.isEmpty() || name == "identity") {
+        return Identity;
+    } else if (name == "gzip" || name == "x-gzip") {
+        return Gzip;
+    } else if (name == "deflate") {
+        return Deflate;
+    }
+    return Unsupported;
+}
+
+QByteArray TransferCompression::encodingName(Encoding encoding)
+{
+    switch (encoding) {
+    case Deflate:
+        return "deflate";
+    case Gzip:
+        return "gzip";
+    default:
+        return "identity";
+    }
+}
+
+TransferCompression::Encoding TransferCompression::uploadEncoding(const QByteArray &acceptEncoding)
+{
+    bool deflate = false;
+    foreach (const QByteArray &entry, acceptEncoding.split(',')) {
+        // ignore the weights, but not "gzip;q=0"
+        QList<QByteArray> parts = entry.split(';');
+        if (parts.count() > 1 && parts.at(1).trimmed() == "q=0") {
+            continue;
+        }
+        Encoding encoding = parseEncoding(parts.at(0));
+        if (encoding == Gzip) {
+            return Gzip;
+        } else if (encoding == Deflate) {
+            deflate = true;
+        }
+    }
+    return deflate ? Deflate : Identity;
+}
+
+bool TransferCompression::isCandidate(const QString &fileName, qint64 size)
+{
+    static const QSet<QString> extensions = compressedExtensionSet();
+
+    if (size < minCompressedFileSize) {
+        return false;
+    }
+    int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    if (dot <= fileName.lastIndexOf(QLatin1Char('/'))) {
+        return true;
+    }
+    return !extensions.contains(fileName.mid(dot + 1).toLower());
+}
+
+double TransferCompression::entropy(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return 0;
+    }
+    qint64 counts[256] = {};
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    for (int i = 0; i < data.size(); ++i) {
+        counts[p[i]]++;
+    }
+    double result = 0;
+    for (int i = 0; i < 256; ++i) {
+        if (counts[i]) {
+            double f = double(counts[i]) / data.size();
+            result -= f * std::log(f) / std::log(2.0);
+        }
+    }
+    return result;
+}
+
+bool TransferCompression::looksCompressible(const QByteArray &sample)
+{
+    return entropy(sample) <= maxCompressibleEntropy;
+}
+
+ZStream::ZStream(Mode mode, TransferCompression::Encoding encoding)
+    : _stream(new z_stream)
+    , _mode(mode)
+    , _finished(false)
+{
+    _stream->zalloc = Z_NULL;
+    _stream->zfree = Z_NULL;
+    _stream->opaque = Z_NULL;
+    _stream->next_in = Z_NULL;
+    _stream->avail_in = 0;
+    int ret;
+    if (_mode == Compress) {
+        // 15 is the largest window, +16 writes a gzip instead of a zlib header
+        int windowBits = encoding == TransferCompression::Gzip ? 15 + 16 : 15;
+        ret = deflateInit2(_stream, compressionLevel, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    } else {
+        // +32 detects zlib and gzip headers
+        ret = inflateInit2(_stream, 15 + 32);
+    }
+    if (ret != Z_OK) {
+        _errorString = QString::fromLatin1("zlib initialization failed (%1)").arg(ret);
+        delete _stream;
+        _stream = 0;
+    }
+}
+
+ZStream::~ZStream()
+{
+    if (_stream) {
+        if (_mode == Compress) {
+            deflateEnd(_stream);
+        } else {
+            inflateEnd(_stream);
+        }
+        delete _stream;
+    }
+}
+
+void ZStream::reset()
+{
+    if (_stream) {
+        if (_mode == Compress) {
+            deflateReset(_stream);
+        } else {
+            inflateReset(_stream);
+        }
+    }
+    _finished = false;
+}
+
+bool ZStream::process(const char *data, qint64 len, QByteArray *out, bool finish)
+{
+    if (!_stream) {
+        return false;
+    }
+    if (_finished) {
+        // trailing data after the end of the stream is ignored
+        return len == 0 || _mode == Decompress;
+    }
+
+    _stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    _stream->avail_in = uInt(len);
+    const bool finishing = _mode == Compress && finish;
+
+    forever {
+        const int oldSize = out->size();
+        const int room = qMax(16 * 1024, int(qMin(len, qint64(1024 * 1024))));
+        out->resize(oldSize + room);
+        _stream->next_out = reinterpret_cast<Bytef *>(out->data() + oldSize);
+        _stream->avail_out = room;
+
+        int ret;
+        if (_mode == Compress) {
+            ret = deflate(_stream, finishing ? Z_FINISH : Z_NO_FLUSH);
+        } else {
+            ret = inflate(_stream, Z_NO_FLUSH);
+        }
+        out->resize(oldSize + room - _stream->avail_out);
+
+        if (ret == Z_STREAM_END) {
+            _finished = true;
+            return true;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            _errorString = QString::fromLatin1("zlib error %1: %2").arg(ret)
+                    .arg(QString::fromLatin1(_stream->msg ? _stream->msg : ""));
+            return false;
+        }
+        if (_stream->avail_out > 0 && (_stream->avail_in == 0 || ret == Z_BUF_ERROR)) {
+            // All input is consumed and all output is out. Only the end of a
+            // compressed stream is still missing if finishing.
+            if (!finishing) {
+                return true;
+            }
+            if (ret == Z_BUF_ERROR) {
+                _errorString = QString::fromLatin1("zlib could not finish the stream");
+                return false;
+            }
+        }
+    }
+}
+
+}
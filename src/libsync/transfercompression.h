@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef TRANSFERCOMPRESSION_H
+#define TRANSFERCOMPRESSION_H
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QString>
+
+struct z_stream_s;
+
+namespace OCC {
+
+/**
+ * @brief Decides which transfers are compressed, and how
+ *
+ * Downloads ask for "Accept-Encoding: gzip, deflate" and decode the reply
+ * themselves. Uploads are only compressed if the server listed an encoding
+ * in the Accept-Encoding header of its OPTIONS reply (RFC 7694).
+ *
+ * Files whose name says they are compressed already, and files that are too
+ * small to gain anything, are transferred as they are.
+ */
+class OWNCLOUDSYNC_EXPORT TransferCompression {
+public:
+    enum Encoding {
+        Identity,
+        Deflate, // the zlib format, as HTTP defines "deflate"
+        Gzip,
+        Unsupported
+    };
+
+    /** The encoding named by a Content-Encoding header */
+    static Encoding parseEncoding(const QByteArray &contentEncoding);
+    static QByteArray encodingName(Encoding encoding);
+
+    /** What to use for uploads given the Accept-Encoding of the server, Identity if nothing fits */
+    static Encoding uploadEncoding(const QByteArray &acceptEncoding);
+
+    /** Whether a file of that name and size may be worth compressing */
+    static bool isCandidate(const QString &fileName, qint64 size);
+
+    /** The Shannon entropy of the bytes of \a data, in bits per byte */
+    static double entropy(const QByteArray &data);
+
+    /** Whether \a sample, usually the start of a file, looks like it compresses well */
+    static bool looksCompressible(const QByteArray &sample);
+};
+
+/**
+ * @brief Compresses or decompresses a stream piece by piece
+ *
+ * Decompression detects the zlib and the gzip format by itself.
+ */
+class OWNCLOUDSYNC_EXPORT ZStream {
+public:
+    enum Mode { Compress, Decompress };
+
+    ZStream(Mode mode, TransferCompression::Encoding encoding);
+    ~ZStream();
+
+    /**
+     * Appends the output for the \a len bytes at \a data to \a out.
+     * When compressing, \a finish ends the stream after this input.
+     * Returns false on error, see errorString().
+     */
+    bool process(const char *data, qint64 len, QByteArray *out, bool finish = false);
+
+    /** Whether the end of the stream was reached */
+    bool isFinished() const { return _finished; }
+
+    /** Starts a new stream */
+    void reset();
+
+    QString errorString() const { return _errorString; }
+
+private:
+    Q_DISABLE_COPY(ZStream)
+
+    z_stream_s *_stream;
+    Mode _mode;
+    bool _finished;
+    QString _errorString;
+};
+
+}
+
+#endif // TRANSFERCOMPRESSION_H
@@ -0,0 +1,766 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_SYNCENGINETESTUTILS_H
+#define MIRALL_SYNCENGINETESTUTILS_H
+
+// Shared by the tests that run SyncEngine against a server. Nothing in here
+// is a QObject of its own, so the header doesn't need to go through moc.
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include <QDirIterator>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <ctime>
+
+#include "csync.h"
+#include "syncengine.h"
+#include "syncjournaldb.h"
+#include "filesystem.h"
+#include "account.h"
+#include "creds/dummycredentials.h"
+
+using namespace OCC;
+
+/*
+ * A WebDAV server good enough for SyncEngine, serving a local directory.
+ *
+ * Every response is held back by the configured latency. With a bandwidth set,
+ * all request and response bodies share one simulated link: a transfer of n bytes
+ * occupies the link for n / bandwidth seconds after the previous transfer ended.
+ *
+ * ETags and file ids are kept in memory. Changing an entry gives it and all
+ * its parent directories a new ETag, like the real server does.
+ *
+ * With setBundleSupport(), OPTIONS announces bundled uploads and POST accepts
+ * them, see PropagateUploadBundle. With setCompressionSupport(), OPTIONS
+ * announces that PUT takes "Content-Encoding: deflate", and GET compresses
+ * if the client accepts it. With addPollUrl(), GET of a path answers like
+ * the poll URL of an upload the server is still processing.
+ */
+class FakeWebDavServer : public QTcpServer
+{
+public:
+    FakeWebDavServer(const QString &root)
+        : _root(QDir::cleanPath(root)), _latency(0), _bandwidth(0), _linkFreeAt(0), _bundleMaxFiles(0)
+        , _compression(false)
+        , _etagCounter(0), _fileIdCounter(0), _bytesReceived(0), _bytesSent(0)
+    {
+        _clock.start();
+        connect(this, &QTcpServer::newConnection, [this]() { slotNewConnection(); });
+    }
+
+    void setLatency(int msec) { _latency = msec; }
+    void setBandwidth(qint64 bytesPerSecond) { _bandwidth = bytesPerSecond; }
+    /** 0 disables bundled uploads */
+    void setBundleSupport(int maxFiles) { _bundleMaxFiles = maxFiles; }
+    void setCompressionSupport(bool enabled) { _compression = enabled; }
+    /** GET of \a path answers "unfinished" \a unfinished times, then that the upload is done */
+    void addPollUrl(const QString &path, int unfinished) { _polls.insert(normalizePath(path.toUtf8()), unfinished); }
+    /** The next request of that verb is answered with \a code and not handled */
+    void failNextRequest(const QByteArray &verb, int code) { _failNext.insert(verb, code); }
+
+    QString root() const { return _root; }
+    QString localPath(const QString &path) const {
+        return path.isEmpty() ? _root : _root + QLatin1Char('/') + path;
+    }
+
+    /** Simulates a change done by another client */
+    void writeFile(const QString &path, const QByteArray &data) {
+        QFile f(localPath(path));
+        if (f.open(QIODevice::WriteOnly)) {
+            f.write(data);
+        }
+        touch(path);
+    }
+
+    QMap<QByteArray, int> requestCounts() const { return _requestCounts; }
+    int requestTotal() const {
+        int total = 0;
+        foreach (int count, _requestCounts) {
+            total += count;
+        }
+        return total;
+    }
+    qint64 bytesReceived() const { return _bytesReceived; }
+    qint64 bytesSent() const { return _bytesSent; }
+    /** The most requests of that verb that were handled at the same time */
+    int maxConcurrentRequests(const QByteArray &verb) const { return _maxConcurrent.value(verb); }
+
+    void resetCounters() {
+        _requestCounts.clear();
+        _maxConcurrent.clear();
+        _bytesReceived = 0;
+        _bytesSent = 0;
+    }
+
+private:
+    struct Request {
+        QByteArray verb;
+        QString path;
+        QMap<QByteArray, QByteArray> headers; // lower case names
+        QByteArray body;
+    };
+
+    struct Response {
+        Response() : code(500) {}
+        int code;
+        QList<QPair<QByteArray, QByteArray> > headers;
+        QByteArray body;
+        void addHeader(const QByteArray &name, const QByteArray &value) {
+            headers.append(qMakePair(name, value));
+        }
+        QByteArray header(const QByteArray &name) const {
+            for (int i = 0; i < headers.count(); ++i) {
+                if (headers.at(i).first == name) {
+                    return headers.at(i).second;
+                }
+            }
+            return QByteArray();
+        }
+    };
+
+    static QByteArray reasonPhrase(int code) {
+        switch (code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 207: return "Multi-Status";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 415: return "Unsupported Media Type";
+        default: return "Internal Server Error";
+        }
+    }
+
+    // "/a/b%20c/" -> "a/b c", or a null string if it escapes the root
+    static QString normalizePath(const QByteArray &rawPath) {
+        QString path = QUrl::fromPercentEncoding(rawPath);
+        QStringList parts;
+        foreach (const QString &part, path.split(QLatin1Char('/'), QString::SkipEmptyParts)) {
+            if (part == QLatin1String("..")) {
+                return QString();
+            }
+            if (part != QLatin1String(".")) {
+                parts.append(part);
+            }
+        }
+        return parts.isEmpty() ? QString::fromLatin1("") : parts.join(QLatin1String("/"));
+    }
+
+    static QString parentOf(const QString &path) {
+        int slash = path.lastIndexOf(QLatin1Char('/'));
+        return slash < 0 ? QString::fromLatin1("") : path.left(slash);
+    }
+
+    QByteArray etag(const QString &path) {
+        if (!_etags.contains(path)) {
+            _etags.insert(path, QByteArray::number(++_etagCounter, 16));
+        }
+        return _etags.value(path);
+    }
+
+    QByteArray fileId(const QString &path) {
+        if (!_fileIds.contains(path)) {
+            _fileIds.insert(path, QByteArray::number(++_fileIdCounter).rightJustified(8, '0') + "bench");
+        }
+        return _fileIds.value(path);
+    }
+
+    void touch(QString path) {
+        forever {
+            _etags.insert(path, QByteArray::number(++_etagCounter, 16));
+            if (path.isEmpty()) {
+                break;
+            }
+            path = parentOf(path);
+        }
+    }
+
+    // Moves the metadata of path and everything below it to newPath
+    void renameMetadata(const QString &path, const QString &newPath) {
+        QList<QHash<QString, QByteArray>*> maps;
+        maps << &_etags << &_fileIds;
+        foreach (QHash<QString, QByteArray> *map, maps) {
+            QHash<QString, QByteArray> moved;
+            QMutableHashIterator<QString, QByteArray> it(*map);
+            while (it.hasNext()) {
+                it.next();
+                if (it.key() == path) {
+                    moved.insert(newPath, it.value());
+                    it.remove();
+                } else if (it.key().startsWith(path + QLatin1Char('/'))) {
+                    moved.insert(newPath + it.key().mid(path.length()), it.value());
+                    it.remove();
+                }
+            }
+            map->unite(moved);
+        }
+    }
+
+    void forgetMetadata(const QString &path) {
+        QList<QHash<QString, QByteArray>*> maps;
+        maps << &_etags << &_fileIds;
+        foreach (QHash<QString, QByteArray> *map, maps) {
+            QMutableHashIterator<QString, QByteArray> it(*map);
+            while (it.hasNext()) {
+                it.next();
+                if (it.key() == path || it.key().startsWith(path + QLatin1Char('/'))) {
+                    it.remove();
+                }
+            }
+        }
+    }
+
+    static QByteArray httpDate(const QDateTime &dateTime) {
+        return QLocale::c().toString(dateTime.toUTC(), QLatin1String("ddd, dd MMM yyyy HH:mm:ss 'GMT'")).toLatin1();
+    }
+
+    QByteArray propfindEntry(const QString &path, const QFileInfo &info) {
+        QByteArray href = QUrl::toPercentEncoding(QLatin1Char('/') + path, "/");
+        if (info.isDir() && !href.endsWith('/')) {
+            href += '/';
+        }
+        QByteArray xml = "<d:response><d:href>" + href + "</d:href><d:propstat><d:prop>";
+        if (info.isDir()) {
+            xml += "<d:resourcetype><d:collection/></d:resourcetype>";
+        } else {
+            xml += "<d:resourcetype/>";
+            xml += "<d:getcontentlength>" + QByteArray::number(info.size()) + "</d:getcontentlength>";
+        }
+        xml += "<d:getlastmodified>" + httpDate(info.lastModified()) + "</d:getlastmodified>";
+        xml += "<d:getetag>\"" + etag(path) + "\"</d:getetag>";
+        xml += "<s:id>" + fileId(path) + "</s:id>";
+        xml += "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>\n";
+        return xml;
+    }
+
+    // "deflate" is the zlib format, which is what qCompress() writes after a four byte length
+    static QByteArray inflate(const QByteArray &data) {
+        const int sizeHint = data.size() * 8;
+        QByteArray prefixed;
+        prefixed.append(char(sizeHint >> 24)).append(char(sizeHint >> 16))
+                .append(char(sizeHint >> 8)).append(char(sizeHint));
+        return qUncompress(prefixed + data);
+    }
+
+    Response putFile(const QString &path, QByteArray body, const QMap<QByteArray, QByteArray> &headers) {
+        Response response;
+        QByteArray encoding = headers.value("content-encoding");
+        if (!encoding.isEmpty()) {
+            if (!_compression || encoding != "deflate") {
+                response.code = 415;
+                return response;
+            }
+            body = inflate(body);
+        }
+        const QString local = localPath(path);
+        QFileInfo info(local);
+        if (!QFileInfo(localPath(parentOf(path))).isDir() || info.isDir()) {
+            response.code = 409;
+            return response;
+        }
+        bool existed = info.exists();
+        QFile f(local + QLatin1String(".part"));
+        if (!f.open(QIODevice::WriteOnly) || f.write(body) != body.size()) {
+            return response;
+        }
+        f.close();
+        QString error;
+        if (!FileSystem::renameReplace(f.fileName(), local, &error)) {
+            return response;
+        }
+        bool mtimeAccepted = false;
+        if (headers.contains("x-swissdisk-mtime")) {
+            mtimeAccepted = FileSystem::setModTime(local, headers.value("x-swissdisk-mtime").toLongLong());
+        }
+        touch(path);
+        response.code = existed ? 204 : 201;
+        response.addHeader("ETag", '"' + etag(path) + '"');
+        response.addHeader("X-SwissDisk-FileId", fileId(path));
+        if (mtimeAccepted) {
+            response.addHeader("X-SwissDisk-MTime", "accepted");
+        }
+        return response;
+    }
+
+    // Splits a multipart body into its parts, the part headers go to headers and the data to body
+    static bool parseMultipart(const QByteArray &body, const QByteArray &boundary, QList<Request> *parts) {
+        const QByteArray delimiter = "--" + boundary;
+        int pos = 0;
+        forever {
+            if (body.mid(pos, delimiter.size()) != delimiter) {
+                return false;
+            }
+            pos += delimiter.size();
+            if (body.mid(pos, 2) == "--") {
+                return true;
+            }
+            int headerEnd = body.indexOf("\r\n\r\n", pos);
+            if (headerEnd < 0) {
+                return false;
+            }
+            Request part;
+            part.headers = parseHeaders(body.mid(pos + 2, headerEnd - pos - 2).split('\n'));
+            qint64 length = part.headers.value("content-length").toLongLong();
+            part.body = body.mid(headerEnd + 4, length);
+            parts->append(part);
+            pos = headerEnd + 4 + length + 2;
+        }
+    }
+
+    Response postBundle(const Request &request) {
+        Response response;
+        QByteArray contentType = request.headers.value("content-type");
+        int boundaryIndex = contentType.indexOf("boundary=");
+        QList<Request> parts;
+        if (!QFileInfo(localPath(request.path)).exists()) {
+            response.code = 404;
+            return response;
+        }
+        if (!QFileInfo(localPath(request.path)).isDir() || boundaryIndex < 0
+                || !parseMultipart(request.body, contentType.mid(boundaryIndex + 9), &parts)
+                || parts.count() > _bundleMaxFiles) {
+            response.code = 400;
+            return response;
+        }
+        QJsonArray files;
+        foreach (const Request &part, parts) {
+            QString name = QUrl::fromPercentEncoding(part.headers.value("x-swissdisk-path"));
+            QString path = normalizePath(QUrl::toPercentEncoding(request.path + QLatin1Char('/') + name, "/"));
+            Response result;
+            result.code = 400;
+            if (!path.isNull() && !name.isEmpty()) {
+                result = putFile(path, part.body, part.headers);
+            }
+            QJsonObject file;
+            file.insert(QLatin1String("path"), name);
+            file.insert(QLatin1String("status"), result.code);
+            file.insert(QLatin1String("etag"), QString::fromLatin1(result.header("ETag")));
+            file.insert(QLatin1String("fileid"), QString::fromLatin1(result.header("X-SwissDisk-FileId")));
+            file.insert(QLatin1String("mtime"), QString::fromLatin1(result.header("X-SwissDisk-MTime")));
+            files.append(file);
+        }
+        QJsonObject obj;
+        obj.insert(QLatin1String("files"), files);
+        response.code = 200;
+        response.addHeader("Content-Type", "application/json");
+        response.body = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+        return response;
+    }
+
+    Response handle(const Request &request) {
+        Response response;
+        if (request.path.isNull()) {
+            response.code = 400;
+            return response;
+        }
+        const QString local = localPath(request.path);
+        QFileInfo info(local);
+
+        if (request.verb == "PROPFIND") {
+            if (!info.exists()) {
+                response.code = 404;
+                return response;
+            }
+            QByteArray xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                             "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://swissdisk.com/dav/props/\">\n";
+            xml += propfindEntry(request.path, info);
+            if (info.isDir() && request.headers.value("depth") != "0") {
+                QDir dir(local);
+                foreach (const QFileInfo &child, dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden)) {
+                    QString childPath = request.path.isEmpty() ? child.fileName()
+                                                               : request.path + QLatin1Char('/') + child.fileName();
+                    xml += propfindEntry(childPath, child);
+                }
+            }
+            xml += "</d:multistatus>\n";
+            response.code = 207;
+            response.addHeader("Content-Type", "application/xml; charset=utf-8");
+            response.body = xml;
+        } else if (request.verb == "GET" && _polls.contains(request.path)) {
+            int &unfinished = _polls[request.path];
+            response.code = 200;
+            response.addHeader("Content-Type", "application/json");
+            if (unfinished > 0) {
+                --unfinished;
+                response.body = "{\"unfinished\":true}";
+            } else {
+                response.body = "{\"etag\":\"" + etag(request.path) + "\",\"fileid\":\"" + fileId(request.path) + "\"}";
+            }
+        } else if (request.verb == "GET") {
+            QFile f(local);
+            if (!info.isFile() || !f.open(QIODevice::ReadOnly)) {
+                response.code = 404;
+                return response;
+            }
+            response.code = 200;
+            response.addHeader("ETag", '"' + etag(request.path) + '"');
+            response.addHeader("Content-Type", "application/octet-stream");
+            response.body = f.readAll();
+            if (_compression && request.headers.value("accept-encoding").contains("deflate")) {
+                response.addHeader("Content-Encoding", "deflate");
+                response.body = qCompress(response.body).mid(4);
+            }
+        } else if (request.verb == "PUT") {
+            response = putFile(request.path, request.body, request.headers);
+        } else if (request.verb == "POST" && _bundleMaxFiles > 0) {
+            response = postBundle(request);
+        } else if (request.verb == "OPTIONS") {
+            response.code = 200;
+            if (_bundleMaxFiles > 0) {
+                response.addHeader("X-SwissDisk-Bundle", QByteArray::number(_bundleMaxFiles));
+            }
+            if (_compression) {
+                response.addHeader("Accept-Encoding", "deflate");
+            }
+        } else if (request.verb == "MKCOL") {
+            if (info.exists()) {
+                response.code = 405;
+            } else if (!QDir().mkdir(local)) {
+                response.code = 409;
+            } else {
+                touch(request.path);
+                response.code = 201;
+                response.addHeader("X-SwissDisk-FileId", fileId(request.path));
+            }
+        } else if (request.verb == "MOVE") {
+            QByteArray destination = request.headers.value("destination");
+            if (destination.contains("://")) {
+                destination = QUrl::fromEncoded(destination).toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority);
+            }
+            QString target = normalizePath(destination);
+            if (!info.exists() || target.isNull() || target.isEmpty()) {
+                response.code = info.exists() ? 400 : 404;
+            } else if (!QDir().rename(local, localPath(target))) {
+                response.code = 409;
+            } else {
+                renameMetadata(request.path, target);
+                touch(parentOf(request.path));
+                touch(target);
+                response.code = 201;
+            }
+        } else if (request.verb == "DELETE") {
+            if (!info.exists()) {
+                response.code = 404;
+            } else if (info.isDir() ? QDir(local).removeRecursively() : QFile::remove(local)) {
+                forgetMetadata(request.path);
+                touch(parentOf(request.path));
+                response.code = 204;
+            }
+        } else {
+            response.code = 405;
+        }
+        return response;
+    }
+
+    // msec until a transfer of the given size, queued now, is complete on the simulated link
+    qint64 reserveLink(qint64 bytes) {
+        qint64 now = _clock.elapsed();
+        if (_bandwidth <= 0) {
+            return 0;
+        }
+        _linkFreeAt = qMax(now, _linkFreeAt) + bytes * 1000 / _bandwidth;
+        return _linkFreeAt - now;
+    }
+
+    static QMap<QByteArray, QByteArray> parseHeaders(const QList<QByteArray> &lines) {
+        QMap<QByteArray, QByteArray> headers;
+        foreach (const QByteArray &line, lines) {
+            int colon = line.indexOf(':');
+            if (colon > 0) {
+                headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+            }
+        }
+        return headers;
+    }
+
+    // Extracts one complete request from the connection buffer, if there is one
+    static bool parseRequest(QByteArray *buffer, Request *request) {
+        int headerEnd = buffer->indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            return false;
+        }
+        QList<QByteArray> lines = buffer->left(headerEnd).split('\n');
+        QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+        if (requestLine.count() < 2) {
+            return false;
+        }
+        QMap<QByteArray, QByteArray> headers = parseHeaders(lines);
+        qint64 length = headers.value("content-length").toLongLong();
+        if (buffer->size() < headerEnd + 4 + length) {
+            return false;
+        }
+        QByteArray rawPath = requestLine.at(1);
+        if (rawPath.indexOf('?') >= 0) {
+            rawPath.truncate(rawPath.indexOf('?'));
+        }
+        request->verb = requestLine.at(0);
+        request->path = normalizePath(rawPath);
+        request->headers = headers;
+        request->body = buffer->mid(headerEnd + 4, length);
+        buffer->remove(0, headerEnd + 4 + length);
+        return true;
+    }
+
+    void processNextRequest(QTcpSocket *socket) {
+        if (socket->property("busy").toBool()) {
+            return;
+        }
+        QByteArray buffer = socket->property("buffer").toByteArray();
+        Request request;
+        bool complete = parseRequest(&buffer, &request);
+        socket->setProperty("buffer", buffer);
+        if (!complete) {
+            return;
+        }
+        socket->setProperty("busy", true);
+
+        _requestCounts[request.verb]++;
+        _maxConcurrent[request.verb] = qMax(_maxConcurrent.value(request.verb), ++_concurrent[request.verb]);
+        _bytesReceived += request.body.size();
+        qint64 uploadMsec = reserveLink(request.body.size());
+
+        Response response;
+        if (_failNext.contains(request.verb)) {
+            response.code = _failNext.take(request.verb);
+        } else {
+            response = handle(request);
+        }
+        QByteArray data = "HTTP/1.1 " + QByteArray::number(response.code) + ' ' + reasonPhrase(response.code) + "\r\n";
+        for (int i = 0; i < response.headers.count(); ++i) {
+            data += response.headers.at(i).first + ": " + response.headers.at(i).second + "\r\n";
+        }
+        data += "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n\r\n";
+        data += response.body;
+        _bytesSent += response.body.size();
+        qint64 delay = qMax(uploadMsec, reserveLink(response.body.size())) + _latency;
+
+        // parented to the socket, so that it goes away with the connection
+        QTimer *timer = new QTimer(socket);
+        timer->setSingleShot(true);
+        const QByteArray verb = request.verb;
+        connect(timer, &QTimer::timeout, [this, socket, timer, data, verb]() {
+            _concurrent[verb]--;
+            socket->write(data);
+            socket->setProperty("busy", false);
+            timer->deleteLater();
+            processNextRequest(socket);
+        });
+        timer->start(int(delay));
+    }
+
+    void slotNewConnection() {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            connect(socket, &QTcpSocket::readyRead, [this, socket]() { slotReadyRead(socket); });
+            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        }
+    }
+
+    void slotReadyRead(QTcpSocket *socket) {
+        socket->setProperty("buffer", socket->property("buffer").toByteArray() + socket->readAll());
+        processNextRequest(socket);
+    }
+
+private:
+    QString _root;
+    int _latency;
+    qint64 _bandwidth;
+    QElapsedTimer _clock;
+    qint64 _linkFreeAt;
+    int _bundleMaxFiles;
+    bool _compression;
+    QHash<QString, int> _polls; // path -> "unfinished" answers left
+    QHash<QByteArray, int> _failNext; // verb -> status code
+
+    QHash<QString, QByteArray> _etags;
+    QHash<QString, QByteArray> _fileIds;
+    qint64 _etagCounter;
+    qint64 _fileIdCounter;
+
+    QMap<QByteArray, int> _requestCounts;
+    QMap<QByteArray, int> _concurrent;
+    QMap<QByteArray, int> _maxConcurrent;
+    qint64 _bytesReceived;
+    qint64 _bytesSent;
+};
+
+struct SyncRunResult {
+    SyncRunResult() : msec(0), items(0), bytes(0), errors(0), anotherSyncNeeded(false) {}
+    qint64 msec;
+    int items; // files that were propagated successfully
+    qint64 bytes; // the size of the files that were transferred
+    int errors;
+    QList<SyncFileItem> completed; // all items the engine reported, in order
+    QStringList pathsToRetry;
+    bool anotherSyncNeeded;
+
+    const SyncFileItem *item(const QString &file) const {
+        for (int i = 0; i < completed.count(); ++i) {
+            if (completed.at(i)._file == file) {
+                return &completed.at(i);
+            }
+        }
+        return 0;
+    }
+};
+
+namespace SyncTestUtils {
+
+inline AccountPtr createAccount(FakeWebDavServer *server)
+{
+    AccountPtr account = Account::create();
+    account->setUrl(QUrl(QString::fromLatin1("http://127.0.0.1:%1/").arg(server->serverPort())));
+    account->setCredentials(new DummyCredentials);
+    return account;
+}
+
+/*
+ * Syncs localPath with the directory remoteFolder of the server. With
+ * targetedPaths, the engine is asked to sync only those, see
+ * SyncEngine::setTargetedPaths().
+ */
+inline SyncRunResult runSync(AccountPtr account, FakeWebDavServer *server, const QString &localPath,
+                             const QString &remoteFolder, const QStringList &targetedPaths = QStringList())
+{
+    SyncRunResult result;
+    QByteArray remoteUrl = QString::fromLatin1("owncloud://127.0.0.1:%1/%2/")
+            .arg(server->serverPort()).arg(remoteFolder).toUtf8();
+
+    CSYNC *ctx = 0;
+    if (csync_create(&ctx, localPath.toUtf8(), remoteUrl.constData()) < 0) {
+        result.errors++;
+        return result;
+    }
+    if (csync_init(ctx) < 0) {
+        csync_destroy(ctx);
+        result.errors++;
+        return result;
+    }
+    csync_set_module_property(ctx, "csync_context", ctx);
+
+    QElapsedTimer timer;
+    timer.start();
+    {
+        SyncJournalDb db(localPath);
+        SyncEngine engine(account, ctx, localPath, QLatin1Char('/') + remoteFolder + QLatin1Char('/'),
+                          remoteFolder, &db);
+        engine.setTargetedPaths(targetedPaths);
+        QEventLoop loop;
+        QObject::connect(&engine, &SyncEngine::finished, &loop, &QEventLoop::quit);
+        QObject::connect(&engine, &SyncEngine::jobCompleted, [&result](const SyncFileItem &item) {
+            result.completed.append(item);
+            if (item._isDirectory || item._instruction == CSYNC_INSTRUCTION_NONE) {
+                return;
+            }
+            if (item._status == SyncFileItem::Success) {
+                result.items++;
+                if (item._instruction == CSYNC_INSTRUCTION_NEW || item._instruction == CSYNC_INSTRUCTION_SYNC
+                        || item._instruction == CSYNC_INSTRUCTION_CONFLICT) {
+                    result.bytes += item._size;
+                }
+            } else if (item._status != SyncFileItem::NoStatus) {
+                result.errors++;
+            }
+        });
+        QTimer::singleShot(10 * 60 * 1000, &loop, SLOT(quit()));
+        QMetaObject::invokeMethod(&engine, "startSync", Qt::QueuedConnection);
+        loop.exec();
+        result.pathsToRetry = engine.pathsToRetry();
+        result.anotherSyncNeeded = engine.isAnotherSyncNeeded();
+    }
+    result.msec = qMax(timer.elapsed(), qint64(1));
+
+    csync_destroy(ctx);
+    return result;
+}
+
+/*
+ * A FakeWebDavServer that serves an empty folder "remote" from a temporary
+ * directory, an account for it and an empty client directory. Tests call
+ * setUp() from init(), so that every test function starts from scratch.
+ */
+class SyncFixture
+{
+public:
+    bool setUp() {
+        _serverDir.reset(new QTemporaryDir);
+        _clientDir.reset(new QTemporaryDir);
+        if (!_serverDir->isValid() || !_clientDir->isValid()) {
+            return false;
+        }
+        _server.reset(new FakeWebDavServer(_serverDir->path()));
+        if (!_server->listen(QHostAddress::LocalHost)
+                || !QDir(_serverDir->path()).mkdir(QLatin1String("remote"))) {
+            return false;
+        }
+        _account = createAccount(_server.data());
+        return true;
+    }
+
+    FakeWebDavServer *server() const { return _server.data(); }
+    AccountPtr account() const { return _account; }
+    QString localPath() const { return _clientDir->path(); }
+    QString localFile(const QString &path) const { return _clientDir->path() + QLatin1Char('/') + path; }
+    QString serverTree() const { return _server->localPath(QLatin1String("remote")); }
+
+    /** Syncs the client directory, the request counters of the server only count this sync */
+    SyncRunResult sync(const QStringList &targetedPaths = QStringList()) {
+        _server->resetCounters();
+        return runSync(_account, _server.data(), _clientDir->path(), QLatin1String("remote"), targetedPaths);
+    }
+
+private:
+    QScopedPointer<QTemporaryDir> _serverDir;
+    QScopedPointer<QTemporaryDir> _clientDir;
+    QScopedPointer<FakeWebDavServer> _server;
+    AccountPtr _account;
+};
+
+// Files that were just written are not uploaded yet, see minFileAgeForUpload
+inline void makeOld(const QString &fileName, int secs)
+{
+    FileSystem::setModTime(fileName, time(0) - secs);
+}
+
+inline bool writeLocalFile(const QString &fileName, const QByteArray &data, int ageSecs = 3600)
+{
+    QDir().mkpath(QFileInfo(fileName).path());
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.size()) {
+        return false;
+    }
+    f.close();
+    makeOld(fileName, ageSecs);
+    return true;
+}
+
+// relative path -> size, -1 for directories, for everything but the client's own metadata
+inline QMap<QString, qint64> listTree(const QString &root)
+{
+    QMap<QString, qint64> result;
+    QDirIterator it(root, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        QString name = it.fileName();
+        if (name.startsWith(QLatin1String(".csync_journal.db")) || name.startsWith(QLatin1String(".swissdisksync.log"))) {
+            continue;
+        }
+        result.insert(it.filePath().mid(root.length() + 1), it.fileInfo().isDir() ? -1 : it.fileInfo().size());
+    }
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTBANDWIDTHMANAGER_H
+#define MIRALL_TESTBANDWIDTHMANAGER_H
+
+#include <QtTest>
+#include <QElapsedTimer>
+
+#include "bandwidthmanager.h"
+
+using namespace OCC;
+
+// Takes as much as it is allowed to from the bucket, like a transfer would.
+class BucketConsumer : public QObject
+{
+    Q_OBJECT
+public:
+    BucketConsumer(BandwidthBucket *bucket)
+        : _bucket(bucket), _received(0), _active(true)
+    {
+        _bucket->addConsumer(this);
+        connect(_bucket, SIGNAL(consumerReady(QObject*)), SLOT(slotReady(QObject*)));
+    }
+    ~BucketConsumer() { _bucket->removeConsumer(this); }
+
+    qint64 received() const { return _received; }
+    void setActive(bool active) { _active = active; }
+
+public slots:
+    void pull() {
+        while (_active) {
+            qint64 got = _bucket->take(this, 16 * 1024);
+            if (got == 0) {
+                return; // wait for slotReady
+            }
+            _received += got;
+        }
+    }
+
+private slots:
+    void slotReady(QObject *consumer) {
+        if (consumer == this) {
+            QMetaObject::invokeMethod(this, "pull", Qt::QueuedConnection);
+        }
+    }
+
+private:
+    BandwidthBucket *_bucket;
+    qint64 _received;
+    bool _active;
+};
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+    // achieved rate in bytes per second while the event loop runs for msec
+    static double runFor(int msec, const QList<BucketConsumer*> &consumers, qint64 *total)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        foreach (BucketConsumer *c, consumers) {
+            QMetaObject::invokeMethod(c, "pull", Qt::QueuedConnection);
+        }
+        QTest::qWait(msec);
+        *total = 0;
+        foreach (BucketConsumer *c, consumers) {
+            c->setActive(false);
+            *total += c->received();
+        }
+        return *total * 1000.0 / timer.elapsed();
+    }
+
+private slots:
+    void testUnlimited()
+    {
+        BandwidthBucket bucket;
+        BucketConsumer consumer(&bucket);
+        QVERIFY(!bucket.isLimited());
+        QCOMPARE(bucket.take(&consumer, 1024 * 1024), qint64(1024 * 1024));
+        QCOMPARE(bucket.totalTaken(), qint64(1024 * 1024));
+    }
+
+    void testAbsoluteRate_data()
+    {
+        QTest::addColumn<qint64>("limit");
+        QTest::addColumn<int>("consumerCount");
+
+        QTest::newRow("50 kB/s, 1 transfer") << qint64(50 * 1024) << 1;
+        QTest::newRow("200 kB/s, 1 transfer") << qint64(200 * 1024) << 1;
+        QTest::newRow("200 kB/s, 4 transfers") << qint64(200 * 1024) << 4;
+        QTest::newRow("2 MB/s, 3 transfers") << qint64(2 * 1024 * 1024) << 3;
+    }
+
+    void testAbsoluteRate()
+    {
+        QFETCH(qint64, limit);
+        QFETCH(int, consumerCount);
+
+        BandwidthBucket bucket;
+        bucket.setLimit(limit);
+        QList<BucketConsumer*> consumers;
+        for (int i = 0; i < consumerCount; ++i) {
+            consumers.append(new BucketConsumer(&bucket));
+        }
+
+        qint64 total = 0;
+        double achieved = runFor(2000, consumers, &total);
+        qDebug() << "configured" << limit << "B/s, achieved" << qint64(achieved) << "B/s";
+
+        QVERIFY(achieved <= limit * 1.1);
+        QVERIFY(achieved >= limit * 0.85);
+
+        // fair sharing
+        foreach (BucketConsumer *c, consumers) {
+            QVERIFY(c->received() >= total / consumerCount * 0.7);
+            QVERIFY(c->received() <= total / consumerCount * 1.3);
+        }
+        qDeleteAll(consumers);
+    }
+
+    void testWorkConserving()
+    {
+        // An idle transfer must not keep the others from using the whole limit
+        const qint64 limit = 100 * 1024;
+        BandwidthBucket bucket;
+        bucket.setLimit(limit);
+        BucketConsumer active(&bucket);
+        BucketConsumer idle(&bucket);
+        idle.setActive(false);
+
+        qint64 total = 0;
+        double achieved = runFor(2000, QList<BucketConsumer*>() << &active << &idle, &total);
+        qDebug() << "configured" << limit << "B/s, achieved" << qint64(achieved) << "B/s";
+        QCOMPARE(idle.received(), qint64(0));
+        QVERIFY(achieved >= limit * 0.85);
+    }
+
+    void testLimitLifted()
+    {
+        BandwidthBucket bucket;
+        bucket.setLimit(1024);
+        BucketConsumer consumer(&bucket);
+        // drain the bucket so that the consumer has to wait
+        while (bucket.take(&consumer, 1024) > 0) {}
+        QSignalSpy spy(&bucket, SIGNAL(consumerReady(QObject*)));
+        bucket.setLimit(0);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(bucket.take(&consumer, 4096), qint64(4096));
+    }
+};
+
+#endif
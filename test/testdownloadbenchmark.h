@@ -0,0 +1,130 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTDOWNLOADBENCHMARK_H
+#define MIRALL_TESTDOWNLOADBENCHMARK_H
+
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <ctime>
+
+#include "propagatedownload.h"
+#include "account.h"
+#include "creds/dummycredentials.h"
+
+using namespace OCC;
+
+// Serves every GET with a body of the given size, streamed as fast as the client reads.
+class LoopbackFileServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    LoopbackFileServer(qint64 size) : _size(size), _chunk(64 * 1024, 'o') {
+        connect(this, SIGNAL(newConnection()), SLOT(slotNewConnection()));
+    }
+
+private slots:
+    void slotNewConnection() {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            socket->setProperty("remaining", _size);
+            connect(socket, SIGNAL(readyRead()), SLOT(slotReadyRead()));
+            connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(slotBytesWritten()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void slotReadyRead() {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+        socket->setProperty("request", request);
+        if (!request.contains("\r\n\r\n")) {
+            return;
+        }
+        socket->write("HTTP/1.1 200 OK\r\n"
+                      "ETag: \"benchmark\"\r\n"
+                      "Content-Length: " + QByteArray::number(_size) + "\r\n"
+                      "\r\n");
+        slotBytesWritten();
+    }
+
+    void slotBytesWritten() {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        qint64 remaining = socket->property("remaining").toLongLong();
+        while (remaining > 0 && socket->bytesToWrite() < 4 * _chunk.size()) {
+            qint64 n = qMin(remaining, qint64(_chunk.size()));
+            socket->write(_chunk.constData(), n);
+            remaining -= n;
+        }
+        socket->setProperty("remaining", remaining);
+    }
+
+private:
+    qint64 _size;
+    QByteArray _chunk;
+};
+
+class TestDownloadBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDownload_data()
+    {
+        QTest::addColumn<bool>("backgroundFlush");
+
+        QTest::newRow("write in event loop") << false;
+        QTest::newRow("background flush") << true;
+    }
+
+    void testDownload()
+    {
+        QFETCH(bool, backgroundFlush);
+        qputenv("OWNCLOUD_DOWNLOAD_BACKGROUND_FLUSH", backgroundFlush ? "1" : "0");
+
+        qint64 size = qgetenv("OWNCLOUD_BENCHMARK_DOWNLOAD_MB").toLongLong() * 1024 * 1024;
+        if (size <= 0) {
+            size = 64 * 1024 * 1024;
+        }
+
+        LoopbackFileServer server(size);
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        AccountPtr account = Account::create();
+        account->setUrl(QUrl(QString("http://127.0.0.1:%1/").arg(server.serverPort())));
+        account->setCredentials(new DummyCredentials);
+
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        file.close();
+        QVERIFY(file.open(QIODevice::Append | QIODevice::Unbuffered));
+
+        GETFileJob *job = new GETFileJob(account, QLatin1String("benchmark.bin"), &file,
+                                         QMap<QByteArray, QByteArray>(), QByteArray(), 0);
+        QSignalSpy spy(job, SIGNAL(finishedSignal()));
+
+        QElapsedTimer timer;
+        timer.start();
+        clock_t cpuStart = clock();
+        job->start();
+        for (int i = 0; i < 600 && spy.isEmpty(); ++i) {
+            QTest::qWait(100);
+        }
+        double seconds = timer.nsecsElapsed() / 1e9;
+        double cpuSeconds = double(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(file.size(), size);
+
+        qDebug() << "downloaded" << size / (1024 * 1024) << "MB:"
+                 << size / (1024 * 1024) / seconds << "MB/s,"
+                 << cpuSeconds * (1024 * 1024 * 1024) / size << "CPU seconds per GB";
+    }
+};
+
+#endif
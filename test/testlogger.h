@@ -0,0 +1,111 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTLOGGER_H
+#define MIRALL_TESTLOGGER_H
+
+#include <QtTest>
+#include <QTemporaryFile>
+#include <QThread>
+
+#include "logger.h"
+
+using namespace OCC;
+
+class LoggingThread : public QThread
+{
+public:
+    LoggingThread(int id, int lines) : _id(id), _lines(lines) {}
+protected:
+    void run() Q_DECL_OVERRIDE {
+        for (int i = 0; i < _lines; ++i) {
+            Logger::mirallLog(QString::fromLatin1("TESTLOG %1 %2").arg(_id).arg(i));
+        }
+    }
+private:
+    int _id;
+    int _lines;
+};
+
+class LogCounter : public QObject
+{
+    Q_OBJECT
+public:
+    LogCounter() : _signals(0), _lines(0) {}
+    int _signals;
+    int _lines;
+public slots:
+    void slotNewLog(const QString &lines) {
+        _signals++;
+        _lines += lines.count(QLatin1Char('\n')) + 1;
+    }
+};
+
+class TestLogger : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testThreadsAndDrops()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        Logger *logger = Logger::instance();
+        logger->setLogFile(file.fileName());
+        logger->flush();
+        int droppedBefore = logger->droppedCount();
+
+        const int threadCount = 4;
+        const int lines = 50000;
+        QList<LoggingThread*> threads;
+        for (int i = 0; i < threadCount; ++i) {
+            threads.append(new LoggingThread(i, lines));
+            threads.last()->start();
+        }
+        foreach (LoggingThread *t, threads) {
+            t->wait();
+        }
+        qDeleteAll(threads);
+        logger->flush();
+        logger->setLogFile(QString());
+
+        QVector<int> last(threadCount, -1);
+        int seen = 0;
+        QFile log(file.fileName());
+        QVERIFY(log.open(QIODevice::ReadOnly));
+        while (!log.atEnd()) {
+            QList<QByteArray> words = log.readLine().trimmed().split(' ');
+            int marker = words.indexOf("TESTLOG");
+            if (marker < 0 || marker + 2 >= words.count()) {
+                continue;
+            }
+            int id = words.at(marker + 1).toInt();
+            int line = words.at(marker + 2).toInt();
+            // lines of one thread keep their order, some may be dropped
+            QVERIFY(line > last[id]);
+            last[id] = line;
+            ++seen;
+        }
+        int dropped = logger->droppedCount() - droppedBefore;
+        qDebug() << seen << "lines written," << dropped << "dropped";
+        QCOMPARE(seen + dropped, threadCount * lines);
+    }
+
+    void testNewLogIsBatched()
+    {
+        LogCounter counter;
+        connect(Logger::instance(), SIGNAL(newLog(QString)), &counter, SLOT(slotNewLog(QString)));
+        for (int i = 0; i < 100; ++i) {
+            Logger::mirallLog(QString::fromLatin1("batched %1").arg(i));
+        }
+        Logger::instance()->flush();
+        QTest::qWait(200); // batches from the writer thread are queued
+        QVERIFY(counter._lines >= 100);
+        QVERIFY(counter._signals < 100);
+    }
+};
+
+#endif
@@ -8,7 +8,23 @@
 #define MIRALL_TESTOWNCLOUDPROPAGATOR_H
 
 #include <QtTest>
+#include <QTemporaryDir>
 
+#include "owncloudpropagator.h"
+#include "account.h"
+#include "utility.h"
+
+using namespace OCC;
+
+// Counts how often the propagator (re)starts it
+class CountingJob : public PropagateItemJob
+{
+public:
+    explicit CountingJob(OwncloudPropagator *propagator)
+        : PropagateItemJob(propagator, SyncFileItem()), _starts(0) {}
+    void start() Q_DECL_OVERRIDE { ++_starts; }
+    int _starts;
+};
 
 class TestOwncloudPropagator : public QObject
 {
@@ -20,6 +36,80 @@ private slots:
 //        OwncloudPropagator propagator( NULL, QLatin1String("test1"), QLatin1String("test2"), new ProgressDatabase);
         QVERIFY( true );
     }
+
+    void testItemPriority()
+    {
+        OwncloudPropagator propagator(Account::create(), 0, QDir::tempPath(),
+                                      QLatin1String("/"), QLatin1String("/"), 0, 0);
+
+        SyncFileItem small;
+        small._file = QLatin1String("a/small.txt");
+        small._size = 1000;
+        small._direction = SyncFileItem::Down;
+        SyncFileItem big = small;
+        big._file = QLatin1String("a/big.iso");
+        big._size = Q_INT64_C(30) * 1024 * 1024 * 1024;
+        SyncFileItem recent = big;
+        recent._file = QLatin1String("b/recent.doc");
+        recent._direction = SyncFileItem::Up;
+        recent._modtime = time(0) - 10;
+        SyncFileItem old = recent;
+        old._modtime = time(0) - 24 * 3600;
+
+        QVERIFY(propagator.itemPriority(small) < propagator.itemPriority(big));
+        QVERIFY(propagator.itemPriority(recent) < propagator.itemPriority(small));
+        QCOMPARE(propagator.itemPriority(old), propagator.itemPriority(big));
+
+        int generation = propagator._priorityGeneration;
+        propagator.prioritizePath(QLatin1String("a/"));
+        QVERIFY(propagator._priorityGeneration != generation);
+        QVERIFY(propagator.itemPriority(big) < propagator.itemPriority(recent));
+        QVERIFY(propagator.itemPriority(small) < propagator.itemPriority(big));
+
+        // "ab" is not below "a"
+        SyncFileItem sibling = small;
+        sibling._file = QLatin1String("ab/small.txt");
+        QVERIFY(propagator.itemPriority(sibling) > propagator.itemPriority(big));
+    }
+
+    void testDiskSpaceReservation()
+    {
+        // 0 turns the limit off, it is read once
+        qputenv("OWNCLOUD_FREE_SPACE_LIMIT", "0");
+        QCOMPARE(OwncloudPropagator::freeSpaceLimit(), qint64(0));
+
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        OwncloudPropagator propagator(Account::create(), 0, dir.path(),
+                                      QLatin1String("/"), QLatin1String("/"), 0, 0);
+        bool ok = false;
+        const qint64 share = Utility::freeDiskSpace(dir.path(), &ok) / 5 * 3;
+        QVERIFY(ok);
+
+        // a second download of more than half the free space does not fit
+        QVERIFY(propagator.reserveDiskSpace(share));
+        QCOMPARE(propagator.reservedDiskSpace(), share);
+        QVERIFY(!propagator.reserveDiskSpace(share));
+
+        // it waits for the reservation of the first one to be given back
+        CountingJob job(&propagator);
+        propagator.waitForDiskSpace(&job);
+        QCoreApplication::processEvents();
+        QCOMPARE(job._starts, 0);
+
+        // the preallocated space is still reserved, but not counted twice
+        propagator.allocateDiskSpace(share);
+        QCOMPARE(propagator.reservedDiskSpace(), share);
+        QVERIFY(propagator.reserveDiskSpace(share));
+        propagator.releaseDiskSpace(share);
+        QCoreApplication::processEvents();
+        QCOMPARE(job._starts, 1);
+
+        propagator.releaseDiskSpace(share, true);
+        QCOMPARE(propagator.reservedDiskSpace(), qint64(0));
+        QVERIFY(propagator.reserveDiskSpace(share));
+        propagator.releaseDiskSpace(share);
+    }
 };
 
 #endif
@@ -0,0 +1,116 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTPOLLJOBS_H
+#define MIRALL_TESTPOLLJOBS_H
+
+#include <QtTest>
+
+#include "syncenginetestutils.h"
+#include "syncmetrics.h"
+#include "propagateupload.h"
+
+using namespace SyncTestUtils;
+
+class TestPollJobs : public QObject
+{
+    Q_OBJECT
+
+    SyncFixture _fixture;
+
+    // Polls the given URL for a.txt until the job gives up or the server is done
+    SyncFileItem poll(const QString &url, qint64 deadlineMsec, qint64 *msec) {
+        SyncJournalDb journal(_fixture.localPath());
+        SyncFileItem item;
+        item._file = QLatin1String("a.txt");
+        // the job deletes itself once it is done
+        PollJob *job = new PollJob(_fixture.account(), url, item, &journal, _fixture.localPath(), 0);
+        job->setDeadline(deadlineMsec);
+        QEventLoop loop;
+        QElapsedTimer timer;
+        QObject::connect(job, &PollJob::finishedSignal, [&]() {
+            *msec = timer.elapsed();
+            item = job->_item;
+            loop.quit();
+        });
+        QTimer::singleShot(60 * 1000, &loop, SLOT(quit()));
+        timer.start();
+        job->start();
+        loop.exec();
+        journal.close();
+        return item;
+    }
+
+private slots:
+    void init()
+    {
+        QVERIFY(_fixture.setUp());
+        SyncMetrics::reset();
+    }
+
+    void testBackoff()
+    {
+        _fixture.server()->addPollUrl(QLatin1String("/poll/a"), 2);
+
+        qint64 msec = 0;
+        SyncFileItem item = poll(QLatin1String("/poll/a"), 0, &msec);
+        QCOMPARE(item._status, SyncFileItem::Success);
+        QCOMPARE(_fixture.server()->requestCounts().value("GET"), 3);
+        QCOMPARE(SyncMetrics::counter("poll.retries"), qint64(2));
+        // it waited one second, then two
+        QVERIFY(msec >= 3000);
+    }
+
+    void testDeadline()
+    {
+        _fixture.server()->addPollUrl(QLatin1String("/poll/a"), 100);
+
+        qint64 msec = 0;
+        SyncFileItem item = poll(QLatin1String("/poll/a"), 1500, &msec);
+        QCOMPARE(item._status, SyncFileItem::SoftError);
+        // the second retry would only come after the deadline
+        QCOMPARE(_fixture.server()->requestCounts().value("GET"), 2);
+        QCOMPARE(SyncMetrics::counter("poll.retries"), qint64(1));
+        QCOMPARE(SyncMetrics::counter("poll.deadline_exceeded"), qint64(1));
+        QVERIFY(msec < 1500);
+    }
+
+    void testItemWithPendingPollIsSkippedAndRetried()
+    {
+        // The upload of polled.txt was accepted, but the server still processes it
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("polled.txt")), QByteArray(100, 'p')));
+        _fixture.server()->addPollUrl(QLatin1String("/poll/polled"), 1);
+        {
+            SyncJournalDb journal(_fixture.localPath());
+            SyncJournalDb::PollInfo info;
+            info._file = QLatin1String("polled.txt");
+            info._url = QLatin1String("/poll/polled");
+            info._modtime = FileSystem::getModTime(_fixture.localFile(info._file));
+            journal.setPollInfo(info);
+            journal.commit("test", false);
+            journal.close();
+        }
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("other.txt")), QByteArray(100, 'o')));
+
+        // The other file does not wait for the poll
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QVERIFY(result.item(QLatin1String("other.txt")));
+        QVERIFY(!result.item(QLatin1String("polled.txt")));
+        QCOMPARE(SyncMetrics::counter("sync.poll_skipped_items"), qint64(1));
+        QCOMPARE(_fixture.server()->requestCounts().value("GET"), 2);
+        // the poll succeeded during the sync, so its file is synced again
+        QCOMPARE(result.pathsToRetry, QStringList() << QLatin1String("polled.txt"));
+
+        SyncJournalDb journal(_fixture.localPath());
+        QVERIFY(journal.getPollInfos().isEmpty());
+        QVERIFY(journal.getFileRecord(QLatin1String("polled.txt")).isValid());
+        journal.close();
+    }
+};
+
+#endif
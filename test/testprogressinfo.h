@@ -0,0 +1,59 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTPROGRESSINFO_H
+#define MIRALL_TESTPROGRESSINFO_H
+
+#include <QtTest>
+
+#include "progressdispatcher.h"
+
+using namespace OCC;
+
+class TestProgressInfo : public QObject
+{
+    Q_OBJECT
+
+    SyncFileItem createItem(const QString &file, quint64 size, bool isDirectory = false) {
+        SyncFileItem i;
+        i._file = file;
+        i._size = size;
+        i._isDirectory = isDirectory;
+        i._instruction = CSYNC_INSTRUCTION_NEW;
+        return i;
+    }
+
+private slots:
+    void testCompletedSize() {
+        Progress::Info info;
+        info._totalSize = 300;
+        info._totalFileCount = 3;
+
+        SyncFileItem a = createItem("a", 100);
+        SyncFileItem b = createItem("b", 200);
+        SyncFileItem dir = createItem("dir", 0, true);
+
+        info.setProgressItem(a, 10);
+        info.setProgressItem(b, 50);
+        info.setProgressItem(dir, 1000); // directories do not count
+        QCOMPARE(info.completedSize(), quint64(60));
+
+        info.setProgressItem(a, 40);
+        QCOMPARE(info.completedSize(), quint64(90));
+
+        info.setProgressComplete(a);
+        QCOMPARE(info.completedSize(), quint64(150));
+        QCOMPARE(info._currentItems.count(), 2);
+
+        info.setProgressComplete(dir);
+        info.setProgressComplete(b);
+        QCOMPARE(info.completedSize(), quint64(300));
+        QCOMPARE(info._completedFileCount, quint64(3));
+        QVERIFY(info._currentItems.isEmpty());
+    }
+};
+
+#endif
@@ -0,0 +1,66 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTPROPAGATEREMOTEMKDIR_H
+#define MIRALL_TESTPROPAGATEREMOTEMKDIR_H
+
+#include <QtTest>
+
+#include "syncenginetestutils.h"
+#include "owncloudpropagator.h"
+
+using namespace SyncTestUtils;
+
+class TestPropagateRemoteMkdir : public QObject
+{
+    Q_OBJECT
+
+    SyncFixture _fixture;
+
+private slots:
+    void init()
+    {
+        QVERIFY(_fixture.setUp());
+    }
+
+    void testNewTreeIsCreatedInTheMkdirLane()
+    {
+        // Every level has to wait for the MKCOLs of the one above it
+        const int fanOut = 3;
+        for (int i = 0; i < fanOut; ++i) {
+            for (int j = 0; j < fanOut; ++j) {
+                QString dir = QString::fromLatin1("a%1/b%2").arg(i).arg(j);
+                QVERIFY(writeLocalFile(_fixture.localFile(dir + QLatin1String("/leaf.dat")),
+                                       QByteArray(1000, 'l')));
+            }
+        }
+
+        // With some latency the MKCOLs of a level overlap
+        _fixture.server()->setLatency(20);
+        SyncRunResult result = _fixture.sync();
+
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, fanOut * fanOut);
+        QCOMPARE(_fixture.server()->requestCounts().value("MKCOL"), fanOut + fanOut * fanOut);
+        // more than the three jobs of the file lane, but not more than the mkdir lane allows
+        QVERIFY(_fixture.server()->maxConcurrentRequests("MKCOL") > 3);
+        QVERIFY(_fixture.server()->maxConcurrentRequests("MKCOL") <= OwncloudPropagator::maximumActiveMkdirJobs());
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+    }
+
+    void testExistingDirectoryIsNotCreated()
+    {
+        QVERIFY(QDir(_fixture.serverTree()).mkdir(QLatin1String("existing")));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("existing/file.dat")), QByteArray(10, 'e')));
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("MKCOL"), 0);
+    }
+};
+
+#endif
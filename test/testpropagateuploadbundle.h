@@ -0,0 +1,106 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTPROPAGATEUPLOADBUNDLE_H
+#define MIRALL_TESTPROPAGATEUPLOADBUNDLE_H
+
+#include <QtTest>
+
+#include "syncenginetestutils.h"
+
+using namespace SyncTestUtils;
+
+class TestPropagateUploadBundle : public QObject
+{
+    Q_OBJECT
+
+    SyncFixture _fixture;
+
+private slots:
+    void init()
+    {
+        QVERIFY(_fixture.setUp());
+    }
+
+    void testSmallFilesAreBundled()
+    {
+        _fixture.server()->setBundleSupport(4);
+        for (int i = 0; i < 10; ++i) {
+            QVERIFY(writeLocalFile(_fixture.localFile(QString::fromLatin1("dir/small%1.txt").arg(i)), QByteArray(100 + i, 's')));
+        }
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 10);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 0);
+        // at most four files per request
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 3);
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+
+        // The etags and file ids went into the journal, so there is nothing to do
+        result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 0);
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 0);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 0);
+    }
+
+    void testLargeFileIsNotBundled()
+    {
+        _fixture.server()->setBundleSupport(25);
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/small.txt")), QByteArray(100, 's')));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/other.txt")), QByteArray(200, 'o')));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/large.dat")), QByteArray(1024 * 1024, 'l')));
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 3);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 1);
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+    }
+
+    void testMissingDirectoryKeepsBundles()
+    {
+        _fixture.server()->setBundleSupport(4);
+        for (int i = 0; i < 3; ++i) {
+            QVERIFY(writeLocalFile(_fixture.localFile(QString::fromLatin1("dir/small%1.txt").arg(i)), QByteArray(100, 's')));
+        }
+        // like a directory that was moved away on the server during the sync
+        _fixture.server()->failNextRequest("POST", 404);
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 3);
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 3);
+
+        // The server still takes bundles
+        for (int i = 0; i < 3; ++i) {
+            QVERIFY(writeLocalFile(_fixture.localFile(QString::fromLatin1("dir/more%1.txt").arg(i)), QByteArray(100, 'm')));
+        }
+        result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 3);
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 0);
+    }
+
+    void testWithoutServerSupport()
+    {
+        for (int i = 0; i < 5; ++i) {
+            QVERIFY(writeLocalFile(_fixture.localFile(QString::fromLatin1("small%1.txt").arg(i)), QByteArray(100, 's')));
+        }
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 5);
+        QCOMPARE(_fixture.server()->requestCounts().value("POST"), 0);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 5);
+    }
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCBENCHMARK_H
+#define MIRALL_TESTSYNCBENCHMARK_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <iostream>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include "syncenginetestutils.h"
+
+using namespace SyncTestUtils;
+
+/*
+ * Runs SyncEngine against FakeWebDavServer in the typical situations of a
+ * client: the first sync of a full folder, a sync without changes, a sync of
+ * a few changes on both sides, a sync after many renames and the first sync
+ * of an empty folder against a full server.
+ *
+ * Every scenario prints one JSON object per line to stdout, and appends it to
+ * the file in OWNCLOUD_BENCHMARK_OUTPUT if that is set. The tree size, the
+ * latency and the bandwidth of the fake server can be set with
+ * OWNCLOUD_BENCHMARK_FILES, OWNCLOUD_BENCHMARK_LATENCY_MS and
+ * OWNCLOUD_BENCHMARK_BANDWIDTH_KBPS.
+ */
+class TestSyncBenchmark : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _serverDir;
+    QTemporaryDir _clientDir;
+    QTemporaryDir _secondClientDir;
+    QScopedPointer<FakeWebDavServer> _server;
+    AccountPtr _account;
+    int _fileCount;
+    int _latency;
+    qint64 _bandwidth;
+    quint32 _random;
+
+    static int envInt(const char *name, int defaultValue) {
+        bool ok = false;
+        int value = qgetenv(name).toInt(&ok);
+        return ok ? value : defaultValue;
+    }
+
+    // deterministic, so that all runs see the same tree
+    quint32 nextRandom() {
+        _random = _random * 1103515245 + 12345;
+        return (_random >> 8) & 0xffffff;
+    }
+
+    QByteArray content(qint64 size) {
+        QByteArray data(size, 'x');
+        char c = 'a' + nextRandom() % 26;
+        for (int i = 0; i < data.size(); i += 61) {
+            data[i] = c;
+        }
+        return data;
+    }
+
+    // Mostly small files and a few larger ones, in a two level tree
+    void generateTree(const QString &root, int fileCount) {
+        QStringList dirs;
+        for (int i = 0; i < 10; ++i) {
+            QString dir = QString::fromLatin1("dir%1").arg(i);
+            dirs << dir;
+            for (int j = 0; j < 3; ++j) {
+                dirs << dir + QString::fromLatin1("/sub%1").arg(j);
+            }
+        }
+        foreach (const QString &dir, dirs) {
+            QDir(root).mkpath(dir);
+        }
+        for (int i = 0; i < fileCount; ++i) {
+            qint64 size = (nextRandom() % 10 == 0) ? 64 * 1024 + nextRandom() % (448 * 1024)
+                                                   : 1024 + nextRandom() % (15 * 1024);
+            QFile f(root + QLatin1Char('/') + dirs.at(i % dirs.count()) + QString::fromLatin1("/file%1.dat").arg(i));
+            QVERIFY(f.open(QIODevice::WriteOnly));
+            f.write(content(size));
+            f.close();
+            makeOld(f.fileName(), 3600);
+        }
+    }
+
+    static qint64 peakRssKb() {
+#ifdef Q_OS_UNIX
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MAC
+            return usage.ru_maxrss / 1024;
+#else
+            return usage.ru_maxrss;
+#endif
+        }
+#endif
+        return -1;
+    }
+
+    SyncRunResult runSync(const QString &localPath) {
+        return SyncTestUtils::runSync(_account, _server.data(), localPath, QLatin1String("bench"));
+    }
+
+    void report(const char *scenario, const SyncRunResult &stats) {
+        QJsonObject requests;
+        QMap<QByteArray, int> counts = _server->requestCounts();
+        for (QMap<QByteArray, int>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it) {
+            requests.insert(QString::fromLatin1(it.key()), it.value());
+        }
+
+        double seconds = stats.msec / 1000.0;
+        QJsonObject obj;
+        obj.insert(QLatin1String("scenario"), QLatin1String(scenario));
+        obj.insert(QLatin1String("treeFiles"), _fileCount);
+        obj.insert(QLatin1String("latencyMs"), _latency);
+        obj.insert(QLatin1String("bandwidthBytesPerSecond"), double(_bandwidth));
+        obj.insert(QLatin1String("seconds"), seconds);
+        obj.insert(QLatin1String("files"), stats.items);
+        obj.insert(QLatin1String("filesPerSecond"), stats.items / seconds);
+        obj.insert(QLatin1String("bytes"), double(stats.bytes));
+        obj.insert(QLatin1String("mbPerSecond"), stats.bytes / (1024.0 * 1024.0) / seconds);
+        obj.insert(QLatin1String("bytesUploaded"), double(_server->bytesReceived()));
+        obj.insert(QLatin1String("bytesDownloaded"), double(_server->bytesSent()));
+        obj.insert(QLatin1String("requests"), requests);
+        obj.insert(QLatin1String("requestTotal"), _server->requestTotal());
+        obj.insert(QLatin1String("errors"), stats.errors);
+        obj.insert(QLatin1String("peakRssKb"), double(peakRssKb()));
+
+        QByteArray line = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+        std::cout << line.constData() << std::endl;
+
+        QString outputFile = QString::fromLocal8Bit(qgetenv("OWNCLOUD_BENCHMARK_OUTPUT"));
+        if (!outputFile.isEmpty()) {
+            QFile f(outputFile);
+            if (f.open(QIODevice::Append)) {
+                f.write(line + '\n');
+            }
+        }
+    }
+
+    SyncRunResult runScenario(const char *scenario, const QString &localPath) {
+        _server->resetCounters();
+        SyncRunResult stats = runSync(localPath);
+        report(scenario, stats);
+        return stats;
+    }
+
+    QString serverTree() const { return _server->localPath(QLatin1String("bench")); }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_serverDir.isValid() && _clientDir.isValid() && _secondClientDir.isValid());
+        _fileCount = envInt("OWNCLOUD_BENCHMARK_FILES", 300);
+        _latency = envInt("OWNCLOUD_BENCHMARK_LATENCY_MS", 0);
+        _bandwidth = qint64(envInt("OWNCLOUD_BENCHMARK_BANDWIDTH_KBPS", 0)) * 1024;
+        _random = 42;
+
+        _server.reset(new FakeWebDavServer(_serverDir.path()));
+        _server->setLatency(_latency);
+        _server->setBandwidth(_bandwidth);
+        QVERIFY(_server->listen(QHostAddress::LocalHost));
+        QVERIFY(QDir(_serverDir.path()).mkdir(QLatin1String("bench")));
+
+        _account = createAccount(_server.data());
+
+        generateTree(_clientDir.path(), _fileCount);
+    }
+
+    void testInitialSync()
+    {
+        SyncRunResult stats = runScenario("initial", _clientDir.path());
+        QCOMPARE(stats.errors, 0);
+        QCOMPARE(stats.items, _fileCount);
+        // the server does not announce bundles, every file has its PUT
+        QCOMPARE(_server->requestCounts().value("POST"), 0);
+        QCOMPARE(_server->requestCounts().value("PUT"), _fileCount);
+        QCOMPARE(listTree(serverTree()), listTree(_clientDir.path()));
+    }
+
+    void testNoOpSync()
+    {
+        SyncRunResult stats = runScenario("noop", _clientDir.path());
+        QCOMPARE(stats.errors, 0);
+        QCOMPARE(stats.items, 0);
+        QCOMPARE(_server->requestCounts().value("PUT"), 0);
+        QCOMPARE(_server->requestCounts().value("GET"), 0);
+    }
+
+    void testSmallChangeSync()
+    {
+        // Wait a second so that modified files get a different mtime
+        QTest::qWait(1100);
+
+        QMap<QString, qint64> files = listTree(_clientDir.path());
+        QStringList paths;
+        for (QMap<QString, qint64>::const_iterator it = files.constBegin(); it != files.constEnd(); ++it) {
+            if (it.value() >= 0) {
+                paths << it.key();
+            }
+        }
+        int changes = qMax(2, _fileCount / 100);
+        for (int i = 0; i < changes; ++i) {
+            // local edit, remote edit and a new file on each side
+            QString local = paths.at((i * 7) % paths.count());
+            QFile f(_clientDir.path() + QLatin1Char('/') + local);
+            QVERIFY(f.open(QIODevice::Append));
+            f.write(content(512));
+            f.close();
+            makeOld(f.fileName(), 10);
+
+            QString remote = paths.at((i * 7 + 3) % paths.count());
+            _server->writeFile(QLatin1String("bench/") + remote, content(2048));
+
+            QFile added(_clientDir.path() + QString::fromLatin1("/dir%1/added%2.dat").arg(i % 10).arg(i));
+            QVERIFY(added.open(QIODevice::WriteOnly));
+            added.write(content(4096));
+            added.close();
+            makeOld(added.fileName(), 10);
+            _server->writeFile(QString::fromLatin1("bench/dir%1/remote%2.dat").arg(i % 10).arg(i), content(4096));
+        }
+
+        SyncRunResult stats = runScenario("small-change", _clientDir.path());
+        QCOMPARE(stats.errors, 0);
+        QCOMPARE(stats.items, 4 * changes);
+        QCOMPARE(listTree(serverTree()), listTree(_clientDir.path()));
+    }
+
+    void testRenameHeavySync()
+    {
+        // Rename a tenth of the files and a few whole directories
+        QMap<QString, qint64> files = listTree(_clientDir.path());
+        int renamed = 0;
+        for (QMap<QString, qint64>::const_iterator it = files.constBegin(); it != files.constEnd(); ++it) {
+            if (it.value() < 0 || !it.key().startsWith(QLatin1String("dir1/")) ) {
+                continue;
+            }
+            if (renamed++ % 2 == 0) {
+                QString path = _clientDir.path() + QLatin1Char('/') + it.key();
+                QVERIFY(QFile::rename(path, path + QLatin1String(".renamed")));
+            }
+        }
+        for (int i = 5; i < 8; ++i) {
+            QVERIFY(QDir(_clientDir.path()).rename(QString::fromLatin1("dir%1").arg(i),
+                                                  QString::fromLatin1("moved%1").arg(i)));
+        }
+
+        SyncRunResult stats = runScenario("rename-heavy", _clientDir.path());
+        QCOMPARE(stats.errors, 0);
+        QCOMPARE(_server->requestCounts().value("PUT"), 0);
+        QVERIFY(_server->requestCounts().value("MOVE") > 0);
+        QCOMPARE(listTree(serverTree()), listTree(_clientDir.path()));
+    }
+
+    void testInitialDownload()
+    {
+        SyncRunResult stats = runScenario("initial-download", _secondClientDir.path());
+        QCOMPARE(stats.errors, 0);
+        QCOMPARE(listTree(_secondClientDir.path()), listTree(serverTree()));
+    }
+};
+
+#endif
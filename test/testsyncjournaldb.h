@@ -13,6 +13,7 @@
 
 #include "libsync/syncjournaldb.h"
 #include "libsync/syncjournalfilerecord.h"
+#include "libsync/syncfileitem.h"
 
 using namespace OCC;
 
@@ -112,6 +113,142 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testGenerationCleanup()
+    {
+        SyncJournalFileRecord record;
+        record._inode = 1;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._type = 0;
+        record._etag = "etag";
+        record._path = "seen";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "unseen";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "unchanged/file";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "gone/file";
+        QVERIFY(_db.setFileRecord(record));
+        record._type = SyncFileItem::Directory;
+        record._path = "unchanged";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "gone";
+        QVERIFY(_db.setFileRecord(record));
+        record._type = 0;
+
+        SyncJournalDb::DownloadInfo download;
+        download._valid = true;
+        download._tmpfile = "/tmp/.keep.~1";
+        _db.setDownloadInfo("keep", download);
+        download._tmpfile = "/tmp/.stale.~1";
+        _db.setDownloadInfo("stale", download);
+
+        qint64 generation = _db.startSyncGeneration();
+        QVERIFY(_db.startSyncGeneration() > generation);
+        _db.markFileRecordSeen("seen");
+        _db.markFileRecordSeen("unchanged");
+        _db.keepDownloadInfo("keep");
+        record._path = "new";
+        QVERIFY(_db.setFileRecord(record));
+
+        QVector<SyncJournalDb::DownloadInfo> deleted = _db.getAndDeleteStaleDownloadInfos();
+        QCOMPARE(deleted.size(), 1);
+        QCOMPARE(deleted.first()._tmpfile, QString("/tmp/.stale.~1"));
+        QVERIFY(_db.getDownloadInfo("keep")._valid);
+
+        // Only the top level was listed, "unchanged" was read from the journal
+        QVERIFY(_db.postSyncCleanup(QSet<QString>() << QString()));
+        QVERIFY(_db.getFileRecord("seen").isValid());
+        QVERIFY(_db.getFileRecord("new").isValid());
+        QVERIFY(!_db.getFileRecord("unseen").isValid());
+        QVERIFY(_db.getFileRecord("unchanged").isValid());
+        QVERIFY(_db.getFileRecord("unchanged/file").isValid());
+        QVERIFY(!_db.getFileRecord("gone").isValid());
+        QVERIFY(!_db.getFileRecord("gone/file").isValid());
+
+        QCOMPARE(_db.getAndDeleteAllDownloadInfos().size(), 1);
+        QCOMPARE(_db.downloadInfoCount(), 0);
+    }
+
+    void testErrorBlacklistPreload()
+    {
+        _db.wipeErrorBlacklist();
+
+        SyncJournalErrorBlacklistRecord record;
+        record._file = "broken";
+        record._lastTryEtag = "etag";
+        record._lastTryTime = 1000;
+        record._ignoreDuration = 60;
+        record._retryCount = 2;
+        record._errorString = "error";
+        _db.updateErrorBlacklistEntry(record);
+
+        QCOMPARE(_db.preloadErrorBlacklist(), 1);
+        SyncJournalErrorBlacklistRecord stored = _db.errorBlacklistEntry("broken");
+        QVERIFY(stored.isValid());
+        QCOMPARE(stored._retryCount, 2);
+        QCOMPARE(stored._errorString, QString("error"));
+        QVERIFY(!_db.errorBlacklistEntry("fine").isValid());
+
+        // the preloaded copy follows the changes
+        record._file = "other";
+        _db.updateErrorBlacklistEntry(record);
+        QVERIFY(_db.errorBlacklistEntry("other").isValid());
+        _db.wipeErrorBlacklistEntry("broken");
+        QVERIFY(!_db.errorBlacklistEntry("broken").isValid());
+        QCOMPARE(_db.wipeErrorBlacklist(), 1);
+        QVERIFY(!_db.errorBlacklistEntry("other").isValid());
+    }
+
+    void testAsyncWrites()
+    {
+        SyncJournalFileRecord record;
+        record._inode = 1;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._type = 0;
+        record._etag = "etag";
+        record._path = "async";
+        _db.setFileRecordAsync(record);
+
+        SyncJournalDb::UploadInfo upload;
+        upload._chunk = 3;
+        upload._valid = true;
+        _db.setUploadInfoAsync("async", upload);
+        _db.commitAsync("test");
+
+        // the synchronous functions see everything that was queued before
+        QVERIFY(_db.getFileRecord("async").isValid());
+        QCOMPARE(_db.getUploadInfo("async")._chunk, 3);
+
+        _db.deleteFileRecordAsync("async");
+        _db.setUploadInfoAsync("async", SyncJournalDb::UploadInfo());
+        _db.waitForQueuedWrites();
+        QVERIFY(!_db.getFileRecord("async").isValid());
+        QVERIFY(!_db.getUploadInfo("async")._valid);
+    }
+
+    void testAsyncErrorBlacklist()
+    {
+        _db.wipeErrorBlacklist();
+
+        SyncJournalErrorBlacklistRecord record;
+        record._file = "queued";
+        record._lastTryEtag = "etag";
+        record._lastTryTime = 1000;
+        record._ignoreDuration = 60;
+        record._retryCount = 1;
+        _db.updateErrorBlacklistEntryAsync(record);
+        QCOMPARE(_db.errorBlacklistEntry("queued")._retryCount, 1);
+
+        // a synchronous write is done after the queued ones
+        record._retryCount = 2;
+        _db.updateErrorBlacklistEntry(record);
+        _db.wipeErrorBlacklistEntryAsync("queued");
+        QVERIFY(!_db.errorBlacklistEntry("queued").isValid());
+        _db.waitForQueuedWrites();
+        QVERIFY(!_db.errorBlacklistEntry("queued").isValid());
+        QCOMPARE(_db.wipeErrorBlacklist(), 0);
+    }
+
 private:
     SyncJournalDb _db;
 };
@@ -0,0 +1,79 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCMETRICS_H
+#define MIRALL_TESTSYNCMETRICS_H
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "syncmetrics.h"
+
+using namespace OCC;
+
+class TestSyncMetrics : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        SyncMetrics::reset();
+    }
+
+    void testCountersAndGauges()
+    {
+        SyncMetrics::addToCounter("test.counter");
+        SyncMetrics::addToCounter("test.counter", 41);
+        QCOMPARE(SyncMetrics::counter("test.counter"), qint64(42));
+
+        SyncMetrics::setGauge("test.gauge", 10);
+        SyncMetrics::addToGauge("test.gauge", -3);
+        QCOMPARE(SyncMetrics::gauge("test.gauge"), qint64(7));
+        SyncMetrics::setGauge("test.gauge", 1);
+        QCOMPARE(SyncMetrics::gauge("test.gauge"), qint64(1));
+
+        QCOMPARE(SyncMetrics::counter("test.unknown"), qint64(0));
+    }
+
+    void testJson()
+    {
+        SyncMetrics::addToCounter("test.counter", 5);
+        SyncMetrics::setGauge("test.gauge", -2);
+        for (int i = 1; i <= 100; ++i) {
+            SyncMetrics::recordValue("test.histogram", i);
+        }
+
+        QByteArray json = SyncMetrics::toJson();
+        QVERIFY(!json.contains('\n'));
+        QJsonParseError error;
+        QJsonObject obj = QJsonDocument::fromJson(json, &error).object();
+        QCOMPARE(error.error, QJsonParseError::NoError);
+
+        QVERIFY(obj.value("timestamp").toDouble() > 0);
+        QCOMPARE(obj.value("counters").toObject().value("test.counter").toInt(), 5);
+        QCOMPARE(obj.value("gauges").toObject().value("test.gauge").toInt(), -2);
+
+        QJsonObject h = obj.value("histograms").toObject().value("test.histogram").toObject();
+        QCOMPARE(h.value("count").toInt(), 100);
+        QCOMPARE(h.value("sum").toInt(), 5050);
+        QCOMPARE(h.value("min").toInt(), 1);
+        QCOMPARE(h.value("max").toInt(), 100);
+        // percentiles are the upper bounds of power of two buckets
+        QCOMPARE(h.value("p50").toInt(), 64);
+        QCOMPARE(h.value("p99").toInt(), 100);
+    }
+
+    void testEmptyJson()
+    {
+        QJsonObject obj = QJsonDocument::fromJson(SyncMetrics::toJson()).object();
+        QVERIFY(obj.value("counters").toObject().isEmpty());
+        QVERIFY(obj.value("histograms").toObject().isEmpty());
+    }
+};
+
+#endif
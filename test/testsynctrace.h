@@ -0,0 +1,76 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTSYNCTRACE_H
+#define MIRALL_TESTSYNCTRACE_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+
+#include "synctrace.h"
+
+using namespace OCC;
+
+class TestSyncTrace : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDisabled()
+    {
+        SyncTrace::setEnabled(false);
+        QTemporaryDir dir;
+        QString fileName = dir.path() + QLatin1String("/trace.json");
+        SyncTrace::startRun(fileName);
+        QVERIFY(!SyncTrace::isRecording());
+        { TraceSpan span("test", QLatin1String("ignored")); }
+        SyncTrace::finishRun();
+        QVERIFY(!QFile::exists(fileName));
+    }
+
+    void testRun()
+    {
+        SyncTrace::setEnabled(true);
+        QTemporaryDir dir;
+        QString fileName = dir.path() + QLatin1String("/trace.json");
+        SyncTrace::startRun(fileName);
+        QVERIFY(SyncTrace::isRecording());
+
+        {
+            TraceSpan span("test", QLatin1String("outer \"quoted\""));
+            span.setArg(QLatin1String("count"), 3);
+            TraceSpan inner("test", QLatin1String("inner"));
+        }
+        qint64 start = SyncTrace::nowUsec();
+        SyncTrace::addAsyncSpan("network", QLatin1String("GET /file"), start, 1000);
+        SyncTrace::finishRun();
+        SyncTrace::setEnabled(false);
+        QVERIFY(!SyncTrace::isRecording());
+
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QJsonParseError error;
+        QVariantMap trace = QJsonDocument::fromJson(file.readAll(), &error).toVariant().toMap();
+        QCOMPARE(error.error, QJsonParseError::NoError);
+        QVariantList events = trace.value(QLatin1String("traceEvents")).toList();
+
+        QStringList phases;
+        foreach (const QVariant &event, events) {
+            QVariantMap map = event.toMap();
+            phases.append(map.value(QLatin1String("ph")).toString());
+            if (map.value(QLatin1String("name")).toString() == QLatin1String("outer \"quoted\"")) {
+                QCOMPARE(map.value(QLatin1String("args")).toMap().value(QLatin1String("count")).toInt(), 3);
+            }
+        }
+        QCOMPARE(phases.count(QLatin1String("M")), 1); // one thread
+        QCOMPARE(phases.count(QLatin1String("X")), 2);
+        QCOMPARE(phases.count(QLatin1String("b")), 1);
+        QCOMPARE(phases.count(QLatin1String("e")), 1);
+    }
+};
+
+#endif
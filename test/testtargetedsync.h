@@ -0,0 +1,116 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTTARGETEDSYNC_H
+#define MIRALL_TESTTARGETEDSYNC_H
+
+#include <QtTest>
+
+#include "syncenginetestutils.h"
+#include "syncmetrics.h"
+
+using namespace SyncTestUtils;
+
+class TestTargetedSync : public QObject
+{
+    Q_OBJECT
+
+    SyncFixture _fixture;
+
+    static QByteArray readFile(const QString &fileName) {
+        QFile f(fileName);
+        return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+    }
+
+private slots:
+    void init()
+    {
+        QVERIFY(_fixture.setUp());
+
+        // The targeted syncs start from a synced tree
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/a.txt")), QByteArray(100, 'a')));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/b.txt")), QByteArray(100, 'b')));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("other/c.txt")), QByteArray(100, 'c')));
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 3);
+        SyncMetrics::reset();
+    }
+
+    void testTargetedUpload()
+    {
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/a.txt")), QByteArray(200, 'A')));
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/new.txt")), QByteArray(50, 'n')));
+
+        SyncRunResult result = _fixture.sync(QStringList() << QLatin1String("dir/a.txt") << QLatin1String("dir/new.txt"));
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 2);
+        QCOMPARE(SyncMetrics::counter("sync.targeted_runs"), qint64(1));
+        QCOMPARE(SyncMetrics::counter("sync.targeted_fallbacks"), qint64(0));
+        // only the directory of the files is listed
+        QCOMPARE(_fixture.server()->requestCounts().value("PROPFIND"), 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 2);
+        QVERIFY(result.item(QLatin1String("dir/new.txt")));
+        QVERIFY(result.item(QLatin1String("dir/new.txt"))->_inode != 0);
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+
+        // The journal knows the uploads, so a full sync has nothing to do
+        result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 0);
+    }
+
+    void testTargetedDownload()
+    {
+        const QByteArray data(300, 'B');
+        _fixture.server()->writeFile(QLatin1String("remote/dir/b.txt"), data);
+
+        SyncRunResult result = _fixture.sync(QStringList() << QLatin1String("dir/b.txt"));
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QCOMPARE(SyncMetrics::counter("sync.targeted_fallbacks"), qint64(0));
+        QCOMPARE(_fixture.server()->requestCounts().value("GET"), 1);
+        QCOMPARE(readFile(_fixture.localFile(QLatin1String("dir/b.txt"))), data);
+    }
+
+    void testUnchangedFileIsNotSynced()
+    {
+        SyncRunResult result = _fixture.sync(QStringList() << QLatin1String("other/c.txt"));
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 0);
+        QCOMPARE(SyncMetrics::counter("sync.targeted_fallbacks"), qint64(0));
+        QCOMPARE(_fixture.server()->requestCounts().value("PUT"), 0);
+        QCOMPARE(_fixture.server()->requestCounts().value("GET"), 0);
+    }
+
+    void testFallbackOnConflict()
+    {
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("dir/a.txt")), QByteArray(200, 'l')));
+        _fixture.server()->writeFile(QLatin1String("remote/dir/a.txt"), QByteArray(300, 'r'));
+
+        SyncRunResult result = _fixture.sync(QStringList() << QLatin1String("dir/a.txt"));
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(SyncMetrics::counter("sync.targeted_fallbacks"), qint64(1));
+        // the full discovery keeps the server version and a conflict file
+        QCOMPARE(readFile(_fixture.localFile(QLatin1String("dir/a.txt"))), QByteArray(300, 'r'));
+        QStringList conflicts = QDir(_fixture.localFile(QLatin1String("dir"))).entryList(
+                    QStringList() << QLatin1String("*_conflict-*"), QDir::Files);
+        QCOMPARE(conflicts.count(), 1);
+    }
+
+    void testFallbackOnDeletion()
+    {
+        QVERIFY(QFile::remove(_fixture.localFile(QLatin1String("dir/b.txt"))));
+
+        SyncRunResult result = _fixture.sync(QStringList() << QLatin1String("dir/b.txt"));
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(SyncMetrics::counter("sync.targeted_fallbacks"), qint64(1));
+        QVERIFY(!QFile::exists(_fixture.server()->localPath(QLatin1String("remote/dir/b.txt"))));
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTTRANSFERCOMPRESSION_H
+#define MIRALL_TESTTRANSFERCOMPRESSION_H
+
+#include <QtTest>
+
+#include "syncenginetestutils.h"
+#include "syncmetrics.h"
+#include "transfercompression.h"
+
+using namespace SyncTestUtils;
+
+class TestTransferCompression : public QObject
+{
+    Q_OBJECT
+
+    SyncFixture _fixture;
+
+    static QByteArray text(qint64 size, char c) {
+        QByteArray data(size, 'x');
+        for (int i = 0; i < data.size(); i += 61) {
+            data[i] = c;
+        }
+        return data;
+    }
+
+private slots:
+    void init()
+    {
+        QVERIFY(_fixture.setUp());
+        SyncMetrics::reset();
+    }
+
+    void testEncodings()
+    {
+        QCOMPARE(TransferCompression::parseEncoding(""), TransferCompression::Identity);
+        QCOMPARE(TransferCompression::parseEncoding("deflate"), TransferCompression::Deflate);
+        QCOMPARE(TransferCompression::parseEncoding("GZIP"), TransferCompression::Gzip);
+        QCOMPARE(TransferCompression::parseEncoding("br"), TransferCompression::Unsupported);
+        QCOMPARE(TransferCompression::uploadEncoding("br, deflate"), TransferCompression::Deflate);
+        QCOMPARE(TransferCompression::uploadEncoding(""), TransferCompression::Identity);
+    }
+
+    void testCandidates()
+    {
+        QVERIFY(TransferCompression::isCandidate(QLatin1String("notes.txt"), 100 * 1024));
+        QVERIFY(!TransferCompression::isCandidate(QLatin1String("photo.jpg"), 100 * 1024));
+        QVERIFY(!TransferCompression::isCandidate(QLatin1String("notes.txt"), 10));
+        QVERIFY(TransferCompression::looksCompressible(text(4096, 'a')));
+    }
+
+    void testRoundTrip()
+    {
+        const QByteArray data = text(300 * 1024, 'r');
+        ZStream deflater(ZStream::Compress, TransferCompression::Deflate);
+        QByteArray compressed;
+        QVERIFY(deflater.process(data.constData(), data.size() / 2, &compressed));
+        QVERIFY(deflater.process(data.constData() + data.size() / 2, data.size() - data.size() / 2, &compressed, true));
+        QVERIFY(deflater.isFinished());
+        QVERIFY(compressed.size() < data.size() / 10);
+
+        ZStream inflater(ZStream::Decompress, TransferCompression::Deflate);
+        QByteArray decompressed;
+        QVERIFY(inflater.process(compressed.constData(), compressed.size(), &decompressed));
+        QVERIFY(inflater.isFinished());
+        QCOMPARE(decompressed, data);
+    }
+
+    void testCompressedUpload()
+    {
+        const qint64 fileSize = 200 * 1024;
+        _fixture.server()->setCompressionSupport(true);
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("text.txt")), text(fileSize, 'u')));
+        // compressed already going by the name, sent as it is
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("image.jpg")), text(fileSize, 'i')));
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 2);
+        QCOMPARE(SyncMetrics::counter("compression.upload_file_bytes"), fileSize);
+        QVERIFY(SyncMetrics::counter("compression.upload_wire_bytes") < fileSize / 10);
+        QVERIFY(_fixture.server()->bytesReceived() < 2 * fileSize);
+        QCOMPARE(listTree(_fixture.serverTree()), listTree(_fixture.localPath()));
+    }
+
+    void testUploadFeaturesAreAskedOnce()
+    {
+        const qint64 fileSize = 200 * 1024;
+        _fixture.server()->setCompressionSupport(true);
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("first.txt")), text(fileSize, 'f')));
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(_fixture.server()->requestCounts().value("OPTIONS"), 1);
+
+        // The account remembers the answer of the server
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("second.txt")), text(fileSize, 's')));
+        result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QCOMPARE(_fixture.server()->requestCounts().value("OPTIONS"), 0);
+        QCOMPARE(SyncMetrics::counter("compression.upload_file_bytes"), 2 * fileSize);
+    }
+
+    void testUncompressedUploadWithoutServerSupport()
+    {
+        const qint64 fileSize = 200 * 1024;
+        QVERIFY(writeLocalFile(_fixture.localFile(QLatin1String("text.txt")), text(fileSize, 'u')));
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QCOMPARE(SyncMetrics::counter("compression.upload_file_bytes"), qint64(0));
+        QVERIFY(_fixture.server()->bytesReceived() >= fileSize);
+    }
+
+    void testCompressedDownload()
+    {
+        const qint64 fileSize = 200 * 1024;
+        _fixture.server()->setCompressionSupport(true);
+        const QByteArray data = text(fileSize, 'd');
+        _fixture.server()->writeFile(QLatin1String("remote/text.txt"), data);
+
+        SyncRunResult result = _fixture.sync();
+        QCOMPARE(result.errors, 0);
+        QCOMPARE(result.items, 1);
+        QCOMPARE(SyncMetrics::counter("compression.download_file_bytes"), fileSize);
+        QVERIFY(SyncMetrics::counter("compression.download_wire_bytes") < fileSize / 10);
+        QFile f(_fixture.localFile(QLatin1String("text.txt")));
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        QCOMPARE(f.readAll(), data);
+    }
+};
+
+#endif
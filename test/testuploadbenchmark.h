@@ -0,0 +1,127 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTUPLOADBENCHMARK_H
+#define MIRALL_TESTUPLOADBENCHMARK_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <ctime>
+
+#include "propagateupload.h"
+#include "account.h"
+#include "filesystem.h"
+
+using namespace OCC;
+
+// How UploadDevice read the file before it read in blocks: a buffered
+// QIODevice on top of a QFile, with one QFile::read() per request of QNAM.
+class UnblockedUploadDevice : public QIODevice
+{
+public:
+    bool prepareAndOpen(const QString &fileName) {
+        _file.setFileName(fileName);
+        QString openError;
+        if (!FileSystem::openFileSharedRead(&_file, &openError)) {
+            return false;
+        }
+        return QIODevice::open(QIODevice::ReadOnly);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE {
+        return _file.read(data, maxlen);
+    }
+    qint64 writeData(const char *, qint64) Q_DECL_OVERRIDE {
+        return -1;
+    }
+
+private:
+    QFile _file;
+};
+
+/*
+ * The CPU time that QNAM's 16 KiB reads from the upload device cost per
+ * uploaded GB, with the reads before and after UploadDevice read in blocks.
+ * The file size in MB can be set with OWNCLOUD_BENCHMARK_UPLOAD_MB.
+ */
+class TestUploadBenchmark : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    OwncloudPropagator *_propagator;
+    QString _fileName;
+    qint64 _size;
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        _propagator = new OwncloudPropagator(Account::create(), 0, _dir.path(),
+                                             QLatin1String("/"), QLatin1String("/"), 0, 0);
+
+        _size = qgetenv("OWNCLOUD_BENCHMARK_UPLOAD_MB").toLongLong() * 1024 * 1024;
+        if (_size <= 0) {
+            _size = 256 * 1024 * 1024;
+        }
+        QFile file(_dir.path() + QLatin1String("/benchmark.bin"));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray block(1024 * 1024, 'u');
+        for (qint64 written = 0; written < _size; written += block.size()) {
+            file.write(block.constData(), qMin(qint64(block.size()), _size - written));
+        }
+        file.close();
+        _fileName = file.fileName();
+    }
+
+    void cleanupTestCase()
+    {
+        delete _propagator;
+    }
+
+    void benchmarkRead_data()
+    {
+        QTest::addColumn<bool>("blocks");
+
+        QTest::newRow("before: a QFile::read() per request") << false;
+        QTest::newRow("after: UploadDevice blocks") << true;
+    }
+
+    void benchmarkRead()
+    {
+        QFETCH(bool, blocks);
+
+        QScopedPointer<QIODevice> device;
+        if (blocks) {
+            UploadDevice *uploadDevice = new UploadDevice(&_propagator->_bandwidthManager);
+            device.reset(uploadDevice);
+            QVERIFY(uploadDevice->prepareAndOpen(_fileName));
+        } else {
+            UnblockedUploadDevice *unblockedDevice = new UnblockedUploadDevice;
+            device.reset(unblockedDevice);
+            QVERIFY(unblockedDevice->prepareAndOpen(_fileName));
+        }
+        QByteArray buffer(16 * 1024, 0);
+
+        QElapsedTimer timer;
+        timer.start();
+        clock_t cpuStart = clock();
+        qint64 total = 0, r;
+        while ((r = device->read(buffer.data(), buffer.size())) > 0) {
+            total += r;
+        }
+        double cpuSeconds = double(clock() - cpuStart) / CLOCKS_PER_SEC;
+        QCOMPARE(total, _size);
+
+        qDebug() << QTest::currentDataTag() << ": read" << _size / (1024 * 1024) << "MB in"
+                 << timer.elapsed() << "ms," << cpuSeconds * (1024 * 1024 * 1024) / _size
+                 << "CPU seconds per GB";
+    }
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#ifndef MIRALL_TESTUPLOADDEVICE_H
+#define MIRALL_TESTUPLOADDEVICE_H
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+
+#include "propagateupload.h"
+#include "account.h"
+#include "filesystem.h"
+
+using namespace OCC;
+
+class TestUploadDevice : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    OwncloudPropagator *_propagator;
+
+    QString createFile(const QString &name, qint64 size, QByteArray *checksum)
+    {
+        QFile file(_dir.path() + QLatin1Char('/') + name);
+        file.open(QIODevice::WriteOnly);
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        QByteArray block(64 * 1024, 0);
+        for (qint64 written = 0; written < size; written += block.size()) {
+            for (int i = 0; i < block.size(); i += 512) {
+                block[i] = char(qrand());
+            }
+            QByteArray data = block.left(qMin(qint64(block.size()), size - written));
+            file.write(data);
+            hash.addData(data);
+        }
+        *checksum = hash.result();
+        file.close();
+        return file.fileName();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        _propagator = new OwncloudPropagator(Account::create(), 0, _dir.path(),
+                                             QLatin1String("/"), QLatin1String("/"), 0, 0);
+    }
+
+    void cleanupTestCase()
+    {
+        delete _propagator;
+    }
+
+    void testRead_data()
+    {
+        QTest::addColumn<qint64>("size");
+        QTest::addColumn<int>("readSize");
+
+        QTest::newRow("empty") << qint64(0) << 16 * 1024;
+        QTest::newRow("small") << qint64(1000) << 16 * 1024;
+        QTest::newRow("block boundary") << qint64(3 * 1024 * 1024) << 16 * 1024;
+        QTest::newRow("odd reads") << qint64(3 * 1024 * 1024 + 17) << 10007;
+    }
+
+    void testRead()
+    {
+        QFETCH(qint64, size);
+        QFETCH(int, readSize);
+
+        QByteArray expected;
+        QString fileName = createFile(QLatin1String("read.bin"), size, &expected);
+
+        UploadDevice device(&_propagator->_bandwidthManager);
+        QVERIFY(device.prepareAndOpen(fileName));
+        QCOMPARE(device.size(), size);
+
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        QByteArray buffer(readSize, 0);
+        qint64 r;
+        while ((r = device.read(buffer.data(), readSize)) > 0) {
+            hash.addData(buffer.constData(), r);
+        }
+        QVERIFY(device.atEnd());
+        QVERIFY(!device.fileChanged());
+        QCOMPARE(hash.result(), expected);
+
+        // QNAM rewinds the device when it has to resend the request
+        if (size > 0) {
+            QVERIFY(device.seek(0));
+            QCOMPARE(device.read(buffer.data(), 1000), qMin(size, qint64(1000)));
+        }
+    }
+
+    void testChangedDuringRead()
+    {
+        QByteArray checksum;
+        QString fileName = createFile(QLatin1String("changed.bin"), 4 * 1024 * 1024, &checksum);
+
+        UploadDevice device(&_propagator->_bandwidthManager);
+        QVERIFY(device.prepareAndOpen(fileName));
+        QByteArray buffer(16 * 1024, 0);
+        QCOMPARE(device.read(buffer.data(), buffer.size()), qint64(buffer.size()));
+
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::Append));
+        file.write("more");
+        file.close();
+
+        qint64 r;
+        while ((r = device.read(buffer.data(), buffer.size())) > 0) {}
+        QCOMPARE(r, qint64(-1));
+        QVERIFY(device.fileChanged());
+    }
+};
+
+#endif